@@ -1,82 +1,108 @@
 #include <stdlib.h>
 #include <stdint.h>
-#include <math.h>
 
 #include "blockchain.h"
 #include "globalstate.h"
 #include "hash.h"
+#include "sha256.h"
 #include "units.h"
 #include "persistent.h"
 #include "script.h"
+#include "utxo.h"
+#include "utxofilter.h"
+#include "utxostats.h"
+#include "compressor.h"
+#include "prefetch.h"
+#include "pipeline.h"
+#include "verifier.h"
 #include "utils/memory.h"
 #include "utils/datetime.h"
 #include "utils/data.h"
 #include "utils/integers.h"
+#include "utils/uint256.h"
 
+#define UNDO_BUFFER_INITIAL_CAPACITY 4096
 
 static int8_t get_maximal_target(BlockIndex *index, TargetCompact *result);
 
-double pow256(double x) {
-    return pow(2, x * 8);
-}
-
-double target_compact_to_float(TargetCompact targetBytes) {
-    uint32_t exponentWidth = targetBytes >> 24;
-    exponentWidth -= 3;
-    uint32_t mantissa =
-        + ((targetBytes >> 16) & 0xff) * 65536
-        + ((targetBytes >> 8) & 0xff) * 256
-        + (targetBytes & 0xff);
-    return mantissa * pow256(exponentWidth);
+// The header's own proof of work, under a target no easier than the chain allows at its height
+bool is_block_header_valid(BlockIndex *index) {
+    TargetCompact maxTarget;
+    int8_t targetCalculationError = get_maximal_target(index, &maxTarget);
+    if (targetCalculationError) {
+        fprintf(stderr, "is_block_header_valid: cannot calculate target (%i)\n", targetCalculationError);
+        return false;
+    }
+    Uint256 target;
+    Uint256 maxTargetValue;
+    if (uint256_from_compact(index->header.target, &target) || uint256_from_compact(maxTarget, &maxTargetValue)) {
+        return false;
+    }
+    bool targetAllowed = uint256_compare(&target, &maxTargetValue) <= 0;
+    return targetAllowed && hash_satisfies_target_compact(index->meta.hash, index->header.target);
 }
 
-// Compact-Bignum conversion adapted from Bitcoin 0.0.1 by Satoshi
-
-void target_compact_to_bignum(TargetCompact targetBytes, BIGNUM *ptrTarget) {
-    uint32_t size = targetBytes >> 24;
-    Byte inputBytes[64] = {0};
-    inputBytes[3] = (Byte)size;
-    if (size >= 1) inputBytes[4] = (Byte)((targetBytes >> 16) & 0xff);
-    if (size >= 2) inputBytes[5] = (Byte)((targetBytes >> 8) & 0xff);
-    if (size >= 3) inputBytes[6] = (Byte)((targetBytes >> 0) & 0xff);
-    BN_mpi2bn(&inputBytes[0], 4 + size, ptrTarget);
+// What validating a block needs about the outputs its inputs spend. Each input is resolved
+// once, into the current transaction's prevout table, and its amount and script checks both
+// come from there; fees add up as the transactions go, for the coinbase to be checked last
+struct Prevout {
+    int64_t value;
+    Byte *program; // signature script, OP_CODESEPARATOR, then the spent output's script; NULL when assumed valid
+    uint64_t programLength;
+};
+
+struct BlockValidation {
+    BlockPayload *block;
+    BlockIndex *index;
+    Byte *txHashes; // for spends within the block
+    TxOut *output; // scratch for the one being resolved
+    struct Prevout *prevouts; // of the transaction being validated
+    uint64_t prevoutCapacity;
+    uint64_t fees;
+};
+
+typedef struct BlockValidation BlockValidation;
+
+static void init_block_validation(BlockValidation *context, BlockPayload *block, BlockIndex *index) {
+    memset(context, 0, sizeof(*context));
+    context->block = block;
+    context->index = index;
+    context->txHashes = MALLOC(block->txCount * SHA256_LENGTH, "block_validation:txHashes");
+    hash_txs(block->txs, block->txCount, context->txHashes);
+    context->output = CALLOC(1, sizeof(TxOut), "block_validation:output");
 }
 
-uint32_t target_bignum_to_compact(BIGNUM *ptrTarget) {
-    uint32_t size = (uint32_t)BN_bn2mpi(ptrTarget, NULL);
-    Byte outputBytes[64] = {0};
-    size -= 4;
-    BN_bn2mpi(ptrTarget, &outputBytes[0]);
-    uint32_t result = size << 24;
-    if (size >= 1) result |= (outputBytes[4] << 16);
-    if (size >= 2) result |= (outputBytes[5] << 8);
-    if (size >= 3) result |= (outputBytes[6] << 0);
-    return result;
+static void release_block_validation(BlockValidation *context) {
+    FREE(context->txHashes, "block_validation:txHashes");
+    FREE(context->output, "block_validation:output");
+    if (context->prevouts) {
+        FREE(context->prevouts, "block_validation:prevouts");
+    }
 }
 
-bool is_block_header_valid(BlockIndex *index) {
-    bool headerValid;
-    SHA256_HASH hash = {0};
-    TargetCompact maxTarget;
-    int8_t targetCalculationError = get_maximal_target(index, &maxTarget);
-    if (targetCalculationError) {
-        return -50;
+static void ensure_prevout_capacity(BlockValidation *context, uint64_t count) {
+    if (count <= context->prevoutCapacity) {
+        return;
     }
-    headerValid = hash_satisfies_target_compact(hash, maxTarget);
-    return headerValid;
+    if (context->prevouts) {
+        FREE(context->prevouts, "block_validation:prevouts");
+    }
+    context->prevouts = MALLOC(count * sizeof(struct Prevout), "block_validation:prevouts");
+    context->prevoutCapacity = count;
 }
 
-int8_t search_utxo(Outpoint *outpoint, TxPayload *txs, uint64_t txLimit, TxOut *sourceOutput) {
+// Finds the output spent in the UTXO set, else among the block's transactions before txIndex
+static int8_t resolve_prevout(BlockValidation *context, uint64_t txIndex, Outpoint *outpoint, TxOut *sourceOutput) {
     if (global.mode == MODE_VALIDATE_ONE) {
-        TxPayload *tx = CALLOC(1, sizeof(*tx), "search_utxo:tx");
+        TxPayload *tx = CALLOC(1, sizeof(*tx), "resolve_prevout:tx");
         int8_t status = load_tx(outpoint->txHash, tx);
         if (status == 0 && outpoint->index < tx->txOutputCount) {
             memcpy(sourceOutput, &tx->txOutputs[outpoint->index], sizeof(TxOut));
-            FREE(tx, "search_utxo:tx");
+            FREE(tx, "resolve_prevout:tx");
             return 0;
         }
         else {
-            FREE(tx, "search_utxo:tx");
+            FREE(tx, "resolve_prevout:tx");
             return -1;
         }
     }
@@ -84,15 +110,14 @@ int8_t search_utxo(Outpoint *outpoint, TxPayload *txs, uint64_t txLimit, TxOut *
     if (is_outpoint_empty(outpoint)) {
         return -30;
     }
-    int8_t status = load_utxo(outpoint, sourceOutput);
+    int8_t status = get_utxo(outpoint, sourceOutput);
     if (!status) {
         return 0;
     }
     // Search in the same block
-    for (uint64_t txIndex = 0; txIndex < txLimit; txIndex++) {
-        TxPayload *candidateSource = &txs[txIndex];
-        SHA256_HASH txHash;
-        hash_tx(candidateSource, txHash);
+    for (uint64_t candidateIndex = 0; candidateIndex < txIndex; candidateIndex++) {
+        TxPayload *candidateSource = &context->block->txs[candidateIndex];
+        Byte *txHash = context->txHashes + candidateIndex * SHA256_LENGTH;
         if (sha256_match(txHash, outpoint->txHash) && candidateSource->txOutputCount > outpoint->index) {
             memcpy(sourceOutput, &candidateSource->txOutputs[outpoint->index], sizeof(*sourceOutput));
             return 0;
@@ -110,137 +135,126 @@ uint64_t sum_outputs_from_tx(TxPayload *tx) {
     return sum;
 }
 
-uint64_t sum_inputs_from_tx(TxPayload *tx, TxPayload *txs, uint64_t txLimit) {
-    uint64_t sum = 0;
-    TxOut *sourceOutput = CALLOC(1, sizeof(*sourceOutput), "sum_inputs_from_tx:sourceOutput");
-    for (uint64_t inputIndex = 0; inputIndex < tx->txInputCount; inputIndex++) {
+static void release_prevout_programs(BlockValidation *context, uint64_t count) {
+    for (uint64_t i = 0; i < count; i++) {
+        if (context->prevouts[i].program) {
+            FREE(context->prevouts[i].program, "script_check:program");
+        }
+    }
+}
+
+// @see GetBlockSubsidy() in Bitcoin Core's 'validation.cpp'
+int64_t get_block_subsidy(uint32_t height) {
+    uint32_t halvings = height / params->subsidyHalvingInterval;
+    if (halvings >= 64) {
+        return 0;
+    }
+    return COIN(50) >> halvings;
+}
+
+// Fills the prevout table with an entry per input of the transaction, left empty for the coinbase input
+static int8_t resolve_tx_prevouts(BlockValidation *context, uint64_t txIndex) {
+    TxPayload *tx = &context->block->txs[txIndex];
+    ensure_prevout_capacity(context, tx->txInputCount);
+    bool assumed = are_script_checks_assumed();
+    for (uint32_t inputIndex = 0; inputIndex < tx->txInputCount; inputIndex++) {
         TxIn *input = &tx->txInputs[inputIndex];
+        struct Prevout *prevout = &context->prevouts[inputIndex];
+        memset(prevout, 0, sizeof(*prevout));
         if (is_coinbase(input)) {
             continue;
         }
+
+        TxOut *sourceOutput = context->output;
         memset(sourceOutput, 0, sizeof(*sourceOutput));
-        int8_t error = search_utxo(&input->previous_output, txs, txLimit, sourceOutput);
+        int8_t error = resolve_prevout(context, txIndex, &input->previous_output, sourceOutput);
         if (error) {
             fprintf(
                 stderr,
-                "search_utxo error %i: searching %s #%u\n",
+                "Cannot load source tx output (%i): %s #%u\n",
                 error,
                 binary_to_hexstr(input->previous_output.txHash, SHA256_LENGTH),
                 input->previous_output.index
             );
+            release_prevout_programs(context, inputIndex);
+            return -1;
         }
-        else {
-            sum += sourceOutput->value;
+        prevout->value = sourceOutput->value;
+        if (assumed) {
+            continue;
         }
-    }
-    FREE(sourceOutput, "sum_inputs_from_tx:sourceOutput");
-    return sum;
-}
-uint64_t compute_tx_residue(TxPayload *tx, TxPayload *txs, uint64_t txLimit) {
-    uint64_t input = sum_inputs_from_tx(tx, txs, txLimit);
-    uint64_t output = sum_outputs_from_tx(tx);
-    return input - output;
-}
 
-uint64_t agregate_residues(TxPayload *txs, uint64_t count, uint64_t initialOffset) {
-    uint64_t sum = 0;
-    for (uint64_t txIndex = initialOffset; txIndex < count; txIndex++) {
-        TxPayload *tx = &txs[txIndex];
-        sum += compute_tx_residue(tx, txs, txIndex);
+        prevout->programLength = input->signature_script_length + 1 + sourceOutput->public_key_script_length;
+        Byte *program = CALLOC(1, prevout->programLength, "script_check:program");
+        memcpy(program, input->signature_script, input->signature_script_length);
+        Byte codeSeparator = OP_CODESEPARATOR;
+        memcpy(program+input->signature_script_length, &codeSeparator, 1);
+        memcpy(program+input->signature_script_length+1, sourceOutput->public_key_script, sourceOutput->public_key_script_length);
+        prevout->program = program;
     }
-    return sum;
+    return 0;
 }
 
-bool is_normal_tx_valid(uint64_t txIndex, TxPayload *txs) {
-    TxPayload *tx = &txs[txIndex];
+static bool is_normal_tx_valid(BlockValidation *context, uint64_t txIndex) {
+    TxPayload *tx = &context->block->txs[txIndex];
+    if (resolve_tx_prevouts(context, txIndex)) {
+        return false;
+    }
 
-    bool amountValid = false;
+    uint64_t totalInputAmount = 0;
+    for (uint32_t inputIndex = 0; inputIndex < tx->txInputCount; inputIndex++) {
+        totalInputAmount += context->prevouts[inputIndex].value;
+    }
+    uint64_t totalOutputAmount = sum_outputs_from_tx(tx);
+    bool amountValid;
     if (txIndex == 0) {
-        amountValid = true; // Handled at is_initial_tx_valid()
+        // The coinbase comes last, once every fee of the block is known
+        int64_t coinbaseSubsidy = get_block_subsidy(context->index->context.height);
+        amountValid = totalInputAmount + coinbaseSubsidy + context->fees >= totalOutputAmount;
     }
     else {
-        uint64_t totalInputAmount = sum_inputs_from_tx(tx, txs, txIndex);
-        uint64_t totalOutputAmount = sum_outputs_from_tx(tx);
         amountValid = totalInputAmount >= totalOutputAmount;
+        if (amountValid) {
+            context->fees += totalInputAmount - totalOutputAmount;
+        }
+    }
+    if (!amountValid) {
+        release_prevout_programs(context, tx->txInputCount);
+        return false;
     }
 
     bool signaturesValid = true;
-    TxOut *sourceOutput = CALLOC(1, sizeof(TxOut), "is_tx_valid:txSource");
     for (uint32_t inputIndex = 0; inputIndex < tx->txInputCount; inputIndex++) {
-        TxIn *input = &tx->txInputs[inputIndex];
-        if (is_coinbase(input)) {
+        struct Prevout *prevout = &context->prevouts[inputIndex];
+        if (!prevout->program) {
             continue;
         }
-
-        memset(sourceOutput, 0, sizeof(*sourceOutput));
-        Outpoint *outpoint = &input->previous_output;
-        int8_t error = search_utxo(outpoint, txs, txIndex, sourceOutput);
-        if (error) {
-            fprintf(stderr, "Cannot load source tx output (%i)...\n", error);
-            signaturesValid = false;
-            break;
+        if (signaturesValid) {
+            // The verifier frees the program once the check has run
+            signaturesValid = queue_script_check(tx, inputIndex, prevout->program, prevout->programLength);
         }
-
-        uint64_t programLength = input->signature_script_length + 1 + sourceOutput->public_key_script_length;
-
-        Byte *program = CALLOC(1, programLength, "is_tx_valid:program");
-        memcpy(program, input->signature_script, input->signature_script_length);
-        Byte codeSeparator = OP_CODESEPARATOR;
-        memcpy(program+input->signature_script_length, &codeSeparator, 1);
-        memcpy(program+input->signature_script_length+1, sourceOutput->public_key_script, sourceOutput->public_key_script_length);
-        CheckSigMeta meta = {
-            .sourceOutput = sourceOutput,
-            .txInputIndex = inputIndex,
-            .currentTx = tx,
-        };
-        bool scriptWorks = run_program(program, programLength, meta);
-        FREE(program, "is_tx_valid:program");
-        if (!scriptWorks) {
-            signaturesValid = false;
-            break;
+        else {
+            FREE(prevout->program, "script_check:program");
         }
+        prevout->program = NULL;
     }
-    FREE(sourceOutput, "is_tx_valid:txSource");
-
-    bool result = amountValid && signaturesValid;
-
-    return result;
-}
-
-bool is_initial_tx_valid(uint64_t txIndex, TxPayload *txs, BlockPayload *block, BlockIndex *blockIndex) {
-    bool validAsNormalTx = is_normal_tx_valid(txIndex, txs);
-
-    bool amountValid;
-    uint64_t totalInputAmount = sum_inputs_from_tx(&txs[txIndex], txs, 0);
-    uint64_t totalOutputAmount = sum_outputs_from_tx(&txs[txIndex]);
-    uint64_t transactionFees = agregate_residues(block->txs, block->txCount, 1);
-    int64_t coinbaseSubsidy = COIN(50) >> (blockIndex->context.height / 210000);
-    amountValid = totalInputAmount + coinbaseSubsidy + transactionFees >= totalOutputAmount;
-
-    return validAsNormalTx && amountValid;
+    return signaturesValid;
 }
 
-
-bool is_tx_valid(uint64_t txIndex, TxPayload *txs, BlockPayload *block, BlockIndex *blockIndex) {
-    TxPayload *tx = &txs[txIndex];
+static bool is_tx_valid(BlockValidation *context, uint64_t txIndex) {
+    TxPayload *tx = &context->block->txs[txIndex];
     #if LOG_VALIDATION_PROCEDURES
     printf("\nValidating TX #%llu\n", txIndex);
     #endif
     if (!is_tx_legal(tx)) {
         return false;
     }
-    bool firstTxInBlock = txIndex == 0;
-    if (firstTxInBlock) {
-        return is_initial_tx_valid(txIndex, txs, block, blockIndex);
-    }
-    else {
-        return is_normal_tx_valid(txIndex, txs);
-    }
+    return is_normal_tx_valid(context, txIndex);
 }
 
 static bool is_block_checkpoint_compatible(BlockIndex *ptrIndex) {
     for (uint32_t i = 0; i < MAX_CHECKPOINTS; i++) {
-        struct ChainCheckPoint checkpoint = mainnet.checkpoints[i];
+        struct ChainCheckPoint checkpoint = params->checkpoints[i];
         if (!checkpoint.height) {
             continue;
         }
@@ -256,19 +270,58 @@ static bool is_block_checkpoint_compatible(BlockIndex *ptrIndex) {
     return true;
 }
 
+// Scripts below the assumed-valid block are taken as checked by whoever vouched for its hash;
+// everything else about those blocks, amounts and UTXO accounting included, is still verified.
+// Only the indexed block counts, on the best header chain at or below the assumed one, which
+// is then its ancestor; a block off that chain gets every script run
+static bool is_block_assumed_valid(BlockIndex *ptrIndex) {
+    // Decoded again only when the option points at another string
+    static char *decodedOption = NULL;
+    static bool hasAssumedHash = false;
+    static SHA256_HASH assumedHash = {0};
+    if (config.assumeValidBlock != decodedOption) {
+        decodedOption = config.assumeValidBlock;
+        hasAssumedHash = decodedOption && strlen(decodedOption) == 2 * SHA256_LENGTH;
+        if (hasAssumedHash) {
+            sha256_hex_to_binary(decodedOption, assumedHash);
+            reverse_bytes(assumedHash, SHA256_LENGTH);
+        }
+    }
+    if (!hasAssumedHash) {
+        return false;
+    }
+    BlockIndex *assumed = GET_BLOCK_INDEX(assumedHash);
+    BlockIndex *candidate = GET_BLOCK_INDEX(ptrIndex->meta.hash);
+    if (!assumed || !candidate) {
+        return false;
+    }
+    return assumed->context.chainStatus == CHAIN_STATUS_MAINCHAIN
+        && candidate->context.chainStatus == CHAIN_STATUS_MAINCHAIN
+        && candidate->context.height <= assumed->context.height;
+}
+
 bool is_block_valid(BlockPayload *ptrCandidate, BlockIndex *ptrIndex) {
 
     bool isBlockLegal = is_block_legal(ptrCandidate);
 
     bool satisfyCheckpoint = is_block_checkpoint_compatible(ptrIndex);
 
+    // Scripts are verified on the pool while the transactions are walked for amounts;
+    // a failure on either side stops the other
+    begin_script_checks(is_block_assumed_valid(ptrIndex));
+    BlockValidation context;
+    init_block_validation(&context, ptrCandidate, ptrIndex);
     bool allTxValid = true;
-    for (uint64_t i = 0; i < ptrCandidate->txCount; i++) {
-        if (!is_tx_valid(i, ptrCandidate->txs, ptrCandidate, ptrIndex)) {
+    // Coinbase last: 1, 2, ..., txCount - 1, 0
+    for (uint64_t n = 1; n <= ptrCandidate->txCount; n++) {
+        if (!is_tx_valid(&context, n % ptrCandidate->txCount) || have_script_checks_failed()) {
             allTxValid = false;
             break;
         }
     }
+    bool allScriptsValid = finish_script_checks(!allTxValid);
+    allTxValid = allTxValid && allScriptsValid;
+    release_block_validation(&context);
 
     bool isBlockValid = isBlockLegal && satisfyCheckpoint && allTxValid;
 
@@ -276,6 +329,24 @@ bool is_block_valid(BlockPayload *ptrCandidate, BlockIndex *ptrIndex) {
 }
 
 
+// Marks the branch of newTip main chain down to where it meets the current one, and the
+// abandoned part of the current one side chain; the validated chain follows separately
+static void switch_main_header_chain(BlockIndex *newTip) {
+    BlockIndex *newSide = newTip;
+    BlockIndex *oldSide = GET_BLOCK_INDEX(global.mainHeaderTip.meta.hash);
+    while (newSide && oldSide && !sha256_match(newSide->meta.hash, oldSide->meta.hash)) {
+        if (newSide->context.height >= oldSide->context.height) {
+            newSide->context.chainStatus = CHAIN_STATUS_MAINCHAIN;
+            newSide = GET_BLOCK_INDEX(newSide->header.prev_block);
+        }
+        else {
+            oldSide->context.chainStatus = CHAIN_STATUS_SIDECHAIN;
+            oldSide = GET_BLOCK_INDEX(oldSide->header.prev_block);
+        }
+    }
+    global.mainHeaderTip = *newTip;
+}
+
 int8_t process_incoming_block_header(BlockPayloadHeader *ptrHeader) {
     if (!is_block_header_legal(ptrHeader)) {
         fprintf(stderr, "Received illegal header\n");
@@ -301,7 +372,9 @@ int8_t process_incoming_block_header(BlockPayloadHeader *ptrHeader) {
     BlockIndex *parent = hashmap_get(&global.blockIndices, ptrHeader->prev_block, NULL);
     if (parent) {
         index.context.height = parent->context.height + 1;
-        index.context.chainPOW = parent->context.chainPOW + calc_block_pow(index.header.target);
+        Uint256 blockWork;
+        calc_block_work(index.header.target, &blockWork);
+        uint256_add(&parent->context.chainWork, &blockWork, &index.context.chainWork);
         switch (parent->context.chainStatus) {
             case CHAIN_STATUS_MAINCHAIN: {
                 if (parent->context.children.length == 0) {
@@ -325,17 +398,11 @@ int8_t process_incoming_block_header(BlockPayloadHeader *ptrHeader) {
             }
         }
 
-        if (index.context.chainStatus == CHAIN_STATUS_SIDECHAIN) {
-            if (global.mainHeaderTip.context.chainPOW < index.context.chainPOW) {
-                printf("Side chain overtaking main chain: should reorg...\n");
-            }
-            // TODO: Handle reorg
-        }
     }
     else {
         // We don't know new block's parent
         add_orphan(hash);
-        index.context.chainPOW = calc_block_pow(index.header.target);
+        calc_block_work(index.header.target, &index.context.chainWork);
     }
 
     // Validation
@@ -352,7 +419,7 @@ int8_t process_incoming_block_header(BlockPayloadHeader *ptrHeader) {
     }
 
     bool isNewTip = index.context.chainStatus == CHAIN_STATUS_MAINCHAIN
-                    && index.context.chainPOW > global.mainHeaderTip.context.chainPOW;
+                    && uint256_compare(&index.context.chainWork, &global.mainHeaderTip.context.chainWork) > 0;
     if (isNewTip) {
         print_hash_with_description("Updating header tip to ", index.meta.hash);
         memcpy(&global.mainHeaderTip, &index, sizeof(index));
@@ -362,16 +429,23 @@ int8_t process_incoming_block_header(BlockPayloadHeader *ptrHeader) {
     if (setError) {
         return -4;
     }
+
+    bool overtakesMainchain = index.context.chainStatus == CHAIN_STATUS_SIDECHAIN
+                              && uint256_compare(&index.context.chainWork, &global.mainHeaderTip.context.chainWork) > 0;
+    if (overtakesMainchain) {
+        printf("Side chain overtaking main chain: switching header tip\n");
+        switch_main_header_chain(GET_BLOCK_INDEX(hash));
+    }
     return 0;
 }
 
 int8_t get_maximal_target(BlockIndex *index, TargetCompact *result) {
     *result = 0;
-    if (index->context.height < mainnet.retargetPeriod) {
-        *result = global.genesisBlock.header.target;
+    if (index->context.height < params->retargetPeriod) {
+        *result = params->powLimit;
         return 0;
     }
-    else if ((index->context.height % mainnet.retargetPeriod) != 0) {
+    else if (params->noRetargeting || (index->context.height % params->retargetPeriod) != 0) {
         BlockIndex *parent = GET_BLOCK_INDEX(index->header.prev_block);
         if (!parent) {
             print_hash_with_description("get_maximal_target: Cannot find parent for index ", index->meta.hash);
@@ -385,7 +459,7 @@ int8_t get_maximal_target(BlockIndex *index, TargetCompact *result) {
     print_hash_with_description("Retargeting from tip ", index->meta.hash);
 
     Byte *ptrRetargetPeriodStart = index->header.prev_block;
-    for (uint32_t counter = 0; counter < mainnet.retargetLookBackPeriod; counter++) {
+    for (uint32_t counter = 0; counter < params->retargetLookBackPeriod; counter++) {
         BlockIndex *ptrIndex = GET_BLOCK_INDEX(ptrRetargetPeriodStart);
         if (!ptrIndex) {
             print_hash_with_description("get_maximal_target: Cannot find index", ptrRetargetPeriodStart);
@@ -397,39 +471,40 @@ int8_t get_maximal_target(BlockIndex *index, TargetCompact *result) {
 
     BlockIndex *ptrStartBlockIndex = GET_BLOCK_INDEX(ptrRetargetPeriodStart);
     BlockIndex *ptrEndBlockIndex = GET_BLOCK_INDEX(index->header.prev_block);
-    uint32_t actualPeriod = ptrEndBlockIndex->header.timestamp - ptrStartBlockIndex->header.timestamp;
+    int64_t actualPeriod = (int64_t)ptrEndBlockIndex->header.timestamp - ptrStartBlockIndex->header.timestamp;
     printf(
-        "time difference in retarget period: %u seconds (%2.1f days) [from %u, to %u]\n",
+        "time difference in retarget period: %lli seconds (%2.1f days) [from %u, to %u]\n",
         actualPeriod,
         1.0 * actualPeriod / DAY_TO_SECOND(1),
         ptrStartBlockIndex->header.timestamp,
         ptrEndBlockIndex->header.timestamp
     );
 
-    double ratio = (double)actualPeriod / (double)mainnet.desiredRetargetPeriod;
-    double MAX_TARGET = target_compact_to_float(global.genesisBlock.header.target);
-    double currentTargetFloat = target_compact_to_float(ptrEndBlockIndex->header.target);
-    double nextTargetFloat = currentTargetFloat * ratio;
-    if (nextTargetFloat > MAX_TARGET) {
+    // @see GetNextWorkRequired() in Bitcoin Core's 'pow.cpp': clamp the period, scale, cap at the ceiling
+    uint32_t minPeriod = params->desiredRetargetPeriod / params->retargetBound;
+    uint32_t maxPeriod = params->desiredRetargetPeriod * params->retargetBound;
+    uint32_t boundedPeriod = actualPeriod < minPeriod
+        ? minPeriod
+        : actualPeriod > maxPeriod ? maxPeriod : (uint32_t)actualPeriod;
+    Uint256 maxTarget;
+    Uint256 currentTarget;
+    uint256_from_compact(params->powLimit, &maxTarget);
+    uint256_from_compact(ptrEndBlockIndex->header.target, &currentTarget);
+    Uint256 nextTarget = currentTarget;
+    uint256_multiply_word(&nextTarget, boundedPeriod);
+    uint256_divide_word(&nextTarget, params->desiredRetargetPeriod);
+    if (uint256_compare(&nextTarget, &maxTarget) > 0) {
         printf("Next target hitting ceiling, using ceiling instead\n");
-        *result = global.genesisBlock.header.target;
+        *result = params->powLimit;
     }
     else {
-        double difficulty = MAX_TARGET / nextTargetFloat;
-        printf("retarget: %.3e -> %.3e (difficulty %.2f)\n", currentTargetFloat, nextTargetFloat, difficulty);
-        BIGNUM *newTarget = BN_new();
-        target_compact_to_bignum(ptrEndBlockIndex->header.target, newTarget);
-        if (actualPeriod > mainnet.desiredRetargetPeriod * mainnet.retargetBound) {
-            BN_mul_word(newTarget, mainnet.retargetBound);
-        }
-        else if (actualPeriod * mainnet.retargetBound < mainnet.desiredRetargetPeriod) {
-            BN_div_word(newTarget, mainnet.retargetBound);
-        }
-        else {
-            BN_mul_word(newTarget, actualPeriod);
-            BN_div_word(newTarget, mainnet.desiredRetargetPeriod);
-        }
-        *result = target_bignum_to_compact(newTarget);
+        *result = uint256_to_compact(&nextTarget);
+        printf(
+            "retarget: %.3e -> %.3e (difficulty %.2f)\n",
+            uint256_to_double(&currentTarget),
+            uint256_to_double(&nextTarget),
+            uint256_to_double(&maxTarget) / uint256_to_double(&nextTarget)
+        );
     }
     printf("New target %u (%x)\n", *result, *result);
     printf("=============\n");
@@ -437,7 +512,7 @@ int8_t get_maximal_target(BlockIndex *index, TargetCompact *result) {
 }
 
 uint32_t max_full_block_height_from_genesis() {
-    uint32_t height = mainnet.genesisHeight;
+    uint32_t height = params->genesisHeight;
     SHA256_HASH hash = {0};
     memcpy(hash, global.genesisHash, SHA256_LENGTH);
     while (true) {
@@ -457,54 +532,355 @@ uint32_t max_full_block_height_from_genesis() {
 }
 
 // @see GetBlockProof() in Bitcoin Core's 'chain.cpp'
+// Expected hashes to meet the target: 2^256 / (target + 1), computed as ~target / (target + 1) + 1
+// since 2^256 itself does not fit
+
+void calc_block_work(TargetCompact targetBytes, Uint256 *ptrWork) {
+    Uint256 target;
+    uint256_set_word(ptrWork, 0);
+    if (uint256_from_compact(targetBytes, &target) || uint256_is_zero(&target)) {
+        return;
+    }
+    Uint256 one;
+    uint256_set_word(&one, 1);
+    Uint256 inverted;
+    for (uint32_t i = 0; i < UINT256_WORD_COUNT; i++) {
+        inverted.words[i] = ~target.words[i];
+    }
+    Uint256 divisor;
+    uint256_add(&target, &one, &divisor);
+    uint256_divide(&inverted, &divisor, ptrWork);
+    uint256_add(ptrWork, &one, ptrWork);
+}
 
-double calc_block_pow(TargetCompact targetBytes) {
-    if (targetBytes == 0) {
-        return 0;
+struct UndoBuffer {
+    Byte *data;
+    uint64_t width;
+    uint64_t capacity;
+};
+
+static void append_undo_record(struct UndoBuffer *ptrUndo, Byte *record, uint32_t width) {
+    uint64_t needed = ptrUndo->width + MAX_MSB_VARINT_WIDTH + width;
+    if (needed > ptrUndo->capacity) {
+        uint64_t capacity = ptrUndo->capacity * 2 > needed ? ptrUndo->capacity * 2 : needed;
+        Byte *grown = MALLOC(capacity, "register_validated_block:undo");
+        memcpy(grown, ptrUndo->data, ptrUndo->width);
+        FREE(ptrUndo->data, "register_validated_block:undo");
+        ptrUndo->data = grown;
+        ptrUndo->capacity = capacity;
+    }
+    ptrUndo->width += serialize_to_msb_varint(width, ptrUndo->data + ptrUndo->width);
+    memcpy(ptrUndo->data + ptrUndo->width, record, width);
+    ptrUndo->width += width;
+}
+
+static uint64_t count_utxo_changes(BlockPayload *ptrBlock) {
+    uint64_t count = 0;
+    for (uint64_t txIndex = 0; txIndex < ptrBlock->txCount; txIndex++) {
+        TxPayload *tx = &ptrBlock->txs[txIndex];
+        count += tx->txOutputCount;
+        for (uint64_t inIndex = 0; inIndex < tx->txInputCount; inIndex++) {
+            count += !is_coinbase(&tx->txInputs[inIndex]);
+        }
     }
-    double targetFloat = target_compact_to_float(targetBytes);
-    return pow(2, 256) / (targetFloat + 1);
+    return count;
 }
 
-void register_validated_block(BlockPayload *ptrBlock) {
+// Applies the block to the UTXO set and archives what it spent, one record per
+// non-coinbase input in block order, so disconnect_block can reverse it.
+// The changes go to the UTXO cache shards all at once; statistics and undo data follow
+// from the records they hand back
+int8_t register_validated_block(BlockPayload *ptrBlock) {
     SHA256_HASH blockHash = {0};
     hash_block_header(&ptrBlock->header, blockHash);
     print_hash_with_description("Registering block ", blockHash);
-    SHA256_HASH txHash = {0};
+    BlockIndex *index = GET_BLOCK_INDEX(blockHash);
+    uint32_t height = index ? index->context.height : 0;
+    set_utxo_cache_height(height);
+    set_utxo_stats_block(blockHash);
+    Byte *txHashes = MALLOC(ptrBlock->txCount * SHA256_LENGTH, "register_validated_block:txHashes");
+    hash_txs(ptrBlock->txs, ptrBlock->txCount, txHashes);
+    uint64_t changeCount = count_utxo_changes(ptrBlock);
+    UtxoChange *changes = CALLOC(changeCount + 1, sizeof(UtxoChange), "register_validated_block:changes");
+    uint64_t changeIndex = 0;
     for (uint64_t txIndex = 0; txIndex < ptrBlock->txCount; txIndex++) {
         TxPayload *tx = &ptrBlock->txs[txIndex];
-        hash_tx(tx, txHash);
         for (uint64_t outIndex = 0; outIndex < tx->txOutputCount; outIndex++) {
-            TxOut *out = &tx->txOutputs[outIndex];
-            Outpoint outpoint;
-            outpoint.index = (uint32_t)outIndex;
-            memcpy(outpoint.txHash, txHash, SHA256_LENGTH);
-            int8_t status = save_utxo(&outpoint, out);
-            if (status) {
-                #if LOG_BLOCK_REGISTRATION_DETAILS
-                fprintf(stderr, "register utxo: %i\n", status);
-                #endif
-            }
-            else  {
-                #if LOG_BLOCK_REGISTRATION_DETAILS
-                printf("registered utxo: %s %llu\n", binary_to_hexstr(txHash, SHA256_LENGTH), outIndex);
-                #endif
-            }
+            UtxoChange *change = &changes[changeIndex++];
+            change->outpoint.index = (uint32_t)outIndex;
+            memcpy(change->outpoint.txHash, txHashes + txIndex * SHA256_LENGTH, SHA256_LENGTH);
+            change->output = &tx->txOutputs[outIndex];
         }
         for (uint64_t inIndex = 0; inIndex < tx->txInputCount; inIndex++) {
             TxIn *input = &tx->txInputs[inIndex];
             if (!is_coinbase(input)) {
-                spend_output(&input->previous_output);
-                #if LOG_BLOCK_REGISTRATION_DETAILS
-                printf(
-                    "spent utxo: %s %u\n",
-                    binary_to_hexstr(input->previous_output.txHash, SHA256_LENGTH),
-                    input->previous_output.index
-                );
-                #endif
+                changes[changeIndex++].outpoint = input->previous_output;
             }
         }
     }
+    apply_utxo_changes(changes, changeCount);
+
+    struct UndoBuffer undo = {
+        .data = MALLOC(UNDO_BUFFER_INITIAL_CAPACITY, "register_validated_block:undo"),
+        .capacity = UNDO_BUFFER_INITIAL_CAPACITY,
+    };
+    for (uint64_t i = 0; i < changeCount; i++) {
+        UtxoChange *change = &changes[i];
+        if (change->output) {
+            add_to_utxo_stats(&change->outpoint, change->record, change->width);
+            #if LOG_BLOCK_REGISTRATION_DETAILS
+            printf("registered utxo: %s %u\n", binary_to_hexstr(change->outpoint.txHash, SHA256_LENGTH), change->outpoint.index);
+            #endif
+            continue;
+        }
+        if (change->status) {
+            // An empty record: this input cannot be put back on disconnection
+            fprintf(
+                stderr,
+                "register_validated_block: spending unknown output %s #%u\n",
+                binary_to_hexstr(change->outpoint.txHash, SHA256_LENGTH),
+                change->outpoint.index
+            );
+            mark_utxo_stats_stale(height);
+        }
+        else {
+            remove_from_utxo_stats(&change->outpoint, change->record, change->width);
+        }
+        append_undo_record(&undo, change->record, change->width);
+        #if LOG_BLOCK_REGISTRATION_DETAILS
+        printf("spent utxo: %s %u\n", binary_to_hexstr(change->outpoint.txHash, SHA256_LENGTH), change->outpoint.index);
+        #endif
+    }
+    int8_t status = save_block_undo(blockHash, undo.data, undo.width);
+    FREE(changes, "register_validated_block:changes");
+    FREE(undo.data, "register_validated_block:undo");
+    FREE(txHashes, "register_validated_block:txHashes");
+    flush_utxo_cache_if_needed();
+    return status;
+}
+
+// Extends the validated chain by a block found valid on top of it
+static int8_t connect_block(BlockPayload *ptrBlock, BlockIndex *index) {
+    int8_t status = register_validated_block(ptrBlock);
+    index->meta.fullBlockValidated = true;
+    index->meta.outputsRegistered = true;
+    global.mainValidatedTip = *index;
+    return status;
+}
+
+// Takes the validated tip off the chain: its outputs leave the UTXO set and the outputs it
+// spent come back from its undo data, walking the block backwards
+int8_t disconnect_block(BlockIndex *index) {
+    if (!sha256_match(index->meta.hash, global.mainValidatedTip.meta.hash)) {
+        fprintf(stderr, "disconnect_block: only the validated tip can be disconnected\n");
+        return -1;
+    }
+    BlockIndex *parent = GET_BLOCK_INDEX(index->header.prev_block);
+    if (!parent) {
+        fprintf(stderr, "disconnect_block: cannot disconnect genesis\n");
+        return -2;
+    }
+    BlockPayload *ptrBlock = CALLOC(1, sizeof(*ptrBlock), "disconnect_block:block");
+    if (load_block(index->meta.hash, ptrBlock)) {
+        release_block(ptrBlock);
+        return -3;
+    }
+    uint64_t undoWidth = 0;
+    Byte *undo = load_block_undo(index->meta.hash, &undoWidth);
+    if (!undo) {
+        release_block(ptrBlock);
+        return -4;
+    }
+
+    // Records are read forwards into a table, then consumed from the end
+    uint64_t inputCount = 0;
+    for (uint64_t txIndex = 0; txIndex < ptrBlock->txCount; txIndex++) {
+        inputCount += ptrBlock->txs[txIndex].txInputCount;
+    }
+    Byte **records = CALLOC(inputCount + 1, sizeof(Byte *), "disconnect_block:records");
+    uint32_t *widths = CALLOC(inputCount + 1, sizeof(uint32_t), "disconnect_block:widths");
+    uint64_t recordCount = 0;
+    int8_t status = 0;
+    for (uint64_t offset = 0; offset < undoWidth; recordCount++) {
+        uint64_t width = 0;
+        uint8_t prefixWidth = parse_msb_varint(undo + offset, undoWidth - offset, &width);
+        if (!prefixWidth || recordCount == inputCount || width > undoWidth - offset - prefixWidth) {
+            status = -5;
+            break;
+        }
+        records[recordCount] = undo + offset + prefixWidth;
+        widths[recordCount] = (uint32_t)width;
+        offset += prefixWidth + width;
+    }
+
+    uint64_t nonCoinbaseInputs = 0;
+    for (uint64_t txIndex = 0; txIndex < ptrBlock->txCount; txIndex++) {
+        TxPayload *tx = &ptrBlock->txs[txIndex];
+        for (uint64_t inIndex = 0; inIndex < tx->txInputCount; inIndex++) {
+            nonCoinbaseInputs += !is_coinbase(&tx->txInputs[inIndex]);
+        }
+    }
+    if (!status && recordCount != nonCoinbaseInputs) {
+        status = -5;
+    }
+    if (status) {
+        fprintf(stderr, "disconnect_block: undo data does not match the block\n");
+        goto release;
+    }
+
+    set_utxo_cache_height(index->context.height);
+    set_utxo_stats_block(parent->meta.hash);
+    Byte *txHashes = MALLOC(ptrBlock->txCount * SHA256_LENGTH, "disconnect_block:txHashes");
+    hash_txs(ptrBlock->txs, ptrBlock->txCount, txHashes);
+    Byte created[MAX_COMPRESSED_TX_OUT_WIDTH];
+    uint64_t record = recordCount;
+    for (uint64_t txIndex = ptrBlock->txCount; txIndex-- > 0;) {
+        TxPayload *tx = &ptrBlock->txs[txIndex];
+        for (uint64_t outIndex = 0; outIndex < tx->txOutputCount; outIndex++) {
+            Outpoint outpoint;
+            outpoint.index = (uint32_t)outIndex;
+            memcpy(outpoint.txHash, txHashes + txIndex * SHA256_LENGTH, SHA256_LENGTH);
+            spend_utxo(&outpoint, NULL, NULL);
+            remove_from_utxo_stats(&outpoint, created, (uint32_t)compress_tx_out(&tx->txOutputs[outIndex], created));
+        }
+        for (uint64_t inIndex = tx->txInputCount; inIndex-- > 0;) {
+            TxIn *input = &tx->txInputs[inIndex];
+            if (is_coinbase(input)) {
+                continue;
+            }
+            record--;
+            if (widths[record] == 0) {
+                fprintf(stderr, "disconnect_block: no undo record for input %llu of tx %llu\n", inIndex, txIndex);
+                mark_utxo_stats_stale(index->context.height);
+                continue;
+            }
+            restore_utxo(&input->previous_output, records[record], widths[record]);
+            add_to_utxo_stats(&input->previous_output, records[record], widths[record]);
+        }
+    }
+    FREE(txHashes, "disconnect_block:txHashes");
+
+    index->meta.outputsRegistered = false;
+    global.mainValidatedTip = *parent;
+    print_hash_with_description("Disconnected block ", index->meta.hash);
+    flush_utxo_cache_if_needed();
+
+    release:
+    FREE(records, "disconnect_block:records");
+    FREE(widths, "disconnect_block:widths");
+    FREE(undo, "load_block_undo:data");
+    release_block(ptrBlock);
+    return status;
+}
+
+// Latest common ancestor of two indices
+static BlockIndex *find_fork(BlockIndex *a, BlockIndex *b) {
+    while (a && b && !sha256_match(a->meta.hash, b->meta.hash)) {
+        if (a->context.height >= b->context.height) {
+            a = GET_BLOCK_INDEX(a->header.prev_block);
+        }
+        else {
+            b = GET_BLOCK_INDEX(b->header.prev_block);
+        }
+    }
+    return a && b ? a : NULL;
+}
+
+// Hashes of the blocks after fork up to tip, lowest first
+static Byte *collect_branch(BlockIndex *tip, BlockIndex *fork, uint32_t *ptrCount) {
+    uint32_t count = tip->context.height - fork->context.height;
+    Byte *hashes = CALLOC(count + 1, SHA256_LENGTH, "collect_branch:hashes");
+    BlockIndex *index = tip;
+    for (uint32_t i = count; i > 0 && index; i--) {
+        memcpy(hashes + (i - 1) * SHA256_LENGTH, index->meta.hash, SHA256_LENGTH);
+        index = GET_BLOCK_INDEX(index->header.prev_block);
+    }
+    *ptrCount = count;
+    return hashes;
+}
+
+// Validates and connects blocks in order until one fails; returns how many got connected
+static uint32_t connect_branch(Byte *hashes, uint32_t count) {
+    uint32_t connected = 0;
+    for (; connected < count; connected++) {
+        BlockIndex *index = GET_BLOCK_INDEX(hashes + connected * SHA256_LENGTH);
+        if (!index) {
+            break;
+        }
+        BlockPayload *ptrBlock = CALLOC(1, sizeof(*ptrBlock), "connect_branch:block");
+        if (load_block(index->meta.hash, ptrBlock)) {
+            release_block(ptrBlock);
+            break;
+        }
+        bool valid = is_block_valid(ptrBlock, index);
+        if (valid) {
+            connect_block(ptrBlock, index);
+        }
+        else {
+            index->meta.fullBlockValidated = false;
+            print_hash_with_description("connect_branch: invalid block ", index->meta.hash);
+        }
+        release_block(ptrBlock);
+        if (!valid) {
+            break;
+        }
+    }
+    return connected;
+}
+
+// Moves the validated tip to newTip: disconnects back to the fork, then validates and
+// connects forwards. Nothing changes when the branch lacks a block or needs more than
+// maxConnect connections; an invalid block on it brings the old chain back.
+int8_t reorganize_validated_chain(BlockIndex *newTip, uint32_t maxConnect) {
+    double start = get_now();
+    BlockIndex *oldTip = GET_BLOCK_INDEX(global.mainValidatedTip.meta.hash);
+    BlockIndex *fork = oldTip ? find_fork(newTip, oldTip) : NULL;
+    if (!fork) {
+        fprintf(stderr, "reorganize_validated_chain: no common ancestor\n");
+        return -1;
+    }
+    if (newTip->context.height - fork->context.height > maxConnect) {
+        return -2;
+    }
+    uint32_t newCount = 0;
+    uint32_t oldCount = 0;
+    Byte *newBranch = collect_branch(newTip, fork, &newCount);
+    Byte *oldBranch = collect_branch(oldTip, fork, &oldCount);
+    int8_t status = 0;
+    for (uint32_t i = 0; i < newCount; i++) {
+        BlockIndex *index = GET_BLOCK_INDEX(newBranch + i * SHA256_LENGTH);
+        if (!index || !index->meta.fullBlockAvailable) {
+            status = -3;
+            goto release;
+        }
+    }
+
+    for (uint32_t i = oldCount; i > 0; i--) {
+        if (disconnect_block(GET_BLOCK_INDEX(oldBranch + (i - 1) * SHA256_LENGTH))) {
+            status = -4;
+            goto release;
+        }
+    }
+    uint32_t connected = connect_branch(newBranch, newCount);
+    if (connected < newCount) {
+        for (uint32_t i = connected; i > 0; i--) {
+            disconnect_block(GET_BLOCK_INDEX(newBranch + (i - 1) * SHA256_LENGTH));
+        }
+        connect_branch(oldBranch, oldCount);
+        status = -5;
+    }
+    printf(
+        "Reorganization %s: %u blocks disconnected, %u connected in %.1fms\n",
+        status ? "abandoned" : "done",
+        oldCount,
+        connected,
+        get_now() - start
+    );
+
+    release:
+    FREE(newBranch, "collect_branch:hashes");
+    FREE(oldBranch, "collect_branch:hashes");
+    return status;
 }
 
 int8_t process_incoming_block(BlockPayload *ptrBlock, bool persistent) {
@@ -520,8 +896,9 @@ int8_t process_incoming_block(BlockPayload *ptrBlock, bool persistent) {
         fprintf(stderr, "header error status %i\n", status);
         return status;
     }
+    // Hashed by the legality check above
     SHA256_HASH hash = {0};
-    dsha256(&ptrBlock->header, sizeof(ptrBlock->header), hash);
+    memcpy(hash, ptrBlock->legality.hash, SHA256_LENGTH);
 
     BlockIndex *index = GET_BLOCK_INDEX(hash);
     if (!index) {
@@ -529,56 +906,82 @@ int8_t process_incoming_block(BlockPayload *ptrBlock, bool persistent) {
         return -30;
     }
 
+    // Persistence, first, so that a reorganization can load the block back
+    int8_t saveError = save_block(ptrBlock);
+    if (saveError) {
+        fprintf(stderr, "save block error\n");
+        return -5;
+    }
+    print_hash_with_description("Block saved: ", hash);
+    index->meta.fullBlockAvailable = true;
+    for (uint64_t i = 0; i < ptrBlock->txCount; i++) {
+        save_tx_location(&ptrBlock->txs[i], index->meta.hash);
+    }
+
     if (persistent) {
-        bool valid = is_block_valid(ptrBlock, index);
-        if (valid) {
-            index->meta.fullBlockValidated = true;
-            bool onMainchain = index->context.chainStatus == CHAIN_STATUS_MAINCHAIN;
-            bool morePOW = index->context.chainPOW > global.mainValidatedTip.context.chainPOW;
-            bool shouldMoveTip = onMainchain && morePOW;
-            if (shouldMoveTip) {
-                global.mainValidatedTip = *index;
-                print_hash_with_description(
-                    "Valid incoming block: move validated tip to ", index->meta.hash
-                );
+        // Only the UTXO set at its parent can tell whether a block is valid
+        bool extendsValidatedTip = sha256_match(ptrBlock->header.prev_block, global.mainValidatedTip.meta.hash);
+        bool onMainchain = index->context.chainStatus == CHAIN_STATUS_MAINCHAIN;
+        bool moreWork = uint256_compare(&index->context.chainWork, &global.mainValidatedTip.context.chainWork) > 0;
+        if (index->meta.outputsRegistered) {
+            printf("Incoming block already registered\n");
+        }
+        else if (extendsValidatedTip && onMainchain) {
+            if (is_block_valid(ptrBlock, index)) {
+                connect_block(ptrBlock, index);
+                print_hash_with_description("Valid incoming block: move validated tip to ", index->meta.hash);
             }
             else {
-                printf("Valid incoming block: not moving tip\n");
+                index->meta.fullBlockValidated = false;
+                fprintf(stderr, "Block invalid\n");
             }
-            if (!index->meta.outputsRegistered) {
-                register_validated_block(ptrBlock);
-                index->meta.outputsRegistered = true;
+        }
+        else if (onMainchain && moreWork) {
+            int8_t reorgStatus = reorganize_validated_chain(index, MAX_INCOMING_REORG_BLOCKS);
+            if (reorgStatus) {
+                printf("Incoming block beyond the validated tip: left for validation (%i)\n", reorgStatus);
             }
         }
         else {
-            index->meta.fullBlockValidated = false;
-            fprintf(stderr, "Block invalid\n");
+            printf("Incoming block on a side chain: not validating\n");
         }
     }
 
     printf("handle incoming block: %.1fms\n", get_now() - start);
+    return 0;
+}
 
-    // Persistence
-    int8_t saveError = save_block(ptrBlock);
-    if (saveError) {
-        fprintf(stderr, "save block error\n");
-        return -5;
-    }
-    else {
-        print_hash_with_description("Block saved: ", hash);
-        index->meta.fullBlockAvailable = true;
-    }
-
-    for (uint64_t i = 0; i < ptrBlock->txCount; i++) {
-        save_tx_location(&ptrBlock->txs[i], index->meta.hash);
+// Headers are copied side by side so the digests run through the batch engine
+static void rehash_block_indices(Byte *keys, uint32_t indexCount) {
+    BlockIndex **indices = CALLOC(INDEX_HASH_BATCH_SIZE, sizeof(BlockIndex *), "rehash_block_indices:indices");
+    BlockPayloadHeader *headers = CALLOC(INDEX_HASH_BATCH_SIZE, sizeof(BlockPayloadHeader), "rehash_block_indices:headers");
+    Byte *hashes = CALLOC(INDEX_HASH_BATCH_SIZE, SHA256_LENGTH, "rehash_block_indices:hashes");
+    uint32_t batchCount = 0;
+    for (uint32_t i = 0; i < indexCount; i++) {
+        BlockIndex *ptrIndex = hashmap_get(&global.blockIndices, keys + i * SHA256_LENGTH, NULL);
+        if (ptrIndex) {
+            indices[batchCount] = ptrIndex;
+            headers[batchCount] = ptrIndex->header;
+            batchCount++;
+        }
+        if (batchCount == INDEX_HASH_BATCH_SIZE || (i == indexCount - 1 && batchCount > 0)) {
+            dsha256_batch((Byte *)headers, sizeof(BlockPayloadHeader), batchCount, hashes);
+            for (uint32_t j = 0; j < batchCount; j++) {
+                memcpy(indices[j]->meta.hash, hashes + j * SHA256_LENGTH, SHA256_LENGTH);
+            }
+            batchCount = 0;
+        }
     }
-    return 0;
+    FREE(indices, "rehash_block_indices:indices");
+    FREE(headers, "rehash_block_indices:headers");
+    FREE(hashes, "rehash_block_indices:hashes");
 }
 
 double scan_block_indices(bool recheckBlockExistence, bool reloadBlockContent) {
     printf("Scanning block indices...\n");
     Byte *keys = CALLOC(MAX_BLOCK_COUNT, SHA256_LENGTH, "recalculate_block_indices:keys");
     uint32_t indexCount = (uint32_t)hashmap_getkeys(&global.blockIndices, keys);
+    rehash_block_indices(keys, indexCount);
     uint32_t fullBlockAvailable = 0;
 
     for (uint32_t i = 0; i < indexCount; i++) {
@@ -592,7 +995,6 @@ double scan_block_indices(bool recheckBlockExistence, bool reloadBlockContent) {
             printf("Key not found\n");
             continue;
         }
-        dsha256(&ptrIndex->header, sizeof(BlockPayloadHeader), ptrIndex->meta.hash);
         if (recheckBlockExistence) {
             ptrIndex->meta.fullBlockAvailable = is_block_downloaded(ptrIndex->meta.hash);
         }
@@ -617,6 +1019,16 @@ double scan_block_indices(bool recheckBlockExistence, bool reloadBlockContent) {
     return fullBlockAvailable * 1.0 / indexCount;
 }
 
+static BlockIndex *get_main_child(BlockIndex *index) {
+    for (uint16_t i = 0; i < index->context.children.length; i++) {
+        BlockIndex *child = GET_BLOCK_INDEX(index->context.children.hashes[i]);
+        if (child && child->context.chainStatus == CHAIN_STATUS_MAINCHAIN) {
+            return child;
+        }
+    }
+    return NULL;
+}
+
 // 2: valid and continue; 1: valid and stop; 0: invalid; <0: error
 
 int8_t validate_block(Byte *target, bool saveValidation, Byte *nextHash) {
@@ -635,7 +1047,10 @@ int8_t validate_block(Byte *target, bool saveValidation, Byte *nextHash) {
         binary_to_hexstr(index->meta.hash, SHA256_LENGTH)
     );
     BlockPayload *block = CALLOC(1, sizeof(*block), "validate_blocks:block");
-    int8_t blockLoadStatus = load_block(index->meta.hash, block);
+    int8_t blockLoadStatus = 0;
+    if (!take_pipeline_block(index->meta.hash, block, &blockLoadStatus)) {
+        blockLoadStatus = load_block(index->meta.hash, block);
+    }
     #if LOG_VALIDATION_PROCEDURES
     print_block_payload(block);
     #endif
@@ -648,7 +1063,8 @@ int8_t validate_block(Byte *target, bool saveValidation, Byte *nextHash) {
         goto release;
     }
 
-    bool hasChild = index->context.children.length > 0;
+    BlockIndex *child = get_main_child(index);
+    bool hasChild = child != NULL;
 
     bool blockValid = is_block_valid(block, index);
     if (!blockValid) {
@@ -668,16 +1084,16 @@ int8_t validate_block(Byte *target, bool saveValidation, Byte *nextHash) {
     printf(" [validated]\n");
 
     if (saveValidation) {
-        index->meta.fullBlockValidated = true;
-        index->meta.outputsRegistered = true;
-        register_validated_block(block);
-        if (index->context.chainPOW > global.mainValidatedTip.context.chainPOW) {
-            global.mainValidatedTip = *index;
+        if (!sha256_match(index->header.prev_block, global.mainValidatedTip.meta.hash)) {
+            fprintf(stderr, "validate_blocks: block does not extend the validated tip\n");
+            blockValidation = -20;
+            goto release;
         }
+        connect_block(block, index);
     }
 
     if (nextHash && hasChild) {
-        memcpy(nextHash, index->context.children.hashes[0], SHA256_LENGTH); // TODO: handle side-chain
+        memcpy(nextHash, child->meta.hash, SHA256_LENGTH);
     }
 
     release:
@@ -685,6 +1101,37 @@ int8_t validate_block(Byte *target, bool saveValidation, Byte *nextHash) {
     return blockValidation;
 }
 
+// Queues the available main-chain blocks within the prefetch depth past the one about to be
+// validated; returns the height queued up to, so the next call continues from there
+static uint32_t prefetch_ahead(BlockIndex *index, uint32_t queuedHeight) {
+    uint32_t endHeight = index->context.height + get_utxo_prefetch_depth();
+    BlockIndex *next = get_main_child(index);
+    while (next && next->context.height <= endHeight && next->meta.fullBlockAvailable) {
+        if (next->context.height > queuedHeight) {
+            queue_utxo_prefetch(next->meta.hash);
+            queuedHeight = next->context.height;
+        }
+        next = get_main_child(next);
+    }
+    return queuedHeight;
+}
+
+// Fills the pipeline with the available main-chain blocks from the one about to be validated
+// on; returns the height queued up to, so the next call continues from there
+static uint32_t pipeline_ahead(BlockIndex *index, uint32_t queuedHeight) {
+    BlockIndex *next = index;
+    while (next && next->meta.fullBlockAvailable) {
+        if (next->context.height > queuedHeight) {
+            if (!queue_pipeline_block(next->meta.hash)) {
+                break;
+            }
+            queuedHeight = next->context.height;
+        }
+        next = get_main_child(next);
+    }
+    return queuedHeight;
+}
+
 uint32_t validate_blocks(double maxTime) {
     double start = get_now();
     double now = start;
@@ -692,16 +1139,36 @@ uint32_t validate_blocks(double maxTime) {
     SHA256_HASH blockHash = {0};
     Byte *lastValid = global.mainValidatedTip.meta.hash;
     BlockIndex *index = GET_BLOCK_INDEX(lastValid);
+    // Off the main chain after a header switch: step back to it before going forward
+    while (index && index->context.chainStatus != CHAIN_STATUS_MAINCHAIN) {
+        if (disconnect_block(index)) {
+            return 0;
+        }
+        index = GET_BLOCK_INDEX(global.mainValidatedTip.meta.hash);
+    }
     if (!index) {
         return 0;
     }
-    else if (index->context.children.length == 0) {
+    BlockIndex *child = get_main_child(index);
+    if (!child) {
         return 1;
     }
-    memcpy(blockHash, index->context.children.hashes[0], SHA256_LENGTH);
+    memcpy(blockHash, child->meta.hash, SHA256_LENGTH);
     uint32_t checkedBlocks = 0;
     double averageTime = 0.0;
+    start_utxo_prefetch();
+    start_block_pipeline();
+    uint32_t queuedHeight = 0;
     while ((now - start + averageTime) < maxTime) {
+        BlockIndex *current = GET_BLOCK_INDEX(blockHash);
+        // The pipeline does the lookups itself and drains them as each block is taken
+        if (current && is_block_pipeline_running()) {
+            queuedHeight = pipeline_ahead(current, queuedHeight);
+        }
+        else if (current && is_utxo_prefetch_running()) {
+            queuedHeight = prefetch_ahead(current, queuedHeight);
+            drain_utxo_prefetch();
+        }
         int8_t validation = validate_block(blockHash, true, blockHash);
         checkedBlocks++;
         now = get_now();
@@ -710,6 +1177,8 @@ uint32_t validate_blocks(double maxTime) {
             break;
         }
     }
+    stop_block_pipeline();
+    stop_utxo_prefetch();
     double deltaT = now - start;
     printf("\nValidated %u in %.1fms (avg. %.1fms per block)\n", checkedBlocks, deltaT, deltaT / checkedBlocks);
     return checkedBlocks;
@@ -732,6 +1201,9 @@ void reset_validation() {
 void reset_utxo() {
     printf("Reseting utxo\n");
     reset_validation();
-    destory_db(config.utxoDBName);
+    clear_utxo_cache();
+    reset_utxo_db();
+    reset_utxo_filter(0);
+    reset_utxo_stats(global.genesisHash);
     printf("Done.\n");
 }
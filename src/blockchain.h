@@ -1,12 +1,14 @@
 #pragma once
 #include <stdint.h>
-#include "openssl/bn.h"
 #include "hash.h"
 #include "datatypes.h"
 #include "messages/block.h"
+#include "utils/uint256.h"
 
 #define MAX_BLOCK_COUNT 1000000
 
+#define INDEX_HASH_BATCH_SIZE 1024
+
 #define MAX_CHILDREN_PER_BLOCK 16
 
 #define CHAIN_STATUS_MAINCHAIN 0
@@ -15,6 +17,9 @@
 
 #define HEADER_EXISTED 100
 
+// Deeper reorganizations are left to validate_blocks rather than done on block arrival
+#define MAX_INCOMING_REORG_BLOCKS 144
+
 struct BlockChildren {
     SHA256_HASH hashes[MAX_CHILDREN_PER_BLOCK];
     uint16_t length;
@@ -30,7 +35,7 @@ struct BlockMeta {
 struct BlockContext {
     uint8_t chainStatus;
     uint32_t height;
-    double chainPOW;
+    Uint256 chainWork;
     struct BlockChildren children;
 };
 
@@ -42,11 +47,8 @@ struct BlockIndex {
 
 typedef struct BlockIndex BlockIndex;
 
-double target_compact_to_float(TargetCompact targetBytes);
-void target_compact_to_bignum(TargetCompact targetBytes, BIGNUM *ptrTarget);
-uint32_t target_bignum_to_compact(BIGNUM *ptrTarget);
-
-double calc_block_pow(TargetCompact targetFloat);
+void calc_block_work(TargetCompact targetBytes, Uint256 *ptrWork);
+int64_t get_block_subsidy(uint32_t height);
 int8_t process_incoming_block_header(BlockPayloadHeader *ptrHeader);
 int8_t process_incoming_block(BlockPayload *ptrBlock, bool persistent);
 double scan_block_indices(bool recheckBlockExistence, bool reloadBlockContent);
@@ -54,4 +56,7 @@ bool is_block_valid(BlockPayload *ptrCandidate, BlockIndex *ptrIndex);
 uint32_t max_full_block_height_from_genesis(void);
 uint32_t validate_blocks(double maxTime);
 int8_t validate_block(Byte *target, bool saveValidation, Byte *nextHash);
+int8_t register_validated_block(BlockPayload *ptrBlock);
+int8_t disconnect_block(BlockIndex *index);
+int8_t reorganize_validated_chain(BlockIndex *newTip, uint32_t maxConnect);
 void reset_utxo();
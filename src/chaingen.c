@@ -0,0 +1,474 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "openssl/bn.h"
+#include "openssl/ec.h"
+#include "openssl/ecdsa.h"
+#include "openssl/obj_mac.h"
+
+#include "chaingen.h"
+#include "blockchain.h"
+#include "globalstate.h"
+#include "mine.h"
+#include "parameters.h"
+#include "script.h"
+#include "utils/datetime.h"
+#include "utils/memory.h"
+
+#define COMPRESSED_PUBKEY_LENGTH 33
+#define MAX_DER_SIGNATURE_LENGTH 72
+
+// Regtest targets are met within a couple of nonces, far cheaper than starting miner threads
+#define CHAINGEN_SERIAL_NONCES 1024
+
+#define CHAINGEN_DEFAULT_KEY_COUNT 16
+
+enum CoinScript {
+    COIN_SCRIPT_P2PKH,
+    COIN_SCRIPT_MULTISIG,
+};
+
+struct GeneratorKey {
+    EC_KEY *key;
+    Byte publicKey[COMPRESSED_PUBKEY_LENGTH];
+    RIPEMD_HASH publicKeyHash;
+};
+
+// An output the generator holds the key to; keyIndex is the key that signs for it
+struct Coin {
+    Outpoint outpoint;
+    int64_t value;
+    uint16_t keyIndex;
+    uint8_t script;
+};
+
+// Oldest coins are spent first, so fan-out blocks draw on earlier blocks' outputs
+struct CoinPool {
+    struct Coin *coins;
+    uint32_t head;
+    uint32_t count;
+};
+
+struct Generator {
+    ChainGenOptions options;
+    struct GeneratorKey keys[CHAINGEN_MAX_KEYS];
+    EC_GROUP *group;
+    BN_CTX *bnContext;
+    struct CoinPool pool;
+    uint64_t random;
+    SHA256_HASH tipHash;
+    uint32_t tipHeight;
+    uint32_t tipTimestamp;
+    ChainGenStats *ptrStats;
+};
+
+// xorshift64*: choices depend on the seed alone
+static uint64_t next_random(struct Generator *ptrGen) {
+    ptrGen->random ^= ptrGen->random >> 12;
+    ptrGen->random ^= ptrGen->random << 25;
+    ptrGen->random ^= ptrGen->random >> 27;
+    return ptrGen->random * 0x2545F4914F6CDD1DULL;
+}
+
+static void push_coin(struct CoinPool *ptrPool, struct Coin *ptrCoin) {
+    if (ptrPool->count == CHAINGEN_MAX_COINS) {
+        // Left unspent for good, which only grows the UTXO set
+        return;
+    }
+    ptrPool->coins[(ptrPool->head + ptrPool->count) % CHAINGEN_MAX_COINS] = *ptrCoin;
+    ptrPool->count++;
+}
+
+static struct Coin take_coin(struct CoinPool *ptrPool) {
+    struct Coin coin = ptrPool->coins[ptrPool->head];
+    ptrPool->head = (ptrPool->head + 1) % CHAINGEN_MAX_COINS;
+    ptrPool->count--;
+    return coin;
+}
+
+static int8_t derive_keys(struct Generator *ptrGen) {
+    for (uint32_t i = 0; i < ptrGen->options.keyCount; i++) {
+        Byte material[sizeof(ptrGen->options.seed) + sizeof(i)];
+        memcpy(material, &ptrGen->options.seed, sizeof(ptrGen->options.seed));
+        memcpy(material + sizeof(ptrGen->options.seed), &i, sizeof(i));
+        SHA256_HASH secret = {0};
+        sha256(material, sizeof(material), secret);
+
+        struct GeneratorKey *ptrKey = &ptrGen->keys[i];
+        ptrKey->key = EC_KEY_new_by_curve_name(NID_secp256k1);
+        BIGNUM *privateKey = BN_bin2bn(secret, SHA256_LENGTH, NULL);
+        EC_POINT *publicKey = EC_POINT_new(ptrGen->group);
+        bool derived = ptrKey->key
+            && EC_POINT_mul(ptrGen->group, publicKey, privateKey, NULL, NULL, ptrGen->bnContext) == 1
+            && EC_KEY_set_private_key(ptrKey->key, privateKey) == 1
+            && EC_KEY_set_public_key(ptrKey->key, publicKey) == 1
+            && EC_POINT_point2oct(
+                ptrGen->group,
+                publicKey,
+                POINT_CONVERSION_COMPRESSED,
+                ptrKey->publicKey,
+                COMPRESSED_PUBKEY_LENGTH,
+                ptrGen->bnContext
+            ) == COMPRESSED_PUBKEY_LENGTH;
+        EC_POINT_free(publicKey);
+        BN_clear_free(privateKey);
+        if (!derived) {
+            fprintf(stderr, "derive_keys: cannot derive key %u\n", i);
+            return -1;
+        }
+        sharipe(ptrKey->publicKey, COMPRESSED_PUBKEY_LENGTH, ptrKey->publicKeyHash);
+    }
+    return 0;
+}
+
+// ECDSA with the nonce hashed from the key and digest, so the same seed gives the same chain
+static int32_t sign_digest(struct Generator *ptrGen, struct GeneratorKey *ptrKey, SHA256_HASH digest, Byte *signature) {
+    const BIGNUM *privateKey = EC_KEY_get0_private_key(ptrKey->key);
+    const BIGNUM *order = EC_GROUP_get0_order(ptrGen->group);
+    Byte material[SHA256_LENGTH * 2];
+    BN_bn2binpad(privateKey, material, SHA256_LENGTH);
+    memcpy(material + SHA256_LENGTH, digest, SHA256_LENGTH);
+    SHA256_HASH nonceBytes = {0};
+    dsha256(material, sizeof(material), nonceBytes);
+
+    BIGNUM *nonce = BN_bin2bn(nonceBytes, SHA256_LENGTH, NULL);
+    BN_mod(nonce, nonce, order, ptrGen->bnContext);
+    if (BN_is_zero(nonce)) {
+        BN_one(nonce);
+    }
+    EC_POINT *noncePoint = EC_POINT_new(ptrGen->group);
+    BIGNUM *r = BN_new();
+    EC_POINT_mul(ptrGen->group, noncePoint, nonce, NULL, NULL, ptrGen->bnContext);
+    EC_POINT_get_affine_coordinates(ptrGen->group, noncePoint, r, NULL, ptrGen->bnContext);
+    BN_nnmod(r, r, order, ptrGen->bnContext);
+    BIGNUM *nonceInverse = BN_mod_inverse(NULL, nonce, order, ptrGen->bnContext);
+
+    ECDSA_SIG *ptrSignature = ECDSA_do_sign_ex(digest, SHA256_LENGTH, nonceInverse, r, ptrKey->key);
+    int32_t width = -1;
+    if (ptrSignature) {
+        Byte *p = signature;
+        width = i2d_ECDSA_SIG(ptrSignature, &p);
+        ECDSA_SIG_free(ptrSignature);
+    }
+    BN_clear_free(nonceInverse);
+    BN_free(r);
+    EC_POINT_free(noncePoint);
+    BN_clear_free(nonce);
+    return width;
+}
+
+static uint64_t write_output_script(struct Generator *ptrGen, struct Coin *ptrCoin, Byte *script) {
+    Byte *p = script;
+    struct GeneratorKey *ptrSigner = &ptrGen->keys[ptrCoin->keyIndex];
+    if (ptrCoin->script == COIN_SCRIPT_P2PKH) {
+        *p++ = OP_DUP;
+        *p++ = OP_HASH160;
+        *p++ = RIPEMD_LENGTH;
+        memcpy(p, ptrSigner->publicKeyHash, RIPEMD_LENGTH);
+        p += RIPEMD_LENGTH;
+        *p++ = OP_EQUALVERIFY;
+        *p++ = OP_CHECKSIG;
+    }
+    else {
+        // 1-of-2 with the signer last: OP_CHECKMULTISIG tries keys from the top of the stack
+        struct GeneratorKey *ptrCosigner = &ptrGen->keys[(ptrCoin->keyIndex + 1) % ptrGen->options.keyCount];
+        *p++ = OP_1;
+        *p++ = COMPRESSED_PUBKEY_LENGTH;
+        memcpy(p, ptrCosigner->publicKey, COMPRESSED_PUBKEY_LENGTH);
+        p += COMPRESSED_PUBKEY_LENGTH;
+        *p++ = COMPRESSED_PUBKEY_LENGTH;
+        memcpy(p, ptrSigner->publicKey, COMPRESSED_PUBKEY_LENGTH);
+        p += COMPRESSED_PUBKEY_LENGTH;
+        *p++ = OP_2;
+        *p++ = OP_CHECKMULTISIG;
+    }
+    return p - script;
+}
+
+static int8_t sign_input(struct Generator *ptrGen, TxPayload *ptrTx, uint64_t inputIndex, struct Coin *ptrSource) {
+    Byte subscript[128];
+    uint64_t subscriptLength = write_output_script(ptrGen, ptrSource, subscript);
+    SHA256_HASH digest = {0};
+    compute_signature_hash(ptrTx, inputIndex, subscript, subscriptLength, SIGHASH_ALL, digest);
+
+    struct GeneratorKey *ptrKey = &ptrGen->keys[ptrSource->keyIndex];
+    Byte signature[MAX_DER_SIGNATURE_LENGTH + 1];
+    int32_t signatureWidth = sign_digest(ptrGen, ptrKey, digest, signature);
+    if (signatureWidth <= 0) {
+        fprintf(stderr, "sign_input: cannot sign input %llu\n", inputIndex);
+        return -1;
+    }
+    signature[signatureWidth++] = SIGHASH_ALL;
+
+    TxIn *input = &ptrTx->txInputs[inputIndex];
+    Byte *p = input->signature_script;
+    if (ptrSource->script == COIN_SCRIPT_MULTISIG) {
+        *p++ = OP_0; // Consumed by OP_CHECKMULTISIG's extra pop
+    }
+    *p++ = (Byte)signatureWidth;
+    memcpy(p, signature, (size_t)signatureWidth);
+    p += signatureWidth;
+    if (ptrSource->script == COIN_SCRIPT_P2PKH) {
+        *p++ = COMPRESSED_PUBKEY_LENGTH;
+        memcpy(p, ptrKey->publicKey, COMPRESSED_PUBKEY_LENGTH);
+        p += COMPRESSED_PUBKEY_LENGTH;
+    }
+    input->signature_script_length = p - input->signature_script;
+    return 0;
+}
+
+static void init_generated_tx(TxPayload *ptrTx, uint64_t inputCount, uint64_t outputCount) {
+    memset(ptrTx, 0, sizeof(*ptrTx));
+    ptrTx->version = 1;
+    ptrTx->txInputCount = inputCount;
+    ptrTx->txInputs = CALLOC(inputCount, sizeof(TxIn), "parse_into_tx_payload:txInputs");
+    ptrTx->txOutputCount = outputCount;
+    ptrTx->txOutputs = CALLOC(outputCount, sizeof(TxOut), "parse_into_tx_payload:txOutputs");
+}
+
+// Spends `source` into outputsPerTx fresh coins, written to `created` with their outpoints
+static int8_t build_spending_tx(struct Generator *ptrGen, struct Coin *ptrSource, TxPayload *ptrTx, struct Coin *created) {
+    uint32_t outputCount = ptrGen->options.outputsPerTx;
+    init_generated_tx(ptrTx, 1, outputCount);
+    TxIn *input = &ptrTx->txInputs[0];
+    input->previous_output = ptrSource->outpoint;
+    input->sequence = UINT32_MAX;
+
+    int64_t fee = ptrSource->value > CHAINGEN_FEE ? CHAINGEN_FEE : 0;
+    int64_t share = (ptrSource->value - fee) / outputCount;
+    int64_t remainder = (ptrSource->value - fee) - share * outputCount;
+    for (uint32_t i = 0; i < outputCount; i++) {
+        struct Coin *ptrCoin = &created[i];
+        ptrCoin->value = share + (i == 0 ? remainder : 0);
+        ptrCoin->keyIndex = (uint16_t)(next_random(ptrGen) % ptrGen->options.keyCount);
+        bool multisig = next_random(ptrGen) % 100 < ptrGen->options.multisigPercent;
+        ptrCoin->script = multisig ? COIN_SCRIPT_MULTISIG : COIN_SCRIPT_P2PKH;
+        TxOut *output = &ptrTx->txOutputs[i];
+        output->value = ptrCoin->value;
+        output->public_key_script_length = write_output_script(ptrGen, ptrCoin, output->public_key_script);
+    }
+
+    if (sign_input(ptrGen, ptrTx, 0, ptrSource)) {
+        return -1;
+    }
+    SHA256_HASH txHash = {0};
+    hash_tx(ptrTx, txHash);
+    for (uint32_t i = 0; i < outputCount; i++) {
+        memcpy(created[i].outpoint.txHash, txHash, SHA256_LENGTH);
+        created[i].outpoint.index = i;
+    }
+    ptrGen->ptrStats->inputs += 1;
+    ptrGen->ptrStats->outputs += outputCount;
+    return 0;
+}
+
+static void build_coinbase(struct Generator *ptrGen, uint32_t height, int64_t fees, TxPayload *ptrTx) {
+    init_generated_tx(ptrTx, 1, 1);
+    TxIn *input = &ptrTx->txInputs[0];
+    memset(input->previous_output.txHash, 0, SHA256_LENGTH);
+    input->previous_output.index = UINT32_MAX;
+    input->sequence = UINT32_MAX;
+    // The height keeps every coinbase, and so every txid, distinct
+    input->signature_script[0] = sizeof(height);
+    memcpy(input->signature_script + 1, &height, sizeof(height));
+    input->signature_script_length = 1 + sizeof(height);
+
+    struct Coin coin = {
+        .value = get_block_subsidy(height) + fees,
+        .keyIndex = (uint16_t)(height % ptrGen->options.keyCount),
+        .script = COIN_SCRIPT_P2PKH,
+    };
+    TxOut *output = &ptrTx->txOutputs[0];
+    output->value = coin.value;
+    output->public_key_script_length = write_output_script(ptrGen, &coin, output->public_key_script);
+
+    hash_tx(ptrTx, coin.outpoint.txHash);
+    coin.outpoint.index = 0;
+    push_coin(&ptrGen->pool, &coin);
+    ptrGen->ptrStats->outputs += 1;
+}
+
+static int64_t sum_created_values(struct Coin *created, uint32_t count) {
+    int64_t sum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        sum += created[i].value;
+    }
+    return sum;
+}
+
+// Fills txs[1..] per the configured shape and returns how many it made; -1 on error
+static int32_t build_block_txs(struct Generator *ptrGen, TxPayload *txs, int64_t *ptrFees) {
+    ChainGenOptions *ptrOptions = &ptrGen->options;
+    if (ptrOptions->shape == TX_SHAPE_COINBASE_ONLY || ptrOptions->txsPerBlock == 0) {
+        return 0;
+    }
+    // Coins created in this block are pushed behind these and left for later blocks
+    uint32_t available = ptrGen->pool.count;
+    struct Coin created[CHAINGEN_MAX_OUTPUTS_PER_TX];
+    struct Coin source;
+    memset(&source, 0, sizeof(source));
+    uint32_t txCount = 0;
+    if (ptrOptions->shape == TX_SHAPE_CHAIN) {
+        if (available == 0) {
+            return 0;
+        }
+        source = take_coin(&ptrGen->pool);
+    }
+    for (uint32_t i = 0; i < ptrOptions->txsPerBlock; i++) {
+        if (ptrOptions->shape == TX_SHAPE_FAN_OUT) {
+            if (available == 0) {
+                break;
+            }
+            source = take_coin(&ptrGen->pool);
+            available--;
+        }
+        TxPayload *ptrTx = &txs[1 + txCount];
+        if (build_spending_tx(ptrGen, &source, ptrTx, created)) {
+            return -1;
+        }
+        txCount++;
+        *ptrFees += source.value - sum_created_values(created, ptrOptions->outputsPerTx);
+        uint32_t firstPooled = 0;
+        bool chainContinues = ptrOptions->shape == TX_SHAPE_CHAIN && i + 1 < ptrOptions->txsPerBlock;
+        if (chainContinues) {
+            source = created[0];
+            firstPooled = 1;
+        }
+        for (uint32_t j = firstPooled; j < ptrOptions->outputsPerTx; j++) {
+            push_coin(&ptrGen->pool, &created[j]);
+        }
+    }
+    return (int32_t)txCount;
+}
+
+static int8_t mine_generated_header(BlockPayloadHeader *ptrHeader) {
+    SHA256_HASH hash = {0};
+    for (uint32_t nonce = 0; nonce < CHAINGEN_SERIAL_NONCES; nonce++) {
+        ptrHeader->nonce = nonce;
+        hash_block_header(ptrHeader, hash);
+        if (hash_satisfies_target_compact(hash, ptrHeader->target)) {
+            return 0;
+        }
+    }
+    // Harder targets than regtest's; no longer deterministic with several mining threads
+    ptrHeader->nonce = 0;
+    return mine_block_header(ptrHeader, 0, NULL) ? -1 : 0;
+}
+
+static int8_t generate_block(struct Generator *ptrGen) {
+    uint32_t height = ptrGen->tipHeight + 1;
+    BlockPayload *ptrBlock = CALLOC(1, sizeof(BlockPayload), "block_payload");
+    ptrBlock->txs = CALLOC(1 + ptrGen->options.txsPerBlock, sizeof(TxPayload), "parse_block:txs");
+    int8_t status = 0;
+
+    int64_t fees = 0;
+    int32_t spendingTxCount = build_block_txs(ptrGen, ptrBlock->txs, &fees);
+    if (spendingTxCount < 0) {
+        status = -1;
+        goto release;
+    }
+    ptrBlock->txCount = 1 + (uint64_t)spendingTxCount;
+    build_coinbase(ptrGen, height, fees, &ptrBlock->txs[0]);
+
+    BlockPayloadHeader *ptrHeader = &ptrBlock->header;
+    ptrHeader->version = 1;
+    memcpy(ptrHeader->prev_block, ptrGen->tipHash, SHA256_LENGTH);
+    compute_merkle_root(ptrBlock->txs, ptrBlock->txCount, ptrHeader->merkle_root);
+    ptrHeader->timestamp = ptrGen->tipTimestamp + ptrGen->options.blockInterval;
+    ptrHeader->target = params->powLimit;
+    if (mine_generated_header(ptrHeader)) {
+        fprintf(stderr, "generate_block: cannot mine block at height %u\n", height);
+        status = -2;
+        goto release;
+    }
+
+    hash_block_header(ptrHeader, ptrGen->tipHash);
+    ptrGen->tipHeight = height;
+    ptrGen->tipTimestamp = ptrHeader->timestamp;
+    ptrGen->ptrStats->blocks += 1;
+    ptrGen->ptrStats->txs += ptrBlock->txCount;
+
+    ChainGenSink *sink = ptrGen->options.sink ? ptrGen->options.sink : &submit_generated_block;
+    if (sink(ptrBlock, height, ptrGen->options.sinkContext)) {
+        fprintf(stderr, "generate_block: sink rejected block at height %u\n", height);
+        status = -3;
+    }
+
+    release:
+    release_block(ptrBlock);
+    return status;
+}
+
+static int8_t check_options(ChainGenOptions *ptrOptions) {
+    if (ptrOptions->keyCount == 0) {
+        ptrOptions->keyCount = CHAINGEN_DEFAULT_KEY_COUNT;
+    }
+    if (ptrOptions->outputsPerTx == 0) {
+        ptrOptions->outputsPerTx = 1;
+    }
+    if (ptrOptions->keyCount > CHAINGEN_MAX_KEYS) {
+        fprintf(stderr, "generate_chain: at most %u keys\n", CHAINGEN_MAX_KEYS);
+        return -1;
+    }
+    if (ptrOptions->outputsPerTx > CHAINGEN_MAX_OUTPUTS_PER_TX) {
+        fprintf(stderr, "generate_chain: at most %u outputs per tx\n", CHAINGEN_MAX_OUTPUTS_PER_TX);
+        return -1;
+    }
+    return 0;
+}
+
+// Extends the current header tip by blockCount blocks
+int8_t generate_chain(ChainGenOptions *ptrOptions, ChainGenStats *ptrStats) {
+    struct Generator *ptrGen = CALLOC(1, sizeof(*ptrGen), "generate_chain:generator");
+    ptrGen->options = *ptrOptions;
+    ChainGenStats ignoredStats;
+    ptrGen->ptrStats = ptrStats ? ptrStats : &ignoredStats;
+    memset(ptrGen->ptrStats, 0, sizeof(*ptrGen->ptrStats));
+    int8_t status = check_options(&ptrGen->options);
+    if (status) {
+        FREE(ptrGen, "generate_chain:generator");
+        return status;
+    }
+    ptrGen->random = ptrGen->options.seed ^ 0x9E3779B97F4A7C15ULL;
+    if (ptrGen->random == 0) {
+        ptrGen->random = 1;
+    }
+    ptrGen->group = EC_GROUP_new_by_curve_name(NID_secp256k1);
+    ptrGen->bnContext = BN_CTX_new();
+    ptrGen->pool.coins = MALLOC(CHAINGEN_MAX_COINS * sizeof(struct Coin), "generate_chain:coins");
+    memcpy(ptrGen->tipHash, global.mainHeaderTip.meta.hash, SHA256_LENGTH);
+    ptrGen->tipHeight = global.mainHeaderTip.context.height;
+    ptrGen->tipTimestamp = global.mainHeaderTip.header.timestamp;
+
+    double start = get_now();
+    status = derive_keys(ptrGen);
+    for (uint32_t i = 0; i < ptrGen->options.blockCount && !status; i++) {
+        status = generate_block(ptrGen);
+    }
+    ptrGen->ptrStats->elapsed = get_now() - start;
+
+    for (uint32_t i = 0; i < ptrGen->options.keyCount; i++) {
+        EC_KEY_free(ptrGen->keys[i].key);
+    }
+    FREE(ptrGen->pool.coins, "generate_chain:coins");
+    BN_CTX_free(ptrGen->bnContext);
+    EC_GROUP_free(ptrGen->group);
+    FREE(ptrGen, "generate_chain:generator");
+    return status;
+}
+
+// Validates, registers outputs and archives, as for a block from a peer
+int8_t submit_generated_block(BlockPayload *ptrBlock, uint32_t height, void *context) {
+    int8_t status = process_incoming_block(ptrBlock, true);
+    if (status) {
+        return status;
+    }
+    BlockIndex *ptrIndex = GET_BLOCK_INDEX(ptrBlock->legality.hash);
+    return ptrIndex && ptrIndex->meta.fullBlockValidated ? 0 : -1;
+}
+
+// Indexes and archives without validation, leaving that to a later --revalidate run
+int8_t archive_generated_block(BlockPayload *ptrBlock, uint32_t height, void *context) {
+    return process_incoming_block(ptrBlock, false);
+}
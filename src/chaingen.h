@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "messages/block.h"
+
+// Synthetic chains for benchmarks: valid blocks extending the header tip, spending their
+// own coinbases through deterministic keys, reproducible from a seed and needing no peers.
+
+#define CHAINGEN_MAX_COINS (1 << 16)
+#define CHAINGEN_MAX_KEYS 256
+#define CHAINGEN_MAX_OUTPUTS_PER_TX 256
+#define CHAINGEN_FEE 1000
+
+enum TxShape {
+    TX_SHAPE_COINBASE_ONLY,
+    TX_SHAPE_FAN_OUT, // each tx spends one older coin into outputsPerTx outputs
+    TX_SHAPE_CHAIN,   // each tx spends the previous tx of the same block
+};
+
+// Handed each block once it is mined; the block is released after it returns
+typedef int8_t ChainGenSink(BlockPayload *ptrBlock, uint32_t height, void *context);
+
+struct ChainGenOptions {
+    uint32_t blockCount;
+    enum TxShape shape;
+    uint32_t txsPerBlock; // besides the coinbase
+    uint32_t outputsPerTx;
+    uint8_t multisigPercent; // share of outputs paying to 1-of-2 multisig rather than P2PKH
+    uint32_t keyCount;
+    uint32_t blockInterval; // seconds between block timestamps
+    uint64_t seed;
+    ChainGenSink *sink; // NULL to validate and archive in-process
+    void *sinkContext;
+};
+
+typedef struct ChainGenOptions ChainGenOptions;
+
+struct ChainGenStats {
+    uint32_t blocks;
+    uint64_t txs;
+    uint64_t inputs;
+    uint64_t outputs;
+    double elapsed; // ms
+};
+
+typedef struct ChainGenStats ChainGenStats;
+
+int8_t generate_chain(ChainGenOptions *ptrOptions, ChainGenStats *ptrStats);
+int8_t submit_generated_block(BlockPayload *ptrBlock, uint32_t height, void *context);
+int8_t archive_generated_block(BlockPayload *ptrBlock, uint32_t height, void *context);
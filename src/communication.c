@@ -12,6 +12,9 @@
 #include "config.h"
 #include "peer.h"
 #include "persistent.h"
+#include "utxo.h"
+#include "utxostats.h"
+#include "verifier.h"
 
 #include "messages/common.h"
 #include "messages/shared.h"
@@ -26,6 +29,7 @@
 #include "messages/pingpong.h"
 #include "messages/headers.h"
 #include "messages/print.h"
+#include "messages/registry.h"
 
 #include "utils/networking.h"
 #include "utils/datetime.h"
@@ -33,10 +37,12 @@
 #include "utils/memory.h"
 #include "utils/data.h"
 #include "utils/integers.h"
+#include "utils/pool.h"
 
 void send_getheaders(uv_tcp_t *socket);
 void send_getdata_for_block(uv_tcp_t *socket, Byte *hash);
 int32_t setup_api_socket(void);
+void setup_message_handlers(void);
 void termination_check();
 
 bool disable_candidate(PeerCandidate *ptrCandidate) {
@@ -206,6 +212,17 @@ void print_node_status() {
     printf("Validated tip at height %u", global.mainValidatedTip.context.height);
     print_sha256_reverse(global.mainValidatedTip.meta.hash);
     printf("\n");
+    UtxoSetStats utxoStats;
+    get_utxo_set_stats(&utxoStats);
+    if (utxoStats.stale) {
+        printf("UTXO set: statistics stale until the next full flush\n");
+    }
+    else {
+        printf("UTXO set: %llu outputs, %llu satoshis, commitment ", utxoStats.outputs, utxoStats.amount);
+        print_sha256(utxoStats.commitment);
+        printf("\n");
+    }
+    print_message_codec_stats();
     printf("=====================\n");
 }
 
@@ -318,6 +335,7 @@ void stop_timers() {
 uint32_t setup_main_event_loop() {
     printf("Setting up main event loop...");
     uv_loop_init(uv_default_loop());
+    setup_message_handlers();
     setup_timers();
     setup_api_socket();
     printf("Done.\n");
@@ -353,49 +371,17 @@ char *get_ip_from_context(void *data) {
     return convert_ipv4_readable(((SocketContext *)data)->peer->address.ip);
 }
 
-int32_t parse_buffer_into_message(uint8_t *ptrBuffer, Message *ptrMessage) {
-    Header header = get_empty_header();
-    parse_message_header(ptrBuffer, &header);
-    char *command = (char *)header.command;
-    if (strcmp(command, CMD_VERSION) == 0) {
-        return parse_into_version_message(ptrBuffer, ptrMessage);
-    }
-    else if (strcmp(command, CMD_VERACK) == 0) {
-        return parse_into_verack_message(ptrBuffer, ptrMessage);
-    }
-    else if (strcmp(command, CMD_INV) == 0) {
-        return parse_into_inv_message(ptrBuffer, ptrMessage);
-    }
-    else if (strcmp(command, CMD_ADDR) == 0) {
-        return parse_into_addr_message(ptrBuffer, ptrMessage);
-    }
-    else if (strcmp(command, CMD_REJECT) == 0) {
-        return parse_into_reject_message(ptrBuffer, ptrMessage);
-    }
-    else if (strcmp(command, CMD_PING) == 0) {
-        return parse_into_pingpong_message(ptrBuffer, ptrMessage);
-    }
-    else if (strcmp(command, CMD_PONG) == 0) {
-        return parse_into_pingpong_message(ptrBuffer, ptrMessage);
-    }
-    else if (strcmp(command, CMD_HEADERS) == 0) {
-        return parse_into_headers_message(ptrBuffer, ptrMessage);
-    }
-    else if (strcmp(command, CMD_BLOCK) == 0) {
-        return parse_into_block_message(ptrBuffer, ptrMessage);
-    }
-    else if (strcmp(command, CMD_GETDATA) == 0) {
-        return parse_into_blockreq_message(ptrBuffer, ptrMessage);
-    }
-    else {
-        fprintf(stderr, "Cannot parse message with unknown command '%s'\n", command);
-        return 1;
+int32_t parse_buffer_into_message(MessageCodec *ptrCodec, uint8_t *ptrBuffer, Message *ptrMessage) {
+    if (!ptrCodec->parse) {
+        parse_message_header(ptrBuffer, &ptrMessage->header);
+        return 0;
     }
+    return ptrCodec->parse(ptrBuffer, ptrMessage);
 }
 
 void free_write_request(uv_write_t *writeRequest) {
     struct WriteContext *ptrContext = writeRequest->data;
-    FREE(ptrContext->buf.base, "send_message:buffer");
+    release_buffer((Byte *)ptrContext->buf.base);
     FREE(ptrContext, "write_buffer_to_socket:WriteContext");
     FREE(writeRequest, "write_buffer_to_socket:WriteRequest");
 }
@@ -409,29 +395,20 @@ void on_message_attempted(uv_write_t *writeRequest, int status) {
         goto cleanup;
     }
     else {
-        Message msg = get_empty_message();
-        int32_t error = parse_buffer_into_message((Byte *)ptrContext->buf.base, &msg);
-        if (error) {
-            #if LOG_MESSAGE_SENT
-            printf("unknown message sent to %s\n", msg.header.command);
-            #endif
-        }
-        else {
-            #if LOG_MESSAGE_SENT
-            printf("%s message sent to %s\n", msg.header.command, ipString);
-            #endif
-            if (strcmp((char *)msg.header.command, CMD_PING) == 0) {
-                double now = get_now();
-                ptrContext->peer->networking.ping.pingSent = now;
-            }
-            else if (strcmp((char *)msg.header.command, CMD_VERSION) == 0) {
-                double now = get_now();
-                ptrContext->peer->handshake.handshakeStart = now;
-            }
+        // Only the header is needed to tell what was sent; the payload is never re-parsed
+        Header header = get_empty_header();
+        parse_message_header((Byte *)ptrContext->buf.base, &header);
+        char *command = (char *)header.command;
+        #if LOG_MESSAGE_SENT
+        printf("%s message sent to %s\n", command, ipString);
+        #endif
+        if (strcmp(command, CMD_PING) == 0) {
+            double now = get_now();
+            ptrContext->peer->networking.ping.pingSent = now;
         }
-        if (msg.ptrPayload) {
-            free_message_payload(&msg);
-            msg.ptrPayload = NULL;
+        else if (strcmp(command, CMD_VERSION) == 0) {
+            double now = get_now();
+            ptrContext->peer->handshake.handshakeStart = now;
         }
     }
     cleanup:
@@ -456,89 +433,49 @@ void write_buffer_to_socket(
     }
 }
 
+void send_binary(uv_tcp_t *socket, struct VariableLengthString *ptrPayload) {
+    Byte *buffer = acquire_buffer(ptrPayload->length);
+    memcpy(buffer, ptrPayload->string, ptrPayload->length);
+    uv_buf_t uvBuffer = uv_buf_init((char *)buffer, (unsigned int)ptrPayload->length);
+    printf("Sending binary to peer %s\n", get_ip_from_context(socket->data));
+    print_object((Byte *)uvBuffer.base, uvBuffer.len);
+    write_buffer_to_socket(&uvBuffer, socket);
+}
+
 void send_message(uv_tcp_t *socket, char *command, void *ptrData) {
-    Message message = get_empty_message();
-    SocketContext *ptrContext = (SocketContext *)socket->data;
-    Byte *buffer = MALLOC(MESSAGE_BUFFER_LENGTH, "send_message:buffer");
-    uv_buf_t uvBuffer = uv_buf_init((char *)buffer, sizeof(buffer));
-    uvBuffer.base = (char *)buffer;
-
-    uint64_t dataSize = 0;
-
-    if (strcmp(command, CMD_VERSION) == 0) {
-        make_version_message(&message, ptrContext->peer);
-        dataSize = serialize_version_message(&message, buffer);
-    }
-    else if (strcmp(command, CMD_VERACK) == 0) {
-        make_verack_message(&message);
-        dataSize = serialize_verack_message(&message, buffer);
-    }
-    else if (strcmp(command, CMD_GETADDR) == 0) {
-        make_getaddr_message(&message);
-        dataSize = serialize_getaddr_message(&message, buffer);
-    }
-    else if (strcmp(command, CMD_GETDATA) == 0) {
-        GenericIVPayload *ptrPayload = ptrData;
-        make_iv_message(
-            &message,
-            ptrPayload,
-            (Byte *)CMD_GETDATA,
-            sizeof(CMD_GETDATA)
-        );
-        dataSize = serialize_iv_message(&message, buffer);
-    }
-    else if (strcmp(command, CMD_GETHEADERS) == 0) {
-        BlockRequestPayload *ptrPayload = ptrData;
-        make_blockreq_message(&message, ptrPayload, CMD_GETHEADERS, sizeof(CMD_GETHEADERS));
-        dataSize = serialize_blockreq_message(&message, buffer);
-    }
-    else if (strcmp(command, CMD_GETBLOCKS) == 0) {
-        BlockRequestPayload *ptrPayload = ptrData;
-        make_blockreq_message(&message, ptrPayload, CMD_GETBLOCKS, sizeof(CMD_GETBLOCKS));
-        dataSize = serialize_blockreq_message(&message, buffer);
-    }
-    else if (strcmp(command, CMD_SENDHEADERS) == 0) {
-        make_sendheaders_message(&message);
-        dataSize = serialize_sendheaders_message(&message, buffer);
-    }
-    else if (strcmp(command, CMD_PING) == 0) {
-        PingpongPayload *ptrPayload = ptrData;
-        make_ping_message(&message, ptrPayload);
-        dataSize = serialize_pingpong_message(&message, buffer);
-    }
-    else if (strcmp(command, CMD_PONG) == 0) {
-        PingpongPayload *ptrPayload = ptrData;
-        make_pong_message(&message, ptrPayload);
-        dataSize = serialize_pingpong_message(&message, buffer);
-    }
-    else if (strcmp(command, XCMD_BINARY) == 0) {
-        struct VariableLengthString *ptrPayload = ptrData;
-        dataSize = ptrPayload->length;
-        memcpy(buffer, ptrPayload->string, dataSize);
+    if (strcmp(command, XCMD_BINARY) == 0) {
+        send_binary(socket, ptrData);
+        return;
     }
-    else {
+    MessageCodec *ptrCodec = get_message_codec_by_name(command);
+    if (!ptrCodec) {
         fprintf(stderr, "send_message: Cannot recognize command %s", command);
-        goto release_resources;
+        return;
     }
-    uvBuffer.len = dataSize;
+    SocketContext *ptrContext = (SocketContext *)socket->data;
 
-    char *ipString = get_ip_from_context(socket->data);
-    if (strcmp(command, XCMD_BINARY) == 0) {
-        printf("Sending binary to peer %s\n", ipString);
-        print_object((Byte *)uvBuffer.base, uvBuffer.len);
-    }
-    else {
-        #if LOG_MESSAGE_SENDING
-        printf(
-            "Sending message %s to peer %s\n",
-            message.header.command,
-            ipString
-        );
-        #endif
-    }
+    uint64_t payloadWidthBound = 0;
+    if (ptrCodec->calc_payload_width) {
+        payloadWidthBound = ptrCodec->calc_payload_width(ptrData);
+    }
+    Byte *buffer = prepare_message_buffer(payloadWidthBound);
+    uint64_t payloadWidth = 0;
+    if (ptrCodec->serialize_payload) {
+        payloadWidth = ptrCodec->serialize_payload(ptrContext->peer, ptrData, buffer + sizeof(Header));
+    }
+    uint64_t dataSize = seal_message_buffer(buffer, command, payloadWidth);
+    ptrCodec->stats.outgoingMessages += 1;
+    ptrCodec->stats.outgoingBytes += dataSize;
+    uv_buf_t uvBuffer = uv_buf_init((char *)buffer, (unsigned int)dataSize);
+
+    #if LOG_MESSAGE_SENDING
+    printf(
+        "Sending message %s to peer %s\n",
+        command,
+        get_ip_from_context(ptrContext)
+    );
+    #endif
     write_buffer_to_socket(&uvBuffer, socket);
-    release_resources:
-    free_message_payload(&message);
 }
 
 void on_handshake_success(Peer *ptrPeer) {
@@ -557,92 +494,129 @@ void on_handshake_success(Peer *ptrPeer) {
     ping_peer(ptrPeer);
 }
 
-bool should_skip_print(char *command) {
-    return strstr(config.silentIncomingMessageCommands, command) != NULL;
+void handle_version(Peer *ptrPeer, Message *ptrMessage) {
+    VersionPayload *ptrPayloadTyped = ptrMessage->ptrPayload;
+    if (ptrPayloadTyped->version >= params->minimalPeerVersion) {
+        ptrPeer->handshake.acceptThem = true;
+    }
+    ptrPeer->chain_height = ptrPayloadTyped->start_height;
+    ptrPeer->candidacy->addr.net_addr.services = ptrPayloadTyped->services;
+    if (peer_hand_shaken(ptrPeer)) {
+        on_handshake_success(ptrPeer);
+    }
 }
 
-void handle_incoming_message(Peer *ptrPeer, Message message) {
-    if (!should_skip_print((char *)message.header.command)) {
-        print_message(&message);
+void handle_verack(Peer *ptrPeer, Message *ptrMessage) {
+    ptrPeer->handshake.acceptUs = true;
+    send_message(&ptrPeer->socket, CMD_VERACK, NULL);
+    if (peer_hand_shaken(ptrPeer)) {
+        on_handshake_success(ptrPeer);
     }
-    double now = get_now();
-    uint32_t timestamp = (uint32_t) round(now / SECOND_TO_MILLISECOND(1));
-    ptrPeer->candidacy->addr.timestamp = timestamp;
-
-    char *command = (char *)message.header.command;
+}
 
-    if (strcmp(command, CMD_VERSION) == 0) {
-        VersionPayload *ptrPayloadTyped = message.ptrPayload;
-        if (ptrPayloadTyped->version >= mainnet.minimalPeerVersion) {
-            ptrPeer->handshake.acceptThem = true;
+void handle_addr(Peer *ptrPeer, Message *ptrMessage) {
+    AddrPayload *ptrPayload = ptrMessage->ptrPayload;
+    uint64_t skipped = 0;
+    for (uint64_t i = 0; i < ptrPayload->count; i++) {
+        struct AddrRecord *record = &ptrPayload->addr_list[i];
+        if (is_ipv4(record->net_addr.ip)) {
+            uint32_t timestampForRecord = record->timestamp - HOUR_TO_SECOND(2);
+            add_address_as_candidate(record->net_addr, timestampForRecord);
         }
-        ptrPeer->chain_height = ptrPayloadTyped->start_height;
-        ptrPeer->candidacy->addr.net_addr.services = ptrPayloadTyped->services;
-        if (peer_hand_shaken(ptrPeer)) {
-            on_handshake_success(ptrPeer);
+        else {
+            skipped++;
         }
     }
-    else if (strcmp(command, CMD_VERACK) == 0) {
-        ptrPeer->handshake.acceptUs = true;
-        send_message(&ptrPeer->socket, CMD_VERACK, NULL);
-        if (peer_hand_shaken(ptrPeer)) {
-            on_handshake_success(ptrPeer);
+}
+
+void handle_ping(Peer *ptrPeer, Message *ptrMessage) {
+    send_message(&ptrPeer->socket, CMD_PONG, ptrMessage->ptrPayload);
+}
+
+void handle_pong(Peer *ptrPeer, Message *ptrMessage) {
+    PingpongPayload *ptrPayload = ptrMessage->ptrPayload;
+    if (ptrPayload->nonce == ptrPeer->networking.ping.nonce) {
+        double now = get_now();
+        ptrPeer->networking.ping.pongReceived = now;
+        double ping = ptrPeer->networking.ping.pingSent;
+        double latency = now - ping;
+        record_latency(ptrPeer, latency);
+        bool latencyFullyTested = is_latency_fully_tested(ptrPeer);
+        if (latencyFullyTested) {
+            double averageLatency = average_peer_latency(ptrPeer);
+            ptrPeer->candidacy->averageLatency = averageLatency;
         }
     }
-    else if (strcmp(command, CMD_ADDR) == 0) {
-        AddrPayload *ptrPayload = message.ptrPayload;
-        uint64_t skipped = 0;
-        for (uint64_t i = 0; i < ptrPayload->count; i++) {
-            struct AddrRecord *record = &ptrPayload->addr_list[i];
-            if (is_ipv4(record->net_addr.ip)) {
-                uint32_t timestampForRecord = record->timestamp - HOUR_TO_SECOND(2);
-                add_address_as_candidate(record->net_addr, timestampForRecord);
-            }
-            else {
-                skipped++;
-            }
-        }
+    else {
+        printf(
+            "Unexpected pong nonce: received %llu, expecting %llu\n",
+            ptrPayload->nonce, ptrPeer->networking.ping.nonce
+        );
     }
-    else if (strcmp(command, CMD_PING) == 0) {
-        send_message(&ptrPeer->socket, CMD_PONG, message.ptrPayload);
-    }
-    else if (strcmp(command, CMD_PONG) == 0) {
-        PingpongPayload *ptrPayload = message.ptrPayload;
-        if (ptrPayload->nonce == ptrPeer->networking.ping.nonce) {
-            ptrPeer->networking.ping.pongReceived = now;
-            double ping = ptrPeer->networking.ping.pingSent;
-            double latency = now - ping;
-            record_latency(ptrPeer, latency);
-            bool latencyFullyTested = is_latency_fully_tested(ptrPeer);
-            if (latencyFullyTested) {
-                double averageLatency = average_peer_latency(ptrPeer);
-                ptrPeer->candidacy->averageLatency = averageLatency;
-            }
-        }
-        else {
-            printf(
-                "Unexpected pong nonce: received %llu, expecting %llu\n",
-                ptrPayload->nonce, ptrPeer->networking.ping.nonce
-            );
+}
+
+void handle_headers(Peer *ptrPeer, Message *ptrMessage) {
+    HeadersPayload *ptrPayload = ptrMessage->ptrPayload;
+    for (uint64_t i = 0; i < ptrPayload->count; i++) {
+        BlockPayloadHeader *ptrHeader = &ptrPayload->headers[i].header;
+        int8_t status = process_incoming_block_header(ptrHeader);
+        if (status && status != HEADER_EXISTED) {
+            printf("new header status %i\n", status);
         }
     }
-    else if (strcmp(command, CMD_HEADERS) == 0) {
-        HeadersPayload *ptrPayload = message.ptrPayload;
-        for (uint64_t i = 0; i < ptrPayload->count; i++) {
-            BlockPayloadHeader *ptrHeader = &ptrPayload->headers[i].header;
-            int8_t status = process_incoming_block_header(ptrHeader);
-            if (status && status != HEADER_EXISTED) {
-                printf("new header status %i\n", status);
-            }
-        }
+}
+
+void handle_block(Peer *ptrPeer, Message *ptrMessage) {
+    BlockPayload *ptrBlock = ptrMessage->ptrPayload;
+    process_incoming_block(ptrBlock, global.mode == MODE_NORMAL);
+    memset(ptrPeer->networking.requesting, 0, SHA256_LENGTH);
+}
+
+struct MessageHandlerRow {
+    char *command;
+    MessageHandler *handler;
+};
+
+typedef struct MessageHandlerRow MessageHandlerRow;
+
+void setup_message_handlers() {
+    MessageHandlerRow handlerTable[] = {
+        { .command = CMD_VERSION, .handler = &handle_version },
+        { .command = CMD_VERACK, .handler = &handle_verack },
+        { .command = CMD_ADDR, .handler = &handle_addr },
+        { .command = CMD_PING, .handler = &handle_ping },
+        { .command = CMD_PONG, .handler = &handle_pong },
+        { .command = CMD_HEADERS, .handler = &handle_headers },
+        { .command = CMD_BLOCK, .handler = &handle_block },
+    };
+    uint32_t rowCount = sizeof(handlerTable) / sizeof(handlerTable[0]);
+    for (uint32_t i = 0; i < rowCount; i++) {
+        register_message_handler(handlerTable[i].command, handlerTable[i].handler);
+    }
+}
+
+void handle_incoming_message(MessageCodec *ptrCodec, Peer *ptrPeer, Byte *ptrBuffer) {
+    double now = get_now();
+    uint32_t timestamp = (uint32_t) round(now / SECOND_TO_MILLISECOND(1));
+    ptrPeer->candidacy->addr.timestamp = timestamp;
+
+    bool shouldPrint = !ptrCodec->silent;
+    if (!ptrCodec->handle && !shouldPrint) {
+        // Nobody would read the payload, so it is dropped without being decoded
+        return;
+    }
+    Message message = get_empty_message();
+    int32_t error = parse_buffer_into_message(ptrCodec, ptrBuffer, &message);
+    if (error) {
+        free_message_payload(&message);
+        return;
     }
-    else if (strcmp(command, CMD_BLOCK) == 0) {
-        BlockPayload *ptrBlock = message.ptrPayload;
-        process_incoming_block(ptrBlock, global.mode == MODE_NORMAL);
-        memset(ptrPeer->networking.requesting, 0, SHA256_LENGTH);
+    if (shouldPrint) {
+        print_message(&message);
     }
-    else if (strcmp(command, CMD_INV) == 0) {
-        // send_message(ptrPeer->connection, CMD_GETDATA, message.ptrPayload);
+    if (ptrCodec->handle) {
+        ptrCodec->handle(ptrPeer, &message);
+        ptrCodec->stats.handlerTime += get_now() - now;
     }
     free_message_payload(&message);
 }
@@ -655,58 +629,145 @@ bool checksum_match(Byte *ptrBuffer) {
     return memcmp(checksum, messageHeader.checksum, CHECKSUM_SIZE) == 0;
 }
 
-int64_t find_first_magic(Byte *data, uint64_t maxLength) {
-    Byte *p = data;
-    while ((p - data + sizeof(mainnet.magic)) < maxLength) {
-        if (starts_with_magic(p)) {
-            return (int64_t)(p - data);
+static void copy_from_cache(MessageCache *ptrCache, uint64_t offset, Byte *ptrDestination, uint64_t width) {
+    uint64_t capacity = ptrCache->capacity;
+    uint64_t start = (ptrCache->head + offset) % capacity;
+    uint64_t firstPart = width < capacity - start ? width : capacity - start;
+    memcpy(ptrDestination, ptrCache->buffer + start, firstPart);
+    memcpy(ptrDestination + firstPart, ptrCache->buffer, width - firstPart);
+}
+
+static void consume_cache(MessageCache *ptrCache, uint64_t width) {
+    ptrCache->head = (ptrCache->head + width) % ptrCache->capacity;
+    ptrCache->length -= width;
+    if (ptrCache->length == 0) {
+        // Rewind so the next read gets the longest contiguous span
+        ptrCache->head = 0;
+    }
+}
+
+// Moves the buffered bytes into a pooled buffer of at least newCapacity, unwrapped at offset 0
+static int8_t resize_cache(MessageCache *ptrCache, uint64_t newCapacity) {
+    Byte *newBuffer = acquire_buffer(newCapacity);
+    if (!newBuffer) {
+        fprintf(stderr, "resize_cache: cannot acquire %llu bytes\n", newCapacity);
+        return -1;
+    }
+    if (ptrCache->buffer) {
+        copy_from_cache(ptrCache, 0, newBuffer, ptrCache->length);
+        release_buffer(ptrCache->buffer);
+    }
+    ptrCache->buffer = newBuffer;
+    ptrCache->capacity = get_buffer_capacity(newBuffer);
+    ptrCache->head = 0;
+    return 0;
+}
+
+static void release_cache(MessageCache *ptrCache) {
+    release_buffer(ptrCache->buffer);
+    ptrCache->buffer = NULL;
+    ptrCache->capacity = 0;
+    ptrCache->head = 0;
+    ptrCache->length = 0;
+}
+
+// Returns a drained buffer to the pool, and trades an outgrown one for a small one
+// unless the message still being received needs the room
+static void shrink_cache(MessageCache *ptrCache, uint64_t pendingMessageSize) {
+    if (ptrCache->length == 0) {
+        release_cache(ptrCache);
+    }
+    else if (
+        ptrCache->capacity > MESSAGE_CACHE_INITIAL_CAPACITY
+        && ptrCache->length <= MESSAGE_CACHE_INITIAL_CAPACITY
+        && pendingMessageSize <= MESSAGE_CACHE_INITIAL_CAPACITY
+    ) {
+        resize_cache(ptrCache, MESSAGE_CACHE_INITIAL_CAPACITY);
+    }
+}
+
+// Drops bytes until the cache starts with magic; each byte is inspected once
+static bool sync_cache_to_magic(MessageCache *ptrCache) {
+    uint64_t trimmed = 0;
+    Byte magic[sizeof(params->magic)];
+    while (ptrCache->length >= sizeof(magic)) {
+        copy_from_cache(ptrCache, 0, magic, sizeof(magic));
+        if (starts_with_magic(magic)) {
+            break;
         }
-        p++;
+        consume_cache(ptrCache, 1);
+        trimmed++;
+    }
+    if (trimmed) {
+        printf("Trimmed preceding %llu non-magic bytes\n", trimmed);
     }
-    return -1;
+    return ptrCache->length >= sizeof(magic);
 }
 
 void extract_message_from_stream_buffer(MessageCache *ptrCache, Peer *ptrPeer) {
-    int64_t magicOffset = find_first_magic(ptrCache->buffer, ptrCache->bufferIndex);
-    while (magicOffset >= 0) {
-        if (magicOffset != 0) {
-            memcpy(ptrCache->buffer, ptrCache->buffer + magicOffset, ptrCache->bufferIndex - magicOffset);
-            ptrCache->bufferIndex -= magicOffset;
-            printf("Trimmed preceding %llu non-magic bytes", magicOffset);
-        }
+    uint64_t pendingMessageSize = 0;
+    while (sync_cache_to_magic(ptrCache) && ptrCache->length >= sizeof(Header)) {
+        Byte headerBuffer[sizeof(Header)];
+        copy_from_cache(ptrCache, 0, headerBuffer, sizeof(headerBuffer));
         Header header = get_empty_header();
-        parse_message_header(ptrCache->buffer, &header);
+        parse_message_header(headerBuffer, &header);
+        MessageCodec *ptrCodec = get_message_codec(header.command);
+        uint64_t maxPayloadLength = ptrCodec
+            ? ptrCodec->maxPayloadLength
+            : MAX_UNKNOWN_PAYLOAD_LENGTH;
+        if (header.length > maxPayloadLength) {
+            fprintf(
+                stderr,
+                "Oversized %.12s payload from peer %u (%u > %llu); discarding stream buffer\n",
+                (char *)header.command,
+                ptrPeer->slot,
+                header.length,
+                maxPayloadLength
+            );
+            consume_cache(ptrCache, ptrCache->length);
+            break;
+        }
         uint64_t messageSize = sizeof(Header) + header.length;
         #if LOG_MESSAGE_LOADING
         printf("Message loading from %s: (%llu/%llu)\n",
                    convert_ipv4_readable(ptrPeer->address.ip),
-                   ptrCache->bufferIndex,
+                   ptrCache->length,
                    messageSize
             );
         #endif
-        if (ptrCache->bufferIndex >= messageSize) {
-            Message message = get_empty_message();
-            if (!checksum_match(ptrCache->buffer)) {
-                printf("Payload checksum mismatch");
-                print_message_header(header);
-            }
-            else {
-                int32_t error = parse_buffer_into_message(ptrCache->buffer, &message);
-                if (error) {
-                    free_message_payload(&message);
-                }
-                else {
-                    handle_incoming_message(ptrPeer, message);
-                }
+        if (ptrCache->length < messageSize) {
+            pendingMessageSize = messageSize;
+            if (messageSize > ptrCache->capacity && resize_cache(ptrCache, messageSize)) {
+                consume_cache(ptrCache, ptrCache->length);
             }
-            memcpy(ptrCache->buffer, ptrCache->buffer + messageSize, ptrCache->bufferIndex - messageSize);
-            ptrCache->bufferIndex -= messageSize;
-            magicOffset = find_first_magic(ptrCache->buffer, ptrCache->bufferIndex);
+            break;
+        }
+
+        Byte *ptrMessageBuffer = ptrCache->buffer + ptrCache->head;
+        Byte *wrappedCopy = NULL;
+        if (ptrCache->head + messageSize > ptrCache->capacity) {
+            // Only messages straddling the end of the ring are copied out to be parsed
+            wrappedCopy = acquire_buffer(messageSize);
+            copy_from_cache(ptrCache, 0, wrappedCopy, messageSize);
+            ptrMessageBuffer = wrappedCopy;
+        }
+
+        if (!checksum_match(ptrMessageBuffer)) {
+            printf("Payload checksum mismatch");
+            print_message_header(header);
+        }
+        else if (!ptrCodec) {
+            fprintf(stderr, "Cannot parse message with unknown command '%.12s'\n", (char *)header.command);
         }
         else {
-            break;
+            ptrCodec->stats.incomingMessages += 1;
+            ptrCodec->stats.incomingBytes += messageSize;
+            handle_incoming_message(ptrCodec, ptrPeer, ptrMessageBuffer);
         }
+        release_buffer(wrappedCopy);
+        consume_cache(ptrCache, messageSize);
     }
+    shrink_cache(ptrCache, pendingMessageSize);
 }
 
 void on_incoming_segment(uv_stream_t *socket, ssize_t nread, const uv_buf_t *buf) {
@@ -718,17 +779,38 @@ void on_incoming_segment(uv_stream_t *socket, ssize_t nread, const uv_buf_t *buf
         else {
             // file ended; noop
         }
-        goto cleanup;
+        return;
     }
+    // The bytes were read straight into the tail of the stream cache by allocate_peer_read_buffer
     SocketContext *ptrContext = (SocketContext *)socket->data;
     ptrContext->peer->networking.lastHeard = get_now();
     MessageCache *ptrCache = &(ptrContext->streamCache);
-    memcpy(ptrCache->buffer + ptrCache->bufferIndex, buf->base, buf->len);
-    ptrCache->bufferIndex += nread;
+    ptrCache->length += nread;
     ptrContext->peer->networking.incomingBytes += nread;
     extract_message_from_stream_buffer(ptrCache, ptrContext->peer);
-    cleanup:
-    FREE(buf->base, "allocate_read_buffer:bufBase");
+}
+
+void allocate_peer_read_buffer(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {
+    MessageCache *ptrCache = &((SocketContext *)handle->data)->streamCache;
+    if (!ptrCache->buffer && resize_cache(ptrCache, MESSAGE_CACHE_INITIAL_CAPACITY)) {
+        buf->base = NULL;
+        buf->len = 0;
+        return;
+    }
+    uint64_t capacity = ptrCache->capacity;
+    uint64_t tail = (ptrCache->head + ptrCache->length) % capacity;
+    uint64_t freeSpan = 0;
+    if (ptrCache->length == capacity) {
+        freeSpan = 0;
+    }
+    else if (tail >= ptrCache->head) {
+        freeSpan = capacity - tail;
+    }
+    else {
+        freeSpan = ptrCache->head - tail;
+    }
+    buf->base = (char *)(ptrCache->buffer + tail);
+    buf->len = freeSpan;
 }
 
 void allocate_read_buffer(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {
@@ -774,7 +856,7 @@ void on_peer_connect(uv_connect_t* connectionRequest, int32_t error) {
     else {
         printf("connected with peer %s \n", ipString);
         send_message((uv_tcp_t *)connectionRequest->handle, CMD_VERSION, NULL);
-        int32_t readError = uv_read_start(connectionRequest->handle, allocate_read_buffer, on_incoming_segment);
+        int32_t readError = uv_read_start(connectionRequest->handle, allocate_peer_read_buffer, on_incoming_segment);
         if (readError) {
             fprintf(stderr, "uv_read failed %s(%i)", uv_strerror(readError), readError);
         }
@@ -785,6 +867,7 @@ void on_peer_connect(uv_connect_t* connectionRequest, int32_t error) {
 void release_socket_context(uv_handle_t *socket) {
     SocketContext *data = (SocketContext *)socket->data;
     if (data) {
+        release_cache(&data->streamCache);
         if (data->peer) {
             FREE(data->peer, "Peer");
             data->peer = NULL;
@@ -1045,6 +1128,8 @@ void terminate_execution() {
     }
     global.terminating = true;
     save_chain_data();
+    stop_script_verifier();
+    stop_utxo_writers();
     if (global.mode == MODE_NORMAL || global.mode == MODE_CATCHUP) {
         stop_timers();
         terminate_peers();
@@ -6,9 +6,15 @@
 #include "datatypes.h"
 #include "parameters.h"
 
+#define MESSAGE_CACHE_INITIAL_CAPACITY (16 * 1024)
+
+// Ring buffer that socket reads land in directly; messages are framed in place.
+// The buffer comes from the shared pool: it is sized to the message in flight and handed back once drained.
 struct MessageCache {
-    uint64_t bufferIndex;
-    Byte buffer[MESSAGE_BUFFER_LENGTH];
+    Byte *buffer;
+    uint64_t capacity;
+    uint64_t head;
+    uint64_t length;
 };
 
 typedef struct MessageCache MessageCache;
@@ -0,0 +1,254 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "openssl/ec.h"
+#include "openssl/obj_mac.h"
+
+#include "compressor.h"
+#include "script.h"
+
+#define HASH160_LENGTH 20
+#define COORDINATE_LENGTH 32
+#define COMPRESSED_PUBKEY_LENGTH (1 + COORDINATE_LENGTH)
+#define UNCOMPRESSED_PUBKEY_LENGTH (1 + 2 * COORDINATE_LENGTH)
+
+// Most significant group first, each continuation group offset by one so every number
+// has exactly one encoding
+uint8_t serialize_to_msb_varint(uint64_t number, Byte *ptrBuffer) {
+    Byte reversed[MAX_MSB_VARINT_WIDTH];
+    uint8_t width = 0;
+    while (true) {
+        reversed[width] = (Byte)((number & 0x7F) | (width ? 0x80 : 0x00));
+        if (number <= 0x7F) {
+            break;
+        }
+        number = (number >> 7) - 1;
+        width++;
+    }
+    for (uint8_t i = 0; i <= width; i++) {
+        ptrBuffer[i] = reversed[width - i];
+    }
+    return width + 1;
+}
+
+// Bytes consumed, or 0 when the buffer ends early or the number overflows
+uint8_t parse_msb_varint(Byte *ptrBuffer, uint64_t width, uint64_t *number) {
+    uint64_t n = 0;
+    for (uint8_t i = 0; i < width && i < MAX_MSB_VARINT_WIDTH; i++) {
+        if (n > (UINT64_MAX >> 7)) {
+            return 0;
+        }
+        Byte b = ptrBuffer[i];
+        n = (n << 7) | (b & 0x7F);
+        if (!(b & 0x80)) {
+            *number = n;
+            return i + 1;
+        }
+        if (n == UINT64_MAX) {
+            return 0;
+        }
+        n++;
+    }
+    return 0;
+}
+
+// Round amounts have small encodings: trailing decimal zeros go into the exponent e < 10,
+// and the last nonzero digit d is folded in as 1 + 10 * (9 * n + d - 1) + e
+uint64_t compress_amount(uint64_t amount) {
+    if (amount == 0) {
+        return 0;
+    }
+    uint8_t e = 0;
+    while (amount % 10 == 0 && e < 9) {
+        amount /= 10;
+        e++;
+    }
+    if (e < 9) {
+        uint64_t d = amount % 10;
+        amount /= 10;
+        return 1 + (amount * 9 + d - 1) * 10 + e;
+    }
+    return 1 + (amount - 1) * 10 + 9;
+}
+
+uint64_t decompress_amount(uint64_t compressed) {
+    if (compressed == 0) {
+        return 0;
+    }
+    compressed--;
+    uint8_t e = compressed % 10;
+    compressed /= 10;
+    uint64_t amount = 0;
+    if (e < 9) {
+        uint64_t d = compressed % 9 + 1;
+        compressed /= 9;
+        amount = compressed * 10 + d;
+    }
+    else {
+        amount = compressed + 1;
+    }
+    while (e) {
+        amount *= 10;
+        e--;
+    }
+    return amount;
+}
+
+// Converts between the two key forms; false unless the key lies on the curve
+static bool convert_pubkey(Byte *key, uint64_t keyLength, point_conversion_form_t form, Byte *output) {
+    EC_GROUP *group = EC_GROUP_new_by_curve_name(NID_secp256k1);
+    EC_POINT *point = EC_POINT_new(group);
+    bool converted =
+        EC_POINT_oct2point(group, point, key, keyLength, NULL) == 1
+        && EC_POINT_point2oct(
+            group,
+            point,
+            form,
+            output,
+            form == POINT_CONVERSION_COMPRESSED ? COMPRESSED_PUBKEY_LENGTH : UNCOMPRESSED_PUBKEY_LENGTH,
+            NULL
+        ) > 0;
+    EC_POINT_free(point);
+    EC_GROUP_free(group);
+    return converted;
+}
+
+static uint64_t compress_script(Byte *script, uint64_t length, Byte *ptrBuffer) {
+    bool isP2PKH =
+        length == 25
+        && script[0] == OP_DUP
+        && script[1] == OP_HASH160
+        && script[2] == HASH160_LENGTH
+        && script[23] == OP_EQUALVERIFY
+        && script[24] == OP_CHECKSIG;
+    if (isP2PKH) {
+        ptrBuffer[0] = SCRIPT_TEMPLATE_P2PKH;
+        memcpy(ptrBuffer + 1, script + 3, HASH160_LENGTH);
+        return 1 + HASH160_LENGTH;
+    }
+    bool isP2SH =
+        length == 23
+        && script[0] == OP_HASH160
+        && script[1] == HASH160_LENGTH
+        && script[22] == OP_EQUAL;
+    if (isP2SH) {
+        ptrBuffer[0] = SCRIPT_TEMPLATE_P2SH;
+        memcpy(ptrBuffer + 1, script + 2, HASH160_LENGTH);
+        return 1 + HASH160_LENGTH;
+    }
+    bool isCompressedP2PK =
+        length == COMPRESSED_PUBKEY_LENGTH + 2
+        && script[0] == COMPRESSED_PUBKEY_LENGTH
+        && (script[1] == 0x02 || script[1] == 0x03)
+        && script[length - 1] == OP_CHECKSIG;
+    if (isCompressedP2PK) {
+        memcpy(ptrBuffer, script + 1, COMPRESSED_PUBKEY_LENGTH);
+        return COMPRESSED_PUBKEY_LENGTH;
+    }
+    bool isUncompressedP2PK =
+        length == UNCOMPRESSED_PUBKEY_LENGTH + 2
+        && script[0] == UNCOMPRESSED_PUBKEY_LENGTH
+        && script[1] == 0x04
+        && script[length - 1] == OP_CHECKSIG;
+    // Off-curve keys could not be rebuilt from x, so they are kept verbatim
+    Byte compressedKey[COMPRESSED_PUBKEY_LENGTH];
+    if (isUncompressedP2PK && convert_pubkey(script + 1, UNCOMPRESSED_PUBKEY_LENGTH, POINT_CONVERSION_COMPRESSED, compressedKey)) {
+        ptrBuffer[0] = (Byte)(compressedKey[0] + (SCRIPT_TEMPLATE_P2PK_FULL_EVEN - SCRIPT_TEMPLATE_P2PK_EVEN));
+        memcpy(ptrBuffer + 1, compressedKey + 1, COORDINATE_LENGTH);
+        return COMPRESSED_PUBKEY_LENGTH;
+    }
+    uint8_t prefixWidth = serialize_to_msb_varint(length + SCRIPT_TEMPLATE_COUNT, ptrBuffer);
+    memcpy(ptrBuffer + prefixWidth, script, length);
+    return prefixWidth + length;
+}
+
+uint64_t compress_tx_out(TxOut *ptrTxOut, Byte *ptrBuffer) {
+    Byte *p = ptrBuffer;
+    p += serialize_to_msb_varint(compress_amount((uint64_t)ptrTxOut->value), p);
+    p += compress_script(ptrTxOut->public_key_script, ptrTxOut->public_key_script_length, p);
+    return p - ptrBuffer;
+}
+
+static int8_t decompress_script(Byte *ptrBuffer, uint64_t width, TxOut *ptrTxOut) {
+    uint64_t tag = 0;
+    uint8_t tagWidth = parse_msb_varint(ptrBuffer, width, &tag);
+    if (!tagWidth) {
+        return -1;
+    }
+    Byte *script = ptrTxOut->public_key_script;
+    Byte *data = ptrBuffer + tagWidth;
+    uint64_t dataWidth = width - tagWidth;
+    switch (tag) {
+        case SCRIPT_TEMPLATE_P2PKH: {
+            if (dataWidth != HASH160_LENGTH) {
+                return -2;
+            }
+            script[0] = OP_DUP;
+            script[1] = OP_HASH160;
+            script[2] = HASH160_LENGTH;
+            memcpy(script + 3, data, HASH160_LENGTH);
+            script[23] = OP_EQUALVERIFY;
+            script[24] = OP_CHECKSIG;
+            ptrTxOut->public_key_script_length = 25;
+            return 0;
+        }
+        case SCRIPT_TEMPLATE_P2SH: {
+            if (dataWidth != HASH160_LENGTH) {
+                return -2;
+            }
+            script[0] = OP_HASH160;
+            script[1] = HASH160_LENGTH;
+            memcpy(script + 2, data, HASH160_LENGTH);
+            script[22] = OP_EQUAL;
+            ptrTxOut->public_key_script_length = 23;
+            return 0;
+        }
+        case SCRIPT_TEMPLATE_P2PK_EVEN:
+        case SCRIPT_TEMPLATE_P2PK_ODD: {
+            if (dataWidth != COORDINATE_LENGTH) {
+                return -2;
+            }
+            script[0] = COMPRESSED_PUBKEY_LENGTH;
+            script[1] = (Byte)tag;
+            memcpy(script + 2, data, COORDINATE_LENGTH);
+            script[COMPRESSED_PUBKEY_LENGTH + 1] = OP_CHECKSIG;
+            ptrTxOut->public_key_script_length = COMPRESSED_PUBKEY_LENGTH + 2;
+            return 0;
+        }
+        case SCRIPT_TEMPLATE_P2PK_FULL_EVEN:
+        case SCRIPT_TEMPLATE_P2PK_FULL_ODD: {
+            if (dataWidth != COORDINATE_LENGTH) {
+                return -2;
+            }
+            Byte compressedKey[COMPRESSED_PUBKEY_LENGTH];
+            compressedKey[0] = (Byte)(tag - (SCRIPT_TEMPLATE_P2PK_FULL_EVEN - SCRIPT_TEMPLATE_P2PK_EVEN));
+            memcpy(compressedKey + 1, data, COORDINATE_LENGTH);
+            script[0] = UNCOMPRESSED_PUBKEY_LENGTH;
+            if (!convert_pubkey(compressedKey, COMPRESSED_PUBKEY_LENGTH, POINT_CONVERSION_UNCOMPRESSED, script + 1)) {
+                return -3;
+            }
+            script[UNCOMPRESSED_PUBKEY_LENGTH + 1] = OP_CHECKSIG;
+            ptrTxOut->public_key_script_length = UNCOMPRESSED_PUBKEY_LENGTH + 2;
+            return 0;
+        }
+        default: {
+            uint64_t length = tag - SCRIPT_TEMPLATE_COUNT;
+            if (length != dataWidth || length > MAX_PK_SCRIPT_LENGTH) {
+                return -2;
+            }
+            memcpy(script, data, length);
+            ptrTxOut->public_key_script_length = length;
+            return 0;
+        }
+    }
+}
+
+int8_t decompress_tx_out(Byte *ptrBuffer, uint64_t width, TxOut *ptrTxOut) {
+    uint64_t compressedAmount = 0;
+    uint8_t amountWidth = parse_msb_varint(ptrBuffer, width, &compressedAmount);
+    if (!amountWidth) {
+        return -1;
+    }
+    ptrTxOut->value = (int64_t)decompress_amount(compressedAmount);
+    return decompress_script(ptrBuffer + amountWidth, width - amountWidth, ptrTxOut);
+}
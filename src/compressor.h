@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include "datatypes.h"
+#include "messages/tx.h"
+
+// Storage encoding of unspent outputs, after Bitcoin Core's compressor. Amounts become a
+// base-128 varint of their decimal mantissa and exponent; P2PKH, P2SH and P2PK scripts
+// shrink to a one-byte template tag followed by the hash or key they carry.
+
+#define SCRIPT_TEMPLATE_P2PKH 0x00
+#define SCRIPT_TEMPLATE_P2SH 0x01
+#define SCRIPT_TEMPLATE_P2PK_EVEN 0x02 // compressed key; the tag doubles as its prefix
+#define SCRIPT_TEMPLATE_P2PK_ODD 0x03
+#define SCRIPT_TEMPLATE_P2PK_FULL_EVEN 0x04 // uncompressed key stored by x alone
+#define SCRIPT_TEMPLATE_P2PK_FULL_ODD 0x05
+#define SCRIPT_TEMPLATE_COUNT 6 // other scripts are prefixed with their length plus this
+
+#define MAX_MSB_VARINT_WIDTH 10
+#define MAX_COMPRESSED_TX_OUT_WIDTH (2 * MAX_MSB_VARINT_WIDTH + MAX_PK_SCRIPT_LENGTH)
+
+uint8_t serialize_to_msb_varint(uint64_t number, Byte *ptrBuffer);
+uint8_t parse_msb_varint(Byte *ptrBuffer, uint64_t width, uint64_t *number);
+uint64_t compress_amount(uint64_t amount);
+uint64_t decompress_amount(uint64_t compressed);
+uint64_t compress_tx_out(TxOut *ptrTxOut, Byte *ptrBuffer);
+int8_t decompress_tx_out(Byte *ptrBuffer, uint64_t width, TxOut *ptrTxOut);
@@ -1,6 +1,7 @@
 #include "config.h"
 #include "units.h"
 #include "parameters.h"
+#include "storage.h"
 
 struct Config config = {
     .periods = {
@@ -13,6 +14,7 @@ struct Config config = {
         .ping = SECOND_TO_MILLISECOND(59),
         .validateNewBlocks = 0,
         .terminationCheck = SECOND_TO_MILLISECOND(1),
+        .flushUtxoCache = MINUTE_TO_MILLISECOND(10),
     },
     .tolerances = {
         .handshake = SECOND_TO_MILLISECOND(10),
@@ -20,6 +22,15 @@ struct Config config = {
         .peerLife = MINUTE_TO_MILLISECOND(30),
         .blockValidation = 200,
     },
+    .databases = {
+        .utxoEngine = STORAGE_ENGINE_LEVELDB,
+        .cacheSize = 64 * 1024 * 1024,
+        .bloomBitsPerKey = 10,
+        .writeBufferSize = 32 * 1024 * 1024,
+        .maxOpenFiles = 1000,
+        .mmapInitialSlots = 1 << 20,
+        .mmapInlineValueWidth = 52,
+    },
     .protocolVersion = 70015,
     .services = SERVICE_NODE_NETWORK,
     .maxIncoming = 125,
@@ -35,4 +46,12 @@ struct Config config = {
     .apiPort = 9494,
     .silentIncomingMessageCommands = "inv,pong,ping,addr,version,verack",
     .verifyBlocks = false,
+    .miningThreads = 0, // one per CPU
+    .utxoCacheBudget = 256 * 1024 * 1024,
+    .utxoShards = 8,
+    .prefetchThreads = 4,
+    .pipelineDepth = 8,
+    .assumeValidBlock = "00000000000000004d9b4ef50f0f9d686fd69db2e03af35a100370c64632a983", // mainnet checkpoint 295000
+    .scriptThreads = 0, // one per CPU
+    .signatureCacheBudget = 32 * 1024 * 1024,
 };
@@ -35,6 +35,7 @@ struct Periods {
     uint64_t ping;
     uint64_t validateNewBlocks;
     uint64_t terminationCheck;
+    uint64_t flushUtxoCache;
 };
 
 struct Tolerances {
@@ -44,9 +45,21 @@ struct Tolerances {
     uint64_t blockValidation;
 };
 
+// Chain-state storage; see storage.h. The transaction location database always uses LevelDB
+struct Databases {
+    char *utxoEngine; // STORAGE_ENGINE_LEVELDB or STORAGE_ENGINE_MMAP
+    uint64_t cacheSize; // LevelDB block cache, bytes
+    uint32_t bloomBitsPerKey; // LevelDB filter policy
+    uint64_t writeBufferSize; // LevelDB memtable, bytes
+    uint32_t maxOpenFiles;
+    uint64_t mmapInitialSlots; // mmap hash table slots at creation
+    uint32_t mmapInlineValueWidth; // bytes; covers the compressed form of common scripts
+};
+
 struct Config {
     struct Periods periods;
     struct Tolerances tolerances;
+    struct Databases databases;
     int32_t protocolVersion;
     uint8_t userAgent[128];
     ServiceBits services;
@@ -62,6 +75,14 @@ struct Config {
     uint16_t apiPort;
     char *silentIncomingMessageCommands;
     bool verifyBlocks;
+    uint32_t miningThreads;
+    uint64_t utxoCacheBudget; // bytes
+    uint32_t utxoShards; // UTXO cache partitions, each applied by its own thread; 1 for none
+    uint32_t prefetchThreads; // UTXO lookups ahead of validate_blocks; 0 to disable
+    uint32_t pipelineDepth; // blocks read, parsed and resolved ahead of validate_blocks; 0 to disable
+    char *assumeValidBlock; // big-endian hex; its ancestors on the best header chain skip script checks; "0" for none. Decoded once, so change it by pointing it at another string
+    uint32_t scriptThreads; // input script verification; 0 for one per CPU, 1 to verify on the validating thread
+    uint64_t signatureCacheBudget; // bytes of verified signatures kept; under one bucket (256 bytes) disables it
 };
 
 extern struct Config config;
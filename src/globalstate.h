@@ -7,6 +7,7 @@
 #include "hashmap.h"
 #include "messages/block.h"
 #include "blockchain.h"
+#include "storage.h"
 
 #define MAX_PEERS 256
 #define MAX_PEER_CANDIDATES 32768
@@ -27,6 +28,9 @@ enum ExecutionMode {
     MODE_RESET_UTXO,
     MODE_VALIDATE_ONE,
     MODE_TEST,
+    MODE_GENERATE,
+    MODE_DUMP_UTXO,
+    MODE_LOAD_UTXO,
 };
 
 struct GlobalState {
@@ -39,8 +43,8 @@ struct GlobalState {
     void *timerTable;
 
     uv_tcp_t apiSocket;
-    void *txLocationDB;
-    void *utxoDB;
+    Storage *txLocationDB;
+    Storage *utxoDB;
 
     PeerCandidate peerCandidates[MAX_PEER_CANDIDATES];
     uint32_t peerCandidateCount;
@@ -6,18 +6,16 @@
 #include "openssl/ripemd.h"
 #include "datatypes.h"
 #include "hash.h"
+#include "sha256.h"
 
 void sha256(void *data, uint32_t length, SHA256_HASH result) {
-    SHA256_CTX context;
-    SHA256_Init(&context);
-    SHA256_Update(&context, data, length);
-    SHA256_Final(result, &context);
+    sha256_stream(data, length, result);
 }
 
 void dsha256(void *data, uint32_t length, SHA256_HASH result) {
     SHA256_HASH firstRoundResult = {0};
-    sha256(data, length, firstRoundResult);
-    sha256(firstRoundResult, SHA256_LENGTH, result);
+    sha256_stream(data, length, firstRoundResult);
+    sha256_stream(firstRoundResult, SHA256_LENGTH, result);
 }
 
 static void print_hex_of_width(Byte *data, uint64_t length) {
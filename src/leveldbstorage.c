@@ -0,0 +1,198 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "leveldb/c.h"
+
+#include "storage.h"
+#include "utils/memory.h"
+
+// Options are made once per database instead of around every call
+struct LevelDBStore {
+    leveldb_t *db;
+    leveldb_options_t *options;
+    leveldb_cache_t *cache;
+    leveldb_filterpolicy_t *filterPolicy;
+    leveldb_readoptions_t *readOptions;
+    leveldb_writeoptions_t *writeOptions;
+    leveldb_writeoptions_t *syncWriteOptions;
+};
+
+static void release_store(struct LevelDBStore *store) {
+    if (store->db) {
+        leveldb_close(store->db);
+    }
+    // The options refer to the cache and the filter policy, so they go first
+    if (store->options) {
+        leveldb_options_destroy(store->options);
+    }
+    if (store->cache) {
+        leveldb_cache_destroy(store->cache);
+    }
+    if (store->filterPolicy) {
+        leveldb_filterpolicy_destroy(store->filterPolicy);
+    }
+    if (store->readOptions) {
+        leveldb_readoptions_destroy(store->readOptions);
+    }
+    if (store->writeOptions) {
+        leveldb_writeoptions_destroy(store->writeOptions);
+    }
+    if (store->syncWriteOptions) {
+        leveldb_writeoptions_destroy(store->syncWriteOptions);
+    }
+    FREE(store, "leveldb_store");
+}
+
+static void *open_leveldb(char *path, StorageOptions *options) {
+    struct LevelDBStore *store = CALLOC(1, sizeof(*store), "leveldb_store");
+    store->options = leveldb_options_create();
+    leveldb_options_set_create_if_missing(store->options, 1);
+    if (options->cacheSize > 0) {
+        store->cache = leveldb_cache_create_lru(options->cacheSize);
+        leveldb_options_set_cache(store->options, store->cache);
+    }
+    if (options->bloomBitsPerKey > 0) {
+        store->filterPolicy = leveldb_filterpolicy_create_bloom((int)options->bloomBitsPerKey);
+        leveldb_options_set_filter_policy(store->options, store->filterPolicy);
+    }
+    if (options->writeBufferSize > 0) {
+        leveldb_options_set_write_buffer_size(store->options, options->writeBufferSize);
+    }
+    if (options->maxOpenFiles > 0) {
+        leveldb_options_set_max_open_files(store->options, (int)options->maxOpenFiles);
+    }
+    store->readOptions = leveldb_readoptions_create();
+    store->writeOptions = leveldb_writeoptions_create();
+    store->syncWriteOptions = leveldb_writeoptions_create();
+    leveldb_writeoptions_set_sync(store->syncWriteOptions, 1);
+
+    char *error = NULL;
+    store->db = leveldb_open(store->options, path, &error);
+    if (error != NULL) {
+        fprintf(stderr, "Open LevelDB fail: %s\n", error);
+        leveldb_free(error);
+        store->db = NULL;
+        release_store(store);
+        return NULL;
+    }
+    return store;
+}
+
+static void close_leveldb(void *handle) {
+    release_store(handle);
+}
+
+static int8_t destroy_leveldb(char *path) {
+    leveldb_options_t *options = leveldb_options_create();
+    char *error = NULL;
+    leveldb_destroy_db(options, path, &error);
+    leveldb_options_destroy(options);
+    if (error != NULL) {
+        fprintf(stderr, "Database destruction: fail: %s\n", error);
+        leveldb_free(error);
+        return -1;
+    }
+    return 0;
+}
+
+static int8_t get_from_leveldb(void *handle, Byte *key, size_t keyWidth, Byte *value, size_t capacity, size_t *width) {
+    struct LevelDBStore *store = handle;
+    size_t readWidth = 0;
+    char *error = NULL;
+    char *read = leveldb_get(store->db, store->readOptions, (char*)key, keyWidth, &readWidth, &error);
+    if (error != NULL) {
+        leveldb_free(error);
+        if (read) {
+            leveldb_free(read);
+        }
+        return -2;
+    }
+    if (read == NULL) {
+        return -1;
+    }
+    if (readWidth > capacity) {
+        leveldb_free(read);
+        return -3;
+    }
+    memcpy(value, read, readWidth);
+    leveldb_free(read);
+    *width = readWidth;
+    return 0;
+}
+
+static void *create_leveldb_batch(void *handle) {
+    return leveldb_writebatch_create();
+}
+
+static void stage_leveldb_put(void *batch, Byte *key, size_t keyWidth, Byte *value, size_t width) {
+    leveldb_writebatch_put(batch, (char*)key, keyWidth, (char*)value, width);
+}
+
+static void stage_leveldb_removal(void *batch, Byte *key, size_t keyWidth) {
+    leveldb_writebatch_delete(batch, (char*)key, keyWidth);
+}
+
+static int8_t commit_leveldb_batch(void *handle, void *batch, bool sync) {
+    struct LevelDBStore *store = handle;
+    char *error = NULL;
+    leveldb_write(store->db, sync ? store->syncWriteOptions : store->writeOptions, batch, &error);
+    if (error != NULL) {
+        fprintf(stderr, "LevelDB write fail: %s\n", error);
+        leveldb_free(error);
+        return -1;
+    }
+    leveldb_writebatch_clear(batch);
+    return 0;
+}
+
+static void destroy_leveldb_batch(void *batch) {
+    leveldb_writebatch_destroy(batch);
+}
+
+static void *create_leveldb_snapshot(void *handle) {
+    struct LevelDBStore *store = handle;
+    return (void*)leveldb_create_snapshot(store->db);
+}
+
+static void release_leveldb_snapshot(void *handle, void *snapshot) {
+    struct LevelDBStore *store = handle;
+    leveldb_release_snapshot(store->db, snapshot);
+}
+
+// Always in key order; a scan leaves the block cache to the lookups
+static int8_t iterate_leveldb(void *handle, void *snapshot, bool ordered, StorageVisitor visitor, void *context) {
+    struct LevelDBStore *store = handle;
+    leveldb_readoptions_t *readOptions = leveldb_readoptions_create();
+    leveldb_readoptions_set_fill_cache(readOptions, 0);
+    if (snapshot) {
+        leveldb_readoptions_set_snapshot(readOptions, snapshot);
+    }
+    leveldb_iterator_t *iterator = leveldb_create_iterator(store->db, readOptions);
+    int8_t status = 0;
+    for (leveldb_iter_seek_to_first(iterator); leveldb_iter_valid(iterator) && !status; leveldb_iter_next(iterator)) {
+        size_t keyWidth = 0;
+        Byte *key = (Byte*)leveldb_iter_key(iterator, &keyWidth);
+        size_t width = 0;
+        Byte *value = (Byte*)leveldb_iter_value(iterator, &width);
+        status = visitor(key, keyWidth, value, width, context);
+    }
+    leveldb_iter_destroy(iterator);
+    leveldb_readoptions_destroy(readOptions);
+    return status;
+}
+
+const StorageEngine levelDBEngine = {
+    .name = STORAGE_ENGINE_LEVELDB,
+    .open = &open_leveldb,
+    .close = &close_leveldb,
+    .destroy = &destroy_leveldb,
+    .get = &get_from_leveldb,
+    .create_batch = &create_leveldb_batch,
+    .stage_put = &stage_leveldb_put,
+    .stage_removal = &stage_leveldb_removal,
+    .commit_batch = &commit_leveldb_batch,
+    .destroy_batch = &destroy_leveldb_batch,
+    .create_snapshot = &create_leveldb_snapshot,
+    .release_snapshot = &release_leveldb_snapshot,
+    .iterate = &iterate_leveldb,
+};
@@ -4,7 +4,10 @@
 #include "persistent.h"
 #include "globalstate.h"
 #include "blockchain.h"
+#include "chaingen.h"
 #include "config.h"
+#include "sha256.h"
+#include "snapshot.h"
 #include "utils/networking.h"
 #include "utils/opt.h"
 
@@ -27,6 +30,7 @@ void setup_cleanup() {
 
 int8_t init() {
     printf("Initializing...\n");
+    printf("SHA-256 engine: %s\n", get_sha256_engine_name());
     global.start_time = time(NULL);
     srand((unsigned int)global.start_time);
     setup_cleanup();
@@ -43,6 +47,7 @@ int8_t init() {
     load_genesis();
     load_block_indices();
     scan_block_indices(false, false);
+    open_utxo_stats();
     if (global.mode == MODE_NORMAL && should_catchup()) {
         global.mode = MODE_CATCHUP;
         printf("Activated catchup mode\n");
@@ -51,6 +56,34 @@ int8_t init() {
     return 0;
 }
 
+int32_t generate_default_chain(uint32_t blockCount) {
+    if (params != &regtest) {
+        fprintf(stderr, "--generate needs --regtest\n");
+        return -1;
+    }
+    ChainGenOptions options = {
+        .blockCount = blockCount,
+        .shape = TX_SHAPE_FAN_OUT,
+        .txsPerBlock = 4,
+        .outputsPerTx = 2,
+        .multisigPercent = 20,
+        .blockInterval = 1,
+        .seed = 1,
+    };
+    ChainGenStats stats;
+    int8_t status = generate_chain(&options, &stats);
+    printf(
+        "Generated %u blocks, %llu txs, %llu inputs, %llu outputs in %.1fms (status %i)\n",
+        stats.blocks,
+        stats.txs,
+        stats.inputs,
+        stats.outputs,
+        stats.elapsed,
+        status
+    );
+    return status;
+}
+
 int32_t connect_to_peers() {
     // connect_to_local();
     connect_to_initial_peers();
@@ -83,6 +116,15 @@ int32_t main(int32_t argc, char **argv) {
             reset_utxo();
             return 0;
         }
+        case MODE_GENERATE: {
+            return generate_default_chain(*(uint32_t *)global.modeData);
+        }
+        case MODE_DUMP_UTXO: {
+            return dump_utxo_snapshot(global.modeData);
+        }
+        case MODE_LOAD_UTXO: {
+            return load_utxo_snapshot(global.modeData);
+        }
         default: {
             setup_main_event_loop();
             connect_to_peers();
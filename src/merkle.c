@@ -0,0 +1,139 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "merkle.h"
+#include "sha256.h"
+#include "utils/memory.h"
+
+// @see https://en.bitcoin.it/wiki/Protocol_documentation#Merkle_Trees
+
+static Byte *get_node(MerkleTree *ptrTree, uint32_t level, uint64_t index) {
+    return ptrTree->nodes + (ptrTree->levelOffsets[level] + index) * SHA256_LENGTH;
+}
+
+// Copies the last hash of an odd level into the slot after it
+static void pad_merkle_level(Byte *level, uint64_t count) {
+    if (count % 2) {
+        memcpy(level + count * SHA256_LENGTH, level + (count - 1) * SHA256_LENGTH, SHA256_LENGTH);
+    }
+}
+
+// `hashes` needs room for count + 1 hashes and is overwritten level by level:
+// pair i lands on slot i, which its inputs have already passed
+int32_t compute_merkle_root_in_place(Byte *hashes, uint64_t count, SHA256_HASH result) {
+    if (count == 0) {
+        return 1;
+    }
+    while (count > 1) {
+        pad_merkle_level(hashes, count);
+        count = (count + 1) / 2;
+        dsha256_batch(hashes, SHA256_LENGTH * 2, count, hashes);
+    }
+    memcpy(result, hashes, SHA256_LENGTH);
+    return 0;
+}
+
+int32_t build_merkle_tree(Byte *leaves, uint64_t leafCount, MerkleTree *ptrTree) {
+    memset(ptrTree, 0, sizeof(*ptrTree));
+    if (leafCount == 0) {
+        return 1;
+    }
+    uint64_t slotCount = 0;
+    uint64_t levelCount = leafCount;
+    uint32_t level = 0;
+    while (true) {
+        if (level > MERKLE_MAX_DEPTH) {
+            fprintf(stderr, "build_merkle_tree: %llu leaves exceed maximal depth\n", leafCount);
+            return -1;
+        }
+        ptrTree->levelOffsets[level] = slotCount;
+        ptrTree->levelCounts[level] = levelCount;
+        slotCount += levelCount + 1;
+        if (levelCount == 1) {
+            break;
+        }
+        levelCount = (levelCount + 1) / 2;
+        level++;
+    }
+    ptrTree->leafCount = leafCount;
+    ptrTree->depth = level;
+    ptrTree->nodes = MALLOC(slotCount * SHA256_LENGTH, "build_merkle_tree:nodes");
+    memcpy(ptrTree->nodes, leaves, leafCount * SHA256_LENGTH);
+    for (level = 0; level < ptrTree->depth; level++) {
+        Byte *children = get_node(ptrTree, level, 0);
+        pad_merkle_level(children, ptrTree->levelCounts[level]);
+        dsha256_batch(
+            children,
+            SHA256_LENGTH * 2,
+            ptrTree->levelCounts[level + 1],
+            get_node(ptrTree, level + 1, 0)
+        );
+    }
+    return 0;
+}
+
+void get_merkle_tree_root(MerkleTree *ptrTree, SHA256_HASH result) {
+    memcpy(result, get_node(ptrTree, ptrTree->depth, 0), SHA256_LENGTH);
+}
+
+// Writes `depth` sibling hashes, from the leaf upwards, and returns how many
+int32_t get_merkle_branch(MerkleTree *ptrTree, uint64_t index, Byte *branch) {
+    if (index >= ptrTree->leafCount) {
+        fprintf(stderr, "get_merkle_branch: index %llu out of %llu leaves\n", index, ptrTree->leafCount);
+        return -1;
+    }
+    for (uint32_t level = 0; level < ptrTree->depth; level++) {
+        memcpy(branch + level * SHA256_LENGTH, get_node(ptrTree, level, index ^ 1), SHA256_LENGTH);
+        index /= 2;
+    }
+    return (int32_t)ptrTree->depth;
+}
+
+void compute_merkle_root_from_branch(
+    SHA256_HASH leaf,
+    uint64_t index,
+    Byte *branch,
+    uint32_t branchLength,
+    SHA256_HASH result
+) {
+    Byte pair[SHA256_LENGTH * 2];
+    memcpy(result, leaf, SHA256_LENGTH);
+    for (uint32_t level = 0; level < branchLength; level++) {
+        Byte *sibling = branch + level * SHA256_LENGTH;
+        if (index % 2) {
+            memcpy(pair, sibling, SHA256_LENGTH);
+            memcpy(pair + SHA256_LENGTH, result, SHA256_LENGTH);
+        }
+        else {
+            memcpy(pair, result, SHA256_LENGTH);
+            memcpy(pair + SHA256_LENGTH, sibling, SHA256_LENGTH);
+        }
+        dsha256(pair, sizeof(pair), result);
+        index /= 2;
+    }
+}
+
+// Rehashes only the path from the leaf to the root
+int32_t update_merkle_leaf(MerkleTree *ptrTree, uint64_t index, SHA256_HASH leaf) {
+    if (index >= ptrTree->leafCount) {
+        fprintf(stderr, "update_merkle_leaf: index %llu out of %llu leaves\n", index, ptrTree->leafCount);
+        return -1;
+    }
+    memcpy(get_node(ptrTree, 0, index), leaf, SHA256_LENGTH);
+    for (uint32_t level = 0; level < ptrTree->depth; level++) {
+        pad_merkle_level(get_node(ptrTree, level, 0), ptrTree->levelCounts[level]);
+        uint64_t pairIndex = index & ~1ULL;
+        dsha256(get_node(ptrTree, level, pairIndex), SHA256_LENGTH * 2, get_node(ptrTree, level + 1, index / 2));
+        index /= 2;
+    }
+    return 0;
+}
+
+void release_merkle_tree(MerkleTree *ptrTree) {
+    if (ptrTree->nodes) {
+        FREE(ptrTree->nodes, "build_merkle_tree:nodes");
+        ptrTree->nodes = NULL;
+    }
+}
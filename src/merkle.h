@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include "datatypes.h"
+#include "hash.h"
+
+// Enough levels for 2^32 leaves
+#define MERKLE_MAX_DEPTH 32
+
+// Every level is stored contiguously, leaves first, each followed by one spare slot;
+// an odd level keeps a copy of its last hash there so that pairs can be hashed as a batch
+// and a node's sibling is always at index ^ 1.
+struct MerkleTree {
+    Byte *nodes;
+    uint64_t leafCount;
+    uint32_t depth;
+    uint64_t levelOffsets[MERKLE_MAX_DEPTH + 1];
+    uint64_t levelCounts[MERKLE_MAX_DEPTH + 1];
+};
+
+typedef struct MerkleTree MerkleTree;
+
+int32_t compute_merkle_root_in_place(Byte *hashes, uint64_t count, SHA256_HASH result);
+int32_t build_merkle_tree(Byte *leaves, uint64_t leafCount, MerkleTree *ptrTree);
+void get_merkle_tree_root(MerkleTree *ptrTree, SHA256_HASH result);
+int32_t get_merkle_branch(MerkleTree *ptrTree, uint64_t index, Byte *branch);
+void compute_merkle_root_from_branch(
+    SHA256_HASH leaf,
+    uint64_t index,
+    Byte *branch,
+    uint32_t branchLength,
+    SHA256_HASH result
+);
+int32_t update_merkle_leaf(MerkleTree *ptrTree, uint64_t index, SHA256_HASH leaf);
+void release_merkle_tree(MerkleTree *ptrTree);
@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <stddef.h>
 
 #include "messages/shared.h"
 #include "messages/addr.h"
@@ -8,11 +9,11 @@
 
 void parse_addr_payload(
     Byte *ptrBuffer,
+    uint64_t count,
     AddrPayload *ptrPayload
 ) {
     Byte *p = ptrBuffer;
-    p += parse_varint(ptrBuffer, &ptrPayload->count);
-
+    ptrPayload->count = count;
     for (uint64_t i = 0; i < ptrPayload->count; i++) {
         AddrRecord *record = &ptrPayload->addr_list[i];
         p += PARSE_INTO(p, &record->timestamp);
@@ -28,17 +29,23 @@ int32_t parse_into_addr_message(
     parse_message_header(ptrBuffer, &header);
     memcpy(ptrMessage, &header, sizeof(header));
 
-    AddrPayload payload;
-    memset(&payload, 0, sizeof(payload));
-    parse_addr_payload(ptrBuffer + sizeof(header), &payload);
-    ptrMessage->ptrPayload = MALLOC(sizeof(AddrPayload), "parse_message:payload");
-    memcpy(ptrMessage->ptrPayload, &payload, sizeof(payload));
+    Byte *p = ptrBuffer + sizeof(header);
+    uint64_t count = 0;
+    p += parse_count_varint(p, header.length, ADDR_RECORD_WIDTH, MAX_RECORDS_IN_ADDR, &count);
+    uint64_t payloadSize = offsetof(AddrPayload, addr_list) + count * sizeof(AddrRecord);
+    AddrPayload *ptrPayload = MALLOC(payloadSize, "parse_message:payload");
+    parse_addr_payload(p, count, ptrPayload);
+    ptrMessage->ptrPayload = ptrPayload;
     return 0;
 }
 
 void print_addr_message(Message *ptrMessage) {
     print_message_header(ptrMessage->header);
     AddrPayload *ptrPayload = (AddrPayload *)ptrMessage->ptrPayload;
+    if (ptrPayload->count == 0) {
+        printf("payload: count=0\n");
+        return;
+    }
     AddrRecord record = ptrPayload->addr_list[0];
     char *ipString = convert_ipv4_readable(record.net_addr.ip);
     printf("payload: count=%llu, first being %s\n",
@@ -5,6 +5,7 @@
 #include "messages/shared.h"
 
 #define MAX_RECORDS_IN_ADDR 4096
+#define ADDR_RECORD_WIDTH 30
 
 struct AddrPayload {
     uint64_t count;
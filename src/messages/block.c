@@ -6,6 +6,8 @@
 #include "utils/memory.h"
 #include "utils/datetime.h"
 #include "utils/data.h"
+#include "utils/pool.h"
+#include "utils/uint256.h"
 
 uint64_t parse_block_payload_header(Byte *ptrBuffer, BlockPayloadHeader *ptrHeader) {
     Byte *p = ptrBuffer;
@@ -32,6 +34,7 @@ uint64_t serialize_block_payload_header(BlockPayloadHeader *ptrHeader, Byte *ptr
 int32_t parse_into_block_payload(Byte *ptrBuffer, BlockPayload *ptrBlock) {
     Byte *p = ptrBuffer;
 
+    reset_block_legality(ptrBlock);
     p += PARSE_INTO(p, &ptrBlock->header);
     p += parse_varint(p, &ptrBlock->txCount);
 
@@ -65,21 +68,30 @@ uint64_t serialize_block_payload(BlockPayload *ptrPayload, Byte *ptrBuffer) {
     return p - ptrBuffer;
 }
 
+uint64_t calc_block_payload_width(BlockPayload *ptrPayload) {
+    uint64_t width = sizeof(BlockPayloadHeader) + calc_number_varint_width(ptrPayload->txCount);
+    for (uint64_t i = 0; i < ptrPayload->txCount; i++) {
+        width += calc_tx_payload_width(&ptrPayload->txs[i]);
+    }
+    return width;
+}
+
 int32_t make_block_message(Message *ptrMessage, BlockPayload *ptrPayload) {
-    ptrMessage->header.magic = mainnet.magic;
+    ptrMessage->header.magic = params->magic;
     memcpy(ptrMessage->header.command, CMD_BLOCK, sizeof(CMD_BLOCK));
 
     ptrMessage->ptrPayload = MALLOC(sizeof(BlockPayload), "make_message:payload");
     memcpy(ptrMessage->ptrPayload, ptrPayload, sizeof(BlockPayload));
 
-    Byte buffer[MESSAGE_BUFFER_LENGTH] = {0};
+    Byte *buffer = acquire_buffer(calc_block_payload_width(ptrPayload));
     uint64_t payloadLength = serialize_block_payload(ptrPayload, buffer);
     ptrMessage->header.length = (uint32_t)payloadLength;
     calculate_data_checksum(
-        &buffer,
+        buffer,
         ptrMessage->header.length,
         ptrMessage->header.checksum
     );
+    release_buffer(buffer);
     return 0;
 }
 
@@ -135,82 +147,96 @@ int32_t parse_into_block_message(Byte *ptrBuffer, Message *ptrMessage) {
 
 // @see https://en.bitcoin.it/wiki/Protocol_rules#.22block.22_messages
 
-bool is_block_legal(BlockPayload *ptrBlock) {
-
-    bool nonEmptyTxList = ptrBlock->txCount > 0;
+static uint8_t check_block_legality(BlockPayload *ptrBlock, Byte *headerHash) {
+    uint8_t failures = 0;
 
-    bool timestampLegal = ptrBlock->header.timestamp - time(NULL) < mainnet.blockMaxForwardTimestamp;
+    if (ptrBlock->txCount == 0) {
+        return BLOCK_ILLEGAL_NO_TX;
+    }
 
-    bool initialInputIsCoinbase = is_coinbase(&ptrBlock->txs[0].txInputs[0]);
+    if ((int64_t)ptrBlock->header.timestamp - time(NULL) >= params->blockMaxForwardTimestamp) {
+        failures |= BLOCK_ILLEGAL_TIMESTAMP;
+    }
 
+    TxPayload *firstTx = &ptrBlock->txs[0];
+    bool initialInputIsCoinbase = firstTx->txInputCount > 0 && is_coinbase(&firstTx->txInputs[0]);
     bool onlyOneCoinbase = true;
-    for (uint64_t txIndex = 0; txIndex < ptrBlock->txCount; txIndex++) {
+    for (uint64_t txIndex = 0; txIndex < ptrBlock->txCount && onlyOneCoinbase; txIndex++) {
         TxPayload *tx = &ptrBlock->txs[txIndex];
         for (uint64_t inputIndex = 0; inputIndex < tx->txInputCount; inputIndex++) {
             if (txIndex == 0 && inputIndex == 0) {
                 continue;
             }
-            if (is_coinbase(&ptrBlock->txs[txIndex].txInputs[inputIndex])) {
+            if (is_coinbase(&tx->txInputs[inputIndex])) {
                 onlyOneCoinbase = false;
                 break;
             }
         }
     }
+    if (!initialInputIsCoinbase || !onlyOneCoinbase) {
+        failures |= BLOCK_ILLEGAL_COINBASE;
+    }
 
-    bool allTxLegal = true;
     for (uint64_t i = 0; i < ptrBlock->txCount; i++) {
         if (!is_tx_legal(&ptrBlock->txs[i])) {
-            allTxLegal = false;
+            failures |= BLOCK_ILLEGAL_TX;
             break;
         }
     }
 
-    bool hashSatisfiesTarget;
+    if (!hash_satisfies_target_compact(headerHash, ptrBlock->header.target)) {
+        failures |= BLOCK_ILLEGAL_POW;
+    }
+
+    // The merkle tree is by far the costliest check; skip it once the verdict is settled
+    if (!failures) {
+        SHA256_HASH computedMerkle = {0};
+        compute_merkle_root(ptrBlock->txs, ptrBlock->txCount, computedMerkle);
+        if (memcmp(computedMerkle, ptrBlock->header.merkle_root, SHA256_LENGTH) != 0) {
+            failures |= BLOCK_ILLEGAL_MERKLE;
+        }
+    }
+
+    return failures;
+}
+
+bool is_block_legal(BlockPayload *ptrBlock) {
     SHA256_HASH headerHash = {0};
     hash_block_header(&ptrBlock->header, headerHash);
-    hashSatisfiesTarget = hash_satisfies_target_compact(headerHash, ptrBlock->header.target);
-
-    bool merkleMatch;
-    SHA256_HASH computedMerkle = {0};
-    compute_merkle_root(ptrBlock->txs, ptrBlock->txCount, computedMerkle);
-    merkleMatch = memcmp(computedMerkle, ptrBlock->header.merkle_root, SHA256_LENGTH) == 0;
-
-    /*
-    printf("block legality: %u %u %u %u %u %u %u\n",
-           nonEmptyTxList,
-           timestampLegal,
-           firstTxIsCoinbase,
-           onlyOneCoinbase,
-           allTxLegal,
-           hashSatisfiesTarget,
-           merkleMatch
-    );
-    */
+    struct BlockLegality *ptrLegality = &ptrBlock->legality;
+    if (!ptrLegality->checked || memcmp(ptrLegality->hash, headerHash, SHA256_LENGTH) != 0) {
+        ptrLegality->failures = check_block_legality(ptrBlock, headerHash);
+        memcpy(ptrLegality->hash, headerHash, SHA256_LENGTH);
+        ptrLegality->checked = true;
+    }
+    return ptrLegality->failures == 0;
+}
 
-    return nonEmptyTxList
-           && timestampLegal
-           && initialInputIsCoinbase
-           && onlyOneCoinbase
-           && allTxLegal
-           && hashSatisfiesTarget
-           && merkleMatch;
+// For blocks whose content is known to have passed is_block_legal before, e.g. checksummed archives
+void mark_block_legal(BlockPayload *ptrBlock, Byte *hash) {
+    ptrBlock->legality.checked = true;
+    ptrBlock->legality.failures = 0;
+    memcpy(ptrBlock->legality.hash, hash, SHA256_LENGTH);
 }
 
-bool hash_satisfies_target_compact(const Byte *hash, TargetCompact target) {
-    ByteArray32 targetExpanded = {0};
-    target_4to32(target, targetExpanded);
-    return bytescmp(hash, targetExpanded, SHA256_LENGTH) <= 0;
+void reset_block_legality(BlockPayload *ptrBlock) {
+    memset(&ptrBlock->legality, 0, sizeof(ptrBlock->legality));
 }
 
-void target_4to32(uint32_t targetBytes, Byte *bytes) {
-    int32_t exponentWidth = (targetBytes >> 24) - 3;
-    memset(bytes, 0, 32);
-    memcpy(bytes + exponentWidth, &targetBytes, TARGET_BITS_MANTISSA_WIDTH);
+// Negative, overflowing and zero targets are met by no hash
+bool hash_satisfies_target_compact(const Byte *hash, TargetCompact target) {
+    Uint256 targetValue;
+    if (uint256_from_compact(target, &targetValue) || uint256_is_zero(&targetValue)) {
+        return false;
+    }
+    Uint256 hashValue;
+    uint256_from_bytes(hash, &hashValue);
+    return uint256_compare(&hashValue, &targetValue) <= 0;
 }
 
 bool is_block_header_legal(BlockPayloadHeader *ptrHeader) {
     bool timestampLegal =
-        (int64_t)ptrHeader->timestamp - time(NULL) < mainnet.blockMaxForwardTimestamp;
+        (int64_t)ptrHeader->timestamp - time(NULL) < params->blockMaxForwardTimestamp;
     return timestampLegal;
 }
 
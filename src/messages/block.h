@@ -22,15 +22,33 @@ struct BlockPayloadHeader {
 
 typedef struct BlockPayloadHeader BlockPayloadHeader;
 
+#define BLOCK_ILLEGAL_NO_TX        (1 << 0)
+#define BLOCK_ILLEGAL_TIMESTAMP    (1 << 1)
+#define BLOCK_ILLEGAL_COINBASE     (1 << 2)
+#define BLOCK_ILLEGAL_TX           (1 << 3)
+#define BLOCK_ILLEGAL_POW          (1 << 4)
+#define BLOCK_ILLEGAL_MERKLE       (1 << 5)
+
+// Outcome of is_block_legal, kept with the block so later stages don't rebuild its merkle tree.
+// It is bound to the header hash it was computed for; whoever edits txs without touching
+// the header must call reset_block_legality.
+struct BlockLegality {
+    bool checked;
+    SHA256_HASH hash;
+    uint8_t failures;
+};
+
 struct BlockPayload {
     BlockPayloadHeader header;
     VarIntMem txCount;
     TxPayload *txs;
+    struct BlockLegality legality;
 };
 
 typedef struct BlockPayload BlockPayload;
 
 uint64_t serialize_block_payload(BlockPayload *ptrPayload, Byte *ptrBuffer);
+uint64_t calc_block_payload_width(BlockPayload *ptrPayload);
 int32_t make_block_message(Message *ptrMessage, BlockPayload *ptrPayload);
 uint64_t serialize_block_message(Message *ptrMessage, uint8_t *ptrBuffer);
 uint64_t parse_block_payload_header(Byte *ptrBuffer, BlockPayloadHeader *ptrHeader);
@@ -40,9 +58,10 @@ uint64_t load_block_message(char *path, Message *ptrMessage);
 void print_block_message(Message *ptrMessage);
 int32_t parse_into_block_message(Byte *ptrBuffer, Message *ptrMessage);
 bool is_block_legal(BlockPayload *ptrBlock);
+void mark_block_legal(BlockPayload *ptrBlock, Byte *hash);
+void reset_block_legality(BlockPayload *ptrBlock);
 bool is_block_header_legal(BlockPayloadHeader *ptrHeader);
 bool hash_satisfies_target_compact(const Byte *hash, TargetCompact target);
-void target_4to32(TargetCompact targetBytes, Byte *bytes);
 void hash_block_header(BlockPayloadHeader *ptrHeader, Byte *hash);
 void print_block_payload(BlockPayload *ptrBlock);
 void release_block(BlockPayload *ptrBlock);
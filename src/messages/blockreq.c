@@ -4,6 +4,7 @@
 #include "blockreq.h"
 
 #include "utils/memory.h"
+#include "utils/pool.h"
 
 uint64_t serialize_blockreq_payload(
     BlockRequestPayload *ptrPayload,
@@ -33,26 +34,34 @@ uint64_t parse_blockreq_payload(
     return p - ptrBuffer;
 }
 
+uint64_t calc_blockreq_payload_width(BlockRequestPayload *ptrPayload) {
+    return sizeof(ptrPayload->version)
+           + calc_number_varint_width(ptrPayload->hashCount)
+           + ptrPayload->hashCount * SHA256_LENGTH
+           + sizeof(ptrPayload->hashStop);
+}
+
 int32_t make_blockreq_message(
     Message *ptrMessage,
     BlockRequestPayload *ptrPayload,
     char *command,
     uint8_t commandSize
 ) {
-    ptrMessage->header.magic = mainnet.magic;
+    ptrMessage->header.magic = params->magic;
     memcpy(ptrMessage->header.command, command, commandSize);
 
     ptrMessage->ptrPayload = MALLOC(sizeof(BlockRequestPayload), "make_message:payload");
     memcpy(ptrMessage->ptrPayload, ptrPayload, sizeof(BlockRequestPayload));
 
-    Byte buffer[MESSAGE_BUFFER_LENGTH] = {0};
+    Byte *buffer = acquire_buffer(calc_blockreq_payload_width(ptrPayload));
     uint64_t payloadLength = serialize_blockreq_payload(ptrPayload, buffer);
     ptrMessage->header.length = (uint32_t)payloadLength;
     calculate_data_checksum(
-        &buffer,
+        buffer,
         ptrMessage->header.length,
         ptrMessage->header.checksum
     );
+    release_buffer(buffer);
     return 0;
 }
 
@@ -21,6 +21,8 @@ uint64_t serialize_blockreq_payload(
     Byte *ptrBuffer
 );
 
+uint64_t calc_blockreq_payload_width(BlockRequestPayload *ptrPayload);
+
 int32_t make_blockreq_message(
     Message *ptrMessage,
     BlockRequestPayload *ptrPayload,
@@ -1,16 +1,18 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <stddef.h>
 
 #include "messages/common.h"
 #include "messages/shared.h"
 #include "utils/memory.h"
+#include "utils/pool.h"
 
 int32_t make_header_only_message(
     Message *ptrMessage,
     char* command,
     uint16_t commandSize
 ) {
-    ptrMessage->header.magic = mainnet.magic;
+    ptrMessage->header.magic = params->magic;
     memcpy(ptrMessage->header.command, command, commandSize);
     ptrMessage->header.length = 0;
     calculate_data_checksum(
@@ -32,11 +34,10 @@ uint64_t serialize_header_only_message(
 
 static uint64_t parse_iv_payload(
     Byte *ptrBuffer,
+    uint64_t count,
     GenericIVPayload *ptrPayload
 ) {
     Byte *p = ptrBuffer;
-    uint64_t count = 0;
-    p += parse_varint(p, &count);
     ptrPayload->count = count;
     for (uint64_t index = 0; index < count; index++) {
         p += PARSE_INTO(p, &ptrPayload->inventory[index]);
@@ -44,7 +45,7 @@ static uint64_t parse_iv_payload(
     return p - ptrBuffer;
 }
 
-static uint64_t serialize_iv_payload(
+uint64_t serialize_iv_payload(
     GenericIVPayload *ptrPayload,
     Byte *ptrBuffer
 ) {
@@ -73,13 +74,17 @@ int32_t parse_into_iv_message(
     Message *ptrMessage
 ) {
     Header header = get_empty_header();
-    GenericIVPayload payload;
-    memset(&payload, 0, sizeof(payload));
     parse_message_header(ptrBuffer, &header);
-    parse_iv_payload(ptrBuffer + sizeof(header), &payload);
     memcpy(ptrMessage, &header, sizeof(header));
-    ptrMessage->ptrPayload = MALLOC(sizeof(GenericIVPayload), "parse_message:payload");
-    memcpy(ptrMessage->ptrPayload, &payload, sizeof(payload));
+
+    Byte *p = ptrBuffer + sizeof(header);
+    uint64_t count = 0;
+    p += parse_count_varint(p, header.length, sizeof(InventoryVector), MAX_INV_SIZE, &count);
+    // Only the entries actually sent are allocated, not the full MAX_INV_SIZE
+    uint64_t payloadSize = offsetof(GenericIVPayload, inventory) + count * sizeof(InventoryVector);
+    GenericIVPayload *ptrPayload = MALLOC(payloadSize, "parse_message:payload");
+    parse_iv_payload(p, count, ptrPayload);
+    ptrMessage->ptrPayload = ptrPayload;
     return 0;
 }
 
@@ -134,19 +139,44 @@ int32_t make_iv_message(
     Byte *command,
     uint32_t commandSize
 ) {
-    ptrMessage->header.magic = mainnet.magic;
+    ptrMessage->header.magic = params->magic;
     memcpy(ptrMessage->header.command, command, commandSize);
 
     ptrMessage->ptrPayload = MALLOC(sizeof(GenericIVPayload), "make_message:payload");
     memcpy(ptrMessage->ptrPayload, ptrPayload, sizeof(GenericIVPayload));
 
-    Byte buffer[MESSAGE_BUFFER_LENGTH] = {0};
+    Byte *buffer = acquire_buffer(calc_iv_payload_width(ptrPayload->count));
     uint64_t payloadLength = serialize_iv_payload(ptrPayload, buffer);
     ptrMessage->header.length = (uint32_t)payloadLength;
     calculate_data_checksum(
-        &buffer,
+        buffer,
         ptrMessage->header.length,
         ptrMessage->header.checksum
     );
+    release_buffer(buffer);
     return 0;
 }
+
+uint64_t calc_iv_payload_width(uint64_t count) {
+    return calc_number_varint_width(count) + count * (sizeof(uint32_t) + SHA256_LENGTH);
+}
+
+// Outbound messages are serialized once, straight after the header slot of a pooled buffer;
+// the header is filled in afterwards with a checksum over those same bytes.
+
+Byte *prepare_message_buffer(uint64_t payloadWidthBound) {
+    return acquire_buffer(sizeof(Header) + payloadWidthBound);
+}
+
+uint64_t seal_message_buffer(
+    Byte *ptrBuffer,
+    char *command,
+    uint64_t payloadWidth
+) {
+    Header header = get_empty_header();
+    fill_command_field(header.command, command);
+    header.length = (uint32_t)payloadWidth;
+    calculate_data_checksum(ptrBuffer + sizeof(Header), header.length, header.checksum);
+    memcpy(ptrBuffer, &header, sizeof(Header));
+    return sizeof(Header) + payloadWidth;
+}
@@ -44,3 +44,18 @@ uint64_t serialize_iv_message(
     Message *ptrMessage,
     uint8_t *ptrBuffer
 );
+
+uint64_t serialize_iv_payload(
+    GenericIVPayload *ptrPayload,
+    Byte *ptrBuffer
+);
+
+uint64_t calc_iv_payload_width(uint64_t count);
+
+Byte *prepare_message_buffer(uint64_t payloadWidthBound);
+
+uint64_t seal_message_buffer(
+    Byte *ptrBuffer,
+    char *command,
+    uint64_t payloadWidth
+);
@@ -15,7 +15,7 @@ uint64_t parse_message_header(
 
 Header get_empty_header() {
     Header header = {
-        .magic = mainnet.magic,
+        .magic = params->magic,
         .command = {0},
         .checksum = {0},
         .length = 0
@@ -23,6 +23,12 @@ Header get_empty_header() {
     return header;
 }
 
+// The command field is padded with NULs but not terminated by one when all 12 bytes are used;
+// field must already be zeroed
+void fill_command_field(uint8_t *field, char *command) {
+    memcpy(field, command, strnlen(command, sizeof(((Header *)0)->command)));
+}
+
 void calculate_data_checksum(void *ptrInput, uint32_t count, uint8_t *ptrResult) {
     SHA256_HASH hash = {0};
     dsha256(ptrInput, count, hash);
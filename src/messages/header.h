@@ -23,5 +23,6 @@ uint64_t parse_message_header(
 );
 
 Header get_empty_header(void);
+void fill_command_field(uint8_t *field, char *command);
 
 void print_message_header(Header header);
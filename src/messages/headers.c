@@ -1,18 +1,31 @@
 #include <stdlib.h>
+#include <stddef.h>
 #include "headers.h"
 #include "utils/memory.h"
 
+// Parses up to count entries, stopping at the first that would run past ptrEnd: the count was
+// clamped for one-byte tx counts, which a peer need not send
 uint64_t parse_headers_payload(
     Byte *ptrBuffer,
+    Byte *ptrEnd,
+    uint64_t count,
     HeadersPayload *ptrPayload
 ) {
     Byte *p = ptrBuffer;
-    p += parse_varint(p, &ptrPayload->count);
-    for (uint64_t i = 0; i < ptrPayload->count; i++) {
+    ptrPayload->count = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        if (ptrEnd - p < (ptrdiff_t)HEADER_DATA_MIN_WIDTH) {
+            break;
+        }
+        Byte *txCountStart = p + sizeof(BlockPayloadHeader);
+        if (ptrEnd - txCountStart < calc_varint_width(*txCountStart)) {
+            break;
+        }
         p += parse_block_payload_header(p, &ptrPayload->headers[i].header);
         p += parse_varint(p, &ptrPayload->headers[i].transactionCount);
+        ptrPayload->count++;
     }
-    return ptrBuffer - p;
+    return p - ptrBuffer;
 }
 
 int32_t parse_into_headers_message(
@@ -20,13 +33,17 @@ int32_t parse_into_headers_message(
     Message *ptrMessage
 ) {
     Header header = get_empty_header();
-    HeadersPayload payload;
-    memset(&payload, 0, sizeof(payload));
     parse_message_header(ptrBuffer, &header);
-    parse_headers_payload(ptrBuffer + sizeof(header), &payload);
     memcpy(ptrMessage, &header, sizeof(header));
-    ptrMessage->ptrPayload = MALLOC(sizeof(HeadersPayload), "parse_message:payload");
-    memcpy(ptrMessage->ptrPayload, &payload, sizeof(payload));
+
+    Byte *p = ptrBuffer + sizeof(header);
+    Byte *ptrEnd = p + header.length;
+    uint64_t count = 0;
+    p += parse_count_varint(p, header.length, HEADER_DATA_MIN_WIDTH, MAX_HEAD_PER_PAYLOAD, &count);
+    uint64_t payloadSize = offsetof(HeadersPayload, headers) + count * sizeof(struct HeaderData);
+    HeadersPayload *ptrPayload = MALLOC(payloadSize, "parse_message:payload");
+    parse_headers_payload(p, ptrEnd, count, ptrPayload);
+    ptrMessage->ptrPayload = ptrPayload;
     return 0;
 }
 
@@ -6,6 +6,7 @@
 // @see https://en.bitcoin.it/wiki/Protocol_documentation#headers
 
 #define MAX_HEAD_PER_PAYLOAD 2000
+#define HEADER_DATA_MIN_WIDTH (sizeof(BlockPayloadHeader) + 1)
 
 struct HeaderData {
     VarIntMem transactionCount;
@@ -10,13 +10,13 @@ int32_t make_pingpong_message(
     PingpongPayload *ptrPayload,
     char *command
 ) {
-    ptrMessage->header.magic = mainnet.magic;
+    ptrMessage->header.magic = params->magic;
     memcpy(ptrMessage->header.command, command, sizeof(ptrMessage->header.command));
 
     ptrMessage->ptrPayload = MALLOC(sizeof(PingpongPayload), "make_message:payload");
     memcpy(ptrMessage->ptrPayload, ptrPayload, sizeof(PingpongPayload));
 
-    Byte buffer[MESSAGE_BUFFER_LENGTH] = {0};
+    Byte buffer[sizeof(PingpongPayload)] = {0};
     uint64_t payloadLength = serialize_pingpong_payload(ptrPayload, buffer);
     ptrMessage->header.length = (uint32_t)payloadLength;
     calculate_data_checksum(
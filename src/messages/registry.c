@@ -0,0 +1,243 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "messages/registry.h"
+#include "messages/common.h"
+#include "messages/version.h"
+#include "messages/verack.h"
+#include "messages/inv.h"
+#include "messages/addr.h"
+#include "messages/blockreq.h"
+#include "messages/reject.h"
+#include "messages/pingpong.h"
+#include "messages/headers.h"
+#include "messages/block.h"
+#include "config.h"
+
+static uint64_t calc_version_entry_width(void *ptrPayload) {
+    // The payload is generated at serialization time, so reserve for the longest user agent
+    return VERSION_PAYLOAD_FIXED_WIDTH
+        + calc_number_varint_width(sizeof(config.userAgent))
+        + sizeof(config.userAgent);
+}
+
+static uint64_t serialize_version_entry(struct Peer *ptrPeer, void *ptrPayload, Byte *ptrBuffer) {
+    VersionPayload payload;
+    memset(&payload, 0, sizeof(payload));
+    make_version_payload(&payload, ptrPeer);
+    return serialize_version_payload(&payload, ptrBuffer);
+}
+
+static uint64_t calc_iv_entry_width(void *ptrPayload) {
+    return calc_iv_payload_width(((GenericIVPayload *)ptrPayload)->count);
+}
+
+static uint64_t serialize_iv_entry(struct Peer *ptrPeer, void *ptrPayload, Byte *ptrBuffer) {
+    return serialize_iv_payload(ptrPayload, ptrBuffer);
+}
+
+static uint64_t calc_blockreq_entry_width(void *ptrPayload) {
+    return calc_blockreq_payload_width(ptrPayload);
+}
+
+static uint64_t serialize_blockreq_entry(struct Peer *ptrPeer, void *ptrPayload, Byte *ptrBuffer) {
+    return serialize_blockreq_payload(ptrPayload, ptrBuffer);
+}
+
+static uint64_t calc_pingpong_entry_width(void *ptrPayload) {
+    return sizeof(PingpongPayload);
+}
+
+static uint64_t serialize_pingpong_entry(struct Peer *ptrPeer, void *ptrPayload, Byte *ptrBuffer) {
+    return serialize_pingpong_payload(ptrPayload, ptrBuffer);
+}
+
+static MessageCodec codecs[] = {
+    {
+        .command = CMD_VERSION,
+        .parse = &parse_into_version_message,
+        .calc_payload_width = &calc_version_entry_width,
+        .serialize_payload = &serialize_version_entry,
+        .print = &print_version_message,
+        .maxPayloadLength = VERSION_PAYLOAD_FIXED_WIDTH + 9 + MAX_VARIABLE_LENGTH_STRING_LENGTH,
+    },
+    {
+        .command = CMD_VERACK,
+        .print = &print_verack_message,
+        .maxPayloadLength = 0,
+    },
+    {
+        .command = CMD_GETADDR,
+        .maxPayloadLength = 0,
+    },
+    {
+        .command = CMD_SENDHEADERS,
+        .maxPayloadLength = 0,
+    },
+    {
+        .command = CMD_INV,
+        .parse = &parse_into_inv_message,
+        .print = &print_inv_message,
+        .maxPayloadLength = 9 + MAX_INV_SIZE * sizeof(InventoryVector),
+    },
+    {
+        .command = CMD_GETDATA,
+        .parse = &parse_into_iv_message,
+        .calc_payload_width = &calc_iv_entry_width,
+        .serialize_payload = &serialize_iv_entry,
+        .print = &print_iv_message,
+        .maxPayloadLength = 9 + MAX_INV_SIZE * sizeof(InventoryVector),
+    },
+    {
+        .command = CMD_ADDR,
+        .parse = &parse_into_addr_message,
+        .print = &print_addr_message,
+        .maxPayloadLength = 9 + MAX_RECORDS_IN_ADDR * (4 + 26),
+    },
+    {
+        .command = CMD_GETHEADERS,
+        .parse = &parse_into_blockreq_message,
+        .calc_payload_width = &calc_blockreq_entry_width,
+        .serialize_payload = &serialize_blockreq_entry,
+        .maxPayloadLength = 4 + 9 + (MAX_LOCATORS_PER_BLOCK_REQUEST + 1) * SHA256_LENGTH,
+    },
+    {
+        .command = CMD_GETBLOCKS,
+        .parse = &parse_into_blockreq_message,
+        .calc_payload_width = &calc_blockreq_entry_width,
+        .serialize_payload = &serialize_blockreq_entry,
+        .maxPayloadLength = 4 + 9 + (MAX_LOCATORS_PER_BLOCK_REQUEST + 1) * SHA256_LENGTH,
+    },
+    {
+        .command = CMD_REJECT,
+        .parse = &parse_into_reject_message,
+        .print = &print_reject_message,
+        .maxPayloadLength = 2 * (9 + MAX_VARIABLE_LENGTH_STRING_LENGTH) + 1 + SHA256_LENGTH,
+    },
+    {
+        .command = CMD_PING,
+        .parse = &parse_into_pingpong_message,
+        .calc_payload_width = &calc_pingpong_entry_width,
+        .serialize_payload = &serialize_pingpong_entry,
+        .print = &print_pingpong_message,
+        .maxPayloadLength = sizeof(PingpongPayload),
+    },
+    {
+        .command = CMD_PONG,
+        .parse = &parse_into_pingpong_message,
+        .calc_payload_width = &calc_pingpong_entry_width,
+        .serialize_payload = &serialize_pingpong_entry,
+        .print = &print_pingpong_message,
+        .maxPayloadLength = sizeof(PingpongPayload),
+    },
+    {
+        .command = CMD_HEADERS,
+        .parse = &parse_into_headers_message,
+        .print = &print_headers_message,
+        .maxPayloadLength = 9 + MAX_HEAD_PER_PAYLOAD * (sizeof(BlockPayloadHeader) + 9),
+    },
+    {
+        .command = CMD_BLOCK,
+        .parse = &parse_into_block_message,
+        .print = &print_block_message,
+        .maxPayloadLength = (MESSAGE_BUFFER_LENGTH) - sizeof(Header),
+    },
+};
+
+#define CODEC_COUNT (sizeof(codecs) / sizeof(codecs[0]))
+
+// Open-addressed index from hashed command key to codec; -1 marks an empty slot
+static int16_t codecSlots[CODEC_SLOT_COUNT];
+static bool registryReady = false;
+
+static uint32_t hash_command_key(Byte *key) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < COMMAND_KEY_WIDTH; i++) {
+        hash = (hash ^ key[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static bool is_command_silent(char *command) {
+    char *list = config.silentIncomingMessageCommands;
+    size_t commandLength = strlen(command);
+    while (list && *list) {
+        char *comma = strchr(list, ',');
+        size_t itemLength = comma ? (size_t)(comma - list) : strlen(list);
+        if (itemLength == commandLength && strncmp(list, command, itemLength) == 0) {
+            return true;
+        }
+        list = comma ? comma + 1 : NULL;
+    }
+    return false;
+}
+
+static void setup_message_registry() {
+    for (uint32_t slot = 0; slot < CODEC_SLOT_COUNT; slot++) {
+        codecSlots[slot] = -1;
+    }
+    for (uint32_t i = 0; i < CODEC_COUNT; i++) {
+        MessageCodec *ptrCodec = &codecs[i];
+        memset(ptrCodec->key, 0, COMMAND_KEY_WIDTH);
+        fill_command_field(ptrCodec->key, ptrCodec->command);
+        ptrCodec->silent = is_command_silent(ptrCodec->command);
+        uint32_t slot = hash_command_key(ptrCodec->key) % CODEC_SLOT_COUNT;
+        while (codecSlots[slot] >= 0) {
+            slot = (slot + 1) % CODEC_SLOT_COUNT;
+        }
+        codecSlots[slot] = (int16_t)i;
+    }
+    registryReady = true;
+}
+
+MessageCodec *get_message_codec(Byte *commandKey) {
+    if (!registryReady) {
+        setup_message_registry();
+    }
+    uint32_t slot = hash_command_key(commandKey) % CODEC_SLOT_COUNT;
+    while (codecSlots[slot] >= 0) {
+        MessageCodec *ptrCodec = &codecs[codecSlots[slot]];
+        if (memcmp(ptrCodec->key, commandKey, COMMAND_KEY_WIDTH) == 0) {
+            return ptrCodec;
+        }
+        slot = (slot + 1) % CODEC_SLOT_COUNT;
+    }
+    return NULL;
+}
+
+MessageCodec *get_message_codec_by_name(char *command) {
+    Byte key[COMMAND_KEY_WIDTH] = {0};
+    fill_command_field(key, command);
+    return get_message_codec(key);
+}
+
+int8_t register_message_handler(char *command, MessageHandler *handler) {
+    MessageCodec *ptrCodec = get_message_codec_by_name(command);
+    if (!ptrCodec) {
+        fprintf(stderr, "register_message_handler: no codec for command %s\n", command);
+        return -1;
+    }
+    ptrCodec->handle = handler;
+    return 0;
+}
+
+void print_message_codec_stats() {
+    printf("Messages (in / out / handler time):\n");
+    for (uint32_t i = 0; i < CODEC_COUNT; i++) {
+        MessageCodec *ptrCodec = &codecs[i];
+        struct MessageCodecStats *ptrStats = &ptrCodec->stats;
+        if (!ptrStats->incomingMessages && !ptrStats->outgoingMessages) {
+            continue;
+        }
+        printf(
+            "%-12s %7llu (%llu KB) / %7llu (%llu KB) / %.1fms\n",
+            ptrCodec->command,
+            ptrStats->incomingMessages,
+            ptrStats->incomingBytes / 1024,
+            ptrStats->outgoingMessages,
+            ptrStats->outgoingBytes / 1024,
+            ptrStats->handlerTime
+        );
+    }
+}
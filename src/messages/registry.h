@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "datatypes.h"
+#include "messages/shared.h"
+
+// Commands are looked up by the zero-padded 12-byte field of the wire header
+#define COMMAND_KEY_WIDTH sizeof(((Header *)0)->command)
+#define CODEC_SLOT_COUNT 64
+
+// Commands without a codec are still framed and checksummed before being dropped
+#define MAX_UNKNOWN_PAYLOAD_LENGTH ((MESSAGE_BUFFER_LENGTH) - sizeof(Header))
+
+struct Peer;
+
+typedef int32_t MessageParser(Byte *ptrBuffer, Message *ptrMessage);
+typedef uint64_t PayloadWidthCalculator(void *ptrPayload);
+typedef uint64_t PayloadSerializer(struct Peer *ptrPeer, void *ptrPayload, Byte *ptrBuffer);
+typedef void MessagePrinter(Message *ptrMessage);
+typedef void MessageHandler(struct Peer *ptrPeer, Message *ptrMessage);
+
+struct MessageCodecStats {
+    uint64_t incomingMessages;
+    uint64_t incomingBytes;
+    uint64_t outgoingMessages;
+    uint64_t outgoingBytes;
+    double handlerTime;
+};
+
+// A parser left NULL means the command carries nothing worth decoding beyond its header;
+// a serializer left NULL means it is sent with an empty payload.
+struct MessageCodec {
+    char *command;
+    Byte key[COMMAND_KEY_WIDTH];
+    MessageParser *parse;
+    PayloadWidthCalculator *calc_payload_width;
+    PayloadSerializer *serialize_payload;
+    MessagePrinter *print;
+    MessageHandler *handle;
+    uint32_t maxPayloadLength;
+    bool silent;
+    struct MessageCodecStats stats;
+};
+
+typedef struct MessageCodec MessageCodec;
+
+MessageCodec *get_message_codec(Byte *commandKey);
+MessageCodec *get_message_codec_by_name(char *command);
+int8_t register_message_handler(char *command, MessageHandler *handler);
+void print_message_codec_stats(void);
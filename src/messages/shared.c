@@ -46,6 +46,24 @@ uint8_t serialize_to_varint(
     }
 }
 
+// Width of a varint, prefix included, as told by its first byte
+uint8_t calc_varint_width(uint8_t prefix) {
+    switch (prefix) {
+        case VAR_INT_PREFIX_16: {
+            return 3;
+        }
+        case VAR_INT_PREFIX_32: {
+            return 5;
+        }
+        case VAR_INT_PREFIX_64: {
+            return 9;
+        }
+        default: {
+            return 1;
+        }
+    }
+}
+
 uint8_t parse_varint(
     uint8_t *ptrBuffer,
     uint64_t *result
@@ -71,6 +89,27 @@ uint8_t parse_varint(
     }
 }
 
+uint8_t parse_count_varint(
+    Byte *ptrBuffer,
+    uint64_t payloadLength,
+    uint64_t minItemWidth,
+    uint64_t maxCount,
+    uint64_t *ptrCount
+) {
+    if (payloadLength == 0) {
+        *ptrCount = 0;
+        return 0;
+    }
+    if (calc_varint_width(ptrBuffer[0]) > payloadLength) {
+        *ptrCount = 0;
+        return (uint8_t)payloadLength;
+    }
+    uint8_t countWidth = parse_varint(ptrBuffer, ptrCount);
+    uint64_t fittingCount = payloadLength > countWidth ? (payloadLength - countWidth) / minItemWidth : 0;
+    *ptrCount = min_uint64(min_uint64(*ptrCount, fittingCount), maxCount);
+    return countWidth;
+}
+
 uint64_t serialize_varstr(
     struct VariableLengthString *ptrVarStr,
     uint8_t *ptrBuffer
@@ -116,7 +155,7 @@ uint64_t parse_network_address(
 }
 
 bool starts_with_magic(void *p) {
-    return combine_uint32(p) == mainnet.magic;
+    return combine_uint32(p) == params->magic;
 }
 
 Message get_empty_message() {
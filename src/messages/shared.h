@@ -50,11 +50,22 @@ uint8_t calc_number_varint_width(uint64_t number);
 
 uint8_t serialize_to_varint(uint64_t data, uint8_t *ptrBuffer);
 
+uint8_t calc_varint_width(uint8_t prefix);
+
 uint8_t parse_varint(
     uint8_t *ptrBuffer,
     uint64_t *result
 );
 
+// Parses the count prefixing a list, clamped to what the payload could hold and to maxCount
+uint8_t parse_count_varint(
+    Byte *ptrBuffer,
+    uint64_t payloadLength,
+    uint64_t minItemWidth,
+    uint64_t maxCount,
+    uint64_t *ptrCount
+);
+
 uint64_t serialize_varstr(
     struct VariableLengthString *ptrVarStr,
     uint8_t *ptrBuffer
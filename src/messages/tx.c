@@ -4,6 +4,8 @@
 #include "tx.h"
 #include "utils/memory.h"
 #include "utils/data.h"
+#include "utils/pool.h"
+#include "sha256.h"
 
 static uint64_t parse_outpoint(Byte *ptrBuffer, Outpoint *ptrOutpoint) {
     Byte *p = ptrBuffer;
@@ -84,6 +86,36 @@ uint64_t serialize_tx_payload(
     return p - ptrBuffer;
 }
 
+uint64_t calc_tx_payload_width(TxPayload *ptrPayload) {
+    bool hasWitnessData = (ptrPayload->marker == WITNESS_MARKER) && (ptrPayload->flag == WITNESS_FLAG);
+    uint64_t width = sizeof(ptrPayload->version) + sizeof(ptrPayload->lockTime);
+    if (hasWitnessData) {
+        width += sizeof(ptrPayload->marker) + sizeof(ptrPayload->flag);
+    }
+    width += calc_number_varint_width(ptrPayload->txInputCount);
+    for (uint64_t i = 0; i < ptrPayload->txInputCount; i++) {
+        TxIn *ptrTxIn = &ptrPayload->txInputs[i];
+        width += SHA256_LENGTH + sizeof(ptrTxIn->previous_output.index)
+                 + calc_number_varint_width(ptrTxIn->signature_script_length)
+                 + ptrTxIn->signature_script_length
+                 + sizeof(ptrTxIn->sequence);
+    }
+    width += calc_number_varint_width(ptrPayload->txOutputCount);
+    for (uint64_t i = 0; i < ptrPayload->txOutputCount; i++) {
+        TxOut *ptrTxOut = &ptrPayload->txOutputs[i];
+        width += sizeof(ptrTxOut->value)
+                 + calc_number_varint_width(ptrTxOut->public_key_script_length)
+                 + ptrTxOut->public_key_script_length;
+    }
+    if (hasWitnessData) {
+        for (uint64_t i = 0; i < ptrPayload->txInputCount; i++) {
+            TxWitness *ptrWitness = &ptrPayload->txWitnesses[i];
+            width += calc_number_varint_width(ptrWitness->length) + ptrWitness->length;
+        }
+    }
+    return width;
+}
+
 static uint64_t parse_tx_in(
     Byte *ptrBuffer,
     TxIn *ptrTxIn
@@ -162,20 +194,21 @@ int32_t make_tx_message(
     Message *ptrMessage,
     TxPayload *ptrPayload
 ) {
-    ptrMessage->header.magic = mainnet.magic;
+    ptrMessage->header.magic = params->magic;
     memcpy(ptrMessage->header.command, CMD_TX, sizeof(CMD_TX));
 
     ptrMessage->ptrPayload = MALLOC(sizeof(TxPayload), "make_message:payload");
     memcpy(ptrMessage->ptrPayload, ptrPayload, sizeof(TxPayload));
 
-    Byte buffer[MESSAGE_BUFFER_LENGTH] = {0};
+    Byte *buffer = acquire_buffer(calc_tx_payload_width(ptrPayload));
     uint64_t payloadLength = serialize_tx_payload(ptrPayload, buffer);
     ptrMessage->header.length = (uint32_t)payloadLength;
     calculate_data_checksum(
-        &buffer,
+        buffer,
         ptrMessage->header.length,
         ptrMessage->header.checksum
     );
+    release_buffer(buffer);
     return 0;
 }
 
@@ -196,65 +229,49 @@ uint64_t serialize_tx_message(
 // @see https://en.bitcoin.it/wiki/Block_hashing_algorithm
 
 void hash_tx(TxPayload *ptrTx, SHA256_HASH result) {
-    Byte *buffer = MALLOC(MESSAGE_BUFFER_LENGTH, "hash_tx:buffer");
+    Byte *buffer = MALLOC(calc_tx_payload_width(ptrTx), "hash_tx:buffer");
     uint64_t txWidth = serialize_tx_payload(ptrTx, buffer);
     dsha256(buffer, (uint32_t) txWidth, result);
     FREE(buffer, "hash_tx:buffer");
 }
 
-struct HashNode {
-    SHA256_HASH hash;
-    struct HashNode *next;
-};
-
-typedef struct HashNode HashNode;
+// Txs differ in width, so only the second round can go through the batch engine
+void hash_txs(TxPayload txs[], uint64_t txCount, Byte *results) {
+    uint64_t maxWidth = 0;
+    for (uint64_t i = 0; i < txCount; i++) {
+        uint64_t width = calc_tx_payload_width(&txs[i]);
+        maxWidth = width > maxWidth ? width : maxWidth;
+    }
+    Byte *buffer = MALLOC(maxWidth, "hash_txs:buffer");
+    for (uint64_t i = 0; i < txCount; i++) {
+        uint64_t txWidth = serialize_tx_payload(&txs[i], buffer);
+        sha256_stream(buffer, txWidth, results + i * SHA256_LENGTH);
+    }
+    FREE(buffer, "hash_txs:buffer");
+    sha256_batch(results, SHA256_LENGTH, txCount, results);
+}
 
 // @see https://en.bitcoin.it/wiki/Getblocktemplate#How_to_build_merkle_root
 
 int32_t compute_merkle_root(TxPayload txs[], uint64_t txCount, SHA256_HASH result) {
-    // Hash the linked tx list
-    HashNode *ptrFirstHashNode = NULL;
-    HashNode *ptrPreviousHashNode = NULL;
-    for (uint64_t i = 0; i < txCount; i++) {
-        HashNode *newHashNode = CALLOC(1, sizeof(HashNode), "compute_merkle_root:HashNode");
-        hash_tx(&txs[i], newHashNode->hash);
-        if (!ptrFirstHashNode) {
-            ptrFirstHashNode = newHashNode;
-        }
-        if (ptrPreviousHashNode) {
-            ptrPreviousHashNode->next = newHashNode;
-        }
-        ptrPreviousHashNode = newHashNode;
-    }
-
-    if (!ptrFirstHashNode) {
+    if (txCount == 0) {
         return 1;
     }
+    // One spare slot to duplicate the last hash of an odd level
+    Byte *hashes = MALLOC((txCount + 1) * SHA256_LENGTH, "compute_merkle_root:hashes");
+    hash_txs(txs, txCount, hashes);
+    int32_t status = compute_merkle_root_in_place(hashes, txCount, result);
+    FREE(hashes, "compute_merkle_root:hashes");
+    return status;
+}
 
-    while (ptrFirstHashNode->next) {
-        HashNode *p = ptrFirstHashNode;
-        while (p) {
-            Byte *leftHash = p->hash;
-            Byte *rightHash = p->next ? p->next->hash : p->hash;
-            Byte buffer[SHA256_LENGTH * 2] = {0};
-            memcpy(buffer, leftHash, SHA256_LENGTH);
-            memcpy(buffer+SHA256_LENGTH, rightHash, SHA256_LENGTH);
-            dsha256(buffer, SHA256_LENGTH * 2, p->hash);
-            if (p->next) {
-                HashNode *freeTarget = p->next;
-                p->next = p->next->next;
-                p = p->next;
-                FREE(freeTarget, "compute_merkle_root:HashNode");
-            }
-            else {
-                p = NULL;
-            }
-        }
-    }
-    memcpy(result, ptrFirstHashNode->hash, SHA256_LENGTH);
-
-    FREE(ptrFirstHashNode, "compute_merkle_root:HashNode");
-    return 0;
+// Keeps every level, for branches and leaf updates
+int32_t build_tx_merkle_tree(TxPayload txs[], uint64_t txCount, MerkleTree *ptrTree) {
+    Byte *txHashes = MALLOC(txCount * SHA256_LENGTH, "build_tx_merkle_tree:txHashes");
+    hash_txs(txs, txCount, txHashes);
+    int32_t status = build_merkle_tree(txHashes, txCount, ptrTree);
+    FREE(txHashes, "build_tx_merkle_tree:txHashes");
+    return status;
 }
 
 void print_tx_payload(TxPayload *ptrTx) {
@@ -300,8 +317,8 @@ bool is_tx_legal(TxPayload *ptrTx) {
     for (uint64_t inputIndex = 0; inputIndex < ptrTx->txInputCount; inputIndex++) {
         TxIn *input = &ptrTx->txInputs[inputIndex];
         if (is_coinbase(input)) {
-            bool coinbaseLegal = input->signature_script_length <= mainnet.scriptSigSizeUpper
-                                 && input->signature_script_length >= mainnet.scriptSigSizeLower;
+            bool coinbaseLegal = input->signature_script_length <= params->scriptSigSizeUpper
+                                 && input->signature_script_length >= params->scriptSigSizeLower;
             if (!coinbaseLegal) {
                 inputsLegal = false;
                 break;
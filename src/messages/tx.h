@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include "datatypes.h"
 #include "hash.h"
+#include "merkle.h"
 #include "shared.h"
 
 // @see https://en.bitcoin.it/wiki/Protocol_documentation#tx
@@ -63,10 +64,12 @@ struct TxPayload {
 typedef struct TxPayload TxPayload;
 
 uint64_t serialize_tx_payload(TxPayload *ptrPayload, Byte *ptrBuffer);
+uint64_t calc_tx_payload_width(TxPayload *ptrPayload);
 uint64_t parse_into_tx_payload(Byte *ptrBuffer, TxPayload *ptrTx);
 uint64_t serialize_tx_message(Message *ptrPayload, Byte *ptrBuffer);
 int32_t make_tx_message(Message *ptrMessage, TxPayload *ptrPayload);
 int32_t compute_merkle_root(TxPayload txs[], uint64_t txCount, SHA256_HASH result);
+int32_t build_tx_merkle_tree(TxPayload txs[], uint64_t txCount, MerkleTree *ptrTree);
 void print_tx_payload(TxPayload *ptrTx);
 bool is_coinbase(TxIn *input);
 bool is_tx_legal(TxPayload *ptrTx);
@@ -75,4 +78,5 @@ void clone_tx(TxPayload *txFrom, TxPayload *txTo);
 uint64_t parse_tx_out(Byte *ptrBuffer, TxOut *ptrTxOut);
 uint64_t serialize_tx_out(TxOut *ptrTxOut, Byte *ptrBuffer);
 void hash_tx(TxPayload *ptrTx, SHA256_HASH result);
+void hash_txs(TxPayload txs[], uint64_t txCount, Byte *results);
 bool is_outpoint_empty(Outpoint *ptrOutpoint);
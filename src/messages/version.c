@@ -10,6 +10,7 @@
 #include "config.h"
 #include "utils/random.h"
 #include "utils/memory.h"
+#include "utils/pool.h"
 
 uint64_t serialize_version_payload(
     struct VersionPayload *ptrPayload,
@@ -51,7 +52,7 @@ uint32_t make_version_payload(
 
     uint8_t userAgentLengthWidth = calc_number_varint_width(userAgentDataLength);
 
-    return userAgentDataLength + userAgentLengthWidth + 85;
+    return userAgentDataLength + userAgentLengthWidth + VERSION_PAYLOAD_FIXED_WIDTH;
 }
 
 int32_t make_version_message(
@@ -61,9 +62,9 @@ int32_t make_version_message(
     VersionPayload payload;
     memset(&payload, 0, sizeof(payload));
     uint32_t payloadLength = make_version_payload(&payload, ptrPeer);
-    uint8_t checksumCalculationBuffer[MESSAGE_BUFFER_LENGTH] = {0};
+    Byte *checksumCalculationBuffer = acquire_buffer(payloadLength);
     serialize_version_payload(&payload, checksumCalculationBuffer);
-    ptrMessage->header.magic = mainnet.magic;
+    ptrMessage->header.magic = params->magic;
     strcpy((char *)ptrMessage->header.command, CMD_VERSION);
     ptrMessage->header.length = payloadLength;
     ptrMessage->ptrPayload = MALLOC(sizeof(VersionPayload), "make_message:payload");
@@ -73,6 +74,7 @@ int32_t make_version_message(
         ptrMessage->header.length,
         ptrMessage->header.checksum
     );
+    release_buffer(checksumCalculationBuffer);
     return 0;
 }
 
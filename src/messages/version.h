@@ -7,6 +7,9 @@
 
 // @see https://en.bitcoin.it/wiki/Protocol_documentation#version
 
+// Everything but the user agent varstr
+#define VERSION_PAYLOAD_FIXED_WIDTH 85
+
 struct VersionPayload {
     int32_t version;
     uint64_t services;
@@ -25,6 +28,16 @@ struct VersionPayload {
 
 typedef struct VersionPayload VersionPayload;
 
+uint32_t make_version_payload(
+    struct VersionPayload *ptrPayload,
+    struct Peer *ptrPeer
+);
+
+uint64_t serialize_version_payload(
+    struct VersionPayload *ptrPayload,
+    uint8_t *ptrBuffer
+);
+
 uint64_t serialize_version_message(
     Message *ptrMessage,
     uint8_t *ptrBuffer
@@ -1,41 +1,201 @@
 #include <stdint.h>
-#include <sys/time.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
 
 #include "messages/block.h"
 #include "mine.h"
 #include "blockchain.h"
+#include "config.h"
+#include "sha256.h"
 #include "utils/data.h"
+#include "utils/datetime.h"
+#include "utils/uint256.h"
 
-#define LOG_INTERVAL 1000000
+// The first 64 header bytes (version, previous block, most of the merkle root) stay fixed
+// for the whole search, so their SHA-256 state is computed once and each nonce only
+// hashes the last 16 bytes: the merkle root's tail, timestamp, target and nonce.
+#define HEADER_PREFIX_WIDTH 64
+#define HEADER_TAIL_WIDTH (sizeof(BlockPayloadHeader) - HEADER_PREFIX_WIDTH)
+#define TAIL_TIMESTAMP_OFFSET (offsetof(BlockPayloadHeader, timestamp) - HEADER_PREFIX_WIDTH)
+#define TAIL_NONCE_OFFSET (offsetof(BlockPayloadHeader, nonce) - HEADER_PREFIX_WIDTH)
 
+#define NONCE_SPACE (((uint64_t)UINT32_MAX) + 1)
 
-uint32_t mine_block_header(
-    BlockPayloadHeader header,
-    uint32_t initialNonce,
-    char *processLabel
+struct MiningJob {
+    Sha256Midstate midstate;
+    Byte tail[HEADER_TAIL_WIDTH];
+    Uint256 target;
+    uint32_t baseTimestamp;
+    uint32_t maxTimestampRolls;
+    uint32_t threadCount;
+    atomic_bool found;
+    uint32_t foundNonce;
+    uint32_t foundTimestamp;
+};
+
+struct MiningWorker {
+    struct MiningJob *ptrJob;
+    uint32_t index;
+    uv_thread_t thread;
+};
+
+// Live figures for get_mining_stats, readable from any thread
+static atomic_bool miningRunning;
+static atomic_uint_fast64_t minedHashes;
+static atomic_uint timestampRollsReached;
+static _Atomic(double) miningStartTime;
+static _Atomic(double) miningEndTime;
+static atomic_uint miningThreadCount;
+
+static uint32_t get_mining_thread_count() {
+    uint32_t threadCount = config.miningThreads;
+    if (threadCount == 0) {
+        uv_cpu_info_t *cpuInfos = NULL;
+        int cpuCount = 0;
+        if (uv_cpu_info(&cpuInfos, &cpuCount) == 0) {
+            uv_free_cpu_info(cpuInfos, cpuCount);
+        }
+        threadCount = cpuCount > 0 ? (uint32_t)cpuCount : 1;
+    }
+    return threadCount > MAX_MINING_THREADS ? MAX_MINING_THREADS : threadCount;
+}
+
+static void record_timestamp_roll(uint32_t roll) {
+    uint32_t reached = atomic_load(&timestampRollsReached);
+    while (roll > reached) {
+        if (atomic_compare_exchange_weak(&timestampRollsReached, &reached, roll)) {
+            break;
+        }
+    }
+}
+
+// Returns true when this worker claimed the solution
+static bool search_nonce_range(
+    struct MiningJob *ptrJob,
+    uint32_t timestamp,
+    uint64_t firstNonce,
+    uint64_t endNonce
 ) {
-    SHA256_HASH hash = {0xFF};
-    header.nonce = initialNonce;
-    struct timeval timer;
-    gettimeofday(&timer, NULL);
-    while (true) {
-        header.nonce++;
-        dsha256(&header, sizeof(header), hash);
-        if (header.nonce % LOG_INTERVAL == 0) {
-            int64_t oldSec = timer.tv_sec;
-            int64_t oldMicroSec = timer.tv_usec;
-            gettimeofday(&timer, NULL);
-            int64_t newSec = timer.tv_sec;
-            int64_t newMicroSec = timer.tv_usec;
-            double delta = (newSec - oldSec) + (newMicroSec - oldMicroSec) / 1e6;
-
-            printf("%s: trying nonce %u (%1.3lfs)\n", processLabel, header.nonce, delta);
-        }
-        if ((hash_satisfies_target_compact(hash, header.target))) {
-            printf("Found nonce=%u", header.nonce);
-            print_object(hash, SHA256_LENGTH);
+    Byte tails[MINING_NONCES_PER_BATCH][HEADER_TAIL_WIDTH];
+    Byte hashes[MINING_NONCES_PER_BATCH * SHA256_LENGTH];
+    for (uint32_t i = 0; i < MINING_NONCES_PER_BATCH; i++) {
+        memcpy(tails[i], ptrJob->tail, HEADER_TAIL_WIDTH);
+        memcpy(tails[i] + TAIL_TIMESTAMP_OFFSET, &timestamp, sizeof(timestamp));
+    }
+    for (uint64_t nonce = firstNonce; nonce < endNonce; nonce += MINING_NONCES_PER_BATCH) {
+        if (atomic_load_explicit(&ptrJob->found, memory_order_relaxed)) {
+            return false;
+        }
+        uint64_t batchSize = endNonce - nonce < MINING_NONCES_PER_BATCH ? endNonce - nonce : MINING_NONCES_PER_BATCH;
+        for (uint32_t i = 0; i < batchSize; i++) {
+            uint32_t candidate = (uint32_t)(nonce + i);
+            memcpy(tails[i] + TAIL_NONCE_OFFSET, &candidate, sizeof(candidate));
+        }
+        dsha256_batch_from_midstate(&ptrJob->midstate, (Byte *)tails, HEADER_TAIL_WIDTH, batchSize, hashes);
+        atomic_fetch_add_explicit(&minedHashes, batchSize, memory_order_relaxed);
+        for (uint32_t i = 0; i < batchSize; i++) {
+            Uint256 hashValue;
+            uint256_from_bytes(hashes + i * SHA256_LENGTH, &hashValue);
+            if (uint256_compare(&hashValue, &ptrJob->target) > 0) {
+                continue;
+            }
+            bool expected = false;
+            if (atomic_compare_exchange_strong(&ptrJob->found, &expected, true)) {
+                ptrJob->foundNonce = (uint32_t)(nonce + i);
+                ptrJob->foundTimestamp = timestamp;
+                return true;
+            }
+            return false;
+        }
+    }
+    return false;
+}
+
+// Each worker owns one contiguous shard of the nonce space and moves on to the next
+// timestamp when it runs out, so workers never wait on each other
+static void run_mining_worker(void *arg) {
+    struct MiningWorker *ptrWorker = arg;
+    struct MiningJob *ptrJob = ptrWorker->ptrJob;
+    uint64_t shardWidth = NONCE_SPACE / ptrJob->threadCount;
+    uint64_t firstNonce = shardWidth * ptrWorker->index;
+    uint64_t endNonce = ptrWorker->index == ptrJob->threadCount - 1 ? NONCE_SPACE : firstNonce + shardWidth;
+    for (uint32_t roll = 0; roll <= ptrJob->maxTimestampRolls; roll++) {
+        record_timestamp_roll(roll);
+        if (search_nonce_range(ptrJob, ptrJob->baseTimestamp + roll, firstNonce, endNonce)) {
+            return;
+        }
+        if (atomic_load(&ptrJob->found)) {
+            return;
+        }
+    }
+}
+
+void get_mining_stats(MiningStats *ptrStats) {
+    bool running = atomic_load(&miningRunning);
+    double end = running ? get_now() : atomic_load(&miningEndTime);
+    ptrStats->running = running;
+    ptrStats->hashes = atomic_load(&minedHashes);
+    ptrStats->elapsed = end - atomic_load(&miningStartTime);
+    ptrStats->hashrate = ptrStats->elapsed > 0 ? ptrStats->hashes / (ptrStats->elapsed / 1000) : 0;
+    ptrStats->timestampRolls = atomic_load(&timestampRollsReached);
+    ptrStats->threads = atomic_load(&miningThreadCount);
+}
+
+// Searches nonces on config.miningThreads threads, advancing the timestamp by one second
+// each time the nonce space is exhausted, at most maxTimestampRolls times.
+// On success (0) the header carries the winning nonce and timestamp; otherwise returns -1 when
+// the search is exhausted, -2 when a worker cannot start and -3 for an unusable target.
+int8_t mine_block_header(BlockPayloadHeader *ptrHeader, uint32_t maxTimestampRolls, MiningStats *ptrStats) {
+    struct MiningJob job;
+    memset(&job, 0, sizeof(job));
+    sha256_midstate((Byte *)ptrHeader, HEADER_PREFIX_WIDTH, &job.midstate);
+    memcpy(job.tail, (Byte *)ptrHeader + HEADER_PREFIX_WIDTH, HEADER_TAIL_WIDTH);
+    if (uint256_from_compact(ptrHeader->target, &job.target) || uint256_is_zero(&job.target)) {
+        fprintf(stderr, "mine_block_header: invalid target %x\n", ptrHeader->target);
+        return -3;
+    }
+    job.baseTimestamp = ptrHeader->timestamp;
+    job.maxTimestampRolls = maxTimestampRolls;
+    job.threadCount = get_mining_thread_count();
+    atomic_init(&job.found, false);
+
+    atomic_store(&minedHashes, 0);
+    atomic_store(&timestampRollsReached, 0);
+    atomic_store(&miningThreadCount, job.threadCount);
+    atomic_store(&miningStartTime, get_now());
+    atomic_store(&miningRunning, true);
+
+    struct MiningWorker workers[MAX_MINING_THREADS];
+    uint32_t startedCount = 0;
+    for (uint32_t i = 0; i < job.threadCount; i++) {
+        workers[i].ptrJob = &job;
+        workers[i].index = i;
+        if (uv_thread_create(&workers[i].thread, &run_mining_worker, &workers[i])) {
+            fprintf(stderr, "mine_block_header: cannot start worker %u\n", i);
+            atomic_store(&job.found, true);
             break;
         }
+        startedCount++;
+    }
+    for (uint32_t i = 0; i < startedCount; i++) {
+        uv_thread_join(&workers[i].thread);
+    }
+
+    atomic_store(&miningEndTime, get_now());
+    atomic_store(&miningRunning, false);
+    if (ptrStats) {
+        get_mining_stats(ptrStats);
+    }
+
+    if (startedCount < job.threadCount) {
+        return -2;
+    }
+    if (!atomic_load(&job.found)) {
+        return -1;
     }
-    return header.nonce;
+    ptrHeader->nonce = job.foundNonce;
+    ptrHeader->timestamp = job.foundTimestamp;
+    return 0;
 }
@@ -1,9 +1,24 @@
 #pragma once
 
+#include <stdint.h>
+#include <stdbool.h>
 #include "messages/block.h"
 
-uint32_t mine_block_header(
-    BlockPayloadHeader header,
-    uint32_t initialNonce,
-    char *processLabel
-);
+#define MAX_MINING_THREADS 64
+
+// Nonces handed to the batch hasher at once; a multiple of the engine's lane count
+#define MINING_NONCES_PER_BATCH 64
+
+struct MiningStats {
+    bool running;
+    uint64_t hashes;
+    double elapsed; // ms
+    double hashrate; // hashes per second
+    uint32_t timestampRolls;
+    uint32_t threads;
+};
+
+typedef struct MiningStats MiningStats;
+
+int8_t mine_block_header(BlockPayloadHeader *ptrHeader, uint32_t maxTimestampRolls, MiningStats *ptrStats);
+void get_mining_stats(MiningStats *ptrStats);
@@ -0,0 +1,882 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "storage.h"
+#include "messages/header.h"
+#include "utils/memory.h"
+
+// Open-addressing hash table in a memory-mapped file, with linear probing and removals that
+// shift followers back, as in the UTXO cache. Slots are fixed-width: a short header, the key
+// and an inline value area. Values too long for it are appended to an overflow file, which
+// is compacted once most of it is garbage.
+// Every batch is written to a journal before it touches the table and the journal is
+// emptied after. A journal found complete on opening belongs to a batch the process died
+// applying: the table is rehashed, dropping the duplicate an interrupted removal can leave,
+// and the batch applied again. Changes in the map survive a process crash; a power loss is
+// only covered for batches committed with sync.
+
+#define MMAP_TABLE_MAGIC "tbchtab\n"
+#define MMAP_JOURNAL_MAGIC "tbcjrnl\n"
+#define MMAP_MAGIC_WIDTH 8
+#define MMAP_TABLE_VERSION 1
+#define MMAP_HEADER_WIDTH 4096 // a page, so slots start page-aligned
+#define MMAP_MIN_SLOTS 1024
+#define MMAP_MAX_LOAD 0.75
+#define MMAP_MAX_KEY_WIDTH 255
+#define MMAP_SLOT_USED 1
+#define MMAP_OPERATION_HEADER_WIDTH 6 // removal flag, key width, 4-byte value width
+#define MMAP_RECORD_HEADER_WIDTH 5 // key width, 4-byte value width
+#define MMAP_COMPACT_MIN_GARBAGE (16 * 1024 * 1024) // bytes
+
+#define TABLE_FILENAME "table.dat"
+#define REBUILT_TABLE_FILENAME "table.new"
+#define OVERFLOW_FILENAME "overflow.dat"
+#define COMPACTED_OVERFLOW_FILENAME "overflow.new"
+#define JOURNAL_FILENAME "journal.dat"
+
+struct MmapTableHeader {
+    char magic[MMAP_MAGIC_WIDTH];
+    uint32_t version;
+    uint32_t slotWidth;
+    uint32_t maxKeyWidth;
+    uint32_t inlineValueWidth;
+    uint64_t slotCount; // a power of two
+    uint64_t used;
+    uint64_t overflowEnd; // where the next overflow record goes
+    uint64_t overflowLive; // bytes of overflow records still referenced
+    bool compacting; // slots may point into the overflow file that was replaced
+};
+
+// Followed by maxKeyWidth bytes of key, then inlineValueWidth bytes holding either the value
+// or, when it is longer, the offset of its overflow record
+struct MmapSlot {
+    uint8_t state;
+    uint8_t keyWidth;
+    uint16_t reserved;
+    uint32_t valueWidth;
+};
+
+// Overflow records carry their key, so a slot's offset can be checked on every read and
+// found again by a scan after an interrupted compaction
+struct MmapStore {
+    int tableFile;
+    int overflowFile;
+    int journalFile;
+    Byte *map;
+    uint64_t mapWidth;
+    uv_rwlock_t lock;
+    char path[MAX_STORAGE_PATH_LENGTH];
+};
+
+// The journal holds the batch body as is, between a header and a checksum of the body
+struct MmapBatch {
+    bool invalid;
+    Byte *data;
+    uint64_t width;
+    uint64_t capacity;
+    uint64_t count;
+};
+
+struct MmapJournalHeader {
+    char magic[MMAP_MAGIC_WIDTH];
+    uint64_t count;
+    uint64_t width;
+};
+
+static struct MmapTableHeader *get_header(Byte *map) {
+    return (struct MmapTableHeader*)map;
+}
+
+static struct MmapSlot *get_slot(Byte *map, uint64_t index) {
+    return (struct MmapSlot*)(map + MMAP_HEADER_WIDTH + index * get_header(map)->slotWidth);
+}
+
+static Byte *get_slot_key(struct MmapSlot *slot) {
+    return (Byte*)slot + sizeof(struct MmapSlot);
+}
+
+static Byte *get_slot_value(Byte *map, struct MmapSlot *slot) {
+    return get_slot_key(slot) + get_header(map)->maxKeyWidth;
+}
+
+static bool is_overflow(Byte *map, struct MmapSlot *slot) {
+    return slot->valueWidth > get_header(map)->inlineValueWidth;
+}
+
+static uint64_t get_overflow_offset(Byte *map, struct MmapSlot *slot) {
+    uint64_t offset = 0;
+    memcpy(&offset, get_slot_value(map, slot), sizeof(offset));
+    return offset;
+}
+
+static uint64_t get_record_width(struct MmapSlot *slot) {
+    return MMAP_RECORD_HEADER_WIDTH + slot->keyWidth + slot->valueWidth;
+}
+
+static void make_store_path(struct MmapStore *store, char *filename, char *path) {
+    sprintf(path, "%s/%s", store->path, filename);
+}
+
+// FNV-1a, finished with a mixer since the table index comes from the low bits
+static uint64_t hash_key(Byte *key, size_t width) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < width; i++) {
+        h ^= key[i];
+        h *= 0x100000001B3ULL;
+    }
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 29;
+    return h;
+}
+
+// Slot holding the key, or the empty slot where it would go
+static uint64_t find_slot(Byte *map, Byte *key, size_t keyWidth, bool *found) {
+    uint64_t mask = get_header(map)->slotCount - 1;
+    uint64_t index = hash_key(key, keyWidth) & mask;
+    while (true) {
+        struct MmapSlot *slot = get_slot(map, index);
+        if (slot->state != MMAP_SLOT_USED) {
+            *found = false;
+            return index;
+        }
+        if (slot->keyWidth == keyWidth && memcmp(get_slot_key(slot), key, keyWidth) == 0) {
+            *found = true;
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+static int8_t read_overflow_record(int file, uint64_t offset, Byte *key, size_t keyWidth, Byte *value, uint32_t width) {
+    Byte header[MMAP_RECORD_HEADER_WIDTH + MMAP_MAX_KEY_WIDTH];
+    uint64_t headerWidth = MMAP_RECORD_HEADER_WIDTH + keyWidth;
+    if (pread(file, header, headerWidth, (off_t)offset) != (ssize_t)headerWidth) {
+        return -1;
+    }
+    uint32_t recordValueWidth = 0;
+    memcpy(&recordValueWidth, header + 1, sizeof(recordValueWidth));
+    bool matched =
+        header[0] == keyWidth
+        && recordValueWidth == width
+        && memcmp(header + MMAP_RECORD_HEADER_WIDTH, key, keyWidth) == 0;
+    if (!matched) {
+        fprintf(stderr, "mmap storage: overflow record at %llu does not match its slot\n", offset);
+        return -2;
+    }
+    if (pread(file, value, width, (off_t)(offset + headerWidth)) != (ssize_t)width) {
+        return -1;
+    }
+    return 0;
+}
+
+static int8_t append_overflow_record(struct MmapStore *store, Byte *key, size_t keyWidth, Byte *value, uint32_t width) {
+    struct MmapTableHeader *header = get_header(store->map);
+    Byte recordHeader[MMAP_RECORD_HEADER_WIDTH];
+    recordHeader[0] = (Byte)keyWidth;
+    memcpy(recordHeader + 1, &width, sizeof(width));
+    uint64_t offset = header->overflowEnd;
+    bool written =
+        pwrite(store->overflowFile, recordHeader, MMAP_RECORD_HEADER_WIDTH, (off_t)offset) == MMAP_RECORD_HEADER_WIDTH
+        && pwrite(store->overflowFile, key, keyWidth, (off_t)(offset + MMAP_RECORD_HEADER_WIDTH)) == (ssize_t)keyWidth
+        && pwrite(store->overflowFile, value, width, (off_t)(offset + MMAP_RECORD_HEADER_WIDTH + keyWidth)) == (ssize_t)width;
+    if (!written) {
+        fprintf(stderr, "mmap storage: overflow write failed: %s\n", strerror(errno));
+        return -1;
+    }
+    header->overflowEnd += MMAP_RECORD_HEADER_WIDTH + keyWidth + width;
+    header->overflowLive += MMAP_RECORD_HEADER_WIDTH + keyWidth + width;
+    return 0;
+}
+
+static void release_overflow_record(Byte *map, struct MmapSlot *slot) {
+    if (is_overflow(map, slot)) {
+        get_header(map)->overflowLive -= get_record_width(slot);
+    }
+}
+
+static Byte *map_table_file(int file, uint64_t width) {
+    Byte *map = mmap(NULL, width, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "mmap storage: cannot map %llu bytes: %s\n", width, strerror(errno));
+        return NULL;
+    }
+    return map;
+}
+
+// Rehashes every entry into a fresh file of slotCount slots, which then replaces the table.
+// Keys met twice are copies left by an interrupted removal and are kept once
+static int8_t rebuild_table(struct MmapStore *store, uint64_t slotCount) {
+    struct MmapTableHeader *oldHeader = get_header(store->map);
+    char path[MAX_STORAGE_PATH_LENGTH + 16] = {0};
+    char tablePath[MAX_STORAGE_PATH_LENGTH + 16] = {0};
+    make_store_path(store, REBUILT_TABLE_FILENAME, path);
+    make_store_path(store, TABLE_FILENAME, tablePath);
+    uint64_t mapWidth = MMAP_HEADER_WIDTH + slotCount * oldHeader->slotWidth;
+    int file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (file < 0 || ftruncate(file, (off_t)mapWidth)) {
+        fprintf(stderr, "mmap storage: cannot create %s: %s\n", path, strerror(errno));
+        if (file >= 0) {
+            close(file);
+        }
+        return -1;
+    }
+    Byte *map = map_table_file(file, mapWidth);
+    if (!map) {
+        close(file);
+        unlink(path);
+        return -2;
+    }
+    struct MmapTableHeader *header = get_header(map);
+    memcpy(header, oldHeader, sizeof(*header));
+    header->slotCount = slotCount;
+    header->used = 0;
+    header->overflowLive = 0;
+    for (uint64_t i = 0; i < oldHeader->slotCount; i++) {
+        struct MmapSlot *oldSlot = get_slot(store->map, i);
+        if (oldSlot->state != MMAP_SLOT_USED) {
+            continue;
+        }
+        bool found = false;
+        uint64_t index = find_slot(map, get_slot_key(oldSlot), oldSlot->keyWidth, &found);
+        if (found) {
+            continue;
+        }
+        memcpy(get_slot(map, index), oldSlot, header->slotWidth);
+        header->used++;
+        if (is_overflow(map, oldSlot)) {
+            header->overflowLive += get_record_width(oldSlot);
+        }
+    }
+    msync(map, mapWidth, MS_SYNC);
+    if (rename(path, tablePath)) {
+        fprintf(stderr, "mmap storage: cannot replace the table: %s\n", strerror(errno));
+        munmap(map, mapWidth);
+        close(file);
+        unlink(path);
+        return -3;
+    }
+    munmap(store->map, store->mapWidth);
+    close(store->tableFile);
+    store->map = map;
+    store->mapWidth = mapWidth;
+    store->tableFile = file;
+    return 0;
+}
+
+static int8_t put_entry(struct MmapStore *store, Byte *key, size_t keyWidth, Byte *value, uint32_t width) {
+    struct MmapTableHeader *header = get_header(store->map);
+    if (keyWidth > header->maxKeyWidth) {
+        fprintf(stderr, "mmap storage: %llu-byte key over the %u-byte limit\n", (uint64_t)keyWidth, header->maxKeyWidth);
+        return -1;
+    }
+    if (header->used + 1 > header->slotCount * MMAP_MAX_LOAD) {
+        if (rebuild_table(store, header->slotCount * 2)) {
+            return -2;
+        }
+        header = get_header(store->map);
+    }
+    bool found = false;
+    struct MmapSlot *slot = get_slot(store->map, find_slot(store->map, key, keyWidth, &found));
+    Byte *slotValue = get_slot_value(store->map, slot);
+    if (width > header->inlineValueWidth) {
+        uint64_t offset = header->overflowEnd;
+        if (append_overflow_record(store, key, keyWidth, value, width)) {
+            return -3;
+        }
+        if (found) {
+            release_overflow_record(store->map, slot);
+        }
+        memcpy(slotValue, &offset, sizeof(offset));
+    }
+    else {
+        if (found) {
+            release_overflow_record(store->map, slot);
+        }
+        memcpy(slotValue, value, width);
+    }
+    if (!found) {
+        slot->keyWidth = (uint8_t)keyWidth;
+        memcpy(get_slot_key(slot), key, keyWidth);
+        header->used++;
+    }
+    slot->valueWidth = width;
+    slot->state = MMAP_SLOT_USED;
+    return 0;
+}
+
+static void remove_entry(struct MmapStore *store, Byte *key, size_t keyWidth) {
+    Byte *map = store->map;
+    struct MmapTableHeader *header = get_header(map);
+    if (keyWidth > header->maxKeyWidth) {
+        return;
+    }
+    bool found = false;
+    uint64_t hole = find_slot(map, key, keyWidth, &found);
+    if (!found) {
+        return;
+    }
+    release_overflow_record(map, get_slot(map, hole));
+    header->used--;
+
+    uint64_t mask = header->slotCount - 1;
+    for (uint64_t next = (hole + 1) & mask; get_slot(map, next)->state == MMAP_SLOT_USED; next = (next + 1) & mask) {
+        struct MmapSlot *slot = get_slot(map, next);
+        uint64_t home = hash_key(get_slot_key(slot), slot->keyWidth) & mask;
+        // Movable unless its home lies between the hole and itself
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            memcpy(get_slot(map, hole), slot, header->slotWidth);
+            hole = next;
+        }
+    }
+    memset(get_slot(map, hole), 0, header->slotWidth);
+}
+
+static int8_t apply_operations(struct MmapStore *store, Byte *data, uint64_t width) {
+    uint64_t offset = 0;
+    while (offset < width) {
+        bool removal = data[offset];
+        uint8_t keyWidth = data[offset + 1];
+        uint32_t valueWidth = 0;
+        memcpy(&valueWidth, data + offset + 2, sizeof(valueWidth));
+        Byte *key = data + offset + MMAP_OPERATION_HEADER_WIDTH;
+        if (removal) {
+            remove_entry(store, key, keyWidth);
+        }
+        else if (put_entry(store, key, keyWidth, key + keyWidth, valueWidth)) {
+            return -1;
+        }
+        offset += MMAP_OPERATION_HEADER_WIDTH + keyWidth + valueWidth;
+    }
+    return 0;
+}
+
+static int8_t write_journal(struct MmapStore *store, struct MmapBatch *batch, bool sync) {
+    struct MmapJournalHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MMAP_JOURNAL_MAGIC, MMAP_MAGIC_WIDTH);
+    header.count = batch->count;
+    header.width = batch->width;
+    PayloadChecksum checksum = {0};
+    calculate_data_checksum(batch->data, (uint32_t)batch->width, checksum);
+    bool written =
+        pwrite(store->journalFile, &header, sizeof(header), 0) == sizeof(header)
+        && pwrite(store->journalFile, batch->data, batch->width, sizeof(header)) == (ssize_t)batch->width
+        && pwrite(store->journalFile, checksum, CHECKSUM_SIZE, (off_t)(sizeof(header) + batch->width)) == CHECKSUM_SIZE;
+    if (!written || (sync && fdatasync(store->journalFile))) {
+        fprintf(stderr, "mmap storage: journal write failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void clear_journal(struct MmapStore *store) {
+    if (ftruncate(store->journalFile, 0)) {
+        fprintf(stderr, "mmap storage: cannot clear the journal: %s\n", strerror(errno));
+    }
+}
+
+// Copies the live overflow records, in slot order, to a new file that replaces the old one,
+// then points the slots at their copies
+static void compact_overflow_if_needed(struct MmapStore *store) {
+    Byte *map = store->map;
+    struct MmapTableHeader *header = get_header(map);
+    uint64_t garbage = header->overflowEnd - header->overflowLive;
+    if (garbage < MMAP_COMPACT_MIN_GARBAGE || garbage < header->overflowLive) {
+        return;
+    }
+    char path[MAX_STORAGE_PATH_LENGTH + 16] = {0};
+    char overflowPath[MAX_STORAGE_PATH_LENGTH + 16] = {0};
+    make_store_path(store, COMPACTED_OVERFLOW_FILENAME, path);
+    make_store_path(store, OVERFLOW_FILENAME, overflowPath);
+    int file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (file < 0) {
+        return;
+    }
+    Byte *buffer = NULL;
+    uint64_t bufferCapacity = 0;
+    uint64_t end = 0;
+    bool copied = true;
+    for (uint64_t i = 0; i < header->slotCount && copied; i++) {
+        struct MmapSlot *slot = get_slot(map, i);
+        if (slot->state != MMAP_SLOT_USED || !is_overflow(map, slot)) {
+            continue;
+        }
+        uint64_t width = get_record_width(slot);
+        if (width > bufferCapacity) {
+            if (buffer) {
+                FREE(buffer, "mmap_storage:record");
+            }
+            bufferCapacity = width * 2;
+            buffer = MALLOC(bufferCapacity, "mmap_storage:record");
+        }
+        copied =
+            pread(store->overflowFile, buffer, width, (off_t)get_overflow_offset(map, slot)) == (ssize_t)width
+            && pwrite(file, buffer, width, (off_t)end) == (ssize_t)width;
+        end += width;
+    }
+    if (buffer) {
+        FREE(buffer, "mmap_storage:record");
+    }
+    if (!copied || fsync(file)) {
+        close(file);
+        unlink(path);
+        return;
+    }
+    header->compacting = true;
+    msync(map, MMAP_HEADER_WIDTH, MS_SYNC);
+    if (rename(path, overflowPath)) {
+        header->compacting = false;
+        close(file);
+        unlink(path);
+        return;
+    }
+    uint64_t offset = 0;
+    for (uint64_t i = 0; i < header->slotCount; i++) {
+        struct MmapSlot *slot = get_slot(map, i);
+        if (slot->state != MMAP_SLOT_USED || !is_overflow(map, slot)) {
+            continue;
+        }
+        memcpy(get_slot_value(map, slot), &offset, sizeof(offset));
+        offset += get_record_width(slot);
+    }
+    close(store->overflowFile);
+    store->overflowFile = file;
+    header->overflowEnd = end;
+    header->overflowLive = end;
+    msync(map, store->mapWidth, MS_SYNC);
+    header->compacting = false;
+}
+
+// After a compaction cut short between replacing the file and updating the slots: the last
+// record of each key in the overflow file is its current value
+static void recover_overflow_offsets(struct MmapStore *store) {
+    printf("mmap storage: recovering overflow offsets in %s\n", store->path);
+    Byte *map = store->map;
+    struct MmapTableHeader *header = get_header(map);
+    struct stat st;
+    fstat(store->overflowFile, &st);
+    uint64_t size = (uint64_t)st.st_size;
+    uint64_t offset = 0;
+    Byte recordHeader[MMAP_RECORD_HEADER_WIDTH + MMAP_MAX_KEY_WIDTH];
+    while (offset + MMAP_RECORD_HEADER_WIDTH <= size) {
+        if (pread(store->overflowFile, recordHeader, sizeof(recordHeader), (off_t)offset) < MMAP_RECORD_HEADER_WIDTH) {
+            break;
+        }
+        uint8_t keyWidth = recordHeader[0];
+        uint32_t valueWidth = 0;
+        memcpy(&valueWidth, recordHeader + 1, sizeof(valueWidth));
+        uint64_t width = MMAP_RECORD_HEADER_WIDTH + keyWidth + valueWidth;
+        if (offset + width > size) {
+            break;
+        }
+        if (keyWidth <= header->maxKeyWidth) {
+            bool found = false;
+            struct MmapSlot *slot = get_slot(map, find_slot(map, recordHeader + MMAP_RECORD_HEADER_WIDTH, keyWidth, &found));
+            if (found && is_overflow(map, slot) && slot->valueWidth == valueWidth) {
+                memcpy(get_slot_value(map, slot), &offset, sizeof(offset));
+            }
+        }
+        offset += width;
+    }
+    header->overflowEnd = size;
+    header->overflowLive = 0;
+    for (uint64_t i = 0; i < header->slotCount; i++) {
+        struct MmapSlot *slot = get_slot(map, i);
+        if (slot->state == MMAP_SLOT_USED && is_overflow(map, slot)) {
+            header->overflowLive += get_record_width(slot);
+        }
+    }
+    header->compacting = false;
+    msync(map, store->mapWidth, MS_SYNC);
+}
+
+static void replay_journal(struct MmapStore *store) {
+    struct MmapJournalHeader header;
+    bool present =
+        pread(store->journalFile, &header, sizeof(header), 0) == sizeof(header)
+        && memcmp(header.magic, MMAP_JOURNAL_MAGIC, MMAP_MAGIC_WIDTH) == 0;
+    if (!present) {
+        clear_journal(store);
+        return;
+    }
+    Byte *body = MALLOC(header.width + CHECKSUM_SIZE, "mmap_storage:journal");
+    PayloadChecksum checksum = {0};
+    bool complete = pread(store->journalFile, body, header.width + CHECKSUM_SIZE, sizeof(header)) == (ssize_t)(header.width + CHECKSUM_SIZE);
+    if (complete) {
+        calculate_data_checksum(body, (uint32_t)header.width, checksum);
+    }
+    // An incomplete journal means the batch never reached the table
+    if (complete && memcmp(checksum, body + header.width, CHECKSUM_SIZE) == 0) {
+        printf("mmap storage: replaying %llu operations in %s\n", header.count, store->path);
+        if (!rebuild_table(store, get_header(store->map)->slotCount) && !apply_operations(store, body, header.width)) {
+            msync(store->map, store->mapWidth, MS_SYNC);
+            fsync(store->overflowFile);
+            clear_journal(store);
+        }
+    }
+    else {
+        clear_journal(store);
+    }
+    FREE(body, "mmap_storage:journal");
+}
+
+static uint64_t round_up_to_power_of_two(uint64_t n) {
+    uint64_t power = 1;
+    while (power < n) {
+        power <<= 1;
+    }
+    return power;
+}
+
+static int8_t create_table(struct MmapStore *store, StorageOptions *options) {
+    struct MmapTableHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MMAP_TABLE_MAGIC, MMAP_MAGIC_WIDTH);
+    header.version = MMAP_TABLE_VERSION;
+    header.maxKeyWidth = options->maxKeyWidth;
+    header.inlineValueWidth = options->inlineValueWidth < sizeof(uint64_t) ? sizeof(uint64_t) : options->inlineValueWidth;
+    uint32_t slotWidth = sizeof(struct MmapSlot) + header.maxKeyWidth + header.inlineValueWidth;
+    header.slotWidth = (slotWidth + 7) / 8 * 8;
+    header.inlineValueWidth = header.slotWidth - sizeof(struct MmapSlot) - header.maxKeyWidth;
+    header.slotCount = round_up_to_power_of_two(options->initialSlots < MMAP_MIN_SLOTS ? MMAP_MIN_SLOTS : options->initialSlots);
+    store->mapWidth = MMAP_HEADER_WIDTH + header.slotCount * header.slotWidth;
+    if (ftruncate(store->tableFile, (off_t)store->mapWidth)) {
+        return -1;
+    }
+    store->map = map_table_file(store->tableFile, store->mapWidth);
+    if (!store->map) {
+        return -2;
+    }
+    memcpy(store->map, &header, sizeof(header));
+    return 0;
+}
+
+static int8_t map_existing_table(struct MmapStore *store, uint64_t fileSize) {
+    struct MmapTableHeader header;
+    bool recognized =
+        pread(store->tableFile, &header, sizeof(header), 0) == sizeof(header)
+        && memcmp(header.magic, MMAP_TABLE_MAGIC, MMAP_MAGIC_WIDTH) == 0
+        && header.version == MMAP_TABLE_VERSION
+        && fileSize == MMAP_HEADER_WIDTH + header.slotCount * header.slotWidth;
+    if (!recognized) {
+        fprintf(stderr, "mmap storage: %s/%s is not a table this version can read\n", store->path, TABLE_FILENAME);
+        return -1;
+    }
+    store->mapWidth = fileSize;
+    store->map = map_table_file(store->tableFile, store->mapWidth);
+    return store->map ? 0 : -2;
+}
+
+static void close_files(struct MmapStore *store) {
+    if (store->map) {
+        munmap(store->map, store->mapWidth);
+    }
+    int files[] = {store->tableFile, store->overflowFile, store->journalFile};
+    for (uint8_t i = 0; i < 3; i++) {
+        if (files[i] >= 0) {
+            close(files[i]);
+        }
+    }
+}
+
+static void *open_mmap(char *path, StorageOptions *options) {
+    if (options->maxKeyWidth == 0 || options->maxKeyWidth > MMAP_MAX_KEY_WIDTH) {
+        fprintf(stderr, "mmap storage: key width limit must be 1 to %u\n", MMAP_MAX_KEY_WIDTH);
+        return NULL;
+    }
+    mkdir(path, 0744);
+    struct MmapStore *store = CALLOC(1, sizeof(*store), "mmap_store");
+    strcpy(store->path, path);
+    char filePath[MAX_STORAGE_PATH_LENGTH + 16] = {0};
+    make_store_path(store, TABLE_FILENAME, filePath);
+    store->tableFile = open(filePath, O_RDWR | O_CREAT, 0644);
+    make_store_path(store, OVERFLOW_FILENAME, filePath);
+    store->overflowFile = open(filePath, O_RDWR | O_CREAT, 0644);
+    make_store_path(store, JOURNAL_FILENAME, filePath);
+    store->journalFile = open(filePath, O_RDWR | O_CREAT, 0644);
+    int8_t status = 0;
+    if (store->tableFile < 0 || store->overflowFile < 0 || store->journalFile < 0) {
+        fprintf(stderr, "mmap storage: cannot open files in %s: %s\n", path, strerror(errno));
+        status = -1;
+    }
+    else {
+        struct stat st;
+        fstat(store->tableFile, &st);
+        status = st.st_size == 0 ? create_table(store, options) : map_existing_table(store, (uint64_t)st.st_size);
+    }
+    if (status) {
+        close_files(store);
+        FREE(store, "mmap_store");
+        return NULL;
+    }
+    // Leftovers of a rebuild or compaction that never replaced anything
+    make_store_path(store, REBUILT_TABLE_FILENAME, filePath);
+    unlink(filePath);
+    make_store_path(store, COMPACTED_OVERFLOW_FILENAME, filePath);
+    unlink(filePath);
+    if (get_header(store->map)->compacting) {
+        recover_overflow_offsets(store);
+    }
+    replay_journal(store);
+    uv_rwlock_init(&store->lock);
+    return store;
+}
+
+static void close_mmap(void *handle) {
+    struct MmapStore *store = handle;
+    msync(store->map, store->mapWidth, MS_SYNC);
+    fsync(store->overflowFile);
+    close_files(store);
+    uv_rwlock_destroy(&store->lock);
+    FREE(store, "mmap_store");
+}
+
+static int8_t destroy_mmap(char *path) {
+    char *filenames[] = {
+        TABLE_FILENAME,
+        REBUILT_TABLE_FILENAME,
+        OVERFLOW_FILENAME,
+        COMPACTED_OVERFLOW_FILENAME,
+        JOURNAL_FILENAME,
+    };
+    char filePath[MAX_STORAGE_PATH_LENGTH + 16] = {0};
+    for (uint8_t i = 0; i < sizeof(filenames) / sizeof(filenames[0]); i++) {
+        sprintf(filePath, "%s/%s", path, filenames[i]);
+        unlink(filePath);
+    }
+    if (rmdir(path) && errno != ENOENT) {
+        fprintf(stderr, "Database destruction: fail: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int8_t get_from_mmap(void *handle, Byte *key, size_t keyWidth, Byte *value, size_t capacity, size_t *width) {
+    struct MmapStore *store = handle;
+    uv_rwlock_rdlock(&store->lock);
+    Byte *map = store->map;
+    int8_t status = -1;
+    bool found = false;
+    struct MmapSlot *slot = NULL;
+    if (keyWidth <= get_header(map)->maxKeyWidth) {
+        slot = get_slot(map, find_slot(map, key, keyWidth, &found));
+    }
+    if (!found) {
+        status = -1;
+    }
+    else if (slot->valueWidth > capacity) {
+        status = -3;
+    }
+    else if (is_overflow(map, slot)) {
+        status = read_overflow_record(store->overflowFile, get_overflow_offset(map, slot), key, keyWidth, value, slot->valueWidth) ? -2 : 0;
+    }
+    else {
+        memcpy(value, get_slot_value(map, slot), slot->valueWidth);
+        status = 0;
+    }
+    if (status == 0) {
+        *width = slot->valueWidth;
+    }
+    uv_rwlock_rdunlock(&store->lock);
+    return status;
+}
+
+static void *create_mmap_batch(void *handle) {
+    return CALLOC(1, sizeof(struct MmapBatch), "mmap_storage:batch");
+}
+
+static void append_operation(struct MmapBatch *batch, bool removal, Byte *key, size_t keyWidth, Byte *value, size_t width) {
+    if (keyWidth > MMAP_MAX_KEY_WIDTH || width > UINT32_MAX) {
+        batch->invalid = true;
+        return;
+    }
+    uint64_t needed = batch->width + MMAP_OPERATION_HEADER_WIDTH + keyWidth + width;
+    if (needed > batch->capacity) {
+        uint64_t capacity = batch->capacity * 2 > needed ? batch->capacity * 2 : needed;
+        Byte *grown = MALLOC(capacity, "mmap_storage:batch_data");
+        if (batch->data) {
+            memcpy(grown, batch->data, batch->width);
+            FREE(batch->data, "mmap_storage:batch_data");
+        }
+        batch->data = grown;
+        batch->capacity = capacity;
+    }
+    Byte *p = batch->data + batch->width;
+    uint32_t valueWidth = (uint32_t)width;
+    p[0] = removal;
+    p[1] = (Byte)keyWidth;
+    memcpy(p + 2, &valueWidth, sizeof(valueWidth));
+    memcpy(p + MMAP_OPERATION_HEADER_WIDTH, key, keyWidth);
+    if (width > 0) {
+        memcpy(p + MMAP_OPERATION_HEADER_WIDTH + keyWidth, value, width);
+    }
+    batch->width = needed;
+    batch->count++;
+}
+
+static void stage_mmap_put(void *batch, Byte *key, size_t keyWidth, Byte *value, size_t width) {
+    append_operation(batch, false, key, keyWidth, value, width);
+}
+
+static void stage_mmap_removal(void *batch, Byte *key, size_t keyWidth) {
+    append_operation(batch, true, key, keyWidth, NULL, 0);
+}
+
+static int8_t commit_mmap_batch(void *handle, void *ptrBatch, bool sync) {
+    struct MmapStore *store = handle;
+    struct MmapBatch *batch = ptrBatch;
+    if (batch->invalid || batch->width > UINT32_MAX) {
+        fprintf(stderr, "mmap storage: batch holds an oversized key or value\n");
+        return -1;
+    }
+    if (batch->count == 0) {
+        return 0;
+    }
+    uv_rwlock_wrlock(&store->lock);
+    int8_t status = write_journal(store, batch, sync);
+    if (!status && apply_operations(store, batch->data, batch->width)) {
+        // The journal stays, so the next opening finishes the batch
+        status = -2;
+    }
+    if (!status) {
+        compact_overflow_if_needed(store);
+        if (sync) {
+            msync(store->map, store->mapWidth, MS_SYNC);
+            fsync(store->overflowFile);
+        }
+        clear_journal(store);
+    }
+    uv_rwlock_wrunlock(&store->lock);
+    if (!status) {
+        batch->width = 0;
+        batch->count = 0;
+    }
+    return status;
+}
+
+static void destroy_mmap_batch(void *ptrBatch) {
+    struct MmapBatch *batch = ptrBatch;
+    if (batch->data) {
+        FREE(batch->data, "mmap_storage:batch_data");
+    }
+    FREE(batch, "mmap_storage:batch");
+}
+
+// Holds off writers until released
+static void *create_mmap_snapshot(void *handle) {
+    struct MmapStore *store = handle;
+    uv_rwlock_rdlock(&store->lock);
+    return store;
+}
+
+static void release_mmap_snapshot(void *handle, void *snapshot) {
+    struct MmapStore *store = handle;
+    uv_rwlock_rdunlock(&store->lock);
+}
+
+static int compare_slot_keys(const void *a, const void *b) {
+    struct MmapSlot *slotA = *(struct MmapSlot**)a;
+    struct MmapSlot *slotB = *(struct MmapSlot**)b;
+    uint8_t width = slotA->keyWidth < slotB->keyWidth ? slotA->keyWidth : slotB->keyWidth;
+    int result = memcmp(get_slot_key(slotA), get_slot_key(slotB), width);
+    if (result) {
+        return result;
+    }
+    return (int)slotA->keyWidth - (int)slotB->keyWidth;
+}
+
+struct SlotVisit {
+    StorageVisitor visitor;
+    void *context;
+    Byte *buffer; // for overflow values
+    uint64_t bufferCapacity;
+};
+
+static int8_t visit_slot(struct MmapStore *store, struct MmapSlot *slot, struct SlotVisit *visit) {
+    Byte *map = store->map;
+    Byte *key = get_slot_key(slot);
+    Byte *value = get_slot_value(map, slot);
+    if (is_overflow(map, slot)) {
+        if (slot->valueWidth > visit->bufferCapacity) {
+            if (visit->buffer) {
+                FREE(visit->buffer, "mmap_storage:value");
+            }
+            visit->bufferCapacity = slot->valueWidth * 2;
+            visit->buffer = MALLOC(visit->bufferCapacity, "mmap_storage:value");
+        }
+        value = visit->buffer;
+        if (read_overflow_record(store->overflowFile, get_overflow_offset(map, slot), key, slot->keyWidth, value, slot->valueWidth)) {
+            return -1;
+        }
+    }
+    return visit->visitor(key, slot->keyWidth, value, slot->valueWidth, visit->context);
+}
+
+// Slot order unless ordered is set, which sorts pointers to every entry first
+static int8_t iterate_mmap(void *handle, void *snapshot, bool ordered, StorageVisitor visitor, void *context) {
+    struct MmapStore *store = handle;
+    if (!snapshot) {
+        uv_rwlock_rdlock(&store->lock);
+    }
+    Byte *map = store->map;
+    struct MmapTableHeader *header = get_header(map);
+    struct SlotVisit visit = {
+        .visitor = visitor,
+        .context = context,
+    };
+    int8_t status = 0;
+    if (ordered) {
+        struct MmapSlot **slots = MALLOC((header->used + 1) * sizeof(struct MmapSlot*), "mmap_storage:slots");
+        uint64_t count = 0;
+        for (uint64_t i = 0; i < header->slotCount && count < header->used; i++) {
+            struct MmapSlot *slot = get_slot(map, i);
+            if (slot->state == MMAP_SLOT_USED) {
+                slots[count++] = slot;
+            }
+        }
+        qsort(slots, count, sizeof(struct MmapSlot*), &compare_slot_keys);
+        for (uint64_t i = 0; i < count && !status; i++) {
+            status = visit_slot(store, slots[i], &visit);
+        }
+        FREE(slots, "mmap_storage:slots");
+    }
+    else {
+        for (uint64_t i = 0; i < header->slotCount && !status; i++) {
+            struct MmapSlot *slot = get_slot(map, i);
+            if (slot->state == MMAP_SLOT_USED) {
+                status = visit_slot(store, slot, &visit);
+            }
+        }
+    }
+    if (visit.buffer) {
+        FREE(visit.buffer, "mmap_storage:value");
+    }
+    if (!snapshot) {
+        uv_rwlock_rdunlock(&store->lock);
+    }
+    return status;
+}
+
+const StorageEngine mmapEngine = {
+    .name = STORAGE_ENGINE_MMAP,
+    .open = &open_mmap,
+    .close = &close_mmap,
+    .destroy = &destroy_mmap,
+    .get = &get_from_mmap,
+    .create_batch = &create_mmap_batch,
+    .stage_put = &stage_mmap_put,
+    .stage_removal = &stage_mmap_removal,
+    .commit_batch = &commit_mmap_batch,
+    .destroy_batch = &destroy_mmap_batch,
+    .create_snapshot = &create_mmap_snapshot,
+    .release_snapshot = &release_mmap_snapshot,
+    .iterate = &iterate_mmap,
+};
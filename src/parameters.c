@@ -22,6 +22,12 @@ const struct ChainParameters mainnet = {
     .scriptSigSizeLower = 2,
     .scriptSigSizeUpper = 100,
     .retargetBound = 4,
+    .noRetargeting = false,
+    .powLimit = 0x1d00ffff,
+    .subsidyHalvingInterval = 210000,
+    .genesisTimestamp = 1231006505,
+    .genesisNonce = 2083236893,
+    .archiveRoot = "archive",
     .checkpoints = {
         { 11111, "0000000069e244f73d78e8fd29ba2fd2ed618bd6fa2ee92559f542fdb26e7c1d"},
         { 33333, "000000002dd5588a74784eaa7ab0507a18ad16a236e7b1ce69f00d7ddfb5d0a6"},
@@ -41,3 +47,30 @@ const struct ChainParameters mainnet = {
         .bip65 = 388381
     },
 };
+
+// @see CRegTestParams in Bitcoin Core's 'chainparams.cpp'
+// Same genesis transaction as mainnet, under a target that about every other hash meets
+const struct ChainParameters regtest = {
+    .magic = REG_TEST_NET_MAGIC,
+    .minimalPeerVersion = 31800,
+    .port = REG_TEST_NET_PORT,
+    .genesisHeight = 0,
+    .retargetPeriod = 2016,
+    .retargetLookBackPeriod = 2015,
+    .desiredRetargetPeriod = DAY_TO_SECOND(14),
+    .blockMaxForwardTimestamp = HOUR_TO_SECOND(2),
+    .scriptSigSizeLower = 2,
+    .scriptSigSizeUpper = 100,
+    .retargetBound = 4,
+    .noRetargeting = true,
+    .powLimit = 0x207fffff,
+    .subsidyHalvingInterval = 150,
+    .genesisTimestamp = 1296688602,
+    .genesisNonce = 2,
+    .archiveRoot = "archive_regtest",
+    .bipHeights = {
+        .bip65 = 1351
+    },
+};
+
+const struct ChainParameters *params = &mainnet;
@@ -1,15 +1,18 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "datatypes.h"
 
 #define MAIN_NET_MAGIC 0xD9B4BEF9
 #define TEST_NET_MAGIC 0xDAB5BFFA
 #define TEST_NET_3_MAGIC 0x0709110B
 #define DIY_NET_MAGIC 0x20180427
+#define REG_TEST_NET_MAGIC 0xDAB5BFFA
 
 #define MAIN_NET_PORT 8333
 #define TEST_NET_PORT 18333
+#define REG_TEST_NET_PORT 18444
 
 #define MESSAGE_BUFFER_LENGTH 4 * 1024 * 1024
 
@@ -41,8 +44,18 @@ struct ChainParameters {
     uint16_t scriptSigSizeUpper;
     uint64_t scriptSigSizeLower;
     uint16_t retargetBound;
+    bool noRetargeting;
+    uint32_t powLimit; // compact; also the genesis target
+    uint32_t subsidyHalvingInterval;
+    uint32_t genesisTimestamp;
+    uint32_t genesisNonce;
+    char *archiveRoot;
     struct ChainCheckPoint checkpoints[MAX_CHECKPOINTS];
     struct BIPHeights bipHeights;
 };
 
 extern const struct ChainParameters mainnet;
+extern const struct ChainParameters regtest;
+
+// The network this process runs on; mainnet unless selected otherwise at startup
+extern const struct ChainParameters *params;
@@ -1,30 +1,49 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include "leveldb/c.h"
 
 #include "persistent.h"
 
 #include "globalstate.h"
 #include "blockchain.h"
 #include "config.h"
+#include "compressor.h"
+#include "storage.h"
+#include "utxo.h"
+#include "utxofilter.h"
+#include "utxostats.h"
 #include "utils/integers.h"
 #include "utils/memory.h"
 #include "utils/networking.h"
 #include "utils/data.h"
+#include "utils/datetime.h"
 #include "utils/file.h"
+#include "utils/random.h"
 
 #define MAX_PATH_LENGTH 256
 
-#define ARCHIVE_ROOT "archive"
+// Each network keeps its own archive, so a regtest run never touches mainnet data
+#define ARCHIVE_ROOT (params->archiveRoot)
 #define BLOCK_ROOT "blocks"
+#define UNDO_ROOT "undo"
 
-#define PEER_LIST_BINARY_FILENAME (ARCHIVE_ROOT"/peers.dat")
-#define PEER_LIST_CSV_FILENAME (ARCHIVE_ROOT"/peers.csv")
+#define PEER_LIST_BINARY_FILENAME (make_archive_path("peers.dat"))
+#define PEER_LIST_CSV_FILENAME (make_archive_path("peers.csv"))
 
-#define BLOCK_INDEX_PATH (ARCHIVE_ROOT"/block_indices.dat")
+#define BLOCK_INDEX_PATH (make_archive_path("block_indices.dat"))
+#define UTXO_FILTER_PATH (make_archive_path("utxo_filter.dat"))
 
 #define HASH_KEY_STRING_LENGTH (SHA256_HEXSTR_LENGTH + 1)
 
+// The txid followed by the big-endian index, so a transaction's outputs sit next to each other
+#define TXO_KEY_LENGTH (SHA256_LENGTH + sizeof(uint32_t))
+
+static char *make_archive_path(char *filename) {
+    static char path[MAX_PATH_LENGTH];
+    memset(path, 0, sizeof(path));
+    sprintf(path, "%s/%s", ARCHIVE_ROOT, filename);
+    return path;
+}
+
 int32_t save_peers_for_human() {
     FILE *file = fopen(PEER_LIST_CSV_FILENAME, "wb");
 
@@ -92,35 +111,59 @@ int32_t load_peer_candidates() {
 }
 
 
+static void make_db_path(char *dbName, char *path) {
+    sprintf(path, "%s/%s", ARCHIVE_ROOT, dbName);
+}
+
+static void get_db_options(StorageOptions *options) {
+    memset(options, 0, sizeof(*options));
+    options->cacheSize = config.databases.cacheSize;
+    options->bloomBitsPerKey = config.databases.bloomBitsPerKey;
+    options->writeBufferSize = config.databases.writeBufferSize;
+    options->maxOpenFiles = config.databases.maxOpenFiles;
+}
+
+static Storage *open_utxo_db() {
+    StorageOptions options;
+    get_db_options(&options);
+    options.initialSlots = config.databases.mmapInitialSlots;
+    options.maxKeyWidth = TXO_KEY_LENGTH;
+    options.inlineValueWidth = config.databases.mmapInlineValueWidth;
+    char path[MAX_PATH_LENGTH] = {0};
+    make_db_path(config.utxoDBName, path);
+    return open_storage(config.databases.utxoEngine, path, &options);
+}
+
 int8_t init_db() {
     printf("Connecting to databases...");
-    leveldb_options_t *options = leveldb_options_create();
-    leveldb_options_set_create_if_missing(options, 1);
-    char *error = NULL;
+    // Opening again, as the tests do, starts from what has been written so far
+    cleanup_db();
+    StorageOptions options;
+    get_db_options(&options);
     char txLocationPath[MAX_PATH_LENGTH] = {0};
-    sprintf(txLocationPath, "%s/%s", ARCHIVE_ROOT, config.txLocationDBName);
-    global.txLocationDB = leveldb_open(options, txLocationPath, &error);
-    if (error != NULL) {
-        fprintf(stderr, "Open LevelDB fail: %s\n", error);
-        leveldb_free(error);
+    make_db_path(config.txLocationDBName, txLocationPath);
+    global.txLocationDB = open_storage(STORAGE_ENGINE_LEVELDB, txLocationPath, &options);
+    if (!global.txLocationDB) {
         return -1;
     }
-    char utxoDBPath[MAX_PATH_LENGTH] = {0};
-    sprintf(utxoDBPath, "%s/%s", ARCHIVE_ROOT, config.utxoDBName);
-    global.utxoDB = leveldb_open(options, utxoDBPath, &error);
-    if (error != NULL) {
-        fprintf(stderr, "Open LevelDB fail: %s\n", error);
-        leveldb_free(error);
+    global.utxoDB = open_utxo_db();
+    if (!global.utxoDB) {
         return -2;
     }
-    leveldb_free(options);
-    printf("Done.\n");
+    printf("Done (UTXO on %s).\n", global.utxoDB->engine->name);
+    open_utxo_filter();
     return 0;
 }
 
 void cleanup_db() {
-    leveldb_close(global.txLocationDB);
-    leveldb_close(global.utxoDB);
+    if (global.txLocationDB) {
+        close_storage(global.txLocationDB);
+        global.txLocationDB = NULL;
+    }
+    if (global.utxoDB) {
+        close_storage(global.utxoDB);
+        global.utxoDB = NULL;
+    }
 }
 
 int32_t save_block_indices(void) {
@@ -171,111 +214,86 @@ int32_t load_block_indices(void) {
     return 0;
 }
 
-int8_t save_data_by_key(leveldb_t *db, char *key, Byte *value, uint64_t valueLength) {
-    char *error = NULL;
-    leveldb_writeoptions_t *writeOptions = leveldb_writeoptions_create();
-    leveldb_put(
-        db, writeOptions,
-        key, strlen(key),
-        (char*)value, valueLength,
-        &error
-    );
-
-    if (error != NULL) {
-        fprintf(stderr, "Write fail: %s\n", error);
-        leveldb_free(error);
+int8_t save_data_by_key(Storage *db, char *key, Byte *value, uint64_t valueLength) {
+    int8_t status = save_to_storage(db, (Byte*)key, strlen(key), value, valueLength, false);
+    if (status) {
+        fprintf(stderr, "Write fail on key %s\n", key);
         return -1;
     }
-    leveldb_free(writeOptions);
     return 0;
-
 }
 
-int8_t save_data_by_hash(leveldb_t *db, Byte *hash, Byte *value, uint64_t valueLength) {
+int8_t save_data_by_hash(Storage *db, Byte *hash, Byte *value, uint64_t valueLength) {
     char key[HASH_KEY_STRING_LENGTH] = {0};
     hash_binary_to_hex(hash, key);
-    save_data_by_key(db, key, value, valueLength);
     return save_data_by_key(db, key, value, valueLength);
 }
 
-int8_t load_data_by_key(leveldb_t *db, char *key, Byte *output, size_t *outputLength) {
-    size_t readLength = 0;
-    char *error = NULL;
-    leveldb_readoptions_t *readOptions = leveldb_readoptions_create();
-    char *read = leveldb_get(
-        db, readOptions,
-        key, strlen(key),
-        &readLength,
-        &error
-    );
-    leveldb_free(readOptions);
-
-    if (read == NULL) {
-        #if LOG_DB_ERROR
-        fprintf(stderr, "leveldb: key not found %s\n", key);
-        #endif
-        return -1;
-    }
-    else if (error != NULL) {
-        leveldb_free(error);
-        #if LOG_DB_ERROR
-        fprintf(stderr, "leveldb: Read fail on key %s\n", key);
-        #endif
-        return -2;
+// Fails with -3 rather than write past capacity bytes of output
+int8_t load_data_by_binary_key(Storage *db, Byte *key, size_t keyLength, Byte *output, size_t capacity, size_t *outputLength) {
+    int8_t status = load_from_storage(db, key, keyLength, output, capacity, outputLength);
+    #if LOG_DB_ERROR
+    if (status == -1) {
+        fprintf(stderr, "%s: key not found %s\n", db->engine->name, binary_to_hexstr(key, keyLength));
     }
-    memcpy(output, read, readLength);
-    if (outputLength) {
-        *outputLength = readLength;
+    else if (status) {
+        fprintf(stderr, "%s: Read fail on key %s\n", db->engine->name, binary_to_hexstr(key, keyLength));
     }
-    return 0;
+    #endif
+    return status;
 }
 
-int8_t load_data_by_hash(leveldb_t *db, Byte *hash, Byte *output, size_t *outputLength) {
+int8_t load_data_by_key(Storage *db, char *key, Byte *output, size_t capacity, size_t *outputLength) {
+    return load_data_by_binary_key(db, (Byte*)key, strlen(key), output, capacity, outputLength);
+}
+
+int8_t load_data_by_hash(Storage *db, Byte *hash, Byte *output, size_t capacity, size_t *outputLength) {
     char key[HASH_KEY_STRING_LENGTH] = {0};
     hash_binary_to_hex(hash, key);
-    return load_data_by_key(db, key, output, outputLength);
+    return load_data_by_key(db, key, output, capacity, outputLength);
 }
 
-int8_t remove_data_by_key(leveldb_t *db, char *key) {
-    char *error = NULL;
-    leveldb_writeoptions_t *writeOptions = leveldb_writeoptions_create();
-    leveldb_delete(
-        db, writeOptions,
-        key, strlen(key),
-        &error
-    );
-
-    if (error != NULL) {
-        fprintf(stderr, "Delete fail: %s\n", error);
-        leveldb_free(error);
+int8_t remove_data_by_key(Storage *db, char *key) {
+    int8_t status = remove_from_storage(db, (Byte*)key, strlen(key), false);
+    if (status) {
+        fprintf(stderr, "Delete fail on key %s\n", key);
         return -1;
     }
-    leveldb_free(writeOptions);
     return 0;
 }
 
-int8_t remove_data_by_hash(leveldb_t *db, Byte *hash) {
+int8_t remove_data_by_hash(Storage *db, Byte *hash) {
     char key[HASH_KEY_STRING_LENGTH] = {0};
     hash_binary_to_hex(hash, key);
     return remove_data_by_key(db, key);
 }
 
-char *make_entity_path(char *collectionRoot, Byte *hash) {
+static void format_entity_path(char *collectionRoot, Byte *hash, char *path) {
     char hashHex[HASH_KEY_STRING_LENGTH] = {0};
     hash_binary_to_hex(hash, hashHex);
-    static char path[MAX_PATH_LENGTH];
-    memset(path, 0, sizeof(path));
     char x[3] = {0};
     memcpy(x, hashHex, 2);
     sprintf(path, "%s/%s/%s/%s.dat", ARCHIVE_ROOT, collectionRoot, x, hashHex);
+}
+
+char *make_entity_path(char *collectionRoot, Byte *hash) {
+    static char path[MAX_PATH_LENGTH];
+    memset(path, 0, sizeof(path));
+    format_entity_path(collectionRoot, hash, path);
     return path;
 }
 
+// Blocks that passed is_block_legal are archived with a trailing payload checksum,
+// which vouches for them when read back instead of redoing the merkle tree
 int8_t save_block(BlockPayload *ptrBlock) {
     SHA256_HASH hash = {0};
     hash_block_header(&ptrBlock->header, hash);
     Byte *buffer = CALLOC(1, MESSAGE_BUFFER_LENGTH, "save_block:buffer");
     uint64_t serializedWidth = serialize_block_payload(ptrBlock, buffer);
+    if (is_block_legal(ptrBlock)) {
+        calculate_data_checksum(buffer, (uint32_t)serializedWidth, buffer + serializedWidth);
+        serializedWidth += CHECKSUM_SIZE;
+    }
     FILE *file = fopen(make_entity_path(BLOCK_ROOT, hash), "wb");
     if (!file) {
         fprintf(stderr, "save_block: cannot open file: %s\n", strerror(errno));
@@ -287,21 +305,81 @@ int8_t save_block(BlockPayload *ptrBlock) {
     return 0;
 }
 
-int8_t load_block(Byte *hash, BlockPayload *ptrBlock) {
-    SHA256_HASH key = {0};
-    memcpy(key, hash, SHA256_LENGTH);
+static bool is_archive_checksum_valid(Byte *buffer, uint64_t payloadWidth, int64_t fileSize) {
+    if ((uint64_t)fileSize != payloadWidth + CHECKSUM_SIZE) {
+        return false;
+    }
+    PayloadChecksum checksum = {0};
+    calculate_data_checksum(buffer, (uint32_t)payloadWidth, checksum);
+    return memcmp(checksum, buffer + payloadWidth, CHECKSUM_SIZE) == 0;
+}
 
-    Byte *buffer = CALLOC(1, MESSAGE_BUFFER_LENGTH, "load_block:buffer");
-    int8_t status = 0;
-    FILE *file = fopen(make_entity_path(BLOCK_ROOT, hash), "rb");
+// Outputs a block spent, so disconnecting it can put them back; checksummed like blocks
+int8_t save_block_undo(Byte *hash, Byte *data, uint64_t width) {
+    PayloadChecksum checksum = {0};
+    calculate_data_checksum(data, (uint32_t)width, checksum);
+    FILE *file = fopen(make_entity_path(UNDO_ROOT, hash), "wb");
     if (!file) {
-        fprintf(stderr, "load_block: Cannot open file\n");
-        return -99;
+        fprintf(stderr, "save_block_undo: cannot open file: %s\n", strerror(errno));
+        return -1;
+    }
+    fwrite(data, width, 1, file);
+    fwrite(checksum, CHECKSUM_SIZE, 1, file);
+    fclose(file);
+    return 0;
+}
+
+// Returns the undo data, to be released with FREE(data, "load_block_undo:data"), or NULL
+Byte *load_block_undo(Byte *hash, uint64_t *width) {
+    FILE *file = fopen(make_entity_path(UNDO_ROOT, hash), "rb");
+    if (!file) {
+        fprintf(stderr, "load_block_undo: cannot open file\n");
+        return NULL;
     }
     int64_t fileSize = get_file_size(file);
-    fread(buffer, (size_t)fileSize, 1, file);
+    if (fileSize < CHECKSUM_SIZE) {
+        fclose(file);
+        return NULL;
+    }
+    Byte *data = MALLOC((size_t)fileSize, "load_block_undo:data");
+    size_t readCount = fread(data, (size_t)fileSize, 1, file);
+    fclose(file);
+    *width = (uint64_t)fileSize - CHECKSUM_SIZE;
+    if (readCount != 1 || !is_archive_checksum_valid(data, *width, fileSize)) {
+        fprintf(stderr, "load_block_undo: corrupted undo data\n");
+        FREE(data, "load_block_undo:data");
+        return NULL;
+    }
+    return data;
+}
+
+// Reads a block's archive file into buffer, which holds MESSAGE_BUFFER_LENGTH bytes.
+// Neither this nor check_block_file touches the index, so both are safe off the main thread
+int8_t read_block_file(Byte *hash, Byte *buffer, int64_t *fileSize) {
+    char path[MAX_PATH_LENGTH] = {0};
+    format_entity_path(BLOCK_ROOT, hash, path);
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "read_block_file: Cannot open file\n");
+        return -99;
+    }
+    *fileSize = get_file_size(file);
+    if (*fileSize <= 0 || *fileSize > MESSAGE_BUFFER_LENGTH) {
+        fprintf(stderr, "read_block_file: Bad file size %lli\n", *fileSize);
+        fclose(file);
+        return -98;
+    }
+    size_t readCount = fread(buffer, (size_t)*fileSize, 1, file);
     fclose(file);
+    if (readCount != 1) {
+        fprintf(stderr, "read_block_file: Short read of %lli bytes\n", *fileSize);
+        return -97;
+    }
+    return 0;
+}
 
+// Parses what read_block_file read; ERROR_BAD_DATA when it is not the block asked for or not legal
+int8_t check_block_file(Byte *hash, Byte *buffer, int64_t fileSize, BlockPayload *ptrBlock) {
     parse_into_block_payload(buffer, ptrBlock);
     SHA256_HASH actualHash = {0};
     Byte hashBuffer[1000] = {0};
@@ -313,25 +391,55 @@ int8_t load_block(Byte *hash, BlockPayload *ptrBlock) {
         #endif
         print_hash_with_description("requested: ", hash);
         print_hash_with_description("actual: ", actualHash);
-        mark_block_as_unavailable(hash);
-        status = ERROR_BAD_DATA;
+        return ERROR_BAD_DATA;
+    }
+    else if (is_archive_checksum_valid(buffer, calc_block_payload_width(ptrBlock), fileSize)) {
+        mark_block_legal(ptrBlock, actualHash);
+        #if LOG_BLOCK_LOAD
+        print_hash_with_description("load_block: OK (checksum) ", hash);
+        #endif
     }
     else if (!is_block_legal(ptrBlock)) {
         #if LOG_BLOCK_LOAD
         fprintf(stderr, "load_block: fetched illegal block, probably file corruption...\n");
         #endif
-        mark_block_as_unavailable(hash);
-        status = ERROR_BAD_DATA;
+        return ERROR_BAD_DATA;
     }
     else {
         #if LOG_BLOCK_LOAD
         print_hash_with_description("load_block: OK ", hash);
         #endif
     }
+    return 0;
+}
+
+int8_t load_block(Byte *hash, BlockPayload *ptrBlock) {
+    Byte *buffer = CALLOC(1, MESSAGE_BUFFER_LENGTH, "load_block:buffer");
+    int64_t fileSize = 0;
+    int8_t status = read_block_file(hash, buffer, &fileSize);
+    if (!status) {
+        status = check_block_file(hash, buffer, fileSize, ptrBlock);
+        if (status) {
+            mark_block_as_unavailable(hash);
+        }
+    }
     FREE(buffer, "load_block:buffer");
     return status;
 }
 
+// Parses an archived block without checking it or touching its index, so it is safe off the
+// main thread; for lookahead work that load_block will redo properly
+int8_t read_archived_block(Byte *hash, BlockPayload *ptrBlock) {
+    Byte *buffer = CALLOC(1, MESSAGE_BUFFER_LENGTH, "read_archived_block:buffer");
+    int64_t fileSize = 0;
+    int8_t status = read_block_file(hash, buffer, &fileSize);
+    if (!status) {
+        parse_into_block_payload(buffer, ptrBlock);
+    }
+    FREE(buffer, "read_archived_block:buffer");
+    return status;
+}
+
 int8_t save_tx_location(TxPayload *ptrTx, Byte *blockHash) {
     Byte *buffer = CALLOC(1, MESSAGE_BUFFER_LENGTH, "save_tx:buffer");
     uint64_t width = serialize_tx_payload(ptrTx, buffer);
@@ -348,7 +456,7 @@ int8_t load_tx(Byte *targetHash, TxPayload *ptrPayload) {
     size_t hashWidth = 0;
     BlockPayload *block = CALLOC(1, sizeof(*block), "load_tx:block");
     Byte *buffer = CALLOC(1, MESSAGE_BUFFER_LENGTH, "save_tx:buffer");
-    status = load_data_by_hash(global.txLocationDB, targetHash, blockHash, &hashWidth);
+    status = load_data_by_hash(global.txLocationDB, targetHash, blockHash, sizeof(blockHash), &hashWidth);
     if (status) {
         fprintf(stderr, "Cannot load block reference\n");
         goto release;
@@ -379,6 +487,9 @@ int8_t load_tx(Byte *targetHash, TxPayload *ptrPayload) {
 
 void save_chain_data() {
     printf("Saving chain data...\n");
+    // Outputs first, so saved indices never claim registrations the database lacks
+    flush_utxo_cache(false);
+    persist_utxo_filter();
     save_peer_candidates();
     save_block_indices();
     printf("Done.");
@@ -389,9 +500,18 @@ void load_genesis() {
     Message genesis = get_empty_message();
     load_block_message("genesis.dat", &genesis);
     BlockPayload *ptrBlock = (BlockPayload*) genesis.ptrPayload;
+    // Networks share the genesis transaction and differ in the header's time and proof of work
+    ptrBlock->header.timestamp = params->genesisTimestamp;
+    ptrBlock->header.target = params->powLimit;
+    ptrBlock->header.nonce = params->genesisNonce;
     memcpy(&global.genesisBlock, ptrBlock, sizeof(BlockPayload));
     hash_block_header(&ptrBlock->header, global.genesisHash);
     process_incoming_block(ptrBlock, global.mode == MODE_NORMAL);
+    // Without validation the chain still starts here; the genesis output is unspendable anyway
+    BlockIndex *genesisIndex = GET_BLOCK_INDEX(global.genesisHash);
+    if (genesisIndex && is_byte_array_empty(global.mainValidatedTip.meta.hash, SHA256_LENGTH)) {
+        global.mainValidatedTip = *genesisIndex;
+    }
     printf("Done.\n");
 }
 
@@ -403,76 +523,269 @@ void checked_mkdir(char *path) {
     }
 }
 
-int8_t destory_db(char *dbname) {
-    printf("Destorying database %s\n", dbname);
-    leveldb_options_t *options = leveldb_options_create();
-    char *error = NULL;
-    leveldb_destroy_db(options, dbname, &error);
-    if (error != NULL) {
-        fprintf(stderr, "Database destruction: fail: %s\n", error);
-        leveldb_free(error);
-        return -1;
+// Empties the UTXO database by closing, deleting and recreating it
+int8_t reset_utxo_db() {
+    printf("Destroying database %s\n", config.utxoDBName);
+    if (global.utxoDB) {
+        close_storage(global.utxoDB);
+        global.utxoDB = NULL;
+    }
+    char path[MAX_PATH_LENGTH] = {0};
+    make_db_path(config.utxoDBName, path);
+    int8_t status = destroy_storage(config.databases.utxoEngine, path);
+    global.utxoDB = open_utxo_db();
+    if (!global.utxoDB) {
+        return -2;
     }
     printf("Done destructing.\n");
-    return 0;
+    return status;
 }
 
-void init_archive_dir() {
-    checked_mkdir(ARCHIVE_ROOT);
-    char blockRoot[MAX_PATH_LENGTH] = {0};
-    sprintf(blockRoot, "%s/%s", ARCHIVE_ROOT, BLOCK_ROOT);
-    checked_mkdir(blockRoot);
+static void init_collection_dir(char *collectionRoot) {
+    char root[MAX_PATH_LENGTH] = {0};
+    sprintf(root, "%s/%s", ARCHIVE_ROOT, collectionRoot);
+    checked_mkdir(root);
 
     for (uint16_t i = 0; i < 0x100; i++) {
         char path[MAX_PATH_LENGTH] = {0};
-        sprintf(path, "%s/%s/%02x", ARCHIVE_ROOT, BLOCK_ROOT, i);
+        sprintf(path, "%s/%s/%02x", ARCHIVE_ROOT, collectionRoot, i);
         checked_mkdir(path);
     }
 }
 
+void init_archive_dir() {
+    checked_mkdir(ARCHIVE_ROOT);
+    init_collection_dir(BLOCK_ROOT);
+    init_collection_dir(UNDO_ROOT);
+}
+
 void init_block_index_map() {
     hashmap_init(&global.blockIndices, (1UL << 25) - 1, SHA256_LENGTH);
 }
 
-#define UINT32_DECIMAL_MAX_WIDTH 10
-
-#define TXO_KEY_LENGTH (HASH_KEY_STRING_LENGTH + 1 + UINT32_DECIMAL_MAX_WIDTH)
+#define UTXO_FLUSH_HEIGHT_KEY "flush_height"
+// Matches the tag in the saved filter file while no write has happened since it was saved
+#define UTXO_FILTER_TAG_KEY "filter_tag"
+// Written with the last batch of a flush, so present only once the flush has fully landed
+#define UTXO_STATS_KEY "utxo_stats"
+
+static void make_txo_key(Outpoint *outpoint, Byte *key) {
+    memcpy(key, outpoint->txHash, SHA256_LENGTH);
+    key[SHA256_LENGTH] = (Byte)(outpoint->index >> 24);
+    key[SHA256_LENGTH + 1] = (Byte)(outpoint->index >> 16);
+    key[SHA256_LENGTH + 2] = (Byte)(outpoint->index >> 8);
+    key[SHA256_LENGTH + 3] = (Byte)outpoint->index;
+}
 
-void make_txo_key(Outpoint *outpoint, char *key) {
-    hash_binary_to_hex(outpoint->txHash, key);
-    sprintf(key+HASH_KEY_STRING_LENGTH-1, "_%010u", outpoint->index);
+static void parse_txo_key(Byte *key, Outpoint *outpoint) {
+    memcpy(outpoint->txHash, key, SHA256_LENGTH);
+    outpoint->index =
+        ((uint32_t)key[SHA256_LENGTH] << 24)
+        | ((uint32_t)key[SHA256_LENGTH + 1] << 16)
+        | ((uint32_t)key[SHA256_LENGTH + 2] << 8)
+        | (uint32_t)key[SHA256_LENGTH + 3];
 }
 
-int8_t save_utxo(Outpoint *outpoint, TxOut *output) {
-    char key[TXO_KEY_LENGTH] = {0};
+// Compressed outputs (see compressor.h); the UTXO cache in utxo.c is the only reader and writer.
+// output must hold MAX_COMPRESSED_TX_OUT_WIDTH bytes
+
+int8_t load_utxo_data(Outpoint *outpoint, Byte *output, size_t *width) {
+    if (!may_contain_utxo(outpoint)) {
+        return -1;
+    }
+    Byte key[TXO_KEY_LENGTH] = {0};
     make_txo_key(outpoint, key);
-    Byte *buffer = MALLOC(MESSAGE_BUFFER_LENGTH, "save_utxo:buffer");
-    uint64_t width = serialize_tx_out(output, buffer);
-    int8_t status = save_data_by_key(global.utxoDB, key, buffer, width);
-    FREE(buffer, "save_utxo:buffer");
+    int8_t status = load_data_by_binary_key(global.utxoDB, key, TXO_KEY_LENGTH, output, MAX_COMPRESSED_TX_OUT_WIDTH, width);
+    if (status == -1) {
+        record_utxo_filter_false_positive();
+    }
     return status;
 }
 
-int8_t load_utxo(Outpoint *outpoint, TxOut *output) {
-    char key[TXO_KEY_LENGTH] = {0};
+void *create_utxo_batch() {
+    return create_storage_batch(global.utxoDB);
+}
+
+void stage_utxo_data(void *batch, Outpoint *outpoint, Byte *data, uint64_t width) {
+    Byte key[TXO_KEY_LENGTH] = {0};
     make_txo_key(outpoint, key);
-    Byte *buffer = MALLOC(MESSAGE_BUFFER_LENGTH, "load_utxo:buffer");
+    stage_storage_put(global.utxoDB, batch, key, TXO_KEY_LENGTH, data, width);
+    // Ahead of the write; a key the filter holds too early only costs a database read
+    add_to_utxo_filter(outpoint);
+}
+
+void stage_utxo_removal(void *batch, Outpoint *outpoint) {
+    Byte key[TXO_KEY_LENGTH] = {0};
+    make_txo_key(outpoint, key);
+    stage_storage_removal(global.utxoDB, batch, key, TXO_KEY_LENGTH);
+}
+
+// Highest block height whose changes may have reached the database; not an outpoint key.
+// Every write carries it, so it also retires the saved filter's tag and set statistics
+void stage_utxo_flush_height(void *batch, uint32_t height) {
+    stage_storage_put(
+        global.utxoDB, batch,
+        (Byte*)UTXO_FLUSH_HEIGHT_KEY, strlen(UTXO_FLUSH_HEIGHT_KEY),
+        (Byte*)&height, sizeof(height)
+    );
+    stage_storage_removal(global.utxoDB, batch, (Byte*)UTXO_FILTER_TAG_KEY, strlen(UTXO_FILTER_TAG_KEY));
+    stage_storage_removal(global.utxoDB, batch, (Byte*)UTXO_STATS_KEY, strlen(UTXO_STATS_KEY));
+}
+
+void stage_utxo_stats(void *batch) {
+    Byte buffer[UTXO_STATS_WIDTH];
+    uint64_t width = serialize_utxo_stats(buffer);
+    stage_storage_put(global.utxoDB, batch, (Byte*)UTXO_STATS_KEY, strlen(UTXO_STATS_KEY), buffer, width);
+}
+
+int8_t load_utxo_flush_height(uint32_t *height) {
+    Byte buffer[sizeof(*height)] = {0};
     size_t width = 0;
-    int8_t status = load_data_by_key(global.utxoDB, key, buffer, &width);
+    int8_t status = load_data_by_key(global.utxoDB, UTXO_FLUSH_HEIGHT_KEY, buffer, sizeof(buffer), &width);
+    if (status || width != sizeof(*height)) {
+        return -1;
+    }
+    memcpy(height, buffer, sizeof(*height));
+    return 0;
+}
+
+// Writes the staged changes atomically and empties the batch for reuse
+int8_t commit_utxo_batch(void *batch) {
+    if (commit_storage_batch(global.utxoDB, batch, false)) {
+        fprintf(stderr, "UTXO batch write fail\n");
+        return -1;
+    }
+    return 0;
+}
+
+void destroy_utxo_batch(void *batch) {
+    destroy_storage_batch(global.utxoDB, batch);
+}
+
+struct UtxoDataVisit {
+    UtxoDataVisitor visitor;
+    void *context;
+};
+
+static int8_t visit_utxo_data(Byte *key, size_t keyWidth, Byte *value, size_t valueWidth, void *context) {
+    if (keyWidth != TXO_KEY_LENGTH) {
+        return 0;
+    }
+    struct UtxoDataVisit *visit = context;
+    Outpoint outpoint;
+    parse_txo_key(key, &outpoint);
+    return visit->visitor(&outpoint, value, valueWidth, visit->context);
+}
+
+// Visits stored outputs in key order, that is by txid and then index, skipping the height
+// marker; stops at and returns the first nonzero visitor result
+int8_t iterate_utxo_data(UtxoDataVisitor visitor, void *context) {
+    struct UtxoDataVisit visit = {
+        .visitor = visitor,
+        .context = context,
+    };
+    return iterate_storage(global.utxoDB, NULL, true, &visit_utxo_data, &visit);
+}
+
+static int8_t count_output(Outpoint *outpoint, Byte *data, uint64_t width, void *context) {
+    (*(uint64_t*)context)++;
+    return 0;
+}
+
+static int8_t add_output_to_filter(Outpoint *outpoint, Byte *data, uint64_t width, void *context) {
+    add_to_utxo_filter(outpoint);
+    return 0;
+}
+
+// Two scans of the database: one to size the filter, one to fill it
+void rebuild_utxo_filter() {
+    printf("Rebuilding UTXO filter...");
+    double start = get_now();
+    uint64_t count = 0;
+    iterate_utxo_data(&count_output, &count);
+    reset_utxo_filter(count);
+    iterate_utxo_data(&add_output_to_filter, NULL);
+    printf("Done: %llu outputs in %.1fms\n", count, get_now() - start);
+}
+
+// Takes the saved filter only if the database has not been written since it was saved
+void open_utxo_filter() {
+    uint64_t fileTag = 0;
+    uint64_t dbTag = 0;
+    size_t width = 0;
+    bool matched =
+        load_utxo_filter(UTXO_FILTER_PATH, &fileTag) == 0
+        && load_data_by_key(global.utxoDB, UTXO_FILTER_TAG_KEY, (Byte*)&dbTag, sizeof(dbTag), &width) == 0
+        && width == sizeof(dbTag)
+        && dbTag == fileTag;
+    if (!matched) {
+        rebuild_utxo_filter();
+    }
+}
+
+// Saves the filter, rebuilt first if it has taken in more keys than it was sized for, and
+// tags the database to match; call right after flushing
+void persist_utxo_filter() {
+    if (is_utxo_filter_saturated()) {
+        rebuild_utxo_filter();
+    }
+    uint64_t tag = random_uint64();
+    if (save_utxo_filter(UTXO_FILTER_PATH, tag)) {
+        return;
+    }
+    int8_t status = save_to_storage(
+        global.utxoDB,
+        (Byte*)UTXO_FILTER_TAG_KEY, strlen(UTXO_FILTER_TAG_KEY),
+        (Byte*)&tag, sizeof(tag),
+        true
+    );
     if (status) {
-        FREE(buffer, "load_utxo:buffer");
-        return status;
+        fprintf(stderr, "UTXO filter tag write fail\n");
     }
-    parse_tx_out(buffer, output);
-    FREE(buffer, "load_utxo:buffer");
+}
+
+static int8_t add_output_to_stats(Outpoint *outpoint, Byte *data, uint64_t width, void *context) {
+    add_to_utxo_stats(outpoint, data, (uint32_t)width);
     return 0;
 }
 
+// Recomputes the set statistics from a database scan and saves them; the database must hold
+// exactly the set as of blockHash, with nothing left unflushed
+void rebuild_utxo_stats(Byte *blockHash) {
+    printf("Rebuilding UTXO set statistics...");
+    double start = get_now();
+    reset_utxo_stats(blockHash);
+    iterate_utxo_data(&add_output_to_stats, NULL);
+    UtxoSetStats stats;
+    get_utxo_set_stats(&stats);
+    printf("Done: %llu outputs in %.1fms\n", stats.outputs, get_now() - start);
+    Byte buffer[UTXO_STATS_WIDTH];
+    uint64_t width = serialize_utxo_stats(buffer);
+    save_data_by_key(global.utxoDB, UTXO_STATS_KEY, buffer, width);
+}
 
-int8_t spend_output(Outpoint *outpoint) {
-    char key[TXO_KEY_LENGTH] = {0};
-    make_txo_key(outpoint, key);
-    return remove_data_by_key(global.utxoDB, key);
+// Takes the saved statistics if they describe the validated tip. Otherwise the database is
+// either at the tip, when no flush went past it, and gets scanned now, or holds blocks about
+// to be registered again after a crash, and the statistics wait for that to finish
+void open_utxo_stats() {
+    Byte *tipHash = global.mainValidatedTip.meta.hash;
+    Byte buffer[UTXO_STATS_WIDTH];
+    size_t width = 0;
+    bool matched =
+        load_data_by_key(global.utxoDB, UTXO_STATS_KEY, buffer, sizeof(buffer), &width) == 0
+        && parse_utxo_stats(buffer, width) == 0
+        && sha256_match(buffer, tipHash);
+    if (matched) {
+        return;
+    }
+    uint32_t flushHeight = 0;
+    if (load_utxo_flush_height(&flushHeight) || flushHeight <= global.mainValidatedTip.context.height) {
+        rebuild_utxo_stats(tipHash);
+        return;
+    }
+    reset_utxo_stats(tipHash);
+    mark_utxo_stats_stale(flushHeight);
+    printf("UTXO set statistics stale until a flush at height %u\n", flushHeight);
 }
 
 void migrate() {
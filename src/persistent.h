@@ -4,13 +4,20 @@
 
 #define ERROR_BAD_DATA -99;
 
+typedef int8_t (*UtxoDataVisitor)(Outpoint *outpoint, Byte *data, uint64_t width, void *context);
+
 int32_t save_peer_candidates(void);
 int32_t load_peer_candidates(void);
 int32_t save_block_indices(void);
 int32_t load_block_indices(void);
 int8_t init_db();
 int8_t save_block(BlockPayload *ptrBlock);
+int8_t read_block_file(Byte *hash, Byte *buffer, int64_t *fileSize);
+int8_t check_block_file(Byte *hash, Byte *buffer, int64_t fileSize, BlockPayload *ptrBlock);
 int8_t load_block(Byte *hash, BlockPayload *ptrBlock);
+int8_t read_archived_block(Byte *hash, BlockPayload *ptrBlock);
+int8_t save_block_undo(Byte *hash, Byte *data, uint64_t width);
+Byte *load_block_undo(Byte *hash, uint64_t *width);
 void save_chain_data();
 int8_t save_tx_location(TxPayload *ptrTx, Byte *blockHash);
 int8_t load_tx(Byte *targetHash, TxPayload *ptrPayload);
@@ -20,9 +27,20 @@ void migrate();
 void cleanup_db();
 void init_archive_dir(void);
 void init_block_index_map(void);
-int8_t save_utxo(Outpoint *outpoint, TxOut *output);
-int8_t spend_output(Outpoint *outpoint);
-bool is_outpoint_available(Outpoint *outpoint);
-int8_t load_utxo(Outpoint *outpoint, TxOut *output);
-int8_t destory_db(char *dbname);
+int8_t load_utxo_data(Outpoint *outpoint, Byte *output, size_t *width);
+void *create_utxo_batch(void);
+void stage_utxo_data(void *batch, Outpoint *outpoint, Byte *data, uint64_t width);
+void stage_utxo_removal(void *batch, Outpoint *outpoint);
+void stage_utxo_flush_height(void *batch, uint32_t height);
+void stage_utxo_stats(void *batch);
+int8_t load_utxo_flush_height(uint32_t *height);
+int8_t commit_utxo_batch(void *batch);
+void destroy_utxo_batch(void *batch);
+int8_t iterate_utxo_data(UtxoDataVisitor visitor, void *context);
+void rebuild_utxo_filter(void);
+void open_utxo_filter(void);
+void persist_utxo_filter(void);
+void rebuild_utxo_stats(Byte *blockHash);
+void open_utxo_stats(void);
+int8_t reset_utxo_db(void);
 bool is_block_downloaded(Byte *hash);
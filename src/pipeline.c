@@ -0,0 +1,277 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pipeline.h"
+#include "config.h"
+#include "globalstate.h"
+#include "hash.h"
+#include "parameters.h"
+#include "persistent.h"
+#include "prefetch.h"
+#include "utils/datetime.h"
+#include "utils/memory.h"
+
+struct PipelineSlot {
+    SHA256_HASH hash;
+    Byte *buffer; // between the read and parse stages
+    int64_t fileSize;
+    BlockPayload *block; // from the parse stage on
+    int8_t status; // of load_block, had it read the block
+    bool unavailable; // the file is not the block; marked so by the validating thread
+};
+
+// Slots are numbered in queueing order and sit at number % depth. Each stage works on the slot
+// at its own counter, so taken <= resolved <= parsed <= read <= queued <= taken + depth.
+// Everything below running is shared under lock; busy counts stages working outside it
+struct BlockPipeline {
+    bool running;
+    bool stopping;
+    bool flushing;
+    uv_mutex_t lock;
+    uv_cond_t changed;
+    uv_thread_t reader;
+    uv_thread_t parser;
+    uv_thread_t resolver;
+    uint32_t threadCount;
+    uint32_t depth;
+    struct PipelineSlot slots[MAX_PIPELINE_DEPTH];
+    uint64_t queued;
+    uint64_t read;
+    uint64_t parsed;
+    uint64_t resolved;
+    uint64_t taken;
+    uint32_t busy;
+    PipelineStats stats;
+};
+
+static struct BlockPipeline pipeline;
+
+static struct PipelineSlot *get_slot(uint64_t number) {
+    return &pipeline.slots[number % pipeline.depth];
+}
+
+// Takes the slot a stage works on next, or NULL once stopping; called and returns with the
+// lock held, and the stage gives it back with release_slot. A bounded stage stays within
+// PIPELINE_MAX_READ_AHEAD of the parser
+static struct PipelineSlot *wait_for_slot(uint64_t *counter, uint64_t *previous, bool bounded) {
+    while (!pipeline.stopping) {
+        bool hasWork = *counter < *previous;
+        bool hasRoom = !bounded || *counter < pipeline.parsed + PIPELINE_MAX_READ_AHEAD;
+        if (!pipeline.flushing && hasWork && hasRoom) {
+            pipeline.busy++;
+            return get_slot(*counter);
+        }
+        uv_cond_wait(&pipeline.changed, &pipeline.lock);
+    }
+    return NULL;
+}
+
+static void release_slot(uint64_t *counter, double *stageTime, double start) {
+    (*counter)++;
+    *stageTime += get_now() - start;
+    pipeline.busy--;
+    uv_cond_broadcast(&pipeline.changed);
+}
+
+static void run_reader(void *arg) {
+    uv_mutex_lock(&pipeline.lock);
+    while (true) {
+        struct PipelineSlot *slot = wait_for_slot(&pipeline.read, &pipeline.queued, true);
+        if (!slot) {
+            break;
+        }
+        uv_mutex_unlock(&pipeline.lock);
+        double start = get_now();
+        slot->buffer = CALLOC(1, MESSAGE_BUFFER_LENGTH, "pipeline:buffer");
+        slot->status = read_block_file(slot->hash, slot->buffer, &slot->fileSize);
+        uv_mutex_lock(&pipeline.lock);
+        release_slot(&pipeline.read, &pipeline.stats.readTime, start);
+    }
+    uv_mutex_unlock(&pipeline.lock);
+}
+
+static void run_parser(void *arg) {
+    uv_mutex_lock(&pipeline.lock);
+    while (true) {
+        struct PipelineSlot *slot = wait_for_slot(&pipeline.parsed, &pipeline.read, false);
+        if (!slot) {
+            break;
+        }
+        uv_mutex_unlock(&pipeline.lock);
+        double start = get_now();
+        if (!slot->status) {
+            slot->block = CALLOC(1, sizeof(BlockPayload), "block_payload");
+            slot->status = check_block_file(slot->hash, slot->buffer, slot->fileSize, slot->block);
+            slot->unavailable = slot->status != 0;
+        }
+        FREE(slot->buffer, "pipeline:buffer");
+        slot->buffer = NULL;
+        uv_mutex_lock(&pipeline.lock);
+        release_slot(&pipeline.parsed, &pipeline.stats.parseTime, start);
+    }
+    uv_mutex_unlock(&pipeline.lock);
+}
+
+static void run_resolver(void *arg) {
+    uv_mutex_lock(&pipeline.lock);
+    while (true) {
+        struct PipelineSlot *slot = wait_for_slot(&pipeline.resolved, &pipeline.parsed, false);
+        if (!slot) {
+            break;
+        }
+        uv_mutex_unlock(&pipeline.lock);
+        double start = get_now();
+        if (!slot->status) {
+            prefetch_block_inputs(slot->block);
+        }
+        uv_mutex_lock(&pipeline.lock);
+        release_slot(&pipeline.resolved, &pipeline.stats.resolveTime, start);
+    }
+    uv_mutex_unlock(&pipeline.lock);
+}
+
+static void clear_slot(struct PipelineSlot *slot) {
+    if (slot->buffer) {
+        FREE(slot->buffer, "pipeline:buffer");
+    }
+    if (slot->block) {
+        release_block(slot->block);
+    }
+    memset(slot, 0, sizeof(*slot));
+}
+
+// Drops every slot not yet taken, once no stage is working on one; called with the lock held
+static void flush_pipeline() {
+    pipeline.flushing = true;
+    while (pipeline.busy) {
+        uv_cond_wait(&pipeline.changed, &pipeline.lock);
+    }
+    for (uint64_t number = pipeline.taken; number < pipeline.queued; number++) {
+        clear_slot(get_slot(number));
+    }
+    pipeline.stats.dropped += pipeline.queued - pipeline.taken;
+    pipeline.read = pipeline.queued;
+    pipeline.parsed = pipeline.queued;
+    pipeline.resolved = pipeline.queued;
+    pipeline.taken = pipeline.queued;
+    pipeline.flushing = false;
+    uv_cond_broadcast(&pipeline.changed);
+}
+
+// Runs config.pipelineDepth slots deep; a no-op when that is zero
+int8_t start_block_pipeline() {
+    if (pipeline.running || config.pipelineDepth == 0) {
+        return 0;
+    }
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.depth = config.pipelineDepth > MAX_PIPELINE_DEPTH ? MAX_PIPELINE_DEPTH : config.pipelineDepth;
+    pipeline.stats.depth = pipeline.depth;
+    uv_mutex_init(&pipeline.lock);
+    uv_cond_init(&pipeline.changed);
+    pipeline.running = true;
+    uv_thread_t *threads[] = {&pipeline.reader, &pipeline.parser, &pipeline.resolver};
+    uv_thread_cb stages[] = {&run_reader, &run_parser, &run_resolver};
+    for (uint32_t i = 0; i < sizeof(stages) / sizeof(stages[0]); i++) {
+        if (uv_thread_create(threads[i], stages[i], NULL)) {
+            fprintf(stderr, "start_block_pipeline: cannot start stage %u\n", i);
+            stop_block_pipeline();
+            return -1;
+        }
+        pipeline.threadCount++;
+    }
+    return 0;
+}
+
+// Joins the stages and drops the blocks nobody took; stats stay readable
+void stop_block_pipeline() {
+    if (!pipeline.running) {
+        return;
+    }
+    uv_mutex_lock(&pipeline.lock);
+    pipeline.stopping = true;
+    uv_cond_broadcast(&pipeline.changed);
+    uv_mutex_unlock(&pipeline.lock);
+    uv_thread_t *threads[] = {&pipeline.reader, &pipeline.parser, &pipeline.resolver};
+    for (uint32_t i = 0; i < pipeline.threadCount; i++) {
+        uv_thread_join(threads[i]);
+    }
+    for (uint64_t number = pipeline.taken; number < pipeline.queued; number++) {
+        clear_slot(get_slot(number));
+    }
+    pipeline.stats.dropped += pipeline.queued - pipeline.taken;
+    uv_cond_destroy(&pipeline.changed);
+    uv_mutex_destroy(&pipeline.lock);
+    pipeline.running = false;
+}
+
+bool is_block_pipeline_running() {
+    return pipeline.running;
+}
+
+// Main thread only. Returns false when every slot is in use
+bool queue_pipeline_block(Byte *blockHash) {
+    if (!pipeline.running) {
+        return false;
+    }
+    uv_mutex_lock(&pipeline.lock);
+    bool hasRoom = pipeline.queued - pipeline.taken < pipeline.depth;
+    if (hasRoom) {
+        struct PipelineSlot *slot = get_slot(pipeline.queued);
+        memset(slot, 0, sizeof(*slot));
+        memcpy(slot->hash, blockHash, SHA256_LENGTH);
+        pipeline.queued++;
+        pipeline.stats.queued++;
+        uv_cond_broadcast(&pipeline.changed);
+    }
+    uv_mutex_unlock(&pipeline.lock);
+    return hasRoom;
+}
+
+// Main thread only. Waits for the oldest slot to finish and, if it holds the block asked for,
+// moves the payload into ptrBlock with the status load_block would have returned, and hands
+// what was prefetched for it to the UTXO cache. Returns false when the pipeline does not have
+// the block next, dropping whatever it had queued, so the caller must load it itself
+bool take_pipeline_block(Byte *blockHash, BlockPayload *ptrBlock, int8_t *status) {
+    if (!pipeline.running) {
+        return false;
+    }
+    uv_mutex_lock(&pipeline.lock);
+    if (pipeline.taken == pipeline.queued || !sha256_match(get_slot(pipeline.taken)->hash, blockHash)) {
+        flush_pipeline();
+        uv_mutex_unlock(&pipeline.lock);
+        return false;
+    }
+    double start = get_now();
+    while (pipeline.resolved <= pipeline.taken) {
+        uv_cond_wait(&pipeline.changed, &pipeline.lock);
+    }
+    pipeline.stats.waitTime += get_now() - start;
+    struct PipelineSlot slot = *get_slot(pipeline.taken);
+    memset(get_slot(pipeline.taken), 0, sizeof(slot));
+    pipeline.taken++;
+    pipeline.stats.taken++;
+    uv_cond_broadcast(&pipeline.changed);
+    uv_mutex_unlock(&pipeline.lock);
+
+    *status = slot.status;
+    if (slot.block) {
+        *ptrBlock = *slot.block;
+        FREE(slot.block, "block_payload");
+    }
+    if (slot.unavailable) {
+        mark_block_as_unavailable(blockHash);
+    }
+    drain_utxo_prefetch();
+    return true;
+}
+
+void get_block_pipeline_stats(PipelineStats *ptrStats) {
+    if (pipeline.running) {
+        uv_mutex_lock(&pipeline.lock);
+    }
+    *ptrStats = pipeline.stats;
+    if (pipeline.running) {
+        uv_mutex_unlock(&pipeline.lock);
+    }
+}
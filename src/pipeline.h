@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "datatypes.h"
+#include "messages/block.h"
+
+// Staged block validation for validate_blocks. Each stage has its own thread and works through
+// a ring of config.pipelineDepth slots in chain order:
+// - read: the archive file into a buffer
+// - parse: the buffer into a payload, checked against its hash and for legality
+// - resolve: the outputs its inputs spend, fetched from the UTXO database for the prefetcher
+//   to hand to the cache (see prefetch.h); skipped while prefetching is off
+// The validating thread takes the finished blocks in order and goes on with prevouts and amounts,
+// the script checks on their own pool (see verifier.h), then the commit that advances
+// mainValidatedTip. A block's inputs may spend the outputs of the one before it, so those last
+// steps wait for the previous commit; everything before them runs up to a ring ahead.
+// Slots between the read and parse stages hold a whole file buffer, so at most
+// PIPELINE_MAX_READ_AHEAD of them may be waiting for the parser.
+
+#define MAX_PIPELINE_DEPTH 64
+#define PIPELINE_MAX_READ_AHEAD 2
+
+struct PipelineStats {
+    uint32_t depth;
+    uint64_t queued;
+    uint64_t taken; // by the validating thread from a finished slot
+    uint64_t dropped; // queued but never taken, after a change of course or on stopping
+    double readTime; // ms spent by each stage on its own work
+    double parseTime;
+    double resolveTime;
+    double waitTime; // ms the validating thread spent waiting for a slot to finish
+};
+
+typedef struct PipelineStats PipelineStats;
+
+int8_t start_block_pipeline(void);
+void stop_block_pipeline(void);
+bool is_block_pipeline_running(void);
+bool queue_pipeline_block(Byte *blockHash);
+bool take_pipeline_block(Byte *blockHash, BlockPayload *ptrBlock, int8_t *status);
+void get_block_pipeline_stats(PipelineStats *ptrStats);
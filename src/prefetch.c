@@ -0,0 +1,263 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "prefetch.h"
+#include "compressor.h"
+#include "config.h"
+#include "persistent.h"
+#include "utxo.h"
+#include "messages/block.h"
+#include "utils/memory.h"
+
+struct PrefetchedOutput {
+    struct PrefetchedOutput *next;
+    Outpoint outpoint;
+    uint64_t generation; // of the UTXO database when read
+    uint32_t width;
+    Byte data[];
+};
+
+// The queue, the found list and the counters in stats are shared with the workers under lock;
+// depth and the adaptation window belong to the main thread
+struct Prefetcher {
+    bool running;
+    bool stopping;
+    uv_mutex_t lock;
+    uv_cond_t jobReady;
+    uv_thread_t threads[MAX_PREFETCH_THREADS];
+    uint32_t threadCount;
+    SHA256_HASH queue[PREFETCH_MAX_DEPTH];
+    uint32_t queueStart;
+    uint32_t queueLength;
+    struct PrefetchedOutput *found;
+    uint32_t depth;
+    uint64_t windowHits;
+    uint64_t windowMisses;
+    PrefetchStats stats;
+};
+
+static struct Prefetcher prefetcher;
+
+static struct PrefetchedOutput *fetch_block_inputs(BlockPayload *block, uint64_t *lookups) {
+    // Taken before the first lookup, so a flush racing with any of them voids the results
+    uint64_t generation = get_utxo_flush_generation();
+    struct PrefetchedOutput *found = NULL;
+    Byte buffer[MAX_COMPRESSED_TX_OUT_WIDTH];
+    // The coinbase spends nothing
+    for (uint64_t i = 1; i < block->txCount; i++) {
+        TxPayload *tx = &block->txs[i];
+        for (uint64_t j = 0; j < tx->txInputCount; j++) {
+            Outpoint *outpoint = &tx->txInputs[j].previous_output;
+            size_t width = 0;
+            (*lookups)++;
+            if (load_utxo_data(outpoint, buffer, &width)) {
+                continue;
+            }
+            struct PrefetchedOutput *output = MALLOC(sizeof(*output) + width, "prefetch:output");
+            output->next = found;
+            output->outpoint = *outpoint;
+            output->generation = generation;
+            output->width = (uint32_t)width;
+            memcpy(output->data, buffer, width);
+            found = output;
+        }
+    }
+    return found;
+}
+
+static struct PrefetchedOutput *fetch_archived_block_inputs(Byte *blockHash, uint64_t *lookups) {
+    BlockPayload *block = CALLOC(1, sizeof(BlockPayload), "block_payload");
+    if (read_archived_block(blockHash, block)) {
+        FREE(block, "block_payload");
+        return NULL;
+    }
+    struct PrefetchedOutput *found = fetch_block_inputs(block, lookups);
+    release_block(block);
+    return found;
+}
+
+// Called with the lock held
+static void record_fetched_block(struct PrefetchedOutput *found, uint64_t lookups) {
+    prefetcher.stats.blocks++;
+    prefetcher.stats.lookups += lookups;
+    while (found) {
+        struct PrefetchedOutput *next = found->next;
+        found->next = prefetcher.found;
+        prefetcher.found = found;
+        prefetcher.stats.found++;
+        found = next;
+    }
+}
+
+static void run_prefetch_worker(void *arg) {
+    uv_mutex_lock(&prefetcher.lock);
+    while (true) {
+        while (!prefetcher.stopping && prefetcher.queueLength == 0) {
+            uv_cond_wait(&prefetcher.jobReady, &prefetcher.lock);
+        }
+        if (prefetcher.stopping) {
+            break;
+        }
+        SHA256_HASH blockHash = {0};
+        memcpy(blockHash, prefetcher.queue[prefetcher.queueStart], SHA256_LENGTH);
+        prefetcher.queueStart = (prefetcher.queueStart + 1) % PREFETCH_MAX_DEPTH;
+        prefetcher.queueLength--;
+        uv_mutex_unlock(&prefetcher.lock);
+
+        uint64_t lookups = 0;
+        struct PrefetchedOutput *found = fetch_archived_block_inputs(blockHash, &lookups);
+
+        uv_mutex_lock(&prefetcher.lock);
+        record_fetched_block(found, lookups);
+    }
+    uv_mutex_unlock(&prefetcher.lock);
+}
+
+static void release_found_outputs(struct PrefetchedOutput *found) {
+    while (found) {
+        struct PrefetchedOutput *next = found->next;
+        FREE(found, "prefetch:output");
+        found = next;
+    }
+}
+
+// Runs on config.prefetchThreads workers; a no-op when that is zero
+int8_t start_utxo_prefetch() {
+    if (prefetcher.running || config.prefetchThreads == 0) {
+        return 0;
+    }
+    uint32_t threadCount = config.prefetchThreads;
+    if (threadCount > MAX_PREFETCH_THREADS) {
+        threadCount = MAX_PREFETCH_THREADS;
+    }
+    memset(&prefetcher, 0, sizeof(prefetcher));
+    uv_mutex_init(&prefetcher.lock);
+    uv_cond_init(&prefetcher.jobReady);
+    prefetcher.depth = PREFETCH_INITIAL_DEPTH;
+    prefetcher.stats.depth = prefetcher.depth;
+    UtxoCacheStats cacheStats;
+    get_utxo_cache_stats(&cacheStats);
+    prefetcher.windowHits = cacheStats.hits;
+    prefetcher.windowMisses = cacheStats.misses;
+    prefetcher.running = true;
+    for (uint32_t i = 0; i < threadCount; i++) {
+        if (uv_thread_create(&prefetcher.threads[i], &run_prefetch_worker, NULL)) {
+            fprintf(stderr, "start_utxo_prefetch: cannot start worker %u\n", i);
+            stop_utxo_prefetch();
+            return -1;
+        }
+        prefetcher.threadCount++;
+    }
+    prefetcher.stats.threads = prefetcher.threadCount;
+    return 0;
+}
+
+// Joins the workers and drops whatever they found but nobody drained; stats stay readable
+void stop_utxo_prefetch() {
+    if (!prefetcher.running) {
+        return;
+    }
+    uv_mutex_lock(&prefetcher.lock);
+    prefetcher.stopping = true;
+    uv_cond_broadcast(&prefetcher.jobReady);
+    uv_mutex_unlock(&prefetcher.lock);
+    for (uint32_t i = 0; i < prefetcher.threadCount; i++) {
+        uv_thread_join(&prefetcher.threads[i]);
+    }
+    uv_cond_destroy(&prefetcher.jobReady);
+    uv_mutex_destroy(&prefetcher.lock);
+    release_found_outputs(prefetcher.found);
+    prefetcher.found = NULL;
+    prefetcher.queueLength = 0;
+    prefetcher.running = false;
+}
+
+bool is_utxo_prefetch_running() {
+    return prefetcher.running;
+}
+
+uint32_t get_utxo_prefetch_depth() {
+    return prefetcher.running ? prefetcher.depth : 0;
+}
+
+// Best effort: a block is skipped when the workers are a full queue behind
+void queue_utxo_prefetch(Byte *blockHash) {
+    if (!prefetcher.running) {
+        return;
+    }
+    uv_mutex_lock(&prefetcher.lock);
+    if (prefetcher.queueLength < PREFETCH_MAX_DEPTH) {
+        uint32_t slot = (prefetcher.queueStart + prefetcher.queueLength) % PREFETCH_MAX_DEPTH;
+        memcpy(prefetcher.queue[slot], blockHash, SHA256_LENGTH);
+        prefetcher.queueLength++;
+        uv_cond_signal(&prefetcher.jobReady);
+    }
+    uv_mutex_unlock(&prefetcher.lock);
+}
+
+// For a block already in memory, such as one in the validation pipeline: the lookups run on the
+// calling thread, any thread, and the results wait for drain_utxo_prefetch like the workers'
+void prefetch_block_inputs(BlockPayload *ptrBlock) {
+    if (!prefetcher.running) {
+        return;
+    }
+    uint64_t lookups = 0;
+    struct PrefetchedOutput *found = fetch_block_inputs(ptrBlock, &lookups);
+    uv_mutex_lock(&prefetcher.lock);
+    record_fetched_block(found, lookups);
+    uv_mutex_unlock(&prefetcher.lock);
+}
+
+// Misses mean the workers fall behind or the cache keeps too little, so look further ahead;
+// once nearly everything hits, back off to hold fewer blocks' worth of outputs
+static void adapt_depth() {
+    UtxoCacheStats cacheStats;
+    get_utxo_cache_stats(&cacheStats);
+    uint64_t hits = cacheStats.hits - prefetcher.windowHits;
+    uint64_t misses = cacheStats.misses - prefetcher.windowMisses;
+    if (hits + misses < PREFETCH_ADAPT_WINDOW) {
+        return;
+    }
+    double hitRate = (double)hits / (double)(hits + misses);
+    if (hitRate < PREFETCH_GROW_BELOW_HIT_RATE) {
+        prefetcher.depth *= 2;
+        if (prefetcher.depth > PREFETCH_MAX_DEPTH) {
+            prefetcher.depth = PREFETCH_MAX_DEPTH;
+        }
+    }
+    else if (hitRate > PREFETCH_SHRINK_ABOVE_HIT_RATE && prefetcher.depth > PREFETCH_MIN_DEPTH) {
+        prefetcher.depth--;
+    }
+    prefetcher.windowHits = cacheStats.hits;
+    prefetcher.windowMisses = cacheStats.misses;
+    prefetcher.stats.depth = prefetcher.depth;
+}
+
+// Main thread only, between blocks: hands what the workers found to the cache
+void drain_utxo_prefetch() {
+    if (!prefetcher.running) {
+        return;
+    }
+    uv_mutex_lock(&prefetcher.lock);
+    struct PrefetchedOutput *found = prefetcher.found;
+    prefetcher.found = NULL;
+    uv_mutex_unlock(&prefetcher.lock);
+    for (struct PrefetchedOutput *output = found; output; output = output->next) {
+        if (prime_utxo(&output->outpoint, output->data, output->width, output->generation) == 0) {
+            prefetcher.stats.primed++;
+        }
+    }
+    release_found_outputs(found);
+    adapt_depth();
+}
+
+void get_utxo_prefetch_stats(PrefetchStats *ptrStats) {
+    if (prefetcher.running) {
+        uv_mutex_lock(&prefetcher.lock);
+    }
+    *ptrStats = prefetcher.stats;
+    if (prefetcher.running) {
+        uv_mutex_unlock(&prefetcher.lock);
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "datatypes.h"
+#include "messages/block.h"
+
+// Lookahead for validate_blocks: worker threads read the blocks queued ahead of the one being
+// validated and fetch the outputs their inputs spend from the UTXO database. The main thread
+// moves the results into the cache between blocks, so the cache stays single-threaded.
+// The lookahead depth doubles while the cache hit rate is low and shrinks once it is high.
+
+#define MAX_PREFETCH_THREADS 32
+#define PREFETCH_MIN_DEPTH 1
+#define PREFETCH_INITIAL_DEPTH 4
+#define PREFETCH_MAX_DEPTH 64 // blocks
+#define PREFETCH_ADAPT_WINDOW 1024 // cache lookups between depth changes
+#define PREFETCH_GROW_BELOW_HIT_RATE 0.95
+#define PREFETCH_SHRINK_ABOVE_HIT_RATE 0.995
+
+struct PrefetchStats {
+    uint32_t threads;
+    uint32_t depth; // latest, kept after stopping
+    uint64_t blocks;
+    uint64_t lookups;
+    uint64_t found;
+    uint64_t primed; // accepted into the cache
+};
+
+typedef struct PrefetchStats PrefetchStats;
+
+int8_t start_utxo_prefetch(void);
+void stop_utxo_prefetch(void);
+bool is_utxo_prefetch_running(void);
+uint32_t get_utxo_prefetch_depth(void);
+void queue_utxo_prefetch(Byte *blockHash);
+void prefetch_block_inputs(BlockPayload *ptrBlock);
+void drain_utxo_prefetch(void);
+void get_utxo_prefetch_stats(PrefetchStats *ptrStats);
@@ -6,6 +6,7 @@
 #include "openssl/obj_mac.h"
 
 #include "script.h"
+#include "sigcache.h"
 #include "messages/tx.h"
 #include "datatypes.h"
 #include "parameters.h"
@@ -26,14 +27,6 @@
 
 #define MASK_HASHTYPE(ht) (ht & 0x1f)
 
-enum HashType {
-    SIGHASH_ALL_ALTERNATIVE = 0,
-    SIGHASH_ALL = 1,
-    SIGHASH_NONE = 2,
-    SIGHASH_SINGLE = 3,
-    SIGHASH_ANYONECANPAY = 0x80,
-};
-
 enum FrameType {
     FRAME_TYPE_OP,
     FRAME_TYPE_DATA,
@@ -395,6 +388,25 @@ TxPayload *make_tx_copy(CheckSigMeta meta, Byte *subscript, uint64_t subscriptLe
     return txCopy;
 }
 
+// The digest an input's signature commits to, with `subscript` standing in for its signature script
+void compute_signature_hash(
+    TxPayload *tx,
+    uint64_t inputIndex,
+    Byte *subscript,
+    uint64_t subscriptLength,
+    uint32_t hashType,
+    SHA256_HASH result
+) {
+    CheckSigMeta meta = {
+        .currentTx = tx,
+        .txInputIndex = inputIndex,
+    };
+    TxPayload *txCopy = make_tx_copy(meta, subscript, subscriptLength);
+    hash_tx_with_hashtype(txCopy, hashType, inputIndex, result);
+    release_items_in_tx(txCopy);
+    FREE(txCopy, "make_tx_copy:txCopy");
+}
+
 #define MAX_SIGNATURE_DATA 128
 
 struct SignatureComponent {
@@ -456,13 +468,13 @@ int8_t fix_signature_component_preceding_zeros(SignatureComponent *component) {
     int8_t offset = 0;
     // Remove current zeros
     while (component->data[0] == 0 && component->length > 0) {
-        memcpy(component->data, component->data+1, component->length-1);
+        memmove(component->data, component->data+1, component->length-1);
         component->length -= 1;
         offset -= 1;
     }
     // Put in our own
     if (byte_has_initial_zero(component->data[0])) {
-        memcpy(component->data+1, component->data, component->length);
+        memmove(component->data+1, component->data, component->length);
         component->data[0] = 0;
         component->length += 1;
         offset += 1;
@@ -696,6 +708,15 @@ int8_t check_signature(StackFrame pubkeyFrame, StackFrame sigFrame, CheckSigMeta
         );
         return -1;
     }
+    uint32_t hashtype = sigFrame.data[sigFrame.dataWidth-1];
+    fix_signature_frame(&sigFrame);
+    SHA256_HASH hashTx = {0};
+    compute_signature_hash(meta.currentTx, meta.txInputIndex, subscript, subscriptLength, hashtype, hashTx);
+    // The hash type is committed to by hashTx, so the signature is keyed without it
+    if (is_signature_cached(hashTx, pubkeyFrame.data, pubkeyFrame.dataWidth, sigFrame.data, sigFrame.dataWidth - 1)) {
+        return 1;
+    }
+
     EC_KEY *ptrPubKey = EC_KEY_new_by_curve_name(NID_secp256k1);
     int32_t status = EC_KEY_oct2key(
         ptrPubKey,
@@ -705,17 +726,10 @@ int8_t check_signature(StackFrame pubkeyFrame, StackFrame sigFrame, CheckSigMeta
     );
     if (status != 1) {
         fprintf(stderr, "Failed to decode elliptic public key\n");
+        EC_KEY_free(ptrPubKey);
         return -1;
     }
 
-    uint32_t hashtype = sigFrame.data[sigFrame.dataWidth-1];
-    fix_signature_frame(&sigFrame);
-    SHA256_HASH hashTx = {0};
-    TxPayload *txCopy = make_tx_copy(meta, subscript, subscriptLength);
-    hash_tx_with_hashtype(txCopy, hashtype, meta.txInputIndex, hashTx);
-    release_items_in_tx(txCopy);
-    FREE(txCopy, "make_tx_copy:txCopy");
-
     int32_t verification = ECDSA_verify(
         0,
         hashTx,
@@ -739,6 +753,7 @@ int8_t check_signature(StackFrame pubkeyFrame, StackFrame sigFrame, CheckSigMeta
         #if LOG_VALIDATION_PROCEDURES
         printf("ECDSA_verify: OK\n");
         #endif
+        cache_signature(hashTx, pubkeyFrame.data, pubkeyFrame.dataWidth, sigFrame.data, sigFrame.dataWidth - 1);
         return 1;
     }
 }
@@ -142,6 +142,14 @@ enum OpcodeType {
     OP_INVALIDOPCODE = 0xff,
 };
 
+enum HashType {
+    SIGHASH_ALL_ALTERNATIVE = 0,
+    SIGHASH_ALL = 1,
+    SIGHASH_NONE = 2,
+    SIGHASH_SINGLE = 3,
+    SIGHASH_ANYONECANPAY = 0x80,
+};
+
 struct CheckSigMeta {
     TxOut *sourceOutput;
     TxPayload *currentTx;
@@ -153,3 +161,11 @@ typedef struct CheckSigMeta CheckSigMeta;
 const char* get_op_name(enum OpcodeType opcode);
 
 bool run_program(Byte *program, uint64_t programLength, CheckSigMeta meta);
+void compute_signature_hash(
+    TxPayload *tx,
+    uint64_t inputIndex,
+    Byte *subscript,
+    uint64_t subscriptLength,
+    uint32_t hashType,
+    SHA256_HASH result
+);
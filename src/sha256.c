@@ -0,0 +1,699 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "openssl/sha.h"
+
+#include "sha256.h"
+#include "hash.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA256_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#else
+#define SHA256_X86 0
+#endif
+
+// @see FIPS 180-4, section 4.2.2 and 5.3.3
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t INITIAL_STATE[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+// Written as macros so they apply to plain words and to lane vectors alike
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define CH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define BIG_SIGMA0(x) (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define BIG_SIGMA1(x) (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define SMALL_SIGMA0(x) (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define SMALL_SIGMA1(x) (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+
+#define SHA256_BLOCK_WIDTH 64
+#define SHA256_MAX_TAIL_WIDTH (2 * SHA256_BLOCK_WIDTH)
+
+// Completes the single block holding a 32-byte digest: the end marker, then its bit length (256)
+static const Byte DIGEST_PADDING[SHA256_BLOCK_WIDTH - SHA256_LENGTH] = {
+    [0] = 0x80, [SHA256_BLOCK_WIDTH - SHA256_LENGTH - 2] = 0x01,
+};
+
+static uint32_t load_be32(const Byte *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void store_be32(Byte *p, uint32_t value) {
+    p[0] = (Byte)(value >> 24);
+    p[1] = (Byte)(value >> 16);
+    p[2] = (Byte)(value >> 8);
+    p[3] = (Byte)value;
+}
+
+// Copies the trailing partial block of a message and appends the padding; returns the block count (1 or 2).
+// `prefixLength` counts whole blocks hashed before `data`, as when resuming from a midstate.
+static uint32_t pad_tail(const Byte *data, uint64_t length, uint64_t prefixLength, Byte *tail) {
+    uint64_t remainder = length % SHA256_BLOCK_WIDTH;
+    memset(tail, 0, SHA256_MAX_TAIL_WIDTH);
+    memcpy(tail, data + length - remainder, remainder);
+    tail[remainder] = 0x80;
+    uint32_t blocks = remainder + 9 > SHA256_BLOCK_WIDTH ? 2 : 1;
+    uint64_t bitLength = (prefixLength + length) * 8;
+    for (uint32_t i = 0; i < 8; i++) {
+        tail[blocks * SHA256_BLOCK_WIDTH - 1 - i] = (Byte)(bitLength >> (8 * i));
+    }
+    return blocks;
+}
+
+static void sha256_stream_openssl(const Byte *data, uint64_t length, Byte *result) {
+    SHA256_CTX context;
+    SHA256_Init(&context);
+    SHA256_Update(&context, data, length);
+    SHA256_Final(result, &context);
+}
+
+static void transform_portable(uint32_t *state, const Byte *data, uint64_t blocks) {
+    for (uint64_t block = 0; block < blocks; block++) {
+        const Byte *p = data + block * SHA256_BLOCK_WIDTH;
+        uint32_t w[64];
+        for (uint32_t t = 0; t < 16; t++) {
+            w[t] = load_be32(p + t * 4);
+        }
+        for (uint32_t t = 16; t < 64; t++) {
+            w[t] = SMALL_SIGMA1(w[t - 2]) + w[t - 7] + SMALL_SIGMA0(w[t - 15]) + w[t - 16];
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (uint32_t t = 0; t < 64; t++) {
+            uint32_t t1 = h + BIG_SIGMA1(e) + CH(e, f, g) + K[t] + w[t];
+            uint32_t t2 = BIG_SIGMA0(a) + MAJ(a, b, c);
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+static const uint32_t *get_start_state(const Sha256Midstate *ptrMidstate) {
+    return ptrMidstate ? ptrMidstate->state : INITIAL_STATE;
+}
+
+static uint64_t get_prefix_length(const Sha256Midstate *ptrMidstate) {
+    return ptrMidstate ? ptrMidstate->length : 0;
+}
+
+/*
+ * Multi-buffer: one message per lane, the same round applied to every lane at once.
+ * GCC/Clang vector extensions map the lanes onto a single AVX2 register,
+ * or onto two SSE2 registers of 4 lanes each when built for the baseline target.
+ */
+
+typedef uint32_t Lanes __attribute__((vector_size(SHA256_BATCH_LANES * sizeof(uint32_t))));
+
+// One round with the working variables renamed instead of shifted, so unrolling keeps them in registers
+#define LANES_ROUND(a, b, c, d, e, f, g, h, k, wt) do { \
+    Lanes t1 = h + BIG_SIGMA1(e) + CH(e, f, g) + (k) + (wt); \
+    Lanes t2 = BIG_SIGMA0(a) + MAJ(a, b, c); \
+    d += t1; \
+    h = t1 + t2; \
+} while (0)
+
+#define LANES_EXPAND(w, t) \
+    (w[(t) & 15] += SMALL_SIGMA1(w[((t) - 2) & 15]) + w[((t) - 7) & 15] + SMALL_SIGMA0(w[((t) - 15) & 15]))
+
+#define LANES_EIGHT_ROUNDS(t, W) do { \
+    LANES_ROUND(a, b, c, d, e, f, g, h, K[(t) + 0], W((t) + 0)); \
+    LANES_ROUND(h, a, b, c, d, e, f, g, K[(t) + 1], W((t) + 1)); \
+    LANES_ROUND(g, h, a, b, c, d, e, f, K[(t) + 2], W((t) + 2)); \
+    LANES_ROUND(f, g, h, a, b, c, d, e, K[(t) + 3], W((t) + 3)); \
+    LANES_ROUND(e, f, g, h, a, b, c, d, K[(t) + 4], W((t) + 4)); \
+    LANES_ROUND(d, e, f, g, h, a, b, c, K[(t) + 5], W((t) + 5)); \
+    LANES_ROUND(c, d, e, f, g, h, a, b, K[(t) + 6], W((t) + 6)); \
+    LANES_ROUND(b, c, d, e, f, g, h, a, K[(t) + 7], W((t) + 7)); \
+} while (0)
+
+#define LANES_LOADED(t) w[(t) & 15]
+#define LANES_EXPANDED(t) LANES_EXPAND(w, t)
+
+static inline __attribute__((always_inline)) void transform_lanes(Lanes *state, Lanes *w) {
+    Lanes a = state[0], b = state[1], c = state[2], d = state[3];
+    Lanes e = state[4], f = state[5], g = state[6], h = state[7];
+    LANES_EIGHT_ROUNDS(0, LANES_LOADED);
+    LANES_EIGHT_ROUNDS(8, LANES_LOADED);
+    for (uint32_t t = 16; t < 64; t += 8) {
+        LANES_EIGHT_ROUNDS(t, LANES_EXPANDED);
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+static inline __attribute__((always_inline)) void load_lanes(const Byte *data, uint64_t stride, Lanes *w) {
+    for (uint32_t word = 0; word < 16; word++) {
+        for (uint32_t lane = 0; lane < SHA256_BATCH_LANES; lane++) {
+            w[word][lane] = load_be32(data + lane * stride + word * 4);
+        }
+    }
+}
+
+// Loads the padding block shared by every lane when the width is a whole number of blocks
+static inline __attribute__((always_inline)) void load_length_block(uint64_t bitLength, Lanes *w) {
+    for (uint32_t word = 0; word < 16; word++) {
+        w[word] = (Lanes){0};
+    }
+    w[0] += 0x80000000u;
+    w[14] += (uint32_t)(bitLength >> 32);
+    w[15] += (uint32_t)bitLength;
+}
+
+static inline __attribute__((always_inline)) void sha256_lanes_body(
+    const Sha256Midstate *ptrMidstate,
+    const Byte *data,
+    uint64_t width,
+    bool doubleHash,
+    Byte *results
+) {
+    Lanes state[8];
+    Lanes w[16];
+    const uint32_t *startState = get_start_state(ptrMidstate);
+    uint64_t prefixLength = get_prefix_length(ptrMidstate);
+    for (uint32_t i = 0; i < 8; i++) {
+        state[i] = (Lanes){0} + startState[i];
+    }
+    uint64_t fullBlocks = width / SHA256_BLOCK_WIDTH;
+    for (uint64_t block = 0; block < fullBlocks; block++) {
+        load_lanes(data + block * SHA256_BLOCK_WIDTH, width, w);
+        transform_lanes(state, w);
+    }
+    if (width % SHA256_BLOCK_WIDTH == 0) {
+        load_length_block((prefixLength + width) * 8, w);
+        transform_lanes(state, w);
+    }
+    else {
+        Byte tails[SHA256_BATCH_LANES][SHA256_MAX_TAIL_WIDTH];
+        uint32_t tailBlocks = 0;
+        for (uint32_t lane = 0; lane < SHA256_BATCH_LANES; lane++) {
+            tailBlocks = pad_tail(data + lane * width, width, prefixLength, tails[lane]);
+        }
+        for (uint32_t block = 0; block < tailBlocks; block++) {
+            load_lanes(tails[0] + block * SHA256_BLOCK_WIDTH, SHA256_MAX_TAIL_WIDTH, w);
+            transform_lanes(state, w);
+        }
+    }
+    if (doubleHash) {
+        // The first digest is already in lanes as big-endian words: hash it as one padded block
+        load_length_block(SHA256_LENGTH * 8, w);
+        w[8] = w[0];
+        for (uint32_t i = 0; i < 8; i++) {
+            w[i] = state[i];
+            state[i] = (Lanes){0} + INITIAL_STATE[i];
+        }
+        transform_lanes(state, w);
+    }
+    for (uint32_t lane = 0; lane < SHA256_BATCH_LANES; lane++) {
+        for (uint32_t i = 0; i < 8; i++) {
+            store_be32(results + lane * SHA256_LENGTH + i * 4, state[i][lane]);
+        }
+    }
+}
+
+static void sha256_lanes_portable(
+    const Sha256Midstate *ptrMidstate,
+    const Byte *data,
+    uint64_t width,
+    bool doubleHash,
+    Byte *results
+) {
+    sha256_lanes_body(ptrMidstate, data, width, doubleHash, results);
+}
+
+#if SHA256_X86
+
+__attribute__((target("avx2")))
+static void sha256_lanes_avx2(
+    const Sha256Midstate *ptrMidstate,
+    const Byte *data,
+    uint64_t width,
+    bool doubleHash,
+    Byte *results
+) {
+    sha256_lanes_body(ptrMidstate, data, width, doubleHash, results);
+}
+
+// @see Intel SHA Extensions whitepaper; state is kept as ABEF/CDGH register pairs
+
+// Four rounds on one group of schedule words
+#define SHANI_ROUNDS(group, w, abef, cdgh) do { \
+    __m128i message = _mm_add_epi32(w, _mm_loadu_si128((const __m128i *)&K[(group) * 4])); \
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, message); \
+    message = _mm_shuffle_epi32(message, 0x0E); \
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, message); \
+} while (0)
+
+// Extends the schedule by four words in place of the oldest group (w0), given the three that follow it
+#define SHANI_SCHEDULE(w0, w1, w2, w3) do { \
+    w0 = _mm_sha256msg1_epu32(w0, w1); \
+    w0 = _mm_add_epi32(w0, _mm_alignr_epi8(w3, w2, 4)); \
+    w0 = _mm_sha256msg2_epu32(w0, w3); \
+} while (0)
+
+// Sixteen rounds: the schedule extended by one group ahead of each of the four round groups
+#define SHANI_SIXTEEN_ROUNDS(group, w0, w1, w2, w3, abef, cdgh) do { \
+    SHANI_SCHEDULE(w0, w1, w2, w3); \
+    SHANI_ROUNDS(group, w0, abef, cdgh); \
+    SHANI_SCHEDULE(w1, w2, w3, w0); \
+    SHANI_ROUNDS((group) + 1, w1, abef, cdgh); \
+    SHANI_SCHEDULE(w2, w3, w0, w1); \
+    SHANI_ROUNDS((group) + 2, w2, abef, cdgh); \
+    SHANI_SCHEDULE(w3, w0, w1, w2); \
+    SHANI_ROUNDS((group) + 3, w3, abef, cdgh); \
+} while (0)
+
+#define SHANI_LOAD(w, p, offset) \
+    __m128i w = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)((p) + (offset))), byteSwap)
+
+__attribute__((target("sha,sse4.1")))
+static inline void load_shani_state(const uint32_t *state, __m128i *abef, __m128i *cdgh) {
+    __m128i dcba = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+    __m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+    *abef = _mm_alignr_epi8(dcba, efgh, 8);
+    *cdgh = _mm_blend_epi16(efgh, dcba, 0xF0);
+}
+
+__attribute__((target("sha,sse4.1")))
+static inline void store_shani_state(uint32_t *state, __m128i abef, __m128i cdgh) {
+    __m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+    __m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(feba, dchg, 0xF0));
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(dchg, feba, 8));
+}
+
+__attribute__((target("sha,sse4.1")))
+static void transform_shani(uint32_t *state, const Byte *data, uint64_t blocks) {
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i abef, cdgh;
+    load_shani_state(state, &abef, &cdgh);
+    for (uint64_t block = 0; block < blocks; block++) {
+        const Byte *p = data + block * SHA256_BLOCK_WIDTH;
+        __m128i savedAbef = abef;
+        __m128i savedCdgh = cdgh;
+        SHANI_LOAD(w0, p, 0);
+        SHANI_LOAD(w1, p, 16);
+        SHANI_LOAD(w2, p, 32);
+        SHANI_LOAD(w3, p, 48);
+        SHANI_ROUNDS(0, w0, abef, cdgh);
+        SHANI_ROUNDS(1, w1, abef, cdgh);
+        SHANI_ROUNDS(2, w2, abef, cdgh);
+        SHANI_ROUNDS(3, w3, abef, cdgh);
+        for (uint32_t group = 4; group < 16; group += 4) {
+            SHANI_SIXTEEN_ROUNDS(group, w0, w1, w2, w3, abef, cdgh);
+        }
+        abef = _mm_add_epi32(abef, savedAbef);
+        cdgh = _mm_add_epi32(cdgh, savedCdgh);
+    }
+    store_shani_state(state, abef, cdgh);
+}
+
+// Two independent messages interleaved: the round instructions have long latency,
+// so a single message leaves most of the SHA unit idle
+__attribute__((target("sha,sse4.1")))
+static void transform_shani_2way(
+    uint32_t *stateX, const Byte *dataX,
+    uint32_t *stateY, const Byte *dataY,
+    uint64_t blocks
+) {
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i abefX, cdghX, abefY, cdghY;
+    load_shani_state(stateX, &abefX, &cdghX);
+    load_shani_state(stateY, &abefY, &cdghY);
+    for (uint64_t block = 0; block < blocks; block++) {
+        const Byte *pX = dataX + block * SHA256_BLOCK_WIDTH;
+        const Byte *pY = dataY + block * SHA256_BLOCK_WIDTH;
+        __m128i savedAbefX = abefX, savedCdghX = cdghX;
+        __m128i savedAbefY = abefY, savedCdghY = cdghY;
+        SHANI_LOAD(x0, pX, 0);
+        SHANI_LOAD(y0, pY, 0);
+        SHANI_LOAD(x1, pX, 16);
+        SHANI_LOAD(y1, pY, 16);
+        SHANI_LOAD(x2, pX, 32);
+        SHANI_LOAD(y2, pY, 32);
+        SHANI_LOAD(x3, pX, 48);
+        SHANI_LOAD(y3, pY, 48);
+        SHANI_ROUNDS(0, x0, abefX, cdghX);
+        SHANI_ROUNDS(0, y0, abefY, cdghY);
+        SHANI_ROUNDS(1, x1, abefX, cdghX);
+        SHANI_ROUNDS(1, y1, abefY, cdghY);
+        SHANI_ROUNDS(2, x2, abefX, cdghX);
+        SHANI_ROUNDS(2, y2, abefY, cdghY);
+        SHANI_ROUNDS(3, x3, abefX, cdghX);
+        SHANI_ROUNDS(3, y3, abefY, cdghY);
+        for (uint32_t group = 4; group < 16; group += 4) {
+            SHANI_SCHEDULE(x0, x1, x2, x3);
+            SHANI_SCHEDULE(y0, y1, y2, y3);
+            SHANI_ROUNDS(group, x0, abefX, cdghX);
+            SHANI_ROUNDS(group, y0, abefY, cdghY);
+            SHANI_SCHEDULE(x1, x2, x3, x0);
+            SHANI_SCHEDULE(y1, y2, y3, y0);
+            SHANI_ROUNDS(group + 1, x1, abefX, cdghX);
+            SHANI_ROUNDS(group + 1, y1, abefY, cdghY);
+            SHANI_SCHEDULE(x2, x3, x0, x1);
+            SHANI_SCHEDULE(y2, y3, y0, y1);
+            SHANI_ROUNDS(group + 2, x2, abefX, cdghX);
+            SHANI_ROUNDS(group + 2, y2, abefY, cdghY);
+            SHANI_SCHEDULE(x3, x0, x1, x2);
+            SHANI_SCHEDULE(y3, y0, y1, y2);
+            SHANI_ROUNDS(group + 3, x3, abefX, cdghX);
+            SHANI_ROUNDS(group + 3, y3, abefY, cdghY);
+        }
+        abefX = _mm_add_epi32(abefX, savedAbefX);
+        cdghX = _mm_add_epi32(cdghX, savedCdghX);
+        abefY = _mm_add_epi32(abefY, savedAbefY);
+        cdghY = _mm_add_epi32(cdghY, savedCdghY);
+    }
+    store_shani_state(stateX, abefX, cdghX);
+    store_shani_state(stateY, abefY, cdghY);
+}
+
+// Batches run as pairs through the interleaved transform
+static void sha256_lanes_shani(
+    const Sha256Midstate *ptrMidstate,
+    const Byte *data,
+    uint64_t width,
+    bool doubleHash,
+    Byte *results
+) {
+    const uint32_t *startState = get_start_state(ptrMidstate);
+    uint64_t prefixLength = get_prefix_length(ptrMidstate);
+    uint64_t fullBlocks = width / SHA256_BLOCK_WIDTH;
+    for (uint32_t lane = 0; lane < SHA256_BATCH_LANES; lane += 2) {
+        const Byte *dataX = data + lane * width;
+        const Byte *dataY = dataX + width;
+        uint32_t stateX[8], stateY[8];
+        memcpy(stateX, startState, sizeof(stateX));
+        memcpy(stateY, startState, sizeof(stateY));
+        transform_shani_2way(stateX, dataX, stateY, dataY, fullBlocks);
+        Byte tailX[SHA256_MAX_TAIL_WIDTH], tailY[SHA256_MAX_TAIL_WIDTH];
+        pad_tail(dataX, width, prefixLength, tailX);
+        uint32_t tailBlocks = pad_tail(dataY, width, prefixLength, tailY);
+        transform_shani_2way(stateX, tailX, stateY, tailY, tailBlocks);
+        if (doubleHash) {
+            memcpy(tailX + SHA256_LENGTH, DIGEST_PADDING, sizeof(DIGEST_PADDING));
+            memcpy(tailY + SHA256_LENGTH, DIGEST_PADDING, sizeof(DIGEST_PADDING));
+            for (uint32_t i = 0; i < 8; i++) {
+                store_be32(tailX + i * 4, stateX[i]);
+                store_be32(tailY + i * 4, stateY[i]);
+            }
+            memcpy(stateX, INITIAL_STATE, sizeof(stateX));
+            memcpy(stateY, INITIAL_STATE, sizeof(stateY));
+            transform_shani_2way(stateX, tailX, stateY, tailY, 1);
+        }
+        for (uint32_t i = 0; i < 8; i++) {
+            store_be32(results + lane * SHA256_LENGTH + i * 4, stateX[i]);
+            store_be32(results + (lane + 1) * SHA256_LENGTH + i * 4, stateY[i]);
+        }
+    }
+}
+
+static void sha256_stream_shani(const Byte *data, uint64_t length, Byte *result) {
+    uint32_t state[8];
+    memcpy(state, INITIAL_STATE, sizeof(state));
+    transform_shani(state, data, length / SHA256_BLOCK_WIDTH);
+    Byte tail[SHA256_MAX_TAIL_WIDTH];
+    uint32_t tailBlocks = pad_tail(data, length, 0, tail);
+    transform_shani(state, tail, tailBlocks);
+    for (uint32_t i = 0; i < 8; i++) {
+        store_be32(result + i * 4, state[i]);
+    }
+}
+
+#endif
+
+#define CPU_FEATURE_NONE 0
+#define CPU_FEATURE_SSE2 (1 << 0)
+#define CPU_FEATURE_AVX2 (1 << 1)
+#define CPU_FEATURE_SHANI (1 << 2)
+
+typedef void Sha256StreamFunction(const Byte *data, uint64_t length, Byte *result);
+typedef void Sha256TransformFunction(uint32_t *state, const Byte *data, uint64_t blocks);
+typedef void Sha256LanesFunction(
+    const Sha256Midstate *ptrMidstate,
+    const Byte *data,
+    uint64_t width,
+    bool doubleHash,
+    Byte *results
+);
+
+struct Sha256Engine {
+    char *name;
+    Sha256StreamFunction *stream;
+    Sha256TransformFunction *transform;
+    Sha256LanesFunction *lanes; // NULL: batches go one item at a time through stream
+    uint32_t requiredFeatures;
+};
+
+typedef struct Sha256Engine Sha256Engine;
+
+// In order of preference; SHA extensions beat multi-buffer AVX2 even on 8 independent messages
+static Sha256Engine engines[] = {
+    #if SHA256_X86
+    {
+        .name = "shani",
+        .stream = &sha256_stream_shani,
+        .transform = &transform_shani,
+        .lanes = &sha256_lanes_shani,
+        .requiredFeatures = CPU_FEATURE_SHANI,
+    },
+    {
+        .name = "avx2-8way",
+        .stream = &sha256_stream_openssl,
+        .transform = &transform_portable,
+        .lanes = &sha256_lanes_avx2,
+        .requiredFeatures = CPU_FEATURE_AVX2,
+    },
+    {
+        .name = "sse2-4way",
+        .stream = &sha256_stream_openssl,
+        .transform = &transform_portable,
+        .lanes = &sha256_lanes_portable,
+        .requiredFeatures = CPU_FEATURE_SSE2,
+    },
+    #endif
+    {
+        .name = "openssl",
+        .stream = &sha256_stream_openssl,
+        .transform = &transform_portable,
+        .lanes = NULL,
+        .requiredFeatures = CPU_FEATURE_NONE,
+    },
+};
+
+#define ENGINE_COUNT (sizeof(engines) / sizeof(engines[0]))
+
+static Sha256Engine *activeEngine = NULL;
+
+static uint32_t detect_cpu_features() {
+    uint32_t features = CPU_FEATURE_NONE;
+    #if SHA256_X86
+    uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return features;
+    }
+    if (edx & bit_SSE2) {
+        features |= CPU_FEATURE_SSE2;
+    }
+    bool hasSse41 = (ecx & bit_SSE4_1) != 0;
+    bool osSavesYmm = false;
+    if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX)) {
+        uint32_t xcr0Low = 0, xcr0High = 0;
+        __asm__ volatile ("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+        osSavesYmm = (xcr0Low & 0x6) == 0x6;
+    }
+    if (__get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        if ((ebx & bit_AVX2) && osSavesYmm) {
+            features |= CPU_FEATURE_AVX2;
+        }
+        if ((ebx & bit_SHA) && hasSse41) {
+            features |= CPU_FEATURE_SHANI;
+        }
+    }
+    #endif
+    return features;
+}
+
+static bool is_engine_supported(Sha256Engine *ptrEngine) {
+    static int64_t cpuFeatures = -1;
+    if (cpuFeatures < 0) {
+        cpuFeatures = detect_cpu_features();
+    }
+    return (ptrEngine->requiredFeatures & (uint32_t)cpuFeatures) == ptrEngine->requiredFeatures;
+}
+
+static Sha256Engine *get_active_engine() {
+    if (!activeEngine) {
+        select_sha256_engine("auto");
+    }
+    return activeEngine;
+}
+
+int8_t select_sha256_engine(char *name) {
+    bool automatic = strcmp(name, "auto") == 0;
+    for (uint32_t i = 0; i < ENGINE_COUNT; i++) {
+        Sha256Engine *ptrEngine = &engines[i];
+        if ((automatic || strcmp(ptrEngine->name, name) == 0) && is_engine_supported(ptrEngine)) {
+            activeEngine = ptrEngine;
+            return 0;
+        }
+    }
+    fprintf(stderr, "select_sha256_engine: %s is not supported on this machine\n", name);
+    return -1;
+}
+
+char *get_sha256_engine_name() {
+    return get_active_engine()->name;
+}
+
+void sha256_stream(const Byte *data, uint64_t length, Byte *result) {
+    get_active_engine()->stream(data, length, result);
+}
+
+// Resumes one message from a midstate through the engine's single-stream transform
+static void finish_from_midstate(
+    Sha256Engine *ptrEngine,
+    const Sha256Midstate *ptrMidstate,
+    const Byte *data,
+    uint64_t width,
+    Byte *result
+) {
+    uint32_t state[8];
+    memcpy(state, ptrMidstate->state, sizeof(state));
+    ptrEngine->transform(state, data, width / SHA256_BLOCK_WIDTH);
+    Byte tail[SHA256_MAX_TAIL_WIDTH];
+    uint32_t tailBlocks = pad_tail(data, width, ptrMidstate->length, tail);
+    ptrEngine->transform(state, tail, tailBlocks);
+    for (uint32_t i = 0; i < 8; i++) {
+        store_be32(result + i * 4, state[i]);
+    }
+}
+
+// Every input of a group is consumed before its digests are written, so results may overlay data
+// as long as each digest lands no further along than its own input
+static void run_batch(
+    const Sha256Midstate *ptrMidstate,
+    const Byte *data,
+    uint64_t width,
+    uint64_t count,
+    bool doubleHash,
+    Byte *results
+) {
+    Sha256Engine *ptrEngine = get_active_engine();
+    uint64_t i = 0;
+    if (ptrEngine->lanes) {
+        for (; i + SHA256_BATCH_LANES <= count; i += SHA256_BATCH_LANES) {
+            ptrEngine->lanes(ptrMidstate, data + i * width, width, doubleHash, results + i * SHA256_LENGTH);
+        }
+    }
+    for (; i < count; i++) {
+        Byte *result = results + i * SHA256_LENGTH;
+        Byte firstRound[SHA256_LENGTH];
+        Byte *firstRoundResult = doubleHash ? firstRound : result;
+        if (ptrMidstate) {
+            finish_from_midstate(ptrEngine, ptrMidstate, data + i * width, width, firstRoundResult);
+        }
+        else {
+            ptrEngine->stream(data + i * width, width, firstRoundResult);
+        }
+        if (doubleHash) {
+            ptrEngine->stream(firstRound, SHA256_LENGTH, result);
+        }
+    }
+}
+
+void sha256_batch(const Byte *data, uint64_t width, uint64_t count, Byte *results) {
+    run_batch(NULL, data, width, count, false, results);
+}
+
+void dsha256_batch(const Byte *data, uint64_t width, uint64_t count, Byte *results) {
+    run_batch(NULL, data, width, count, true, results);
+}
+
+void sha256_midstate(const Byte *prefix, uint64_t length, Sha256Midstate *ptrMidstate) {
+    memcpy(ptrMidstate->state, INITIAL_STATE, sizeof(ptrMidstate->state));
+    ptrMidstate->length = length - length % SHA256_BLOCK_WIDTH;
+    get_active_engine()->transform(ptrMidstate->state, prefix, length / SHA256_BLOCK_WIDTH);
+}
+
+void begin_sha256_stream(Sha256Stream *ptrStream) {
+    memset(ptrStream, 0, sizeof(*ptrStream));
+    memcpy(ptrStream->midstate.state, INITIAL_STATE, sizeof(ptrStream->midstate.state));
+}
+
+void update_sha256_stream(Sha256Stream *ptrStream, const Byte *data, uint64_t length) {
+    Sha256Engine *ptrEngine = get_active_engine();
+    if (ptrStream->pendingWidth) {
+        uint64_t fill = SHA256_BLOCK_WIDTH - ptrStream->pendingWidth;
+        fill = fill < length ? fill : length;
+        memcpy(ptrStream->pending + ptrStream->pendingWidth, data, fill);
+        ptrStream->pendingWidth += (uint32_t)fill;
+        data += fill;
+        length -= fill;
+        if (ptrStream->pendingWidth < SHA256_BLOCK_WIDTH) {
+            return;
+        }
+        ptrEngine->transform(ptrStream->midstate.state, ptrStream->pending, 1);
+        ptrStream->midstate.length += SHA256_BLOCK_WIDTH;
+        ptrStream->pendingWidth = 0;
+    }
+    uint64_t blocks = length / SHA256_BLOCK_WIDTH;
+    ptrEngine->transform(ptrStream->midstate.state, data, blocks);
+    ptrStream->midstate.length += blocks * SHA256_BLOCK_WIDTH;
+    ptrStream->pendingWidth = (uint32_t)(length % SHA256_BLOCK_WIDTH);
+    memcpy(ptrStream->pending, data + blocks * SHA256_BLOCK_WIDTH, ptrStream->pendingWidth);
+}
+
+void finish_sha256_stream(Sha256Stream *ptrStream, Byte *result) {
+    Sha256Engine *ptrEngine = get_active_engine();
+    Byte tail[SHA256_MAX_TAIL_WIDTH];
+    uint32_t tailBlocks = pad_tail(ptrStream->pending, ptrStream->pendingWidth, ptrStream->midstate.length, tail);
+    ptrEngine->transform(ptrStream->midstate.state, tail, tailBlocks);
+    for (uint32_t i = 0; i < 8; i++) {
+        store_be32(result + i * 4, ptrStream->midstate.state[i]);
+    }
+}
+
+void dsha256_batch_from_midstate(
+    const Sha256Midstate *ptrMidstate,
+    const Byte *data,
+    uint64_t width,
+    uint64_t count,
+    Byte *results
+) {
+    run_batch(ptrMidstate, data, width, count, true, results);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "datatypes.h"
+
+// Batches hash `count` items of equal `width` laid out back to back in `data`,
+// writing 32-byte digests back to back in `results`; `results` may overlay `data`
+// as long as no digest lands beyond the start of its own item.
+// The engine is picked once by CPUID on first use: SHA extensions (two items interleaved), else 8-lane AVX2,
+// else 8 lanes over SSE2 (two 4-lane halves), else OpenSSL one item at a time.
+
+#define SHA256_BATCH_LANES 8
+
+// State after the whole 64-byte blocks of a shared prefix, so that many messages
+// starting with it (block headers differing in their last 16 bytes) only hash the rest
+struct Sha256Midstate {
+    uint32_t state[8];
+    uint64_t length;
+};
+
+typedef struct Sha256Midstate Sha256Midstate;
+
+// A message hashed as it is produced, for files too large to hold at once; the whole blocks go
+// through the engine's transform and at most one partial block waits in pending
+struct Sha256Stream {
+    Sha256Midstate midstate;
+    Byte pending[64];
+    uint32_t pendingWidth;
+};
+
+typedef struct Sha256Stream Sha256Stream;
+
+char *get_sha256_engine_name(void);
+int8_t select_sha256_engine(char *name);
+
+void sha256_stream(const Byte *data, uint64_t length, Byte *result);
+void sha256_batch(const Byte *data, uint64_t width, uint64_t count, Byte *results);
+void dsha256_batch(const Byte *data, uint64_t width, uint64_t count, Byte *results);
+void sha256_midstate(const Byte *prefix, uint64_t length, Sha256Midstate *ptrMidstate);
+void begin_sha256_stream(Sha256Stream *ptrStream);
+void update_sha256_stream(Sha256Stream *ptrStream, const Byte *data, uint64_t length);
+void finish_sha256_stream(Sha256Stream *ptrStream, Byte *result);
+void dsha256_batch_from_midstate(
+    const Sha256Midstate *ptrMidstate,
+    const Byte *data,
+    uint64_t width,
+    uint64_t count,
+    Byte *results
+);
@@ -0,0 +1,181 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "sigcache.h"
+#include "config.h"
+#include "sha256.h"
+#include "utils/memory.h"
+#include "utils/random.h"
+
+typedef Byte SignatureCacheEntry[SHA256_LENGTH];
+
+// An all-zero entry is an empty slot
+struct SignatureCache {
+    bool ready;
+    SignatureCacheEntry *entries; // bucketCount * SIGNATURE_CACHE_WAYS
+    uint64_t bucketCount; // a power of two
+    Byte salt[SHA256_LENGTH];
+};
+
+static struct SignatureCache cache;
+static uv_rwlock_t cacheLock;
+static uv_once_t cacheLockOnce = UV_ONCE_INIT;
+static atomic_uint_fast64_t lookupCount;
+static atomic_uint_fast64_t hitCount;
+static atomic_uint_fast64_t insertionCount;
+static atomic_uint_fast64_t evictionCount;
+
+static void init_cache_lock() {
+    uv_rwlock_init(&cacheLock);
+}
+
+// Returns false for keys or signatures too wide for any script to have pushed, which are never cached
+static bool hash_signature_entry(
+    Byte *sighash,
+    Byte *pubkey,
+    uint64_t pubkeyWidth,
+    Byte *signature,
+    uint64_t signatureWidth,
+    SignatureCacheEntry entry
+) {
+    if (pubkeyWidth > SIGNATURE_CACHE_MAX_ELEMENT_WIDTH || signatureWidth > SIGNATURE_CACHE_MAX_ELEMENT_WIDTH) {
+        return false;
+    }
+    Byte preimage[2 * SHA256_LENGTH + 2 * sizeof(uint64_t) + 2 * SIGNATURE_CACHE_MAX_ELEMENT_WIDTH];
+    Byte *p = preimage;
+    memcpy(p, cache.salt, SHA256_LENGTH);
+    p += SHA256_LENGTH;
+    memcpy(p, sighash, SHA256_LENGTH);
+    p += SHA256_LENGTH;
+    // Widths keep the boundary between key and signature from shifting
+    memcpy(p, &pubkeyWidth, sizeof(pubkeyWidth));
+    p += sizeof(pubkeyWidth);
+    memcpy(p, pubkey, pubkeyWidth);
+    p += pubkeyWidth;
+    memcpy(p, &signatureWidth, sizeof(signatureWidth));
+    p += sizeof(signatureWidth);
+    memcpy(p, signature, signatureWidth);
+    p += signatureWidth;
+    sha256_stream(preimage, (uint64_t)(p - preimage), entry);
+    return true;
+}
+
+static SignatureCacheEntry *locate_bucket(SignatureCacheEntry entry) {
+    uint64_t h = 0;
+    memcpy(&h, entry, sizeof(h));
+    return cache.entries + (h & (cache.bucketCount - 1)) * SIGNATURE_CACHE_WAYS;
+}
+
+static bool is_entry_empty(SignatureCacheEntry entry) {
+    for (uint8_t i = 0; i < SHA256_LENGTH; i++) {
+        if (entry[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sized by config.signatureCacheBudget on first use after start or clear_signature_cache, to the
+// most buckets that fit; false when not even one does. Called with the lock held exclusively
+static bool ensure_signature_cache() {
+    if (cache.ready) {
+        return true;
+    }
+    uint64_t bucketWidth = SIGNATURE_CACHE_WAYS * sizeof(SignatureCacheEntry);
+    if (config.signatureCacheBudget < bucketWidth) {
+        return false;
+    }
+    uint64_t bucketCount = 1;
+    while (bucketCount * 2 * bucketWidth <= config.signatureCacheBudget) {
+        bucketCount *= 2;
+    }
+    cache.entries = CALLOC(bucketCount * SIGNATURE_CACHE_WAYS, sizeof(SignatureCacheEntry), "signature_cache:entries");
+    cache.bucketCount = bucketCount;
+    random_bytes(SHA256_LENGTH, cache.salt);
+    cache.ready = true;
+    return true;
+}
+
+bool is_signature_cached(Byte *sighash, Byte *pubkey, uint64_t pubkeyWidth, Byte *signature, uint64_t signatureWidth) {
+    uv_once(&cacheLockOnce, &init_cache_lock);
+    uv_rwlock_rdlock(&cacheLock);
+    if (!cache.ready) {
+        uv_rwlock_rdunlock(&cacheLock);
+        return false;
+    }
+    atomic_fetch_add_explicit(&lookupCount, 1, memory_order_relaxed);
+    SignatureCacheEntry entry;
+    if (!hash_signature_entry(sighash, pubkey, pubkeyWidth, signature, signatureWidth, entry)) {
+        uv_rwlock_rdunlock(&cacheLock);
+        return false;
+    }
+    SignatureCacheEntry *bucket = locate_bucket(entry);
+    bool found = false;
+    for (uint8_t i = 0; i < SIGNATURE_CACHE_WAYS && !found; i++) {
+        found = memcmp(bucket[i], entry, SHA256_LENGTH) == 0;
+    }
+    uv_rwlock_rdunlock(&cacheLock);
+    if (found) {
+        atomic_fetch_add_explicit(&hitCount, 1, memory_order_relaxed);
+    }
+    return found;
+}
+
+// Only for signatures ECDSA_verify has accepted
+void cache_signature(Byte *sighash, Byte *pubkey, uint64_t pubkeyWidth, Byte *signature, uint64_t signatureWidth) {
+    uv_once(&cacheLockOnce, &init_cache_lock);
+    uv_rwlock_wrlock(&cacheLock);
+    if (!ensure_signature_cache()) {
+        uv_rwlock_wrunlock(&cacheLock);
+        return;
+    }
+    SignatureCacheEntry entry;
+    if (!hash_signature_entry(sighash, pubkey, pubkeyWidth, signature, signatureWidth, entry)) {
+        uv_rwlock_wrunlock(&cacheLock);
+        return;
+    }
+    SignatureCacheEntry *bucket = locate_bucket(entry);
+    SignatureCacheEntry *slot = NULL;
+    for (uint8_t i = 0; i < SIGNATURE_CACHE_WAYS; i++) {
+        if (memcmp(bucket[i], entry, SHA256_LENGTH) == 0) {
+            uv_rwlock_wrunlock(&cacheLock);
+            return;
+        }
+        if (!slot && is_entry_empty(bucket[i])) {
+            slot = &bucket[i];
+        }
+    }
+    if (!slot) {
+        // The bucket index came from the leading bytes; the next one is independent of it
+        slot = &bucket[entry[sizeof(uint64_t)] % SIGNATURE_CACHE_WAYS];
+        atomic_fetch_add_explicit(&evictionCount, 1, memory_order_relaxed);
+    }
+    memcpy(*slot, entry, SHA256_LENGTH);
+    atomic_fetch_add_explicit(&insertionCount, 1, memory_order_relaxed);
+    uv_rwlock_wrunlock(&cacheLock);
+}
+
+// Drops every entry and the salt; the next insertion sizes a new cache
+void clear_signature_cache() {
+    uv_once(&cacheLockOnce, &init_cache_lock);
+    uv_rwlock_wrlock(&cacheLock);
+    if (cache.entries) {
+        FREE(cache.entries, "signature_cache:entries");
+    }
+    memset(&cache, 0, sizeof(cache));
+    uv_rwlock_wrunlock(&cacheLock);
+}
+
+void get_signature_cache_stats(SignatureCacheStats *ptrStats) {
+    memset(ptrStats, 0, sizeof(*ptrStats));
+    uv_once(&cacheLockOnce, &init_cache_lock);
+    uv_rwlock_rdlock(&cacheLock);
+    ptrStats->capacity = cache.bucketCount * SIGNATURE_CACHE_WAYS;
+    ptrStats->memory = ptrStats->capacity * sizeof(SignatureCacheEntry);
+    uv_rwlock_rdunlock(&cacheLock);
+    ptrStats->lookups = atomic_load(&lookupCount);
+    ptrStats->hits = atomic_load(&hitCount);
+    ptrStats->insertions = atomic_load(&insertionCount);
+    ptrStats->evictions = atomic_load(&evictionCount);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "datatypes.h"
+#include "hash.h"
+
+// Signatures that passed ECDSA_verify, so that a block checked on arrival and again by the
+// validateNewBlocks timer, or revalidated more than once, pays for the curve math only once.
+// An entry is the SHA-256 of a random per-process salt with the signature hash, the public key
+// and the signature, so peers cannot aim collisions at it. Entries live in buckets of
+// SIGNATURE_CACHE_WAYS; a full bucket overwrites one picked by the new entry's own bits.
+// Used from the script verification threads, so lookups and insertions may come from any thread.
+
+#define SIGNATURE_CACHE_WAYS 8
+#define SIGNATURE_CACHE_MAX_ELEMENT_WIDTH 1024 // as a script stack frame
+
+struct SignatureCacheStats {
+    uint64_t capacity; // entries
+    uint64_t memory; // bytes
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t insertions;
+    uint64_t evictions;
+};
+
+typedef struct SignatureCacheStats SignatureCacheStats;
+
+bool is_signature_cached(Byte *sighash, Byte *pubkey, uint64_t pubkeyWidth, Byte *signature, uint64_t signatureWidth);
+void cache_signature(Byte *sighash, Byte *pubkey, uint64_t pubkeyWidth, Byte *signature, uint64_t signatureWidth);
+void clear_signature_cache(void);
+void get_signature_cache_stats(SignatureCacheStats *ptrStats);
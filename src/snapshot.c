@@ -0,0 +1,329 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "snapshot.h"
+#include "blockchain.h"
+#include "compressor.h"
+#include "globalstate.h"
+#include "hash.h"
+#include "persistent.h"
+#include "sha256.h"
+#include "utxo.h"
+#include "utxofilter.h"
+#include "utxostats.h"
+#include "utils/datetime.h"
+#include "utils/file.h"
+#include "utils/integers.h"
+
+#define SNAPSHOT_OUTPOINT_WIDTH (SHA256_LENGTH + sizeof(uint32_t))
+#define SNAPSHOT_HEADER_WIDTH (UTXO_SNAPSHOT_MAGIC_WIDTH + sizeof(uint32_t) + SHA256_LENGTH + sizeof(uint32_t))
+#define SNAPSHOT_TRAILER_WIDTH (sizeof(uint64_t) + SHA256_LENGTH)
+
+struct SnapshotFile {
+    FILE *file;
+    Sha256Stream hashStream;
+    uint64_t recordsEnd; // file offset where the trailer starts
+    uint64_t position;
+    SHA256_HASH blockHash;
+    uint32_t height;
+    uint64_t count;
+};
+
+static void segment_uint64(uint64_t number, Byte *bytes) {
+    segment_uint32((uint32_t)number, bytes);
+    segment_uint32((uint32_t)(number >> 32), bytes + sizeof(uint32_t));
+}
+
+// Same bytes as the database key, so records sort the way the database iterates
+static void serialize_outpoint(Outpoint *outpoint, Byte *bytes) {
+    memcpy(bytes, outpoint->txHash, SHA256_LENGTH);
+    bytes[SHA256_LENGTH] = (Byte)(outpoint->index >> 24);
+    bytes[SHA256_LENGTH + 1] = (Byte)(outpoint->index >> 16);
+    bytes[SHA256_LENGTH + 2] = (Byte)(outpoint->index >> 8);
+    bytes[SHA256_LENGTH + 3] = (Byte)outpoint->index;
+}
+
+static void parse_outpoint(Byte *bytes, Outpoint *outpoint) {
+    memcpy(outpoint->txHash, bytes, SHA256_LENGTH);
+    outpoint->index =
+        ((uint32_t)bytes[SHA256_LENGTH] << 24)
+        | ((uint32_t)bytes[SHA256_LENGTH + 1] << 16)
+        | ((uint32_t)bytes[SHA256_LENGTH + 2] << 8)
+        | (uint32_t)bytes[SHA256_LENGTH + 3];
+}
+
+static int8_t write_hashed(struct SnapshotFile *snapshot, Byte *data, uint64_t width) {
+    update_sha256_stream(&snapshot->hashStream, data, width);
+    if (fwrite(data, 1, width, snapshot->file) != width) {
+        return -1;
+    }
+    snapshot->position += width;
+    return 0;
+}
+
+static int8_t read_hashed(struct SnapshotFile *snapshot, Byte *data, uint64_t width) {
+    if (snapshot->position + width > snapshot->recordsEnd || fread(data, 1, width, snapshot->file) != width) {
+        return -1;
+    }
+    update_sha256_stream(&snapshot->hashStream, data, width);
+    snapshot->position += width;
+    return 0;
+}
+
+static int8_t write_snapshot_output(Outpoint *outpoint, Byte *data, uint64_t width, void *context) {
+    struct SnapshotFile *snapshot = context;
+    Byte record[SNAPSHOT_OUTPOINT_WIDTH + MAX_MSB_VARINT_WIDTH];
+    serialize_outpoint(outpoint, record);
+    uint8_t widthWidth = serialize_to_msb_varint(width, record + SNAPSHOT_OUTPOINT_WIDTH);
+    if (write_hashed(snapshot, record, SNAPSHOT_OUTPOINT_WIDTH + widthWidth) || write_hashed(snapshot, data, width)) {
+        return -1;
+    }
+    snapshot->count++;
+    return 0;
+}
+
+int8_t dump_utxo_snapshot(char *path) {
+    // Everything registered up to the validated tip has to be in the database first
+    if (flush_utxo_cache(false)) {
+        return -1;
+    }
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "dump_utxo_snapshot: cannot open %s: %s\n", path, strerror(errno));
+        return -2;
+    }
+    double start = get_now();
+    printf("Dumping UTXO set at height %u to %s...\n", global.mainValidatedTip.context.height, path);
+    struct SnapshotFile snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    snapshot.file = file;
+    begin_sha256_stream(&snapshot.hashStream);
+
+    Byte header[SNAPSHOT_HEADER_WIDTH] = {0};
+    Byte *p = header;
+    memcpy(p, UTXO_SNAPSHOT_MAGIC, UTXO_SNAPSHOT_MAGIC_WIDTH);
+    p += UTXO_SNAPSHOT_MAGIC_WIDTH;
+    segment_uint32(UTXO_SNAPSHOT_VERSION, p);
+    p += sizeof(uint32_t);
+    memcpy(p, global.mainValidatedTip.meta.hash, SHA256_LENGTH);
+    p += SHA256_LENGTH;
+    segment_uint32(global.mainValidatedTip.context.height, p);
+    int8_t status = write_hashed(&snapshot, header, SNAPSHOT_HEADER_WIDTH);
+    if (!status) {
+        status = iterate_utxo_data(&write_snapshot_output, &snapshot);
+    }
+    if (!status) {
+        Byte trailer[SNAPSHOT_TRAILER_WIDTH] = {0};
+        segment_uint64(snapshot.count, trailer);
+        update_sha256_stream(&snapshot.hashStream, trailer, sizeof(uint64_t));
+        finish_sha256_stream(&snapshot.hashStream, trailer + sizeof(uint64_t));
+        if (fwrite(trailer, 1, SNAPSHOT_TRAILER_WIDTH, file) != SNAPSHOT_TRAILER_WIDTH) {
+            status = -3;
+        }
+    }
+    if (fclose(file) && !status) {
+        status = -3;
+    }
+    if (status) {
+        fprintf(stderr, "dump_utxo_snapshot: write failed (%i)\n", status);
+        remove(path);
+        return -3;
+    }
+    printf(
+        "Dumped %llu outputs, %llu bytes in %.1fms\n",
+        snapshot.count,
+        snapshot.position + SNAPSHOT_TRAILER_WIDTH,
+        get_now() - start
+    );
+    return 0;
+}
+
+static int8_t open_snapshot(char *path, struct SnapshotFile *snapshot) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->file = fopen(path, "rb");
+    if (!snapshot->file) {
+        fprintf(stderr, "load_utxo_snapshot: cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    int64_t fileSize = get_file_size(snapshot->file);
+    if (fileSize < (int64_t)(SNAPSHOT_HEADER_WIDTH + SNAPSHOT_TRAILER_WIDTH)) {
+        fprintf(stderr, "load_utxo_snapshot: file too short\n");
+        return -2;
+    }
+    snapshot->recordsEnd = (uint64_t)fileSize - SNAPSHOT_TRAILER_WIDTH;
+    begin_sha256_stream(&snapshot->hashStream);
+
+    Byte header[SNAPSHOT_HEADER_WIDTH] = {0};
+    read_hashed(snapshot, header, SNAPSHOT_HEADER_WIDTH);
+    Byte *p = header;
+    bool recognized =
+        memcmp(p, UTXO_SNAPSHOT_MAGIC, UTXO_SNAPSHOT_MAGIC_WIDTH) == 0
+        && combine_uint32(p + UTXO_SNAPSHOT_MAGIC_WIDTH) == UTXO_SNAPSHOT_VERSION;
+    if (!recognized) {
+        fprintf(stderr, "load_utxo_snapshot: not a version %u UTXO snapshot\n", UTXO_SNAPSHOT_VERSION);
+        return -3;
+    }
+    p += UTXO_SNAPSHOT_MAGIC_WIDTH + sizeof(uint32_t);
+    memcpy(snapshot->blockHash, p, SHA256_LENGTH);
+    p += SHA256_LENGTH;
+    snapshot->height = combine_uint32(p);
+    return 0;
+}
+
+static int8_t read_snapshot_output(struct SnapshotFile *snapshot, Byte *outpointBytes, Byte *data, uint64_t *width) {
+    if (read_hashed(snapshot, outpointBytes, SNAPSHOT_OUTPOINT_WIDTH)) {
+        return -1;
+    }
+    Byte widthBytes[MAX_MSB_VARINT_WIDTH] = {0};
+    uint8_t widthWidth = 0;
+    do {
+        if (widthWidth == MAX_MSB_VARINT_WIDTH || read_hashed(snapshot, widthBytes + widthWidth, 1)) {
+            return -1;
+        }
+        widthWidth++;
+    } while (widthBytes[widthWidth - 1] & 0x80);
+    if (!parse_msb_varint(widthBytes, widthWidth, width) || *width > MAX_COMPRESSED_TX_OUT_WIDTH) {
+        return -2;
+    }
+    return read_hashed(snapshot, data, *width);
+}
+
+// Reads every output, adding them to the database and the set statistics when a batch is given;
+// the outputs must be strictly ascending, so the database receives them in its own key order
+static int8_t read_snapshot_outputs(struct SnapshotFile *snapshot, void *batch) {
+    Byte outpointBytes[SNAPSHOT_OUTPOINT_WIDTH] = {0};
+    Byte lastOutpointBytes[SNAPSHOT_OUTPOINT_WIDTH] = {0};
+    Byte data[MAX_COMPRESSED_TX_OUT_WIDTH];
+    uint32_t staged = 0;
+    while (snapshot->position < snapshot->recordsEnd) {
+        uint64_t width = 0;
+        if (read_snapshot_output(snapshot, outpointBytes, data, &width)) {
+            fprintf(stderr, "load_utxo_snapshot: truncated output %llu\n", snapshot->count);
+            return -1;
+        }
+        if (snapshot->count > 0 && memcmp(lastOutpointBytes, outpointBytes, SNAPSHOT_OUTPOINT_WIDTH) >= 0) {
+            fprintf(stderr, "load_utxo_snapshot: output %llu out of order\n", snapshot->count);
+            return -2;
+        }
+        memcpy(lastOutpointBytes, outpointBytes, SNAPSHOT_OUTPOINT_WIDTH);
+        snapshot->count++;
+        if (!batch) {
+            continue;
+        }
+        Outpoint outpoint;
+        parse_outpoint(outpointBytes, &outpoint);
+        stage_utxo_data(batch, &outpoint, data, width);
+        add_to_utxo_stats(&outpoint, data, (uint32_t)width);
+        staged++;
+        if (staged == UTXO_SNAPSHOT_LOAD_BATCH_SIZE) {
+            if (commit_utxo_batch(batch)) {
+                return -3;
+            }
+            staged = 0;
+        }
+    }
+    return 0;
+}
+
+static int8_t check_snapshot_trailer(struct SnapshotFile *snapshot) {
+    Byte trailer[SNAPSHOT_TRAILER_WIDTH] = {0};
+    if (fread(trailer, 1, SNAPSHOT_TRAILER_WIDTH, snapshot->file) != SNAPSHOT_TRAILER_WIDTH) {
+        return -1;
+    }
+    SHA256_HASH checksum = {0};
+    update_sha256_stream(&snapshot->hashStream, trailer, sizeof(uint64_t));
+    finish_sha256_stream(&snapshot->hashStream, checksum);
+    if (combine_uint64(trailer) != snapshot->count) {
+        fprintf(stderr, "load_utxo_snapshot: %llu outputs, trailer says %llu\n", snapshot->count, combine_uint64(trailer));
+        return -2;
+    }
+    if (memcmp(checksum, trailer + sizeof(uint64_t), SHA256_LENGTH) != 0) {
+        fprintf(stderr, "load_utxo_snapshot: checksum mismatch\n");
+        return -3;
+    }
+    return 0;
+}
+
+static int8_t stop_at_first_output(Outpoint *outpoint, Byte *data, uint64_t width, void *context) {
+    return 1;
+}
+
+// The snapshot vouches for every block below it, so they count as validated and registered
+static void mark_chain_registered(BlockIndex *index) {
+    while (index) {
+        index->meta.fullBlockValidated = true;
+        index->meta.outputsRegistered = true;
+        index = GET_BLOCK_INDEX(index->header.prev_block);
+    }
+}
+
+// Trusts the snapshot's content: only its integrity and its place on the header chain are checked
+int8_t load_utxo_snapshot(char *path) {
+    if (iterate_utxo_data(&stop_at_first_output, NULL)) {
+        fprintf(stderr, "load_utxo_snapshot: the UTXO database is not empty; reset it first\n");
+        return -1;
+    }
+    double start = get_now();
+    struct SnapshotFile snapshot;
+    int8_t status = open_snapshot(path, &snapshot);
+    if (!status) {
+        printf("Checking UTXO snapshot %s...\n", path);
+        status = read_snapshot_outputs(&snapshot, NULL);
+    }
+    if (!status) {
+        status = check_snapshot_trailer(&snapshot);
+    }
+    if (snapshot.file) {
+        fclose(snapshot.file);
+    }
+    if (status) {
+        return -2;
+    }
+    BlockIndex *index = GET_BLOCK_INDEX(snapshot.blockHash);
+    bool onMainChain =
+        index
+        && index->context.chainStatus == CHAIN_STATUS_MAINCHAIN
+        && index->context.height == snapshot.height;
+    if (!onMainChain) {
+        fprintf(
+            stderr,
+            "load_utxo_snapshot: block %s at height %u is not on the main header chain\n",
+            binary_to_hexstr(snapshot.blockHash, SHA256_LENGTH),
+            snapshot.height
+        );
+        return -3;
+    }
+
+    printf("Loading %llu outputs at height %u...\n", snapshot.count, snapshot.height);
+    status = open_snapshot(path, &snapshot);
+    void *batch = create_utxo_batch();
+    reset_utxo_stats(snapshot.blockHash);
+    if (!status) {
+        status = read_snapshot_outputs(&snapshot, batch);
+    }
+    if (!status) {
+        stage_utxo_flush_height(batch, snapshot.height);
+        stage_utxo_stats(batch);
+        status = commit_utxo_batch(batch);
+    }
+    destroy_utxo_batch(batch);
+    if (snapshot.file) {
+        fclose(snapshot.file);
+    }
+    if (status) {
+        fprintf(stderr, "load_utxo_snapshot: load failed (%i); reset the UTXO database before retrying\n", status);
+        return -4;
+    }
+    // Picks the new flush height up on next use
+    clear_utxo_cache();
+    if (is_utxo_filter_saturated()) {
+        rebuild_utxo_filter();
+    }
+    mark_chain_registered(index);
+    global.mainValidatedTip = *index;
+    save_block_indices();
+    printf("Loaded %llu outputs in %.1fms; validation resumes from height %u\n", snapshot.count, get_now() - start, snapshot.height);
+    return 0;
+}
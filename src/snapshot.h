@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+// Flat copy of the UTXO set at the validated tip, for seeding a node without replaying the chain.
+// Layout: magic, version, block hash and height; then every output in database key order as
+// txid, big-endian index, MSB varint width and the compressed output (see compressor.h);
+// then the output count and the SHA-256 of all preceding bytes. Integers are little-endian.
+
+#define UTXO_SNAPSHOT_MAGIC "tbcutxo\n"
+#define UTXO_SNAPSHOT_MAGIC_WIDTH 8
+#define UTXO_SNAPSHOT_VERSION 1
+#define UTXO_SNAPSHOT_LOAD_BATCH_SIZE (1 << 16) // outputs per database write
+
+int8_t dump_utxo_snapshot(char *path);
+int8_t load_utxo_snapshot(char *path);
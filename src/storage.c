@@ -0,0 +1,117 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "storage.h"
+#include "utils/memory.h"
+
+static const StorageEngine *engines[] = {
+    &levelDBEngine,
+    &mmapEngine,
+};
+
+const StorageEngine *find_storage_engine(char *name) {
+    for (uint32_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+        if (strcmp(engines[i]->name, name) == 0) {
+            return engines[i];
+        }
+    }
+    return NULL;
+}
+
+Storage *open_storage(char *engineName, char *path, StorageOptions *options) {
+    const StorageEngine *engine = find_storage_engine(engineName);
+    if (!engine) {
+        fprintf(stderr, "open_storage: unknown engine %s\n", engineName);
+        return NULL;
+    }
+    if (strlen(path) >= MAX_STORAGE_PATH_LENGTH) {
+        fprintf(stderr, "open_storage: path too long\n");
+        return NULL;
+    }
+    void *handle = engine->open(path, options);
+    if (!handle) {
+        return NULL;
+    }
+    Storage *storage = CALLOC(1, sizeof(Storage), "storage");
+    storage->engine = engine;
+    storage->handle = handle;
+    strcpy(storage->path, path);
+    return storage;
+}
+
+void close_storage(Storage *storage) {
+    storage->engine->close(storage->handle);
+    FREE(storage, "storage");
+}
+
+// The database must not be open
+int8_t destroy_storage(char *engineName, char *path) {
+    const StorageEngine *engine = find_storage_engine(engineName);
+    if (!engine) {
+        fprintf(stderr, "destroy_storage: unknown engine %s\n", engineName);
+        return -1;
+    }
+    return engine->destroy(path);
+}
+
+int8_t load_from_storage(Storage *storage, Byte *key, size_t keyWidth, Byte *value, size_t capacity, size_t *width) {
+    size_t readWidth = 0;
+    int8_t status = storage->engine->get(storage->handle, key, keyWidth, value, capacity, &readWidth);
+    if (width) {
+        *width = readWidth;
+    }
+    return status;
+}
+
+// A batch of one, so every engine needs only the batch write path
+int8_t save_to_storage(Storage *storage, Byte *key, size_t keyWidth, Byte *value, size_t width, bool sync) {
+    void *batch = storage->engine->create_batch(storage->handle);
+    storage->engine->stage_put(batch, key, keyWidth, value, width);
+    int8_t status = storage->engine->commit_batch(storage->handle, batch, sync);
+    storage->engine->destroy_batch(batch);
+    return status;
+}
+
+int8_t remove_from_storage(Storage *storage, Byte *key, size_t keyWidth, bool sync) {
+    void *batch = storage->engine->create_batch(storage->handle);
+    storage->engine->stage_removal(batch, key, keyWidth);
+    int8_t status = storage->engine->commit_batch(storage->handle, batch, sync);
+    storage->engine->destroy_batch(batch);
+    return status;
+}
+
+void *create_storage_batch(Storage *storage) {
+    return storage->engine->create_batch(storage->handle);
+}
+
+void stage_storage_put(Storage *storage, void *batch, Byte *key, size_t keyWidth, Byte *value, size_t width) {
+    storage->engine->stage_put(batch, key, keyWidth, value, width);
+}
+
+void stage_storage_removal(Storage *storage, void *batch, Byte *key, size_t keyWidth) {
+    storage->engine->stage_removal(batch, key, keyWidth);
+}
+
+// Applies the staged changes atomically and empties the batch for reuse
+int8_t commit_storage_batch(Storage *storage, void *batch, bool sync) {
+    return storage->engine->commit_batch(storage->handle, batch, sync);
+}
+
+void destroy_storage_batch(Storage *storage, void *batch) {
+    storage->engine->destroy_batch(batch);
+}
+
+// See storage.h: the holder must not write until it releases the snapshot
+void *create_storage_snapshot(Storage *storage) {
+    return storage->engine->create_snapshot(storage->handle);
+}
+
+void release_storage_snapshot(Storage *storage, void *snapshot) {
+    storage->engine->release_snapshot(storage->handle, snapshot);
+}
+
+// Without a snapshot the iteration takes its own; either way the visitor must not write
+int8_t iterate_storage(Storage *storage, void *snapshot, bool ordered, StorageVisitor visitor, void *context) {
+    return storage->engine->iterate(storage->handle, snapshot, ordered, visitor, context);
+}
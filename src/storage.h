@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "datatypes.h"
+
+// Key-value storage engines behind the chain-state databases. Callers go through the
+// functions below; each engine supplies a StorageEngine table:
+// - leveldb: ordered LevelDB, tuned by StorageOptions
+// - mmap: an open-addressing hash table in a memory-mapped file, for short fixed-size keys
+//   such as outpoints; see mmapstorage.c
+// Reads may come from any thread. Values read are copied out, so nothing returned refers
+// to engine memory once a call has returned.
+// A snapshot from create_storage_snapshot gives iterate_storage a consistent view. The mmap
+// engine holds the store's read lock until release_storage_snapshot, so the thread holding a
+// snapshot must not write to the same storage meanwhile: its commit would wait forever.
+
+#define STORAGE_ENGINE_LEVELDB "leveldb"
+#define STORAGE_ENGINE_MMAP "mmap"
+#define MAX_STORAGE_PATH_LENGTH 256
+
+struct StorageOptions {
+    uint64_t cacheSize; // leveldb block cache, bytes; 0 for the built-in default
+    uint32_t bloomBitsPerKey; // leveldb filter policy; 0 for none
+    uint64_t writeBufferSize; // leveldb memtable, bytes; 0 for the built-in default
+    uint32_t maxOpenFiles; // leveldb; 0 for the built-in default
+    uint64_t initialSlots; // mmap; rounded up to a power of two
+    uint32_t maxKeyWidth; // mmap; longer keys are refused
+    uint32_t inlineValueWidth; // mmap; longer values go to the overflow file
+};
+
+typedef struct StorageOptions StorageOptions;
+typedef struct StorageEngine StorageEngine;
+typedef struct Storage Storage;
+
+// A nonzero result stops the iteration and is passed back to the caller
+typedef int8_t (*StorageVisitor)(Byte *key, size_t keyWidth, Byte *value, size_t valueWidth, void *context);
+
+// get results: 0 found, -1 absent, -2 read failure, -3 value larger than capacity
+struct StorageEngine {
+    char *name;
+    void *(*open)(char *path, StorageOptions *options);
+    void (*close)(void *handle);
+    int8_t (*destroy)(char *path);
+    int8_t (*get)(void *handle, Byte *key, size_t keyWidth, Byte *value, size_t capacity, size_t *width);
+    void *(*create_batch)(void *handle);
+    void (*stage_put)(void *batch, Byte *key, size_t keyWidth, Byte *value, size_t width);
+    void (*stage_removal)(void *batch, Byte *key, size_t keyWidth);
+    int8_t (*commit_batch)(void *handle, void *batch, bool sync); // empties the batch for reuse
+    void (*destroy_batch)(void *batch);
+    void *(*create_snapshot)(void *handle);
+    void (*release_snapshot)(void *handle, void *snapshot);
+    // Key order is bytewise when ordered is set and engine-specific otherwise
+    int8_t (*iterate)(void *handle, void *snapshot, bool ordered, StorageVisitor visitor, void *context);
+};
+
+struct Storage {
+    const StorageEngine *engine;
+    void *handle;
+    char path[MAX_STORAGE_PATH_LENGTH];
+};
+
+extern const StorageEngine levelDBEngine;
+extern const StorageEngine mmapEngine;
+
+const StorageEngine *find_storage_engine(char *name);
+Storage *open_storage(char *engineName, char *path, StorageOptions *options);
+void close_storage(Storage *storage);
+int8_t destroy_storage(char *engineName, char *path);
+int8_t load_from_storage(Storage *storage, Byte *key, size_t keyWidth, Byte *value, size_t capacity, size_t *width);
+int8_t save_to_storage(Storage *storage, Byte *key, size_t keyWidth, Byte *value, size_t width, bool sync);
+int8_t remove_from_storage(Storage *storage, Byte *key, size_t keyWidth, bool sync);
+void *create_storage_batch(Storage *storage);
+void stage_storage_put(Storage *storage, void *batch, Byte *key, size_t keyWidth, Byte *value, size_t width);
+void stage_storage_removal(Storage *storage, void *batch, Byte *key, size_t keyWidth);
+int8_t commit_storage_batch(Storage *storage, void *batch, bool sync);
+void destroy_storage_batch(Storage *storage, void *batch);
+void *create_storage_snapshot(Storage *storage);
+void release_storage_snapshot(Storage *storage, void *snapshot);
+int8_t iterate_storage(Storage *storage, void *snapshot, bool ordered, StorageVisitor visitor, void *context);
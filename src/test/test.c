@@ -3,6 +3,7 @@
 #include <unistd.h>
 #include <limits.h>
 #include "openssl/bn.h"
+#include "openssl/sha.h"
 
 #include "datatypes.h"
 #include "peer.h"
@@ -11,12 +12,29 @@
 #include "messages/version.h"
 #include "messages/block.h"
 #include "messages/blockreq.h"
+#include "messages/common.h"
+#include "messages/registry.h"
+#include "messages/headers.h"
 #include "test/test.h"
 #include "mine.h"
 #include "hashmap.h"
 #include "blockchain.h"
+#include "chaingen.h"
+#include "utxo.h"
+#include "utxofilter.h"
+#include "utxostats.h"
+#include "compressor.h"
+#include "script.h"
 #include "config.h"
 #include "persistent.h"
+#include "sha256.h"
+#include "snapshot.h"
+#include "prefetch.h"
+#include "pipeline.h"
+#include "storage.h"
+#include "verifier.h"
+#include "sigcache.h"
+#include "units.h"
 
 #include "utils/networking.h"
 #include "utils/memory.h"
@@ -25,6 +43,9 @@
 #include "utils/strings.h"
 #include "utils/random.h"
 #include "utils/bignum.h"
+#include "utils/pool.h"
+#include "utils/uint256.h"
+#include "utils/datetime.h"
 
 
 static int32_t test_version_messages() {
@@ -117,6 +138,32 @@ static void test_block() {
     print_block_payload(ptrBlock);
 }
 
+static void test_block_legality() {
+    Message message = get_empty_message();
+    load_block_message("fixtures/block_7323.dat", &message);
+    BlockPayload *ptrBlock = message.ptrPayload;
+
+    printf("legal = %u (expecting 1)\n", is_block_legal(ptrBlock));
+    printf("checked = %u (expecting 1)\n", ptrBlock->legality.checked);
+
+    TxOut *ptrOutput = &ptrBlock->txs[1].txOutputs[0];
+    ptrOutput->value += 1;
+    reset_block_legality(ptrBlock);
+    printf("tampered legal = %u (expecting 0)\n", is_block_legal(ptrBlock));
+    printf("failures = %u (expecting %u)\n", ptrBlock->legality.failures, BLOCK_ILLEGAL_MERKLE);
+    ptrOutput->value -= 1;
+    reset_block_legality(ptrBlock);
+
+    init_archive_dir();
+    save_block(ptrBlock);
+    BlockPayload *ptrReloaded = CALLOC(1, sizeof(BlockPayload), "test_block_legality:block");
+    int8_t loadStatus = load_block(ptrBlock->legality.hash, ptrReloaded);
+    printf("load status = %i (expecting 0)\n", loadStatus);
+    printf("reloaded checked = %u (expecting 1)\n", ptrReloaded->legality.checked);
+    release_block(ptrReloaded);
+    free_message_payload(&message);
+}
+
 static void test_block_parsing_and_serialization() {
     Message message = get_empty_message();
     load_block_message("fixtures/block_7323.dat", &message);
@@ -161,61 +208,67 @@ static void test_merkles() {
      */
 }
 
+static void test_merkle_tree() {
+    Message message = get_empty_message();
+    load_block_message("fixtures/block_7323.dat", &message);
+    BlockPayload *ptrPayload = message.ptrPayload;
+    uint64_t txCount = ptrPayload->txCount;
+    MerkleTree tree;
+    build_tx_merkle_tree(ptrPayload->txs, txCount, &tree);
+
+    SHA256_HASH expectedRoot = {0};
+    SHA256_HASH root = {0};
+    compute_merkle_root(ptrPayload->txs, txCount, expectedRoot);
+    get_merkle_tree_root(&tree, root);
+    printf("root difference = %i (expecting 0)\n", memcmp(root, expectedRoot, SHA256_LENGTH));
+
+    uint32_t proofFailures = 0;
+    for (uint64_t i = 0; i < txCount; i++) {
+        Byte branch[MERKLE_MAX_DEPTH * SHA256_LENGTH];
+        int32_t branchLength = get_merkle_branch(&tree, i, branch);
+        SHA256_HASH provenRoot = {0};
+        compute_merkle_root_from_branch(
+            tree.nodes + i * SHA256_LENGTH, i, branch, (uint32_t)branchLength, provenRoot
+        );
+        proofFailures += memcmp(provenRoot, expectedRoot, SHA256_LENGTH) != 0;
+    }
+    printf("%u/%llu proofs failed (expecting 0)\n", proofFailures, txCount);
+
+    SHA256_HASH newLeaf = {0};
+    newLeaf[0] = 0x42;
+    uint64_t updateIndex = txCount - 1;
+    update_merkle_leaf(&tree, updateIndex, newLeaf);
+    get_merkle_tree_root(&tree, root);
+    Byte *leaves = MALLOC((txCount + 1) * SHA256_LENGTH, "test_merkle_tree:leaves");
+    memcpy(leaves, tree.nodes, txCount * SHA256_LENGTH);
+    compute_merkle_root_in_place(leaves, txCount, expectedRoot);
+    printf("updated root difference = %i (expecting 0)\n", memcmp(root, expectedRoot, SHA256_LENGTH));
+
+    FREE(leaves, "test_merkle_tree:leaves");
+    release_merkle_tree(&tree);
+    release_block(ptrPayload);
+}
+
 static void test_mine() {
     Message message = get_empty_message();
     load_block_message("genesis.dat", &message);
     BlockPayload *ptrPayload = message.ptrPayload;
 
-    uint32_t nonce = 0;
-    char label[10] = "";
-    pid_t childId1 = fork();
-    pid_t childId2 = fork();
-    pid_t childId3 = fork();
-    if (childId1 > 0) {
-        if (childId2 > 0) {
-            if (childId3 > 0) {
-                strcpy(label, "parent");
-                nonce = 0;
-            }
-            else {
-                strcpy(label, "child1");
-                nonce = UINT32_MAX / 8 * 1;
-            }
-        }
-        else {
-            if (childId3 > 0) {
-                strcpy(label, "child2");
-                nonce = UINT32_MAX / 8 * 2;
-            }
-            else {
-                strcpy(label, "child3");
-                nonce = UINT32_MAX / 8 * 3;
-            }
-        }
-    }
-    else {
-        if (childId2 > 0) {
-            if (childId3 > 0) {
-                strcpy(label, "child4");
-                nonce = UINT32_MAX / 8 * 4;
-            }
-            else {
-                strcpy(label, "child5");
-                nonce = UINT32_MAX / 8 * 5;
-            }
-        }
-        else {
-            if (childId3 > 0) {
-                strcpy(label, "child6");
-                nonce = UINT32_MAX / 8 * 6;
-            }
-            else {
-                strcpy(label, "child7");
-                nonce = UINT32_MAX / 8 * 7;
-            }
-        }
-    }
-    mine_block_header(ptrPayload->header, nonce, label);
+    // An easy target: about 65536 hashes expected
+    BlockPayloadHeader header = ptrPayload->header;
+    header.target = 0x1f00ffff;
+    header.nonce = 0;
+    MiningStats stats;
+    int8_t status = mine_block_header(&header, 1, &stats);
+    SHA256_HASH hash = {0};
+    hash_block_header(&header, hash);
+    printf("status = %i (expecting 0)\n", status);
+    printf("satisfies target = %u (expecting 1)\n", hash_satisfies_target_compact(hash, header.target));
+    printf(
+        "nonce=%u: %llu hashes on %u threads in %.1fms (%.0f H/s)\n",
+        header.nonce, stats.hashes, stats.threads, stats.elapsed, stats.hashrate
+    );
+    free_message_payload(&message);
 }
 
 void test_getheaders() {
@@ -247,6 +300,86 @@ void test_getheaders() {
     );
 }
 
+void test_message_encoding() {
+    BlockRequestPayload payload = {
+        .version = config.protocolVersion,
+        .hashCount = 1,
+        .hashStop = {0}
+    };
+    Message genesisMessage = get_empty_message();
+    load_block_message("genesis.dat", &genesisMessage);
+    BlockPayload *ptrBlock = (BlockPayload*) genesisMessage.ptrPayload;
+    dsha256(&ptrBlock->header, sizeof(ptrBlock->header), payload.blockLocatorHash[0]);
+
+    Byte *buffer = prepare_message_buffer(calc_blockreq_payload_width(&payload));
+    uint64_t payloadWidth = serialize_blockreq_payload(&payload, buffer + sizeof(Header));
+    uint64_t w1 = seal_message_buffer(buffer, CMD_GETHEADERS, payloadWidth);
+
+    Byte *bufferFixture = CALLOC(1, MESSAGE_BUFFER_LENGTH, "test_message_encoding:fixture");
+    uint64_t w2 = load_file("fixtures/getheaders_initial.dat", bufferFixture);
+
+    printf("\nwidth = %llu/%llu (expecting equal)", w1, w2);
+    printf("\ndiff = %x (expecting 0)", memcmp(buffer, bufferFixture, w1));
+    printf("\ncapacity = %llu (expecting 128 <= x < %u)\n", get_buffer_capacity(buffer), MESSAGE_BUFFER_LENGTH);
+
+    release_buffer(buffer);
+    FREE(bufferFixture, "test_message_encoding:fixture");
+
+    Byte *verack = prepare_message_buffer(0);
+    printf("verack width = %llu (expecting 24)\n", seal_message_buffer(verack, CMD_VERACK, 0));
+    print_object(verack, sizeof(Header));
+    release_buffer(verack);
+}
+
+void test_message_registry() {
+    Byte fixture[MESSAGE_BUFFER_LENGTH];
+    load_file("fixtures/getheaders_initial.dat", fixture);
+    Header header = get_empty_header();
+    parse_message_header(fixture, &header);
+
+    MessageCodec *ptrCodec = get_message_codec(header.command);
+    printf("\nheader command = %s (expecting getheaders)", ptrCodec ? ptrCodec->command : "(none)");
+    printf("\nping by name = %s (expecting ping)", get_message_codec_by_name(CMD_PING)->command);
+    printf("\nunknown = %p (expecting 0x0)", (void *)get_message_codec_by_name("feefilter"));
+    printf("\nverack max payload = %u (expecting 0)", get_message_codec_by_name(CMD_VERACK)->maxPayloadLength);
+    printf("\npong silent = %u (expecting 1)\n", get_message_codec_by_name(CMD_PONG)->silent);
+}
+
+// Tx counts sent as 9-byte varints, in a message sized for one-byte ones and allocated to
+// the byte, so that reading past the payload is caught under a sanitizer
+void test_headers_bounds() {
+    uint64_t sentCount = 3;
+    uint64_t payloadWidth = 1 + sentCount * HEADER_DATA_MIN_WIDTH;
+    Byte *buffer = CALLOC(1, sizeof(Header) + payloadWidth, "test_headers_bounds:buffer");
+    Byte *p = buffer + sizeof(Header);
+    *p++ = (Byte)sentCount;
+    Byte *end = p + sentCount * HEADER_DATA_MIN_WIDTH;
+    while (end - p >= (ptrdiff_t)(sizeof(BlockPayloadHeader) + 9)) {
+        p += sizeof(BlockPayloadHeader);
+        *p = 0xff;
+        p += 9;
+    }
+    memset(p, 0xff, end - p);
+    seal_message_buffer(buffer, CMD_HEADERS, payloadWidth);
+
+    Message message = get_empty_message();
+    parse_into_headers_message(buffer, &message);
+    HeadersPayload *ptrPayload = message.ptrPayload;
+    printf("parsed %llu of %llu headers (expecting 2 of 3)\n", ptrPayload->count, sentCount);
+    FREE(ptrPayload, "parse_message:payload");
+
+    // A count varint wider than the whole payload
+    Byte *shortBuffer = CALLOC(1, sizeof(Header) + 1, "test_headers_bounds:buffer");
+    shortBuffer[sizeof(Header)] = 0xff;
+    seal_message_buffer(shortBuffer, CMD_HEADERS, 1);
+    parse_into_headers_message(shortBuffer, &message);
+    ptrPayload = message.ptrPayload;
+    printf("truncated count parsed %llu headers (expecting 0)\n", ptrPayload->count);
+    FREE(ptrPayload, "parse_message:payload");
+    FREE(shortBuffer, "test_headers_bounds:buffer");
+    FREE(buffer, "test_headers_bounds:buffer");
+}
+
 void test_checksum() {
     Byte payload[] = {
         0x7f ,0x11 ,0x01 ,0x00 ,0x01 ,0x6f ,0xe2 ,0x8c
@@ -315,7 +448,9 @@ void test_difficulty() {
 
     SHA256_HASH hash2 = {0};
     uint32_t target2 = 0x18009645;
-    target_4to32(target2, hash2);
+    Uint256 target2Value;
+    uint256_from_compact(target2, &target2Value);
+    uint256_to_bytes(&target2Value, hash2);
     print_object(hash2, SHA256_LENGTH);
 
     printf("%i", hash_satisfies_target_compact(hash2, target));
@@ -332,16 +467,1298 @@ void test_print_hash() {
 void test_target_conversions() {
     // TargetQuodBytes genesisQuod = {0x1a, 0xb9, 0x08, 0x18};
     TargetCompact genesisQuod = 0x1d00ffff;
-    printf("%f\n", target_compact_to_float(genesisQuod));
-    BIGNUM *genesisBN = BN_new();
-    target_compact_to_bignum(genesisQuod, genesisBN);
-    BN_add_word(genesisBN, 1);
-    printf("genesisBN=%s\n", BN_bn2dec(genesisBN));
+    Uint256 genesisTarget;
+    uint256_from_compact(genesisQuod, &genesisTarget);
+    printf("%f\n", uint256_to_double(&genesisTarget));
+    Uint256 one;
+    uint256_set_word(&one, 1);
+    uint256_add(&genesisTarget, &one, &genesisTarget);
 
-    TargetCompact genesisReconstruct = target_bignum_to_compact(genesisBN);
+    TargetCompact genesisReconstruct = uint256_to_compact(&genesisTarget);
     printf("Regenerated genesis = %x", genesisReconstruct);
 }
 
+void test_uint256() {
+    printf("compact round trips (expecting all OK)\n");
+    TargetCompact compacts[] = {0x1d00ffff, 0x1b0404cb, 0x18009645, 0x207fffff, 0x03123456, 0x01120000};
+    for (uint32_t i = 0; i < sizeof(compacts) / sizeof(compacts[0]); i++) {
+        Uint256 value;
+        int8_t error = uint256_from_compact(compacts[i], &value);
+        TargetCompact roundTrip = uint256_to_compact(&value);
+        printf("%x -> %x %s\n", compacts[i], roundTrip, !error && roundTrip == compacts[i] ? "OK" : "FAIL");
+    }
+    Uint256 ignored;
+    printf(
+        "negative %s, overflow %s (expecting OK OK)\n",
+        uint256_from_compact(0x04923456, &ignored) == COMPACT_ERROR_NEGATIVE ? "OK" : "FAIL",
+        uint256_from_compact(0xff123456, &ignored) == COMPACT_ERROR_OVERFLOW ? "OK" : "FAIL"
+    );
+
+    Uint256 work;
+    Uint256 expected;
+    calc_block_work(0x1d00ffff, &work);
+    uint256_set_word(&expected, 0x100010001);
+    printf("genesis work %s (expecting OK)\n", uint256_compare(&work, &expected) == 0 ? "OK" : "FAIL");
+
+    // Four times the work per block at a quarter of the target, exactly
+    Uint256 easyWork;
+    Uint256 hardWork;
+    calc_block_work(0x1d00ffff, &easyWork);
+    calc_block_work(0x1c3fffc0, &hardWork);
+    uint256_multiply_word(&easyWork, 4);
+    int8_t ordering = uint256_compare(&hardWork, &easyWork);
+    printf("quartered target work ordering %i (expecting within one block: -1 or 0)\n", ordering);
+
+    Uint256 value;
+    uint256_from_compact(0x1b0404cb, &value);
+    Uint256 original = value;
+    uint32_t carry = uint256_multiply_word(&value, 1209600);
+    uint32_t remainder = uint256_divide_word(&value, 1209600);
+    printf(
+        "multiply/divide round trip %s (expecting OK)\n",
+        !carry && !remainder && uint256_compare(&value, &original) == 0 ? "OK" : "FAIL"
+    );
+
+    Uint256 quotient;
+    Uint256 divisor;
+    uint256_set_word(&divisor, 0x10001);
+    uint256_divide(&original, &divisor, &quotient);
+    Uint256 product = quotient;
+    uint256_multiply_word(&product, 0x10001);
+    Uint256 leftover;
+    uint256_subtract(&original, &product, &leftover);
+    printf(
+        "long division %s (expecting OK)\n",
+        uint256_compare(&leftover, &divisor) < 0 ? "OK" : "FAIL"
+    );
+}
+
+static int8_t remember_generated_block(BlockPayload *ptrBlock, uint32_t height, void *context) {
+    hash_block_header(&ptrBlock->header, context);
+    return 0;
+}
+
+void test_chaingen() {
+    params = &regtest;
+    init_block_index_map();
+    init_archive_dir();
+    init_db();
+    load_genesis();
+    SHA256_HASH expectedGenesis = {0};
+    sha256_hex_to_binary("0f9188f13cb7b2c71f2a335e3a4fc328bf5beb436012afca590b1a11466e2206", expectedGenesis);
+    reverse_bytes(expectedGenesis, SHA256_LENGTH);
+    printf("regtest genesis %s (expecting OK)\n", sha256_match(expectedGenesis, global.genesisHash) ? "OK" : "FAIL");
+
+    ChainGenOptions options = {
+        .blockCount = 20,
+        .shape = TX_SHAPE_FAN_OUT,
+        .txsPerBlock = 3,
+        .outputsPerTx = 2,
+        .multisigPercent = 30,
+        .blockInterval = 600,
+        .seed = 7,
+    };
+    ChainGenStats stats;
+    int8_t status = generate_chain(&options, &stats);
+    printf("fan-out status = %i (expecting 0)\n", status);
+    printf("%u blocks, %llu txs, %llu inputs in %.1fms\n", stats.blocks, stats.txs, stats.inputs, stats.elapsed);
+
+    options.blockCount = 5;
+    options.shape = TX_SHAPE_CHAIN;
+    options.txsPerBlock = 4;
+    status = generate_chain(&options, &stats);
+    printf("chain status = %i (expecting 0)\n", status);
+    printf(
+        "header tip %u, validated tip %u (expecting 25, 25)\n",
+        global.mainHeaderTip.context.height,
+        global.mainValidatedTip.context.height
+    );
+
+    SHA256_HASH firstRun = {0};
+    SHA256_HASH secondRun = {0};
+    options.sink = &remember_generated_block;
+    options.sinkContext = firstRun;
+    generate_chain(&options, NULL);
+    options.sinkContext = secondRun;
+    generate_chain(&options, NULL);
+    printf("deterministic %s (expecting OK)\n", sha256_match(firstRun, secondRun) ? "OK" : "FAIL");
+    params = &mainnet;
+}
+
+// Starts every chain test from regtest's genesis over whatever the archive holds
+static void reset_regtest_chain() {
+    params = &regtest;
+    init_block_index_map();
+    init_archive_dir();
+    init_db();
+    clear_utxo_cache();
+    memset(&global.mainHeaderTip, 0, sizeof(global.mainHeaderTip));
+    memset(&global.mainValidatedTip, 0, sizeof(global.mainValidatedTip));
+    load_genesis();
+}
+
+struct ForkWitness {
+    Outpoint coinbaseOutput; // of the last block generated
+    Outpoint spentOutput; // by the last block generated
+    BlockIndex *restoreTip; // header tip to put back once the generator has picked its parent
+};
+
+// Processes the block as a peer's and keeps going whether or not it joins the validated chain
+static int8_t submit_fork_block(BlockPayload *ptrBlock, uint32_t height, void *context) {
+    struct ForkWitness *witness = context;
+    if (witness->restoreTip) {
+        global.mainHeaderTip = *witness->restoreTip;
+        witness->restoreTip = NULL;
+    }
+    hash_tx(&ptrBlock->txs[0], witness->coinbaseOutput.txHash);
+    witness->coinbaseOutput.index = 0;
+    if (ptrBlock->txCount > 1) {
+        witness->spentOutput = ptrBlock->txs[1].txInputs[0].previous_output;
+    }
+    return process_incoming_block(ptrBlock, true);
+}
+
+void test_reorg() {
+    reset_regtest_chain();
+
+    struct ForkWitness oldWitness;
+    struct ForkWitness newWitness;
+    memset(&oldWitness, 0, sizeof(oldWitness));
+    memset(&newWitness, 0, sizeof(newWitness));
+    ChainGenOptions options = {
+        .blockCount = 10,
+        .shape = TX_SHAPE_FAN_OUT,
+        .txsPerBlock = 3,
+        .outputsPerTx = 2,
+        .blockInterval = 600,
+        .seed = 11,
+        .sink = &submit_fork_block,
+        .sinkContext = &oldWitness,
+    };
+    generate_chain(&options, NULL);
+    BlockIndex oldTip = global.mainValidatedTip;
+    printf("validated tip %u (expecting 10)\n", oldTip.context.height);
+
+    // Fork off two blocks below the tip; the third block of the branch outweighs the old chain
+    BlockIndex *fork = GET_BLOCK_INDEX(oldTip.header.prev_block);
+    fork = GET_BLOCK_INDEX(fork->header.prev_block);
+    global.mainHeaderTip = *fork;
+    options.blockCount = 3;
+    options.seed = 12;
+    options.sinkContext = &newWitness;
+    newWitness.restoreTip = &oldTip;
+    generate_chain(&options, NULL);
+    TxOut *output = CALLOC(1, sizeof(TxOut), "test_reorg:output");
+    printf(
+        "validated tip %u, header tip %u (expecting 11, 11)\n",
+        global.mainValidatedTip.context.height,
+        global.mainHeaderTip.context.height
+    );
+    printf(
+        "old coinbase found = %i, new coinbase found = %i (expecting -1, 0)\n",
+        get_utxo(&oldWitness.coinbaseOutput, output),
+        get_utxo(&newWitness.coinbaseOutput, output)
+    );
+    BlockIndex *oldTipIndex = GET_BLOCK_INDEX(oldTip.meta.hash);
+    printf(
+        "old tip on side chain %s, registered %i (expecting OK, 0)\n",
+        oldTipIndex->context.chainStatus == CHAIN_STATUS_SIDECHAIN ? "OK" : "FAIL",
+        oldTipIndex->meta.outputsRegistered
+    );
+
+    double start = get_now();
+    int8_t status = disconnect_block(GET_BLOCK_INDEX(global.mainValidatedTip.meta.hash));
+    printf("disconnect status = %i in %.1fms (expecting 0)\n", status, get_now() - start);
+    printf(
+        "validated tip %u, spent output back %i, coinbase gone %i (expecting 10, 0, -1)\n",
+        global.mainValidatedTip.context.height,
+        get_utxo(&newWitness.spentOutput, output),
+        get_utxo(&newWitness.coinbaseOutput, output)
+    );
+    validate_blocks(1000);
+    printf(
+        "reconnected tip %u, coinbase found = %i (expecting 11, 0)\n",
+        global.mainValidatedTip.context.height,
+        get_utxo(&newWitness.coinbaseOutput, output)
+    );
+    FREE(output, "test_reorg:output");
+    params = &mainnet;
+}
+
+static bool are_utxo_set_stats_equal(UtxoSetStats *a, UtxoSetStats *b) {
+    return a->outputs == b->outputs && a->amount == b->amount && sha256_match(a->commitment, b->commitment);
+}
+
+// Flushes, then recomputes the statistics from the database alone
+static void scan_utxo_set_stats(UtxoSetStats *ptrStats) {
+    flush_utxo_cache(false);
+    rebuild_utxo_stats(global.mainValidatedTip.meta.hash);
+    get_utxo_set_stats(ptrStats);
+}
+
+void test_utxo_stats() {
+    reset_regtest_chain();
+    UtxoSetStats initial;
+    scan_utxo_set_stats(&initial);
+
+    ChainGenOptions options = {
+        .blockCount = 10,
+        .shape = TX_SHAPE_FAN_OUT,
+        .txsPerBlock = 4,
+        .outputsPerTx = 3,
+        .blockInterval = 600,
+        .seed = 19,
+    };
+    ChainGenStats genStats;
+    memset(&genStats, 0, sizeof(genStats));
+    generate_chain(&options, &genStats);
+    UtxoSetStats running;
+    get_utxo_set_stats(&running);
+    printf(
+        "outputs added %llu, at tip %s (expecting %llu, OK)\n",
+        running.outputs - initial.outputs,
+        sha256_match(running.blockHash, global.mainValidatedTip.meta.hash) ? "OK" : "FAIL",
+        genStats.outputs - genStats.inputs
+    );
+    UtxoSetStats scanned;
+    scan_utxo_set_stats(&scanned);
+    printf("running stats match a scan %s (expecting OK)\n", are_utxo_set_stats_equal(&running, &scanned) ? "OK" : "FAIL");
+
+    double start = get_now();
+    disconnect_block(GET_BLOCK_INDEX(global.mainValidatedTip.meta.hash));
+    UtxoSetStats disconnected;
+    get_utxo_set_stats(&disconnected);
+    printf("disconnected in %.1fms\n", get_now() - start);
+    scan_utxo_set_stats(&scanned);
+    printf(
+        "after disconnection: changed %s, match a scan %s (expecting OK, OK)\n",
+        are_utxo_set_stats_equal(&running, &disconnected) ? "FAIL" : "OK",
+        are_utxo_set_stats_equal(&disconnected, &scanned) ? "OK" : "FAIL"
+    );
+    validate_blocks(1000);
+    UtxoSetStats reconnected;
+    get_utxo_set_stats(&reconnected);
+    printf("reconnected stats equal the first time %s (expecting OK)\n", are_utxo_set_stats_equal(&running, &reconnected) ? "OK" : "FAIL");
+
+    // Saved by the flush and taken back while they describe the validated tip
+    flush_utxo_cache(false);
+    reset_utxo_stats(global.genesisHash);
+    open_utxo_stats();
+    UtxoSetStats reopened;
+    get_utxo_set_stats(&reopened);
+    printf(
+        "reopened stale %i, equal %s (expecting 0, OK)\n",
+        reopened.stale,
+        are_utxo_set_stats_equal(&running, &reopened) ? "OK" : "FAIL"
+    );
+
+    // As after a crash with the tip flushed but not recorded: stale until registered again
+    BlockIndex tip = global.mainValidatedTip;
+    global.mainValidatedTip = *(BlockIndex*)GET_BLOCK_INDEX(tip.header.prev_block);
+    clear_utxo_cache();
+    open_utxo_stats();
+    printf("reopened below the flush: stale %i (expecting 1)\n", is_utxo_stats_stale());
+    BlockPayload *ptrBlock = CALLOC(1, sizeof(*ptrBlock), "block_payload");
+    load_block(tip.meta.hash, ptrBlock);
+    register_validated_block(ptrBlock);
+    release_block(ptrBlock);
+    global.mainValidatedTip = tip;
+    flush_utxo_cache(false);
+    get_utxo_set_stats(&reopened);
+    printf(
+        "registered again: stale %i, equal %s (expecting 0, OK)\n",
+        reopened.stale,
+        are_utxo_set_stats_equal(&running, &reopened) ? "OK" : "FAIL"
+    );
+    params = &mainnet;
+}
+
+static int8_t stage_output_removal(Outpoint *outpoint, Byte *data, uint64_t width, void *batch) {
+    stage_utxo_removal(batch, outpoint);
+    return 0;
+}
+
+static bool are_files_identical(char *pathA, char *pathB) {
+    FILE *a = fopen(pathA, "rb");
+    FILE *b = fopen(pathB, "rb");
+    bool identical = a && b;
+    while (identical) {
+        int32_t byteA = fgetc(a);
+        identical = byteA == fgetc(b);
+        if (byteA == EOF) {
+            break;
+        }
+    }
+    if (a) {
+        fclose(a);
+    }
+    if (b) {
+        fclose(b);
+    }
+    return identical;
+}
+
+void test_utxo_snapshot() {
+    reset_regtest_chain();
+
+    struct ForkWitness witness;
+    memset(&witness, 0, sizeof(witness));
+    ChainGenOptions options = {
+        .blockCount = 12,
+        .shape = TX_SHAPE_FAN_OUT,
+        .txsPerBlock = 4,
+        .outputsPerTx = 3,
+        .blockInterval = 600,
+        .seed = 13,
+        .sink = &submit_fork_block,
+        .sinkContext = &witness,
+    };
+    generate_chain(&options, NULL);
+    BlockIndex tip = global.mainValidatedTip;
+
+    char path[256] = {0};
+    char reloadedPath[256] = {0};
+    sprintf(path, "%s/utxo.snapshot", params->archiveRoot);
+    sprintf(reloadedPath, "%s/utxo.reloaded.snapshot", params->archiveRoot);
+    printf("dump status = %i (expecting 0)\n", dump_utxo_snapshot(path));
+    printf("load into full database = %i (expecting -1)\n", load_utxo_snapshot(path));
+
+    void *batch = create_utxo_batch();
+    iterate_utxo_data(&stage_output_removal, batch);
+    commit_utxo_batch(batch);
+    destroy_utxo_batch(batch);
+    clear_utxo_cache();
+    global.mainValidatedTip = *(BlockIndex*)GET_BLOCK_INDEX(global.genesisHash);
+
+    // A flipped byte anywhere must fail the checksum before anything is written
+    FILE *file = fopen(path, "r+b");
+    fseek(file, -41, SEEK_END);
+    int32_t original = fgetc(file);
+    fseek(file, -41, SEEK_END);
+    fputc(original ^ 0x01, file);
+    fclose(file);
+    printf("tampered load = %i (expecting -2)\n", load_utxo_snapshot(path));
+    file = fopen(path, "r+b");
+    fseek(file, -41, SEEK_END);
+    fputc(original, file);
+    fclose(file);
+
+    printf("load status = %i (expecting 0)\n", load_utxo_snapshot(path));
+    printf(
+        "validated tip %u, same block %s (expecting %u, OK)\n",
+        global.mainValidatedTip.context.height,
+        sha256_match(global.mainValidatedTip.meta.hash, tip.meta.hash) ? "OK" : "FAIL",
+        tip.context.height
+    );
+    TxOut *output = CALLOC(1, sizeof(TxOut), "test_utxo_snapshot:output");
+    printf(
+        "last coinbase found = %i, last spent found = %i (expecting 0, -1)\n",
+        get_utxo(&witness.coinbaseOutput, output),
+        get_utxo(&witness.spentOutput, output)
+    );
+    FREE(output, "test_utxo_snapshot:output");
+    UtxoSetStats loaded;
+    UtxoSetStats scanned;
+    get_utxo_set_stats(&loaded);
+    scan_utxo_set_stats(&scanned);
+    printf("set statistics from the load match a scan %s (expecting OK)\n", are_utxo_set_stats_equal(&loaded, &scanned) ? "OK" : "FAIL");
+    dump_utxo_snapshot(reloadedPath);
+    printf("dump after load identical %s (expecting OK)\n", are_files_identical(path, reloadedPath) ? "OK" : "FAIL");
+    remove(path);
+    remove(reloadedPath);
+    params = &mainnet;
+}
+
+// Validates the archived blocks past the tip with everything flushed and evicted beforehand,
+// returning the cache misses it took
+static uint64_t validate_cold(uint32_t prefetchThreads) {
+    flush_utxo_cache(true);
+    UtxoCacheStats before;
+    get_utxo_cache_stats(&before);
+    config.prefetchThreads = prefetchThreads;
+    validate_blocks(60000);
+    UtxoCacheStats after;
+    get_utxo_cache_stats(&after);
+    return after.misses - before.misses;
+}
+
+static int8_t archive_above_height(BlockPayload *ptrBlock, uint32_t height, void *context) {
+    uint32_t *validatedHeight = context;
+    return process_incoming_block(ptrBlock, height <= *validatedHeight);
+}
+
+void test_utxo_prefetch() {
+    reset_regtest_chain();
+    uint32_t savedThreads = config.prefetchThreads;
+
+    // The later half is archived only, left for validate_blocks; its inputs spend the oldest
+    // coins, mostly created in the validated half
+    uint32_t baseHeight = global.mainValidatedTip.context.height + 20;
+    ChainGenOptions options = {
+        .blockCount = 40,
+        .shape = TX_SHAPE_FAN_OUT,
+        .txsPerBlock = 12,
+        .outputsPerTx = 4,
+        .blockInterval = 600,
+        .seed = 17,
+        .sink = &archive_above_height,
+        .sinkContext = &baseHeight,
+    };
+    generate_chain(&options, NULL);
+
+    uint64_t prefetchedMisses = validate_cold(4);
+    PrefetchStats stats;
+    get_utxo_prefetch_stats(&stats);
+    printf(
+        "with prefetch: tip %u, %llu misses; %llu of %llu lookups found, %llu primed, final depth %u\n",
+        global.mainValidatedTip.context.height,
+        prefetchedMisses,
+        stats.found,
+        stats.lookups,
+        stats.primed,
+        stats.depth
+    );
+    printf("validated all %s (expecting OK)\n", global.mainValidatedTip.context.height == baseHeight + 20 ? "OK" : "FAIL");
+
+    while (global.mainValidatedTip.context.height > baseHeight) {
+        disconnect_block(GET_BLOCK_INDEX(global.mainValidatedTip.meta.hash));
+    }
+    uint64_t coldMisses = validate_cold(0);
+    printf("without prefetch: tip %u, %llu misses\n", global.mainValidatedTip.context.height, coldMisses);
+    printf("fewer misses with prefetch %s (expecting OK)\n", prefetchedMisses < coldMisses ? "OK" : "FAIL");
+    config.prefetchThreads = savedThreads;
+    params = &mainnet;
+}
+
+// Validates the archived blocks past the tip, returning how long it took
+static double validate_through_pipeline(uint32_t depth, UtxoSetStats *ptrStats) {
+    config.pipelineDepth = depth;
+    double start = get_now();
+    validate_blocks(60000);
+    double elapsed = get_now() - start;
+    get_utxo_set_stats(ptrStats);
+    return elapsed;
+}
+
+void test_block_pipeline() {
+    reset_regtest_chain();
+    uint32_t savedDepth = config.pipelineDepth;
+    uint64_t savedBudget = config.signatureCacheBudget;
+    // Both runs verify every signature, so their times compare
+    clear_signature_cache();
+    config.signatureCacheBudget = 0;
+
+    uint32_t baseHeight = global.mainValidatedTip.context.height + 10;
+    ChainGenOptions options = {
+        .blockCount = 40,
+        .shape = TX_SHAPE_FAN_OUT,
+        .txsPerBlock = 10,
+        .outputsPerTx = 3,
+        .multisigPercent = 20,
+        .blockInterval = 600,
+        .seed = 37,
+        .sink = &archive_above_height,
+        .sinkContext = &baseHeight,
+    };
+    generate_chain(&options, NULL);
+
+    UtxoSetStats piped;
+    double pipedTime = validate_through_pipeline(8, &piped);
+    PipelineStats stats;
+    get_block_pipeline_stats(&stats);
+    printf("pipelined: tip %u in %.1fms\n", global.mainValidatedTip.context.height, pipedTime);
+    printf(
+        "stages: read %.1fms, parse %.1fms, resolve %.1fms; waited %.1fms for them\n",
+        stats.readTime,
+        stats.parseTime,
+        stats.resolveTime,
+        stats.waitTime
+    );
+    printf(
+        "validated all %s, %llu of %llu queued taken (expecting OK, 30 of 30)\n",
+        global.mainValidatedTip.context.height == baseHeight + 30 ? "OK" : "FAIL",
+        stats.taken,
+        stats.queued
+    );
+
+    while (global.mainValidatedTip.context.height > baseHeight) {
+        disconnect_block(GET_BLOCK_INDEX(global.mainValidatedTip.meta.hash));
+    }
+    UtxoSetStats serial;
+    double serialTime = validate_through_pipeline(0, &serial);
+    printf("serial: tip %u in %.1fms\n", global.mainValidatedTip.context.height, serialTime);
+    printf("same UTXO set %s (expecting OK)\n", are_utxo_set_stats_equal(&piped, &serial) ? "OK" : "FAIL");
+
+    // A slot for a block that is not the next one validated is dropped with the rest
+    while (global.mainValidatedTip.context.height > baseHeight) {
+        disconnect_block(GET_BLOCK_INDEX(global.mainValidatedTip.meta.hash));
+    }
+    config.pipelineDepth = 4;
+    start_block_pipeline();
+    BlockIndex *next = GET_BLOCK_INDEX(global.mainValidatedTip.meta.hash);
+    next = GET_BLOCK_INDEX(next->context.children.hashes[0]);
+    BlockIndex *afterNext = GET_BLOCK_INDEX(next->context.children.hashes[0]);
+    queue_pipeline_block(afterNext->meta.hash);
+    int8_t status = validate_block(next->meta.hash, true, NULL);
+    stop_block_pipeline();
+    get_block_pipeline_stats(&stats);
+    printf(
+        "out of order: status %i, tip %u, %llu dropped (expecting 2, %u, 1)\n",
+        status,
+        global.mainValidatedTip.context.height,
+        stats.dropped,
+        baseHeight + 1
+    );
+    config.pipelineDepth = savedDepth;
+    config.signatureCacheBudget = savedBudget;
+    params = &mainnet;
+}
+
+// Validates the archived blocks past the tip, returning the scripts it checked
+static uint64_t validate_assuming(char *assumeValidBlock, uint64_t *assumedBlocks, UtxoSetStats *ptrStats) {
+    config.assumeValidBlock = assumeValidBlock;
+    ScriptVerifierStats before;
+    ScriptVerifierStats after;
+    get_script_verifier_stats(&before);
+    validate_blocks(60000);
+    get_script_verifier_stats(&after);
+    get_utxo_set_stats(ptrStats);
+    *assumedBlocks = after.assumed - before.assumed;
+    return after.checks - before.checks;
+}
+
+void test_assume_valid() {
+    reset_regtest_chain();
+    char *savedBlock = config.assumeValidBlock;
+    uint32_t savedThreads = config.scriptThreads;
+    config.scriptThreads = 1;
+
+    uint32_t baseHeight = global.mainValidatedTip.context.height + 10;
+    ChainGenOptions options = {
+        .blockCount = 30,
+        .shape = TX_SHAPE_FAN_OUT,
+        .txsPerBlock = 6,
+        .outputsPerTx = 3,
+        .multisigPercent = 20,
+        .blockInterval = 600,
+        .seed = 41,
+        .sink = &archive_above_height,
+        .sinkContext = &baseHeight,
+    };
+    generate_chain(&options, NULL);
+
+    // Assume the scripts up to ten blocks past the validated tip
+    BlockIndex *assumed = GET_BLOCK_INDEX(global.mainHeaderTip.meta.hash);
+    while (assumed->context.height > baseHeight + 10) {
+        assumed = GET_BLOCK_INDEX(assumed->header.prev_block);
+    }
+    SHA256_HASH bigEndian = {0};
+    memcpy(bigEndian, assumed->meta.hash, SHA256_LENGTH);
+    reverse_bytes(bigEndian, SHA256_LENGTH);
+    char assumedHex[2 * SHA256_LENGTH + 1] = {0};
+    hash_binary_to_hex(bigEndian, assumedHex);
+
+    uint64_t assumedBlocks = 0;
+    UtxoSetStats assuming;
+    uint64_t partialChecks = validate_assuming(assumedHex, &assumedBlocks, &assuming);
+    printf(
+        "assuming: tip %u, %llu blocks assumed, %llu scripts checked (expecting %u, 10)\n",
+        global.mainValidatedTip.context.height,
+        assumedBlocks,
+        partialChecks,
+        baseHeight + 20
+    );
+
+    while (global.mainValidatedTip.context.height > baseHeight) {
+        disconnect_block(GET_BLOCK_INDEX(global.mainValidatedTip.meta.hash));
+    }
+    UtxoSetStats verifying;
+    uint64_t fullChecks = validate_assuming("0", &assumedBlocks, &verifying);
+    printf(
+        "verifying all: tip %u, %llu blocks assumed, %llu scripts checked (expecting %u, 0)\n",
+        global.mainValidatedTip.context.height,
+        assumedBlocks,
+        fullChecks,
+        baseHeight + 20
+    );
+    printf(
+        "fewer checks when assuming %s, same UTXO set %s (expecting OK, OK)\n",
+        partialChecks < fullChecks ? "OK" : "FAIL",
+        are_utxo_set_stats_equal(&assuming, &verifying) ? "OK" : "FAIL"
+    );
+    config.assumeValidBlock = savedBlock;
+    config.scriptThreads = savedThreads;
+    params = &mainnet;
+}
+
+typedef void GeneratedBlockCheck(BlockPayload *ptrBlock, BlockIndex *ptrIndex, void *context);
+
+struct PreSubmitCheck {
+    GeneratedBlockCheck *check;
+    void *context;
+};
+
+// Runs the check on each generated block, against an index holding only its height, then
+// submits the block as a peer's
+static int8_t check_before_submitting(BlockPayload *ptrBlock, uint32_t height, void *context) {
+    struct PreSubmitCheck *hook = context;
+    BlockIndex index;
+    memset(&index, 0, sizeof(index));
+    index.context.height = height;
+    hook->check(ptrBlock, &index, hook->context);
+    return submit_generated_block(ptrBlock, height, NULL);
+}
+
+// Fifteen blocks of eight fan-out transactions, each checked before it is submitted
+static ChainGenOptions get_checked_chain_options(uint32_t seed, struct PreSubmitCheck *hook) {
+    ChainGenOptions options = {
+        .blockCount = 15,
+        .shape = TX_SHAPE_FAN_OUT,
+        .txsPerBlock = 8,
+        .outputsPerTx = 3,
+        .multisigPercent = 30,
+        .blockInterval = 600,
+        .seed = seed,
+        .sink = &check_before_submitting,
+        .sinkContext = hook,
+    };
+    return options;
+}
+
+struct ScriptCheckTally {
+    uint32_t blocks;
+    uint32_t agreed; // valid both on the validating thread alone and with the pool
+    uint32_t tampered;
+    uint32_t rejected; // tampered and invalid both ways
+};
+
+static bool validate_with_script_threads(BlockPayload *ptrBlock, BlockIndex *ptrIndex, uint32_t threads) {
+    stop_script_verifier();
+    config.scriptThreads = threads;
+    return is_block_valid(ptrBlock, ptrIndex);
+}
+
+// Validates each block before it is submitted, then again with a signature of its last tx
+// broken. Legality is cached by header hash, so only the scripts can catch the change
+static void cross_check_scripts(BlockPayload *ptrBlock, BlockIndex *ptrIndex, void *context) {
+    struct ScriptCheckTally *tally = context;
+    is_block_legal(ptrBlock);
+    tally->blocks++;
+    if (validate_with_script_threads(ptrBlock, ptrIndex, 1) && validate_with_script_threads(ptrBlock, ptrIndex, 4)) {
+        tally->agreed++;
+    }
+    if (ptrBlock->txCount > 1) {
+        TxIn *input = &ptrBlock->txs[ptrBlock->txCount - 1].txInputs[0];
+        input->signature_script[8] ^= 0x01;
+        tally->tampered++;
+        if (!validate_with_script_threads(ptrBlock, ptrIndex, 1) && !validate_with_script_threads(ptrBlock, ptrIndex, 4)) {
+            tally->rejected++;
+        }
+        input->signature_script[8] ^= 0x01;
+    }
+}
+
+void test_script_verifier() {
+    reset_regtest_chain();
+    uint32_t savedThreads = config.scriptThreads;
+    uint64_t savedBudget = config.signatureCacheBudget;
+    // Every pass has to reach ECDSA_verify rather than the cache
+    clear_signature_cache();
+    config.signatureCacheBudget = 0;
+
+    struct ScriptCheckTally tally;
+    memset(&tally, 0, sizeof(tally));
+    struct PreSubmitCheck hook = {&cross_check_scripts, &tally};
+    ChainGenOptions options = get_checked_chain_options(23, &hook);
+    int8_t status = generate_chain(&options, NULL);
+    printf("status = %i, validated tip %u (expecting 0, 15)\n", status, global.mainValidatedTip.context.height);
+    printf("%u of %u blocks valid both ways (expecting all)\n", tally.agreed, tally.blocks);
+    printf(
+        "%u of %u tampered blocks rejected both ways %s (expecting OK)\n",
+        tally.rejected,
+        tally.tampered,
+        tally.tampered > 0 && tally.rejected == tally.tampered ? "OK" : "FAIL"
+    );
+    ScriptVerifierStats stats;
+    get_script_verifier_stats(&stats);
+    printf(
+        "pool of %u: %llu checks, %llu failures, %llu cancelled over %llu blocks\n",
+        stats.threads,
+        stats.checks,
+        stats.failures,
+        stats.cancelled,
+        stats.blocks
+    );
+    stop_script_verifier();
+    config.scriptThreads = savedThreads;
+    config.signatureCacheBudget = savedBudget;
+    params = &mainnet;
+}
+
+struct SignatureCacheTally {
+    uint32_t blocks;
+    uint32_t validTwice;
+    uint64_t verified; // signatures inserted by the first pass
+    uint64_t reused; // cache hits in the second pass
+    uint64_t reinserted; // by the second pass, which should have found everything
+};
+
+// Validates each block twice before it is submitted, the way a block checked on arrival is
+// checked again by the validateNewBlocks timer
+static void validate_twice(BlockPayload *ptrBlock, BlockIndex *ptrIndex, void *context) {
+    struct SignatureCacheTally *tally = context;
+    SignatureCacheStats before;
+    SignatureCacheStats between;
+    SignatureCacheStats after;
+    get_signature_cache_stats(&before);
+    bool firstValid = is_block_valid(ptrBlock, ptrIndex);
+    get_signature_cache_stats(&between);
+    bool secondValid = is_block_valid(ptrBlock, ptrIndex);
+    get_signature_cache_stats(&after);
+    tally->blocks++;
+    if (firstValid && secondValid) {
+        tally->validTwice++;
+    }
+    tally->verified += between.insertions - before.insertions;
+    tally->reused += after.hits - between.hits;
+    tally->reinserted += after.insertions - between.insertions;
+}
+
+void test_signature_cache() {
+    reset_regtest_chain();
+    clear_signature_cache();
+    uint64_t savedBudget = config.signatureCacheBudget;
+
+    struct SignatureCacheTally tally;
+    memset(&tally, 0, sizeof(tally));
+    struct PreSubmitCheck hook = {&validate_twice, &tally};
+    ChainGenOptions options = get_checked_chain_options(29, &hook);
+    double start = get_now();
+    int8_t status = generate_chain(&options, NULL);
+    printf("status = %i, validated tip %u (expecting 0, 15)\n", status, global.mainValidatedTip.context.height);
+    printf("%u of %u blocks valid twice (expecting all)\n", tally.validTwice, tally.blocks);
+    printf(
+        "%llu signatures verified, %llu reused, %llu verified again %s (expecting OK) in %.1fms\n",
+        tally.verified,
+        tally.reused,
+        tally.reinserted,
+        tally.verified > 0 && tally.reused == tally.verified && tally.reinserted == 0 ? "OK" : "FAIL",
+        get_now() - start
+    );
+
+    // A cache of no size is never consulted
+    clear_signature_cache();
+    config.signatureCacheBudget = 0;
+    SignatureCacheStats before;
+    SignatureCacheStats after;
+    get_signature_cache_stats(&before);
+    options.blockCount = 3;
+    options.seed = 31;
+    options.sink = NULL;
+    options.sinkContext = NULL;
+    generate_chain(&options, NULL);
+    get_signature_cache_stats(&after);
+    printf(
+        "disabled: capacity %llu, %llu lookups, %llu insertions (expecting 0, 0, 0)\n",
+        after.capacity,
+        after.lookups - before.lookups,
+        after.insertions - before.insertions
+    );
+
+    // A budget below the default still bounds the table
+    clear_signature_cache();
+    config.signatureCacheBudget = 1000;
+    options.seed = 33;
+    generate_chain(&options, NULL);
+    get_signature_cache_stats(&after);
+    printf(
+        "small budget: %llu bytes for a budget of %llu %s (expecting OK)\n",
+        after.memory,
+        config.signatureCacheBudget,
+        after.memory > 0 && after.memory <= config.signatureCacheBudget ? "OK" : "FAIL"
+    );
+    clear_signature_cache();
+    config.signatureCacheBudget = savedBudget;
+    params = &mainnet;
+}
+
+struct PrevoutTally {
+    uint32_t blocks;
+    uint32_t valid;
+    uint64_t inputs; // other than coinbase ones
+    uint64_t lookups; // in the UTXO cache, hits and misses alike
+};
+
+static void count_prevout_lookups(BlockPayload *ptrBlock, BlockIndex *ptrIndex, void *context) {
+    struct PrevoutTally *tally = context;
+    for (uint64_t i = 1; i < ptrBlock->txCount; i++) {
+        tally->inputs += ptrBlock->txs[i].txInputCount;
+    }
+    UtxoCacheStats before;
+    UtxoCacheStats after;
+    get_utxo_cache_stats(&before);
+    bool valid = is_block_valid(ptrBlock, ptrIndex);
+    get_utxo_cache_stats(&after);
+    tally->blocks++;
+    if (valid) {
+        tally->valid++;
+    }
+    tally->lookups += (after.hits + after.misses) - (before.hits + before.misses);
+}
+
+void test_prevout_resolution() {
+    reset_regtest_chain();
+
+    struct PrevoutTally tally;
+    memset(&tally, 0, sizeof(tally));
+    struct PreSubmitCheck hook = {&count_prevout_lookups, &tally};
+    ChainGenOptions options = get_checked_chain_options(43, &hook);
+    double start = get_now();
+    generate_chain(&options, NULL);
+    printf(
+        "fan-out: %u of %u blocks valid, %llu inputs, %llu lookups %s (expecting all, OK) in %.1fms\n",
+        tally.valid,
+        tally.blocks,
+        tally.inputs,
+        tally.lookups,
+        tally.inputs > 0 && tally.lookups == tally.inputs ? "OK" : "FAIL",
+        get_now() - start
+    );
+
+    // Spends within the block miss the cache once, then come from the block itself
+    memset(&tally, 0, sizeof(tally));
+    options.blockCount = 10;
+    options.shape = TX_SHAPE_CHAIN;
+    options.seed = 47;
+    start = get_now();
+    generate_chain(&options, NULL);
+    printf(
+        "chain: %u of %u blocks valid, %llu inputs, %llu lookups %s (expecting all, OK) in %.1fms\n",
+        tally.valid,
+        tally.blocks,
+        tally.inputs,
+        tally.lookups,
+        tally.inputs > 0 && tally.lookups == tally.inputs ? "OK" : "FAIL",
+        get_now() - start
+    );
+    printf("validated tip %u (expecting 25)\n", global.mainValidatedTip.context.height);
+    params = &mainnet;
+}
+
+static bool is_utxo_on_disk(Outpoint *outpoint) {
+    Byte buffer[MAX_COMPRESSED_TX_OUT_WIDTH];
+    size_t width = 0;
+    return load_utxo_data(outpoint, buffer, &width) == 0;
+}
+
+void test_utxo_cache() {
+    params = &regtest;
+    init_archive_dir();
+    init_db();
+    clear_utxo_cache();
+    set_utxo_cache_height(1);
+
+    TxOut *output = CALLOC(1, sizeof(TxOut), "test_utxo_cache:output");
+    output->value = COIN(25);
+    output->public_key_script_length = 3;
+    memcpy(output->public_key_script, "\x51\x52\x93", 3);
+    TxOut *loaded = CALLOC(1, sizeof(TxOut), "test_utxo_cache:loaded");
+
+    Outpoint transient;
+    Outpoint kept;
+    random_bytes(SHA256_LENGTH, transient.txHash);
+    random_bytes(SHA256_LENGTH, kept.txHash);
+    transient.index = 0;
+    kept.index = 7;
+
+    add_utxo(&transient, output);
+    add_utxo(&kept, output);
+    int8_t status = get_utxo(&transient, loaded);
+    printf(
+        "cached output %s (expecting OK)\n",
+        !status && loaded->value == output->value && loaded->public_key_script[2] == 0x93 ? "OK" : "FAIL"
+    );
+    spend_utxo(&transient, NULL, NULL);
+    printf("spent output found = %i (expecting -1)\n", get_utxo(&transient, loaded));
+
+    flush_utxo_cache(true);
+    printf(
+        "on disk: transient %i, kept %i (expecting 0, 1)\n",
+        is_utxo_on_disk(&transient),
+        is_utxo_on_disk(&kept)
+    );
+
+    UtxoCacheStats stats;
+    memset(loaded, 0, sizeof(*loaded));
+    status = get_utxo(&kept, loaded);
+    get_utxo_cache_stats(&stats);
+    printf(
+        "reloaded %s, %llu misses, %llu elided (expecting OK, 2, 1)\n",
+        !status && loaded->value == output->value ? "OK" : "FAIL",
+        stats.misses,
+        stats.elided
+    );
+
+    spend_utxo(&kept, NULL, NULL);
+    printf("before flush: kept on disk %i (expecting 1)\n", is_utxo_on_disk(&kept));
+    flush_utxo_cache(false);
+    printf("after flush: kept on disk %i (expecting 0)\n", is_utxo_on_disk(&kept));
+
+    // Past the flushed height, new outputs are fresh again
+    set_utxo_cache_height(2);
+    uint32_t count = 100000;
+    Outpoint *outpoints = CALLOC(count, sizeof(Outpoint), "test_utxo_cache:outpoints");
+    double start = get_now();
+    for (uint32_t i = 0; i < count; i++) {
+        random_bytes(SHA256_LENGTH, outpoints[i].txHash);
+        outpoints[i].index = i;
+        add_utxo(&outpoints[i], output);
+    }
+    for (uint32_t i = 0; i < count; i += 2) {
+        spend_utxo(&outpoints[i], NULL, NULL);
+    }
+    uint32_t found = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        found += get_utxo(&outpoints[i], loaded) == 0;
+    }
+    get_utxo_cache_stats(&stats);
+    printf(
+        "%u of %u outputs left, %llu entries (expecting %u, %u) in %.1fms\n",
+        found, count, stats.entries, count / 2, count / 2, get_now() - start
+    );
+    flush_utxo_cache(true);
+
+    FREE(outpoints, "test_utxo_cache:outpoints");
+    FREE(output, "test_utxo_cache:output");
+    FREE(loaded, "test_utxo_cache:loaded");
+    params = &mainnet;
+}
+
+// Adds count outputs, then spends every other one and one never created, all in one call
+static uint64_t apply_test_changes(Outpoint *outpoints, uint32_t count, TxOut *output, uint32_t *failed) {
+    UtxoChange *changes = CALLOC(count + count / 2 + 1, sizeof(UtxoChange), "test_utxo_shards:changes");
+    uint32_t changeCount = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        changes[changeCount].outpoint = outpoints[i];
+        changes[changeCount].output = output;
+        changeCount++;
+    }
+    for (uint32_t i = 0; i < count; i += 2) {
+        changes[changeCount++].outpoint = outpoints[i];
+    }
+    random_bytes(SHA256_LENGTH, changes[changeCount++].outpoint.txHash);
+    apply_utxo_changes(changes, changeCount);
+    *failed = 0;
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < changeCount; i++) {
+        *failed += changes[i].status != 0;
+        for (uint32_t j = 0; j < changes[i].width; j++) {
+            checksum = checksum * 31 + changes[i].record[j];
+        }
+    }
+    FREE(changes, "test_utxo_shards:changes");
+    return checksum;
+}
+
+void test_utxo_shards() {
+    params = &regtest;
+    init_archive_dir();
+    init_db();
+    // Outputs count as fresh only above the database's flush height
+    clear_utxo_cache();
+    reset_utxo_db();
+    uint32_t savedShards = config.utxoShards;
+    TxOut *output = CALLOC(1, sizeof(TxOut), "test_utxo_shards:output");
+    output->value = COIN(50);
+    output->public_key_script_length = 25;
+    memcpy(output->public_key_script, "\x76\xa9\x14", 3);
+    uint32_t count = 200000;
+    Outpoint *outpoints = CALLOC(count, sizeof(Outpoint), "test_utxo_shards:outpoints");
+    for (uint32_t i = 0; i < count; i++) {
+        random_bytes(SHA256_LENGTH, outpoints[i].txHash);
+        outpoints[i].index = i % 4;
+    }
+
+    uint32_t shardCounts[] = {1, 8};
+    uint64_t checksums[2] = {0};
+    for (uint32_t s = 0; s < 2; s++) {
+        config.utxoShards = shardCounts[s];
+        clear_utxo_cache();
+        set_utxo_cache_height(1);
+        uint32_t failed = 0;
+        double start = get_now();
+        checksums[s] = apply_test_changes(outpoints, count, output, &failed);
+        double elapsed = get_now() - start;
+        UtxoCacheStats stats;
+        get_utxo_cache_stats(&stats);
+        TxOut loaded;
+        printf(
+            "%u shards: %llu entries, %llu elided, %u failed, spent %i, kept %i (expecting %u, %u, 1, -1, 0) in %.1fms\n",
+            stats.shards, stats.entries, stats.elided, failed,
+            get_utxo(&outpoints[0], &loaded), get_utxo(&outpoints[1], &loaded),
+            count / 2, count / 2, elapsed
+        );
+    }
+    printf("same records from both %s (expecting OK)\n", checksums[0] == checksums[1] ? "OK" : "FAIL");
+
+    clear_utxo_cache();
+    config.utxoShards = savedShards;
+    FREE(outpoints, "test_utxo_shards:outpoints");
+    FREE(output, "test_utxo_shards:output");
+    params = &mainnet;
+}
+
+static bool is_tx_out_equal(TxOut *a, TxOut *b) {
+    return a->value == b->value
+        && a->public_key_script_length == b->public_key_script_length
+        && memcmp(a->public_key_script, b->public_key_script, a->public_key_script_length) == 0;
+}
+
+void test_utxo_filter() {
+    params = &regtest;
+    init_archive_dir();
+    init_db();
+    clear_utxo_cache();
+    set_utxo_cache_height(1);
+
+    UtxoFilterStats before;
+    get_utxo_filter_stats(&before);
+    uint32_t lookups = 10000;
+    uint32_t found = 0;
+    Outpoint outpoint;
+    outpoint.index = 0;
+    for (uint32_t i = 0; i < lookups; i++) {
+        random_bytes(SHA256_LENGTH, outpoint.txHash);
+        found += is_utxo_on_disk(&outpoint);
+    }
+    UtxoFilterStats after;
+    get_utxo_filter_stats(&after);
+    uint64_t skipped = after.skipped - before.skipped;
+    printf(
+        "absent outputs: %u found, %llu of %u skipped the database (expecting 0, over 98%%)\n",
+        found,
+        skipped,
+        lookups
+    );
+    printf("skip rate %s (expecting OK)\n", skipped > lookups * 0.98 ? "OK" : "FAIL");
+
+    TxOut *output = CALLOC(1, sizeof(TxOut), "test_utxo_filter:output");
+    output->value = COIN(1);
+    output->public_key_script_length = 1;
+    output->public_key_script[0] = 0x51;
+    Outpoint saved;
+    random_bytes(SHA256_LENGTH, saved.txHash);
+    saved.index = 3;
+    add_utxo(&saved, output);
+    flush_utxo_cache(false);
+    printf("flushed output on disk %i (expecting 1)\n", is_utxo_on_disk(&saved));
+
+    persist_utxo_filter();
+    release_utxo_filter();
+    open_utxo_filter();
+    printf("reopened from file: saved output on disk %i (expecting 1)\n", is_utxo_on_disk(&saved));
+
+    // A write after saving must keep the saved file from being used again
+    persist_utxo_filter();
+    Outpoint later;
+    random_bytes(SHA256_LENGTH, later.txHash);
+    later.index = 0;
+    set_utxo_cache_height(2);
+    add_utxo(&later, output);
+    flush_utxo_cache(false);
+    release_utxo_filter();
+    open_utxo_filter();
+    printf("reopened after a write: later output on disk %i (expecting 1)\n", is_utxo_on_disk(&later));
+    FREE(output, "test_utxo_filter:output");
+    params = &mainnet;
+}
+
+void test_utxo_compression() {
+    uint64_t amounts[] = {0, 1, 9, 10, 546, 1000, 12345678, COIN(50), COIN(21000000), 1999999999999999};
+    uint32_t amountFailures = 0;
+    for (uint32_t i = 0; i < sizeof(amounts) / sizeof(amounts[0]); i++) {
+        amountFailures += decompress_amount(compress_amount(amounts[i])) != amounts[i];
+    }
+    printf("%u amount round trips failed (expecting 0)\n", amountFailures);
+    printf("50 BTC compresses to %llu (expecting 50)\n", compress_amount(COIN(50)));
+
+    Byte varint[MAX_MSB_VARINT_WIDTH];
+    uint64_t parsed = 0;
+    uint8_t width = serialize_to_msb_varint(UINT64_MAX, varint);
+    uint8_t parsedWidth = parse_msb_varint(varint, width, &parsed);
+    printf("varint max %s, width %u (expecting OK, 10)\n", parsed == UINT64_MAX && parsedWidth == width ? "OK" : "FAIL", width);
+
+    Message genesis = get_empty_message();
+    load_block_message("genesis.dat", &genesis);
+    BlockPayload *ptrBlock = genesis.ptrPayload;
+    TxOut *original = &ptrBlock->txs[0].txOutputs[0];
+
+    TxOut *samples = CALLOC(5, sizeof(TxOut), "test_utxo_compression:samples");
+    memcpy(&samples[0], original, sizeof(TxOut)); // uncompressed P2PK
+    Byte p2pkh[] = {OP_DUP, OP_HASH160, 20, [23] = OP_EQUALVERIFY, [24] = OP_CHECKSIG};
+    Byte p2sh[] = {OP_HASH160, 20, [22] = OP_EQUAL};
+    Byte p2pk[] = {33, 0x03, [34] = OP_CHECKSIG};
+    Byte other[] = {OP_RETURN, 4, 't', 'i', 'n', 'y'};
+    Byte *scripts[] = {p2pkh, p2sh, p2pk, other};
+    uint64_t lengths[] = {sizeof(p2pkh), sizeof(p2sh), sizeof(p2pk), sizeof(other)};
+    for (uint32_t i = 0; i < 4; i++) {
+        samples[i + 1].value = 123456 * i;
+        samples[i + 1].public_key_script_length = lengths[i];
+        memcpy(samples[i + 1].public_key_script, scripts[i], lengths[i]);
+    }
+    memcpy(samples[3].public_key_script + 2, original->public_key_script + 2, 32); // x of a real key
+
+    TxOut *restored = CALLOC(1, sizeof(TxOut), "test_utxo_compression:restored");
+    Byte buffer[MAX_COMPRESSED_TX_OUT_WIDTH];
+    for (uint32_t i = 0; i < 5; i++) {
+        uint64_t compressedWidth = compress_tx_out(&samples[i], buffer);
+        memset(restored, 0, sizeof(*restored));
+        int8_t status = decompress_tx_out(buffer, compressedWidth, restored);
+        printf(
+            "sample %u: %llu -> %llu bytes, round trip %s (expecting OK)\n",
+            i,
+            sizeof(samples[i].value) + 1 + samples[i].public_key_script_length,
+            compressedWidth,
+            !status && is_tx_out_equal(&samples[i], restored) ? "OK" : "FAIL"
+        );
+    }
+    FREE(samples, "test_utxo_compression:samples");
+    FREE(restored, "test_utxo_compression:restored");
+    release_block(ptrBlock);
+}
+
+struct StorageScan {
+    uint64_t count;
+    bool ordered;
+    Byte lastKey[64];
+};
+
+static int8_t scan_storage_entry(Byte *key, size_t keyWidth, Byte *value, size_t valueWidth, void *context) {
+    struct StorageScan *scan = context;
+    if (scan->count > 0 && memcmp(scan->lastKey, key, keyWidth) >= 0) {
+        scan->ordered = false;
+    }
+    memcpy(scan->lastKey, key, keyWidth);
+    scan->count++;
+    return 0;
+}
+
+// Zero if the keys come out of order
+static uint64_t count_storage_entries(Storage *storage, void *snapshot) {
+    struct StorageScan scan = {
+        .count = 0,
+        .ordered = true,
+    };
+    iterate_storage(storage, snapshot, true, &scan_storage_entry, &scan);
+    return scan.ordered ? scan.count : 0;
+}
+
+// The same workload on each engine, from an empty database
+void test_storage_engines() {
+    params = &regtest;
+    init_archive_dir();
+    char *engineNames[] = {STORAGE_ENGINE_LEVELDB, STORAGE_ENGINE_MMAP};
+    uint32_t count = 100000;
+    uint32_t keyWidth = 36;
+    Byte *keys = CALLOC(count, keyWidth, "test_storage_engines:keys");
+    random_bytes(count * keyWidth, keys);
+    Byte value[300] = {0};
+    Byte loaded[300] = {0};
+    size_t width = 0;
+    StorageOptions options;
+    memset(&options, 0, sizeof(options));
+    options.cacheSize = 8 * 1024 * 1024;
+    options.bloomBitsPerKey = 10;
+    options.initialSlots = 1024; // grows a few times on the way
+    options.maxKeyWidth = keyWidth;
+    options.inlineValueWidth = 52;
+
+    for (uint32_t e = 0; e < sizeof(engineNames) / sizeof(engineNames[0]); e++) {
+        char path[256] = {0};
+        sprintf(path, "%s/storage_test_%s", params->archiveRoot, engineNames[e]);
+        destroy_storage(engineNames[e], path);
+        Storage *storage = open_storage(engineNames[e], path, &options);
+        printf("%s: opened %s (expecting OK)\n", engineNames[e], storage ? "OK" : "FAIL");
+        if (!storage) {
+            continue;
+        }
+
+        double start = get_now();
+        void *batch = create_storage_batch(storage);
+        for (uint32_t i = 0; i < count; i++) {
+            memcpy(value, &i, sizeof(i));
+            stage_storage_put(storage, batch, keys + i * keyWidth, keyWidth, value, 20);
+            if ((i + 1) % (1 << 14) == 0) {
+                commit_storage_batch(storage, batch, false);
+            }
+        }
+        commit_storage_batch(storage, batch, false);
+        double written = get_now();
+        uint32_t found = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (load_from_storage(storage, keys + i * keyWidth, keyWidth, loaded, sizeof(loaded), &width) || width != 20) {
+                continue;
+            }
+            uint32_t stored = 0;
+            memcpy(&stored, loaded, sizeof(stored));
+            found += stored == i;
+        }
+        double read = get_now();
+        printf(
+            "%s: %u of %u read back (expecting %u); write %.1fms, read %.1fms\n",
+            engineNames[e], found, count, count, written - start, read - written
+        );
+
+        memset(value, 0xAB, sizeof(value));
+        save_to_storage(storage, keys, keyWidth, value, sizeof(value), true);
+        int8_t status = load_from_storage(storage, keys, keyWidth, loaded, sizeof(loaded), &width);
+        bool matched = !status && width == sizeof(value) && memcmp(loaded, value, sizeof(value)) == 0;
+        printf(
+            "%s: long value %s, short buffer %i (expecting OK, -3)\n",
+            engineNames[e],
+            matched ? "OK" : "FAIL",
+            load_from_storage(storage, keys, keyWidth, loaded, 10, &width)
+        );
+
+        for (uint32_t i = 0; i < count; i += 2) {
+            stage_storage_removal(storage, batch, keys + i * keyWidth, keyWidth);
+        }
+        commit_storage_batch(storage, batch, false);
+        destroy_storage_batch(storage, batch);
+        printf(
+            "%s: after removals %i, %i (expecting -1, 0)\n",
+            engineNames[e],
+            load_from_storage(storage, keys, keyWidth, loaded, sizeof(loaded), &width),
+            load_from_storage(storage, keys + keyWidth, keyWidth, loaded, sizeof(loaded), &width)
+        );
+
+        start = get_now();
+        uint64_t ordered = count_storage_entries(storage, NULL);
+        double scanned = get_now();
+        void *snapshot = create_storage_snapshot(storage);
+        uint64_t snapshotted = count_storage_entries(storage, snapshot);
+        release_storage_snapshot(storage, snapshot);
+        printf(
+            "%s: %llu in order, %llu in snapshot (expecting %u, %u); scan %.1fms\n",
+            engineNames[e], ordered, snapshotted, count / 2, count / 2, scanned - start
+        );
+
+        close_storage(storage);
+        storage = open_storage(engineNames[e], path, &options);
+        uint32_t stored = 0;
+        status = load_from_storage(storage, keys + 3 * keyWidth, keyWidth, loaded, sizeof(loaded), &width);
+        memcpy(&stored, loaded, sizeof(stored));
+        printf(
+            "%s: reopened with %llu entries, %s (expecting %u, OK)\n",
+            engineNames[e], count_storage_entries(storage, NULL), !status && stored == 3 ? "OK" : "FAIL", count / 2
+        );
+        close_storage(storage);
+        destroy_storage(engineNames[e], path);
+    }
+    FREE(keys, "test_storage_engines:keys");
+    params = &mainnet;
+}
+
 void test_db() {
     Message genesis = get_empty_message();
     load_block_message("genesis.dat", &genesis);
@@ -448,6 +1865,51 @@ void test_hash() {
     printf("s=%s", s);
 }
 
+void test_sha256_engines() {
+    char *engineNames[] = {"shani", "avx2-8way", "sse2-4way", "openssl"};
+    uint64_t widths[] = {32, 64, 80, 100, 200};
+    uint64_t count = 19;
+    Byte data[19 * 200];
+    for (uint64_t i = 0; i < sizeof(data); i++) {
+        data[i] = (Byte)(i * 7 + 3);
+    }
+    for (uint32_t e = 0; e < sizeof(engineNames) / sizeof(engineNames[0]); e++) {
+        if (select_sha256_engine(engineNames[e])) {
+            continue;
+        }
+        uint32_t mismatches = 0;
+        for (uint32_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+            Byte results[19 * SHA256_LENGTH];
+            Byte doubleResults[19 * SHA256_LENGTH];
+            sha256_batch(data, widths[w], count, results);
+            dsha256_batch(data, widths[w], count, doubleResults);
+            for (uint64_t i = 0; i < count; i++) {
+                SHA256_HASH expected = {0};
+                SHA256(data + i * widths[w], widths[w], expected);
+                mismatches += memcmp(expected, results + i * SHA256_LENGTH, SHA256_LENGTH) != 0;
+                SHA256(expected, SHA256_LENGTH, expected);
+                mismatches += memcmp(expected, doubleResults + i * SHA256_LENGTH, SHA256_LENGTH) != 0;
+            }
+        }
+        // Streamed in uneven pieces, across block boundaries
+        Sha256Stream stream;
+        begin_sha256_stream(&stream);
+        uint64_t offset = 0;
+        for (uint64_t piece = 1; offset < sizeof(data); piece = piece * 3 + 1) {
+            uint64_t width = offset + piece < sizeof(data) ? piece : sizeof(data) - offset;
+            update_sha256_stream(&stream, data + offset, width);
+            offset += width;
+        }
+        SHA256_HASH streamed = {0};
+        SHA256_HASH expected = {0};
+        finish_sha256_stream(&stream, streamed);
+        SHA256(data, sizeof(data), expected);
+        mismatches += memcmp(expected, streamed, SHA256_LENGTH) != 0;
+        printf("%s: %u mismatches (expecting 0)\n", get_sha256_engine_name(), mismatches);
+    }
+    select_sha256_engine("auto");
+}
+
 void test_file() {
     init_archive_dir();
     printf("Loading genesis block...\n");
@@ -483,19 +1945,41 @@ void test() {
     // test_genesis();
     // test_block();
     // test_block_parsing_and_serialization();
+    // test_block_legality();
     // test_merkles();
+    // test_merkle_tree();
     // test_mine();
     // test_getheaders();
+    // test_message_encoding();
+    // test_message_registry();
+    // test_headers_bounds();
     // test_checksum();
     // test_hashmap();
     // test_difficulty();
     // test_blockchain_validation();
     // test_print_hash();
     // test_target_conversions();
+    // test_uint256();
+    // test_chaingen();
+    // test_utxo_cache();
+    // test_utxo_shards();
+    // test_utxo_filter();
+    // test_utxo_compression();
+    // test_reorg();
+    // test_utxo_stats();
+    // test_utxo_snapshot();
+    // test_utxo_prefetch();
+    // test_block_pipeline();
+    // test_assume_valid();
+    // test_script_verifier();
+    // test_signature_cache();
+    // test_prevout_resolution();
+    // test_storage_engines();
     // test_db();
     // test_ripe();
     // test_script();
     // test_hash();
+    // test_sha256_engines();
     // test_file();
     test_bignum();
 }
@@ -43,3 +43,9 @@ uint32_t min(uint32_t a, uint32_t b) {
     return b;
 }
 
+uint64_t min_uint64(uint64_t a, uint64_t b) {
+    if (a <= b) {
+        return a;
+    }
+    return b;
+}
@@ -5,3 +5,4 @@ uint16_t combine_uint16(const uint8_t *chars);
 uint32_t combine_uint32(const uint8_t *chars);
 uint64_t combine_uint64(const uint8_t *chars);
 uint32_t min(uint32_t a, uint32_t b);
+uint64_t min_uint64(uint64_t a, uint64_t b);
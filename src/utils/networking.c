@@ -90,10 +90,13 @@ int lookup_host(const char *host, IP ips[MAX_IP_PER_DNS]) {
 
 int dns_bootstrap() {
     puts("Bootstrapping peers via DNS");
-    const uint16_t seedCount = sizeof(mainnet.dnsSeeds) / sizeof(DomainName);
+    const uint16_t seedCount = sizeof(params->dnsSeeds) / sizeof(DomainName);
     for (int seedIndex = 0; seedIndex < seedCount; seedIndex++) {
         DomainName seed;
-        memcpy(seed, mainnet.dnsSeeds[seedIndex], sizeof(seed));
+        memcpy(seed, params->dnsSeeds[seedIndex], sizeof(seed));
+        if (!seed[0]) {
+            continue;
+        }
         IP ips[MAX_IP_PER_DNS] = {{0}};
         printf("Looking up %s\n", seed);
         lookup_host(seed, ips);
@@ -101,7 +104,7 @@ int dns_bootstrap() {
         for (int ipIndex = 0; ipIndex < MAX_IP_PER_DNS; ipIndex++) {
             if (!isIPEmpty(ips[ipIndex])) {
                 NetworkAddress addr = {
-                    .port = htons(mainnet.port),
+                    .port = htons(params->port),
                     .services = SERVICE_NODE_NETWORK,
                     // .ip = ips[ipIndex] <- via memcpy
                 };
@@ -117,14 +120,14 @@ int dns_bootstrap() {
 int32_t get_local_listen_address(struct sockaddr_in *addr) {
     struct addrinfo hints, *localAddress;
     int32_t addrInfoError;
-    char port[5] = {0};
+    char port[6] = {0};
 
     memset(&hints, 0, sizeof hints);
     hints.ai_family = AF_INET;
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags = AI_PASSIVE; // Use my IP
 
-    uint_to_str(mainnet.port, port);
+    uint_to_str(params->port, port);
 
     if ((addrInfoError = getaddrinfo(NULL, port, &hints, &localAddress)) != 0) {
         printf("getaddrinfo: %s\n", gai_strerror(addrInfoError));
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include "opt.h"
 #include "globalstate.h"
+#include "config.h"
 #include "utils/memory.h"
 #include "utils/data.h"
 
@@ -14,11 +15,16 @@ void handle_options(int32_t argc, char **argv) {
         {"revalidate", required_argument, 0, 'r'},
         {"reset-utxo", no_argument, 0, 'u'},
         {"test", no_argument, 0, 't'},
+        {"regtest", no_argument, 0, 'R'},
+        {"generate", required_argument, 0, 'g'},
+        {"dump-utxo", required_argument, 0, 'd'},
+        {"load-utxo", required_argument, 0, 'l'},
+        {"assume-valid", required_argument, 0, 'a'},
         {NULL, 0, NULL, 0}
     };
     int32_t optionChar;
     while (true) {
-        optionChar = getopt_long_only(argc, argv, "o:r:tu", options, &optionIndex);
+        optionChar = getopt_long_only(argc, argv, "o:r:tuRg:d:l:a:", options, &optionIndex);
         if (optionChar == -1) {
             break;
         }
@@ -46,6 +52,31 @@ void handle_options(int32_t argc, char **argv) {
                 global.mode = MODE_TEST;
                 break;
             }
+            case 'R': {
+                params = &regtest;
+                break;
+            }
+            case 'g': {
+                uint32_t *blockCount = CALLOC(1, sizeof(*blockCount), "handle_options:modeData");
+                *blockCount = (uint32_t)atoi(optarg);
+                global.mode = MODE_GENERATE;
+                global.modeData = blockCount;
+                break;
+            }
+            case 'd': {
+                global.mode = MODE_DUMP_UTXO;
+                global.modeData = optarg;
+                break;
+            }
+            case 'l': {
+                global.mode = MODE_LOAD_UTXO;
+                global.modeData = optarg;
+                break;
+            }
+            case 'a': {
+                config.assumeValidBlock = optarg;
+                break;
+            }
             default: {
             }
         }
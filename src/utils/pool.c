@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "utils/pool.h"
+#include "utils/memory.h"
+
+// Each pooled buffer is preceded by its own bookkeeping, so it can be released by pointer alone
+struct PooledBufferHeader {
+    uint64_t capacity;
+    uint64_t sizeClass;
+};
+
+typedef struct PooledBufferHeader PooledBufferHeader;
+
+static Byte *idleBuffers[POOL_CLASS_COUNT][POOL_MAX_IDLE_PER_CLASS];
+static uint32_t idleCounts[POOL_CLASS_COUNT];
+
+static uint32_t get_size_class(uint64_t size) {
+    uint32_t sizeClass = 0;
+    uint64_t classWidth = 1ULL << POOL_MIN_CLASS_WIDTH_BITS;
+    while (classWidth < size && sizeClass < POOL_CLASS_COUNT) {
+        classWidth <<= 1;
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+static PooledBufferHeader *get_pooled_header(Byte *buffer) {
+    return (PooledBufferHeader *)(buffer - sizeof(PooledBufferHeader));
+}
+
+Byte *acquire_buffer(uint64_t size) {
+    uint32_t sizeClass = get_size_class(size);
+    if (sizeClass < POOL_CLASS_COUNT && idleCounts[sizeClass] > 0) {
+        idleCounts[sizeClass] -= 1;
+        return idleBuffers[sizeClass][idleCounts[sizeClass]];
+    }
+    uint64_t capacity = sizeClass < POOL_CLASS_COUNT
+        ? (1ULL << (POOL_MIN_CLASS_WIDTH_BITS + sizeClass))
+        : size;
+    Byte *block = MALLOC(sizeof(PooledBufferHeader) + capacity, "acquire_buffer:block");
+    if (!block) {
+        return NULL;
+    }
+    PooledBufferHeader *ptrHeader = (PooledBufferHeader *)block;
+    ptrHeader->capacity = capacity;
+    ptrHeader->sizeClass = sizeClass;
+    return block + sizeof(PooledBufferHeader);
+}
+
+void release_buffer(Byte *buffer) {
+    if (!buffer) {
+        return;
+    }
+    PooledBufferHeader *ptrHeader = get_pooled_header(buffer);
+    uint64_t sizeClass = ptrHeader->sizeClass;
+    if (sizeClass < POOL_CLASS_COUNT && idleCounts[sizeClass] < POOL_MAX_IDLE_PER_CLASS) {
+        idleBuffers[sizeClass][idleCounts[sizeClass]] = buffer;
+        idleCounts[sizeClass] += 1;
+        return;
+    }
+    FREE(ptrHeader, "acquire_buffer:block");
+}
+
+uint64_t get_buffer_capacity(Byte *buffer) {
+    return get_pooled_header(buffer)->capacity;
+}
+
+void drain_buffer_pool() {
+    for (uint32_t sizeClass = 0; sizeClass < POOL_CLASS_COUNT; sizeClass++) {
+        for (uint32_t i = 0; i < idleCounts[sizeClass]; i++) {
+            FREE(get_pooled_header(idleBuffers[sizeClass][i]), "acquire_buffer:block");
+        }
+        idleCounts[sizeClass] = 0;
+    }
+}
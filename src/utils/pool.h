@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+#include "datatypes.h"
+
+// Power-of-two size classes from 256 B up to 32 MB; larger requests bypass the pool
+#define POOL_MIN_CLASS_WIDTH_BITS 8
+#define POOL_CLASS_COUNT 18
+#define POOL_MAX_IDLE_PER_CLASS 32
+
+// Buffers are only handed out and returned on the main event loop thread
+
+Byte *acquire_buffer(uint64_t size);
+void release_buffer(Byte *buffer);
+uint64_t get_buffer_capacity(Byte *buffer);
+void drain_buffer_pool(void);
@@ -0,0 +1,211 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "utils/uint256.h"
+
+void uint256_set_word(Uint256 *ptrValue, uint64_t word) {
+    memset(ptrValue, 0, sizeof(*ptrValue));
+    ptrValue->words[0] = (uint32_t)word;
+    ptrValue->words[1] = (uint32_t)(word >> 32);
+}
+
+void uint256_from_bytes(const Byte *bytes, Uint256 *ptrValue) {
+    for (uint32_t i = 0; i < UINT256_WORD_COUNT; i++) {
+        const Byte *p = bytes + i * 4;
+        ptrValue->words[i] = (uint32_t)p[0]
+            | ((uint32_t)p[1] << 8)
+            | ((uint32_t)p[2] << 16)
+            | ((uint32_t)p[3] << 24);
+    }
+}
+
+void uint256_to_bytes(const Uint256 *ptrValue, Byte *bytes) {
+    for (uint32_t i = 0; i < UINT256_WORD_COUNT; i++) {
+        uint32_t word = ptrValue->words[i];
+        bytes[i * 4] = (Byte)word;
+        bytes[i * 4 + 1] = (Byte)(word >> 8);
+        bytes[i * 4 + 2] = (Byte)(word >> 16);
+        bytes[i * 4 + 3] = (Byte)(word >> 24);
+    }
+}
+
+bool uint256_is_zero(const Uint256 *ptrValue) {
+    for (uint32_t i = 0; i < UINT256_WORD_COUNT; i++) {
+        if (ptrValue->words[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int8_t uint256_compare(const Uint256 *ptrA, const Uint256 *ptrB) {
+    for (uint32_t i = UINT256_WORD_COUNT; i > 0; i--) {
+        if (ptrA->words[i - 1] < ptrB->words[i - 1]) {
+            return -1;
+        }
+        if (ptrA->words[i - 1] > ptrB->words[i - 1]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Position of the highest set bit plus one; 0 for zero
+uint32_t uint256_bits(const Uint256 *ptrValue) {
+    for (uint32_t i = UINT256_WORD_COUNT; i > 0; i--) {
+        uint32_t word = ptrValue->words[i - 1];
+        if (word) {
+            return (i - 1) * 32 + (32 - (uint32_t)__builtin_clz(word));
+        }
+    }
+    return 0;
+}
+
+// Wraps around on overflow, as fixed-width unsigned arithmetic does
+void uint256_add(const Uint256 *ptrA, const Uint256 *ptrB, Uint256 *ptrResult) {
+    uint64_t carry = 0;
+    for (uint32_t i = 0; i < UINT256_WORD_COUNT; i++) {
+        uint64_t sum = (uint64_t)ptrA->words[i] + ptrB->words[i] + carry;
+        ptrResult->words[i] = (uint32_t)sum;
+        carry = sum >> 32;
+    }
+}
+
+void uint256_subtract(const Uint256 *ptrA, const Uint256 *ptrB, Uint256 *ptrResult) {
+    uint64_t borrow = 0;
+    for (uint32_t i = 0; i < UINT256_WORD_COUNT; i++) {
+        uint64_t difference = (uint64_t)ptrA->words[i] - ptrB->words[i] - borrow;
+        ptrResult->words[i] = (uint32_t)difference;
+        borrow = (difference >> 32) & 1;
+    }
+}
+
+void uint256_shift_left(Uint256 *ptrValue, uint32_t bits) {
+    Uint256 source = *ptrValue;
+    memset(ptrValue, 0, sizeof(*ptrValue));
+    uint32_t wordShift = bits / 32;
+    uint32_t bitShift = bits % 32;
+    for (uint32_t i = 0; i + wordShift < UINT256_WORD_COUNT; i++) {
+        ptrValue->words[i + wordShift] |= source.words[i] << bitShift;
+        if (bitShift && i + wordShift + 1 < UINT256_WORD_COUNT) {
+            ptrValue->words[i + wordShift + 1] |= source.words[i] >> (32 - bitShift);
+        }
+    }
+}
+
+void uint256_shift_right(Uint256 *ptrValue, uint32_t bits) {
+    Uint256 source = *ptrValue;
+    memset(ptrValue, 0, sizeof(*ptrValue));
+    uint32_t wordShift = bits / 32;
+    uint32_t bitShift = bits % 32;
+    for (uint32_t i = wordShift; i < UINT256_WORD_COUNT; i++) {
+        ptrValue->words[i - wordShift] |= source.words[i] >> bitShift;
+        if (bitShift && i - wordShift >= 1) {
+            ptrValue->words[i - wordShift - 1] |= source.words[i] << (32 - bitShift);
+        }
+    }
+}
+
+// Returns the word carried out of the top
+uint32_t uint256_multiply_word(Uint256 *ptrValue, uint32_t word) {
+    uint64_t carry = 0;
+    for (uint32_t i = 0; i < UINT256_WORD_COUNT; i++) {
+        uint64_t product = (uint64_t)ptrValue->words[i] * word + carry;
+        ptrValue->words[i] = (uint32_t)product;
+        carry = product >> 32;
+    }
+    return (uint32_t)carry;
+}
+
+// Returns the remainder; the divisor must not be zero
+uint32_t uint256_divide_word(Uint256 *ptrValue, uint32_t word) {
+    uint64_t remainder = 0;
+    for (uint32_t i = UINT256_WORD_COUNT; i > 0; i--) {
+        uint64_t dividend = (remainder << 32) | ptrValue->words[i - 1];
+        ptrValue->words[i - 1] = (uint32_t)(dividend / word);
+        remainder = dividend % word;
+    }
+    return (uint32_t)remainder;
+}
+
+// Shift-and-subtract long division
+int8_t uint256_divide(const Uint256 *ptrA, const Uint256 *ptrB, Uint256 *ptrQuotient) {
+    uint32_t divisorBits = uint256_bits(ptrB);
+    uint32_t dividendBits = uint256_bits(ptrA);
+    memset(ptrQuotient, 0, sizeof(*ptrQuotient));
+    if (divisorBits == 0) {
+        fprintf(stderr, "uint256_divide: division by zero\n");
+        return -1;
+    }
+    if (divisorBits > dividendBits) {
+        return 0;
+    }
+    Uint256 remainder = *ptrA;
+    Uint256 divisor = *ptrB;
+    uint32_t shift = dividendBits - divisorBits;
+    uint256_shift_left(&divisor, shift);
+    while (true) {
+        if (uint256_compare(&remainder, &divisor) >= 0) {
+            uint256_subtract(&remainder, &divisor, &remainder);
+            ptrQuotient->words[shift / 32] |= 1u << (shift % 32);
+        }
+        if (shift == 0) {
+            break;
+        }
+        uint256_shift_right(&divisor, 1);
+        shift--;
+    }
+    return 0;
+}
+
+// Approximate, for display
+double uint256_to_double(const Uint256 *ptrValue) {
+    double result = 0;
+    for (uint32_t i = UINT256_WORD_COUNT; i > 0; i--) {
+        result = result * 4294967296.0 + ptrValue->words[i - 1];
+    }
+    return result;
+}
+
+// @see arith_uint256::SetCompact() in Bitcoin Core's 'arith_uint256.cpp'
+// The top byte is the width in bytes, the lower three the most significant bytes;
+// 0x00800000 is a sign bit, which no valid target sets.
+int8_t uint256_from_compact(uint32_t compact, Uint256 *ptrValue) {
+    uint32_t size = compact >> 24;
+    uint32_t word = compact & 0x007fffff;
+    if (size <= 3) {
+        uint256_set_word(ptrValue, word >> (8 * (3 - size)));
+    }
+    else {
+        uint256_set_word(ptrValue, word);
+        uint256_shift_left(ptrValue, 8 * (size - 3));
+    }
+    if (word != 0 && (compact & 0x00800000)) {
+        return COMPACT_ERROR_NEGATIVE;
+    }
+    if (word != 0 && (size > 34 || (word > 0xff && size > 33) || (word > 0xffff && size > 32))) {
+        return COMPACT_ERROR_OVERFLOW;
+    }
+    return 0;
+}
+
+// @see arith_uint256::GetCompact()
+uint32_t uint256_to_compact(const Uint256 *ptrValue) {
+    uint32_t size = (uint256_bits(ptrValue) + 7) / 8;
+    uint32_t compact = 0;
+    if (size <= 3) {
+        compact = ptrValue->words[0] << (8 * (3 - size));
+    }
+    else {
+        Uint256 shifted = *ptrValue;
+        uint256_shift_right(&shifted, 8 * (size - 3));
+        compact = shifted.words[0];
+    }
+    // Keep the mantissa clear of the sign bit
+    if (compact & 0x00800000) {
+        compact >>= 8;
+        size++;
+    }
+    return compact | (size << 24);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "datatypes.h"
+
+// Unsigned 256-bit integers for targets and chain work, stored as 32-bit words,
+// least significant first: the same order as the bytes of a hash read as a number.
+
+#define UINT256_WORD_COUNT 8
+#define UINT256_BITS 256
+
+#define COMPACT_ERROR_NEGATIVE -1
+#define COMPACT_ERROR_OVERFLOW -2
+
+struct Uint256 {
+    uint32_t words[UINT256_WORD_COUNT];
+};
+
+typedef struct Uint256 Uint256;
+
+void uint256_set_word(Uint256 *ptrValue, uint64_t word);
+void uint256_from_bytes(const Byte *bytes, Uint256 *ptrValue);
+void uint256_to_bytes(const Uint256 *ptrValue, Byte *bytes);
+bool uint256_is_zero(const Uint256 *ptrValue);
+int8_t uint256_compare(const Uint256 *ptrA, const Uint256 *ptrB);
+uint32_t uint256_bits(const Uint256 *ptrValue);
+void uint256_add(const Uint256 *ptrA, const Uint256 *ptrB, Uint256 *ptrResult);
+void uint256_subtract(const Uint256 *ptrA, const Uint256 *ptrB, Uint256 *ptrResult);
+void uint256_shift_left(Uint256 *ptrValue, uint32_t bits);
+void uint256_shift_right(Uint256 *ptrValue, uint32_t bits);
+uint32_t uint256_multiply_word(Uint256 *ptrValue, uint32_t word);
+uint32_t uint256_divide_word(Uint256 *ptrValue, uint32_t word);
+int8_t uint256_divide(const Uint256 *ptrA, const Uint256 *ptrB, Uint256 *ptrQuotient);
+double uint256_to_double(const Uint256 *ptrValue);
+int8_t uint256_from_compact(uint32_t compact, Uint256 *ptrValue);
+uint32_t uint256_to_compact(const Uint256 *ptrValue);
@@ -0,0 +1,676 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "utxo.h"
+#include "compressor.h"
+#include "config.h"
+#include "hash.h"
+#include "persistent.h"
+#include "utxostats.h"
+#include "utils/datetime.h"
+#include "utils/memory.h"
+#include "utils/random.h"
+
+#define UTXO_ENTRY_OCCUPIED (1 << 0)
+#define UTXO_ENTRY_DIRTY    (1 << 1) // differs from the database
+#define UTXO_ENTRY_FRESH    (1 << 2) // absent from the database, so spending it needs no delete
+
+// A spent entry that the database may still hold keeps its slot, without data, until flushed
+struct UtxoEntry {
+    Outpoint outpoint;
+    uint8_t flags;
+    uint32_t width;
+    Byte *data; // compressed TxOut; NULL once spent
+};
+
+typedef struct UtxoEntry UtxoEntry;
+
+// Open addressing with linear probing; removals shift followers back instead of leaving tombstones.
+// Only its writer thread touches a shard while apply_utxo_changes runs, and only the main
+// thread otherwise
+struct UtxoShard {
+    UtxoEntry *entries;
+    uint64_t capacity;
+    uint64_t count;
+    uint64_t dirtyCount;
+    uint64_t dataBytes;
+    UtxoCacheStats stats;
+    // Records of the changes applied last, in change order; see apply_utxo_changes
+    Byte *records;
+    uint64_t recordsWidth;
+    uint64_t recordsCapacity;
+    uv_thread_t thread;
+};
+
+typedef struct UtxoShard UtxoShard;
+
+// The writers wait for a new round and report back through pending
+struct UtxoWriters {
+    bool running;
+    bool stopping;
+    uint32_t threadCount;
+    uv_mutex_t lock;
+    uv_cond_t roundReady;
+    uv_cond_t roundDone;
+    uint64_t round;
+    uint32_t pending;
+    UtxoChange *changes;
+    uint64_t changeCount;
+};
+
+struct UtxoCache {
+    bool ready;
+    UtxoShard shards[MAX_UTXO_SHARDS];
+    uint32_t shardCount;
+    uint64_t salt;
+    uint32_t height; // of the block being registered
+    uint32_t maxHeight;
+    // Blocks up to this height may have reached the database before the last shutdown, so
+    // their outputs are not fresh when registered again after a crash
+    uint32_t diskHeight;
+    double lastFlush;
+    uint64_t flushes;
+    uint64_t writes;
+    struct UtxoWriters writers;
+};
+
+static struct UtxoCache cache;
+
+// Bumped whenever the database contents change under the cache; see prime_utxo
+static atomic_uint_fast64_t flushGeneration;
+
+static uint64_t hash_outpoint(Outpoint *outpoint) {
+    uint64_t h = 0;
+    memcpy(&h, outpoint->txHash, sizeof(h));
+    h ^= cache.salt;
+    h ^= (uint64_t)outpoint->index * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 29;
+    return h;
+}
+
+static bool is_same_outpoint(Outpoint *a, Outpoint *b) {
+    return a->index == b->index && memcmp(a->txHash, b->txHash, SHA256_LENGTH) == 0;
+}
+
+// By txid prefix, so all outputs of a transaction share a shard
+static uint32_t get_shard_index(Outpoint *outpoint) {
+    uint32_t prefix = ((uint32_t)outpoint->txHash[0] << 8) | outpoint->txHash[1];
+    return prefix % cache.shardCount;
+}
+
+static UtxoShard *get_shard(Outpoint *outpoint) {
+    return &cache.shards[get_shard_index(outpoint)];
+}
+
+static uint64_t get_initial_shard_capacity() {
+    uint64_t capacity = UTXO_CACHE_MIN_SHARD_CAPACITY;
+    while (capacity * cache.shardCount < UTXO_CACHE_INITIAL_CAPACITY) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+static void init_utxo_cache() {
+    cache.shardCount = config.utxoShards;
+    if (cache.shardCount == 0) {
+        cache.shardCount = 1;
+    }
+    if (cache.shardCount > MAX_UTXO_SHARDS) {
+        cache.shardCount = MAX_UTXO_SHARDS;
+    }
+    for (uint32_t i = 0; i < cache.shardCount; i++) {
+        UtxoShard *shard = &cache.shards[i];
+        shard->capacity = get_initial_shard_capacity();
+        shard->entries = CALLOC(shard->capacity, sizeof(UtxoEntry), "utxo_cache:entries");
+        shard->recordsCapacity = UTXO_SHARD_RECORDS_INITIAL_CAPACITY;
+        shard->records = MALLOC(shard->recordsCapacity, "utxo_cache:records");
+    }
+    cache.salt = random_uint64();
+    uint32_t diskHeight = 0;
+    if (load_utxo_flush_height(&diskHeight) == 0) {
+        cache.diskHeight = diskHeight;
+    }
+    cache.lastFlush = get_now();
+    cache.ready = true;
+}
+
+static void ensure_utxo_cache() {
+    if (!cache.ready) {
+        init_utxo_cache();
+    }
+}
+
+// Slot holding the outpoint, or the empty slot where it would go
+static uint64_t find_slot(UtxoShard *shard, Outpoint *outpoint) {
+    uint64_t mask = shard->capacity - 1;
+    uint64_t slot = hash_outpoint(outpoint) & mask;
+    while (shard->entries[slot].flags & UTXO_ENTRY_OCCUPIED) {
+        if (is_same_outpoint(&shard->entries[slot].outpoint, outpoint)) {
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static void resize_table(UtxoShard *shard, uint64_t capacity) {
+    UtxoEntry *oldEntries = shard->entries;
+    uint64_t oldCapacity = shard->capacity;
+    shard->entries = CALLOC(capacity, sizeof(UtxoEntry), "utxo_cache:entries");
+    shard->capacity = capacity;
+    for (uint64_t i = 0; i < oldCapacity; i++) {
+        if (oldEntries[i].flags & UTXO_ENTRY_OCCUPIED) {
+            shard->entries[find_slot(shard, &oldEntries[i].outpoint)] = oldEntries[i];
+        }
+    }
+    FREE(oldEntries, "utxo_cache:entries");
+}
+
+// Existing entry for the outpoint, or a new empty one
+static UtxoEntry *insert_entry(UtxoShard *shard, Outpoint *outpoint, bool *created) {
+    if (shard->count + 1 > shard->capacity * UTXO_CACHE_MAX_LOAD) {
+        resize_table(shard, shard->capacity * 2);
+    }
+    UtxoEntry *entry = &shard->entries[find_slot(shard, outpoint)];
+    *created = !(entry->flags & UTXO_ENTRY_OCCUPIED);
+    if (*created) {
+        memset(entry, 0, sizeof(*entry));
+        entry->outpoint = *outpoint;
+        entry->flags = UTXO_ENTRY_OCCUPIED;
+        shard->count++;
+    }
+    return entry;
+}
+
+static void mark_dirty(UtxoShard *shard, UtxoEntry *entry) {
+    if (!(entry->flags & UTXO_ENTRY_DIRTY)) {
+        entry->flags |= UTXO_ENTRY_DIRTY;
+        shard->dirtyCount++;
+    }
+}
+
+static void replace_entry_data(UtxoShard *shard, UtxoEntry *entry, Byte *data, uint32_t width) {
+    if (entry->data) {
+        shard->dataBytes -= entry->width;
+        FREE(entry->data, "utxo_cache:data");
+    }
+    entry->data = data;
+    entry->width = width;
+    shard->dataBytes += width;
+}
+
+static void remove_slot(UtxoShard *shard, uint64_t slot) {
+    UtxoEntry *entry = &shard->entries[slot];
+    if (entry->flags & UTXO_ENTRY_DIRTY) {
+        shard->dirtyCount--;
+    }
+    replace_entry_data(shard, entry, NULL, 0);
+    shard->count--;
+
+    uint64_t mask = shard->capacity - 1;
+    uint64_t hole = slot;
+    for (uint64_t next = (slot + 1) & mask; shard->entries[next].flags & UTXO_ENTRY_OCCUPIED; next = (next + 1) & mask) {
+        uint64_t home = hash_outpoint(&shard->entries[next].outpoint) & mask;
+        // Movable unless its home lies between the hole and itself
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            shard->entries[hole] = shard->entries[next];
+            hole = next;
+        }
+    }
+    memset(&shard->entries[hole], 0, sizeof(UtxoEntry));
+}
+
+static uint64_t get_cache_memory() {
+    uint64_t memory = 0;
+    for (uint32_t i = 0; i < cache.shardCount; i++) {
+        memory += cache.shards[i].capacity * sizeof(UtxoEntry) + cache.shards[i].dataBytes;
+    }
+    return memory;
+}
+
+int8_t get_utxo(Outpoint *outpoint, TxOut *output) {
+    ensure_utxo_cache();
+    UtxoShard *shard = get_shard(outpoint);
+    UtxoEntry *entry = &shard->entries[find_slot(shard, outpoint)];
+    if (entry->flags & UTXO_ENTRY_OCCUPIED) {
+        shard->stats.hits++;
+        if (!entry->data) {
+            return -1;
+        }
+        return decompress_tx_out(entry->data, entry->width, output);
+    }
+
+    shard->stats.misses++;
+    Byte buffer[MAX_COMPRESSED_TX_OUT_WIDTH];
+    size_t width = 0;
+    int8_t status = load_utxo_data(outpoint, buffer, &width);
+    if (status) {
+        return status;
+    }
+    if (decompress_tx_out(buffer, width, output)) {
+        fprintf(stderr, "Corrupted UTXO record for %s #%u\n", binary_to_hexstr(outpoint->txHash, SHA256_LENGTH), outpoint->index);
+        return -3;
+    }
+    bool created = false;
+    entry = insert_entry(shard, outpoint, &created);
+    Byte *data = MALLOC(width, "utxo_cache:data");
+    memcpy(data, buffer, width);
+    replace_entry_data(shard, entry, data, (uint32_t)width);
+    return 0;
+}
+
+// Takes ownership of data
+static void store_utxo_data(UtxoShard *shard, Outpoint *outpoint, Byte *data, uint32_t width) {
+    bool created = false;
+    UtxoEntry *entry = insert_entry(shard, outpoint, &created);
+    // An entry already here is either fresh itself or known to the database
+    if (created && cache.height > cache.diskHeight) {
+        entry->flags |= UTXO_ENTRY_FRESH;
+    }
+    mark_dirty(shard, entry);
+    replace_entry_data(shard, entry, data, width);
+}
+
+static uint32_t add_to_shard(UtxoShard *shard, Outpoint *outpoint, TxOut *output, Byte *record) {
+    uint32_t width = (uint32_t)compress_tx_out(output, record);
+    Byte *data = MALLOC(width, "utxo_cache:data");
+    memcpy(data, record, width);
+    store_utxo_data(shard, outpoint, data, width);
+    return width;
+}
+
+int8_t add_utxo(Outpoint *outpoint, TxOut *output) {
+    ensure_utxo_cache();
+    Byte buffer[MAX_COMPRESSED_TX_OUT_WIDTH];
+    add_to_shard(get_shard(outpoint), outpoint, output, buffer);
+    return 0;
+}
+
+// Puts back an output from its compressed record, as kept in undo data
+int8_t restore_utxo(Outpoint *outpoint, Byte *record, uint32_t width) {
+    ensure_utxo_cache();
+    Byte *data = MALLOC(width, "utxo_cache:data");
+    memcpy(data, record, width);
+    store_utxo_data(get_shard(outpoint), outpoint, data, width);
+    return 0;
+}
+
+static int8_t spend_from_shard(UtxoShard *shard, Outpoint *outpoint, Byte *spentRecord, uint32_t *spentWidth) {
+    uint64_t slot = find_slot(shard, outpoint);
+    UtxoEntry *entry = &shard->entries[slot];
+    if (entry->flags & UTXO_ENTRY_OCCUPIED) {
+        shard->stats.hits++;
+        if (!entry->data) {
+            return -1;
+        }
+        if (spentRecord) {
+            memcpy(spentRecord, entry->data, entry->width);
+            *spentWidth = entry->width;
+        }
+        if (entry->flags & UTXO_ENTRY_FRESH) {
+            remove_slot(shard, slot);
+            shard->stats.elided++;
+            return 0;
+        }
+        replace_entry_data(shard, entry, NULL, 0);
+        mark_dirty(shard, entry);
+        return 0;
+    }
+    if (spentRecord) {
+        shard->stats.misses++;
+        size_t width = 0;
+        int8_t status = load_utxo_data(outpoint, spentRecord, &width);
+        if (status) {
+            return status;
+        }
+        *spentWidth = (uint32_t)width;
+    }
+    bool created = false;
+    entry = insert_entry(shard, outpoint, &created);
+    mark_dirty(shard, entry);
+    return 0;
+}
+
+// The spent output's compressed record is copied to spentRecord unless it is NULL; the
+// database is only read when the caller asks for the record
+int8_t spend_utxo(Outpoint *outpoint, Byte *spentRecord, uint32_t *spentWidth) {
+    ensure_utxo_cache();
+    return spend_from_shard(get_shard(outpoint), outpoint, spentRecord, spentWidth);
+}
+
+static void append_shard_record(UtxoShard *shard, Byte *record, uint32_t width) {
+    uint64_t needed = shard->recordsWidth + width;
+    if (needed > shard->recordsCapacity) {
+        uint64_t capacity = shard->recordsCapacity * 2 > needed ? shard->recordsCapacity * 2 : needed;
+        Byte *grown = MALLOC(capacity, "utxo_cache:records");
+        memcpy(grown, shard->records, shard->recordsWidth);
+        FREE(shard->records, "utxo_cache:records");
+        shard->records = grown;
+        shard->recordsCapacity = capacity;
+    }
+    memcpy(shard->records + shard->recordsWidth, record, width);
+    shard->recordsWidth += width;
+}
+
+// Applies the changes that fall in the shard, in their order
+static void apply_shard_changes(UtxoShard *shard, UtxoChange *changes, uint64_t count) {
+    uint32_t shardIndex = (uint32_t)(shard - cache.shards);
+    Byte record[MAX_COMPRESSED_TX_OUT_WIDTH];
+    shard->recordsWidth = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        UtxoChange *change = &changes[i];
+        if (get_shard_index(&change->outpoint) != shardIndex) {
+            continue;
+        }
+        change->width = 0;
+        if (change->output) {
+            change->width = add_to_shard(shard, &change->outpoint, change->output, record);
+            change->status = 0;
+        }
+        else {
+            change->status = spend_from_shard(shard, &change->outpoint, record, &change->width);
+            if (change->status) {
+                change->width = 0;
+            }
+        }
+        append_shard_record(shard, record, change->width);
+    }
+}
+
+static void run_utxo_writer(void *arg) {
+    UtxoShard *shard = arg;
+    uint64_t round = 0;
+    uv_mutex_lock(&cache.writers.lock);
+    while (true) {
+        while (!cache.writers.stopping && cache.writers.round == round) {
+            uv_cond_wait(&cache.writers.roundReady, &cache.writers.lock);
+        }
+        if (cache.writers.stopping) {
+            break;
+        }
+        round = cache.writers.round;
+        UtxoChange *changes = cache.writers.changes;
+        uint64_t count = cache.writers.changeCount;
+        uv_mutex_unlock(&cache.writers.lock);
+
+        apply_shard_changes(shard, changes, count);
+
+        uv_mutex_lock(&cache.writers.lock);
+        cache.writers.pending--;
+        if (cache.writers.pending == 0) {
+            uv_cond_signal(&cache.writers.roundDone);
+        }
+    }
+    uv_mutex_unlock(&cache.writers.lock);
+}
+
+// Joins the shard writers; the next apply_utxo_changes starts them again
+void stop_utxo_writers() {
+    if (!cache.writers.running) {
+        return;
+    }
+    uv_mutex_lock(&cache.writers.lock);
+    cache.writers.stopping = true;
+    uv_cond_broadcast(&cache.writers.roundReady);
+    uv_mutex_unlock(&cache.writers.lock);
+    for (uint32_t i = 0; i < cache.writers.threadCount; i++) {
+        uv_thread_join(&cache.shards[i].thread);
+    }
+    uv_cond_destroy(&cache.writers.roundReady);
+    uv_cond_destroy(&cache.writers.roundDone);
+    uv_mutex_destroy(&cache.writers.lock);
+    memset(&cache.writers, 0, sizeof(cache.writers));
+}
+
+static int8_t start_utxo_writers() {
+    memset(&cache.writers, 0, sizeof(cache.writers));
+    uv_mutex_init(&cache.writers.lock);
+    uv_cond_init(&cache.writers.roundReady);
+    uv_cond_init(&cache.writers.roundDone);
+    cache.writers.running = true;
+    for (uint32_t i = 0; i < cache.shardCount; i++) {
+        if (uv_thread_create(&cache.shards[i].thread, &run_utxo_writer, &cache.shards[i])) {
+            fprintf(stderr, "start_utxo_writers: cannot start writer %u\n", i);
+            stop_utxo_writers();
+            return -1;
+        }
+        cache.writers.threadCount++;
+    }
+    return 0;
+}
+
+// Applies a block's worth of additions and spends, each shard on its own writer thread; the
+// changes touching one outpoint are applied in the order given. Returns once every shard is
+// done. Each change gets its status and the compressed record added or spent, which stays
+// valid until the next call
+void apply_utxo_changes(UtxoChange *changes, uint64_t count) {
+    ensure_utxo_cache();
+    if (cache.shardCount > 1 && !cache.writers.running) {
+        start_utxo_writers();
+    }
+    if (cache.writers.running) {
+        uv_mutex_lock(&cache.writers.lock);
+        cache.writers.changes = changes;
+        cache.writers.changeCount = count;
+        cache.writers.pending = cache.shardCount;
+        cache.writers.round++;
+        uv_cond_broadcast(&cache.writers.roundReady);
+        while (cache.writers.pending > 0) {
+            uv_cond_wait(&cache.writers.roundDone, &cache.writers.lock);
+        }
+        uv_mutex_unlock(&cache.writers.lock);
+    }
+    else {
+        // A single shard, or no writers to be had
+        for (uint32_t i = 0; i < cache.shardCount; i++) {
+            apply_shard_changes(&cache.shards[i], changes, count);
+        }
+    }
+    // Each shard kept its records in change order
+    uint64_t offsets[MAX_UTXO_SHARDS] = {0};
+    for (uint64_t i = 0; i < count; i++) {
+        uint32_t shardIndex = get_shard_index(&changes[i].outpoint);
+        changes[i].record = cache.shards[shardIndex].records + offsets[shardIndex];
+        offsets[shardIndex] += changes[i].width;
+    }
+}
+
+uint64_t get_utxo_flush_generation() {
+    return atomic_load(&flushGeneration);
+}
+
+// Caches a record read from the database by another thread. It is dropped if the entry is
+// already here or a flush has happened since the read, as the record may be stale by then
+int8_t prime_utxo(Outpoint *outpoint, Byte *record, uint32_t width, uint64_t generation) {
+    ensure_utxo_cache();
+    if (generation != atomic_load(&flushGeneration)) {
+        return -1;
+    }
+    UtxoShard *shard = get_shard(outpoint);
+    bool created = false;
+    UtxoEntry *entry = insert_entry(shard, outpoint, &created);
+    if (!created) {
+        return -2;
+    }
+    Byte *data = MALLOC(width, "utxo_cache:data");
+    memcpy(data, record, width);
+    replace_entry_data(shard, entry, data, width);
+    shard->stats.primed++;
+    return 0;
+}
+
+void set_utxo_cache_height(uint32_t height) {
+    cache.height = height;
+    if (height > cache.maxHeight) {
+        cache.maxHeight = height;
+    }
+}
+
+static void release_entries(UtxoShard *shard) {
+    for (uint64_t i = 0; i < shard->capacity; i++) {
+        if (shard->entries[i].data) {
+            FREE(shard->entries[i].data, "utxo_cache:data");
+        }
+    }
+    FREE(shard->entries, "utxo_cache:entries");
+}
+
+static void discard_entries(UtxoShard *shard) {
+    release_entries(shard);
+    shard->capacity = get_initial_shard_capacity();
+    shard->entries = CALLOC(shard->capacity, sizeof(UtxoEntry), "utxo_cache:entries");
+    shard->count = 0;
+    shard->dirtyCount = 0;
+    shard->dataBytes = 0;
+}
+
+// After a flush: unspent entries stay as clean copies of the database, spent ones go
+static void keep_clean_entries(UtxoShard *shard) {
+    UtxoEntry *oldEntries = shard->entries;
+    shard->entries = CALLOC(shard->capacity, sizeof(UtxoEntry), "utxo_cache:entries");
+    shard->count = 0;
+    shard->dirtyCount = 0;
+    for (uint64_t i = 0; i < shard->capacity; i++) {
+        UtxoEntry *entry = &oldEntries[i];
+        if (entry->data) {
+            UtxoEntry *slot = &shard->entries[find_slot(shard, &entry->outpoint)];
+            *slot = *entry;
+            slot->flags = UTXO_ENTRY_OCCUPIED;
+            shard->count++;
+        }
+    }
+    FREE(oldEntries, "utxo_cache:entries");
+}
+
+static uint64_t get_dirty_count() {
+    uint64_t dirtyCount = 0;
+    for (uint32_t i = 0; i < cache.shardCount; i++) {
+        dirtyCount += cache.shards[i].dirtyCount;
+    }
+    return dirtyCount;
+}
+
+static int8_t stage_shard_changes(UtxoShard *shard, void *batch, uint32_t *staged) {
+    for (uint64_t i = 0; i < shard->capacity; i++) {
+        UtxoEntry *entry = &shard->entries[i];
+        if (!(entry->flags & UTXO_ENTRY_DIRTY)) {
+            continue;
+        }
+        if (entry->data) {
+            stage_utxo_data(batch, &entry->outpoint, entry->data, entry->width);
+        }
+        else {
+            stage_utxo_removal(batch, &entry->outpoint);
+        }
+        (*staged)++;
+        if (*staged == UTXO_FLUSH_BATCH_SIZE) {
+            *staged = 0;
+            if (commit_utxo_batch(batch)) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int8_t flush_utxo_cache(bool evict) {
+    if (!cache.ready) {
+        return 0;
+    }
+    double start = get_now();
+    uint64_t changes = get_dirty_count();
+    if (changes > 0) {
+        uint32_t flushHeight = cache.maxHeight > cache.diskHeight ? cache.maxHeight : cache.diskHeight;
+        void *batch = create_utxo_batch();
+        // The height marker rides in the first batch, so it lands before any output does
+        stage_utxo_flush_height(batch, flushHeight);
+        uint32_t staged = 1;
+        int8_t status = 0;
+        for (uint32_t i = 0; i < cache.shardCount && !status; i++) {
+            status = stage_shard_changes(&cache.shards[i], batch, &staged);
+        }
+        // Set statistics ride in the last batch, so they land only with the whole flush
+        if (!status) {
+            if (!is_utxo_stats_stale()) {
+                stage_utxo_stats(batch);
+            }
+            status = commit_utxo_batch(batch);
+        }
+        destroy_utxo_batch(batch);
+        if (status) {
+            fprintf(stderr, "UTXO cache flush failed; keeping %llu changes\n", changes);
+            return -1;
+        }
+        cache.diskHeight = flushHeight;
+        cache.writes += changes;
+        atomic_fetch_add(&flushGeneration, 1);
+        if (is_utxo_stats_rebuild_due(flushHeight)) {
+            UtxoSetStats setStats;
+            get_utxo_set_stats(&setStats);
+            rebuild_utxo_stats(setStats.blockHash);
+        }
+    }
+    cache.flushes++;
+    cache.lastFlush = get_now();
+
+    for (uint32_t i = 0; i < cache.shardCount; i++) {
+        if (evict) {
+            discard_entries(&cache.shards[i]);
+        }
+        else if (changes > 0) {
+            keep_clean_entries(&cache.shards[i]);
+        }
+    }
+    printf("Flushed %llu UTXO changes in %.1fms\n", changes, get_now() - start);
+    return 0;
+}
+
+int8_t flush_utxo_cache_if_needed() {
+    if (!cache.ready) {
+        return 0;
+    }
+    if (get_cache_memory() > config.utxoCacheBudget) {
+        return flush_utxo_cache(true);
+    }
+    bool periodDue =
+        config.periods.flushUtxoCache > 0
+        && get_now() - cache.lastFlush > config.periods.flushUtxoCache;
+    if (periodDue) {
+        return flush_utxo_cache(false);
+    }
+    return 0;
+}
+
+// Drops every entry without writing; for when the database underneath is destroyed
+void clear_utxo_cache() {
+    if (cache.ready) {
+        stop_utxo_writers();
+        for (uint32_t i = 0; i < cache.shardCount; i++) {
+            release_entries(&cache.shards[i]);
+            FREE(cache.shards[i].records, "utxo_cache:records");
+        }
+    }
+    memset(&cache, 0, sizeof(cache));
+    atomic_fetch_add(&flushGeneration, 1);
+}
+
+void get_utxo_cache_stats(UtxoCacheStats *ptrStats) {
+    memset(ptrStats, 0, sizeof(*ptrStats));
+    for (uint32_t i = 0; i < cache.shardCount; i++) {
+        UtxoShard *shard = &cache.shards[i];
+        ptrStats->entries += shard->count;
+        ptrStats->dirtyEntries += shard->dirtyCount;
+        ptrStats->hits += shard->stats.hits;
+        ptrStats->misses += shard->stats.misses;
+        ptrStats->elided += shard->stats.elided;
+        ptrStats->primed += shard->stats.primed;
+    }
+    ptrStats->shards = cache.shardCount;
+    ptrStats->flushes = cache.flushes;
+    ptrStats->writes = cache.writes;
+    ptrStats->memory = cache.ready ? get_cache_memory() : 0;
+}
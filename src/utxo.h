@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "messages/tx.h"
+
+// Write-back cache in front of the UTXO database, holding outputs as compress_tx_out encodes
+// them. Outputs created and spent between two flushes never reach the disk; everything else
+// is written in batches when the cache outgrows config.utxoCacheBudget or
+// config.periods.flushUtxoCache has passed.
+// The cache is split into config.utxoShards shards by txid prefix. apply_utxo_changes hands
+// each shard's part of a block to its own writer thread; every other call runs on the main
+// thread.
+
+#define UTXO_CACHE_INITIAL_CAPACITY (1 << 16) // slots across all shards
+#define UTXO_CACHE_MIN_SHARD_CAPACITY (1 << 10) // slots, a power of two
+#define MAX_UTXO_SHARDS 64
+#define UTXO_SHARD_RECORDS_INITIAL_CAPACITY (1 << 12) // bytes
+#define UTXO_CACHE_MAX_LOAD 0.75
+#define UTXO_FLUSH_BATCH_SIZE (1 << 14) // puts and deletes per database write
+
+struct UtxoCacheStats {
+    uint32_t shards;
+    uint64_t entries;
+    uint64_t dirtyEntries;
+    uint64_t memory; // bytes
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t flushes;
+    uint64_t writes; // puts and deletes sent to the database
+    uint64_t elided; // outputs spent before any flush saw them
+    uint64_t primed; // records handed in by prime_utxo
+};
+
+typedef struct UtxoCacheStats UtxoCacheStats;
+
+struct UtxoChange {
+    Outpoint outpoint;
+    TxOut *output; // to add; NULL to spend the outpoint
+    int8_t status; // as from add_utxo or spend_utxo
+    Byte *record; // compressed output added or spent; see apply_utxo_changes
+    uint32_t width; // of record; 0 for a failed spend
+};
+
+typedef struct UtxoChange UtxoChange;
+
+int8_t get_utxo(Outpoint *outpoint, TxOut *output);
+int8_t add_utxo(Outpoint *outpoint, TxOut *output);
+int8_t restore_utxo(Outpoint *outpoint, Byte *record, uint32_t width);
+int8_t spend_utxo(Outpoint *outpoint, Byte *spentRecord, uint32_t *spentWidth);
+void apply_utxo_changes(UtxoChange *changes, uint64_t count);
+uint64_t get_utxo_flush_generation(void);
+int8_t prime_utxo(Outpoint *outpoint, Byte *record, uint32_t width, uint64_t generation);
+void set_utxo_cache_height(uint32_t height);
+int8_t flush_utxo_cache(bool evict);
+int8_t flush_utxo_cache_if_needed(void);
+void clear_utxo_cache(void);
+void stop_utxo_writers(void);
+void get_utxo_cache_stats(UtxoCacheStats *ptrStats);
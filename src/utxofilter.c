@@ -0,0 +1,247 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "utxofilter.h"
+#include "datatypes.h"
+#include "messages/header.h"
+#include "utils/memory.h"
+
+#define UTXO_FILTER_MAGIC "tbcbloom"
+#define UTXO_FILTER_MAGIC_WIDTH 8
+#define WORDS_PER_BLOCK (UTXO_FILTER_BLOCK_BITS / 64)
+#define PROBE_BITS 9 // enough to address UTXO_FILTER_BLOCK_BITS
+
+struct UtxoFilter {
+    bool ready;
+    uint64_t *words;
+    uint64_t blockCount;
+    uint64_t capacity;
+    uint64_t keys;
+};
+
+struct UtxoFilterFileHeader {
+    char magic[UTXO_FILTER_MAGIC_WIDTH];
+    uint64_t tag;
+    uint64_t blockCount;
+    uint64_t capacity;
+    uint64_t keys;
+};
+
+static struct UtxoFilter filter;
+static uv_rwlock_t filterLock;
+static uv_once_t filterLockOnce = UV_ONCE_INIT;
+static atomic_uint_fast64_t queryCount;
+static atomic_uint_fast64_t skipCount;
+static atomic_uint_fast64_t falsePositiveCount;
+
+static void init_filter_lock() {
+    uv_rwlock_init(&filterLock);
+}
+
+static void lock_filter(bool exclusive) {
+    uv_once(&filterLockOnce, &init_filter_lock);
+    if (exclusive) {
+        uv_rwlock_wrlock(&filterLock);
+    }
+    else {
+        uv_rwlock_rdlock(&filterLock);
+    }
+}
+
+static void unlock_filter(bool exclusive) {
+    if (exclusive) {
+        uv_rwlock_wrunlock(&filterLock);
+    }
+    else {
+        uv_rwlock_rdunlock(&filterLock);
+    }
+}
+
+static uint64_t mix(uint64_t h) {
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 29;
+    h *= 0x94D049BB133111EBULL;
+    h ^= h >> 32;
+    return h;
+}
+
+// One hash picks the block, the other supplies UTXO_FILTER_PROBES bit positions within it
+static void hash_outpoint_for_filter(Outpoint *outpoint, uint64_t *blockHash, uint64_t *bitHash) {
+    uint64_t a = 0;
+    uint64_t b = 0;
+    memcpy(&a, outpoint->txHash, sizeof(a));
+    memcpy(&b, outpoint->txHash + sizeof(a), sizeof(b));
+    *blockHash = mix(a ^ ((uint64_t)outpoint->index * 0x9E3779B97F4A7C15ULL));
+    *bitHash = mix(b ^ ((uint64_t)outpoint->index * 0xC2B2AE3D27D4EB4FULL));
+}
+
+static uint64_t *locate_block(Outpoint *outpoint, uint64_t *bitHash) {
+    uint64_t blockHash = 0;
+    hash_outpoint_for_filter(outpoint, &blockHash, bitHash);
+    return filter.words + (blockHash % filter.blockCount) * WORDS_PER_BLOCK;
+}
+
+static void release_words() {
+    if (filter.words) {
+        FREE(filter.words, "utxo_filter:words");
+    }
+    memset(&filter, 0, sizeof(filter));
+}
+
+// Replaces the filter with an empty one sized for expectedKeys
+void reset_utxo_filter(uint64_t expectedKeys) {
+    uint64_t capacity = expectedKeys * UTXO_FILTER_HEADROOM;
+    if (capacity < UTXO_FILTER_MIN_KEYS) {
+        capacity = UTXO_FILTER_MIN_KEYS;
+    }
+    uint64_t blockCount = (capacity * UTXO_FILTER_BITS_PER_KEY + UTXO_FILTER_BLOCK_BITS - 1) / UTXO_FILTER_BLOCK_BITS;
+    uint64_t *words = CALLOC(blockCount * WORDS_PER_BLOCK, sizeof(uint64_t), "utxo_filter:words");
+    lock_filter(true);
+    release_words();
+    filter.words = words;
+    filter.blockCount = blockCount;
+    filter.capacity = capacity;
+    filter.ready = true;
+    unlock_filter(true);
+}
+
+// Lookups pass through unfiltered until the filter is reset or loaded again
+void release_utxo_filter() {
+    lock_filter(true);
+    release_words();
+    unlock_filter(true);
+}
+
+bool is_utxo_filter_ready() {
+    return filter.ready;
+}
+
+bool is_utxo_filter_saturated() {
+    return filter.ready && filter.keys > filter.capacity;
+}
+
+void add_to_utxo_filter(Outpoint *outpoint) {
+    if (!filter.ready) {
+        return;
+    }
+    lock_filter(true);
+    uint64_t bitHash = 0;
+    uint64_t *block = locate_block(outpoint, &bitHash);
+    for (uint8_t i = 0; i < UTXO_FILTER_PROBES; i++) {
+        uint32_t bit = (bitHash >> (i * PROBE_BITS)) & (UTXO_FILTER_BLOCK_BITS - 1);
+        block[bit / 64] |= 1ULL << (bit % 64);
+    }
+    filter.keys++;
+    unlock_filter(true);
+}
+
+// False only when the database certainly lacks the outpoint
+bool may_contain_utxo(Outpoint *outpoint) {
+    atomic_fetch_add(&queryCount, 1);
+    lock_filter(false);
+    bool found = true;
+    if (filter.ready) {
+        uint64_t bitHash = 0;
+        uint64_t *block = locate_block(outpoint, &bitHash);
+        for (uint8_t i = 0; i < UTXO_FILTER_PROBES && found; i++) {
+            uint32_t bit = (bitHash >> (i * PROBE_BITS)) & (UTXO_FILTER_BLOCK_BITS - 1);
+            found = (block[bit / 64] >> (bit % 64)) & 1;
+        }
+    }
+    unlock_filter(false);
+    if (!found) {
+        atomic_fetch_add(&skipCount, 1);
+    }
+    return found;
+}
+
+void record_utxo_filter_false_positive() {
+    atomic_fetch_add(&falsePositiveCount, 1);
+}
+
+// The tag pairs the file with a database state; see open_utxo_filter
+int8_t save_utxo_filter(char *path, uint64_t tag) {
+    if (!filter.ready) {
+        return -1;
+    }
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "save_utxo_filter: cannot open %s\n", path);
+        return -2;
+    }
+    struct UtxoFilterFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, UTXO_FILTER_MAGIC, UTXO_FILTER_MAGIC_WIDTH);
+    header.tag = tag;
+    header.blockCount = filter.blockCount;
+    header.capacity = filter.capacity;
+    header.keys = filter.keys;
+    uint64_t width = filter.blockCount * WORDS_PER_BLOCK * sizeof(uint64_t);
+    PayloadChecksum checksum = {0};
+    calculate_data_checksum(filter.words, (uint32_t)width, checksum);
+    bool written =
+        fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(filter.words, width, 1, file) == 1
+        && fwrite(checksum, CHECKSUM_SIZE, 1, file) == 1;
+    if (fclose(file) || !written) {
+        fprintf(stderr, "save_utxo_filter: write failed\n");
+        remove(path);
+        return -3;
+    }
+    return 0;
+}
+
+int8_t load_utxo_filter(char *path, uint64_t *tag) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return -1;
+    }
+    struct UtxoFilterFileHeader header;
+    bool recognized =
+        fread(&header, sizeof(header), 1, file) == 1
+        && memcmp(header.magic, UTXO_FILTER_MAGIC, UTXO_FILTER_MAGIC_WIDTH) == 0
+        && header.blockCount > 0;
+    if (!recognized) {
+        fclose(file);
+        return -2;
+    }
+    uint64_t width = header.blockCount * WORDS_PER_BLOCK * sizeof(uint64_t);
+    uint64_t *words = MALLOC(width, "utxo_filter:words");
+    PayloadChecksum storedChecksum = {0};
+    bool complete =
+        fread(words, width, 1, file) == 1
+        && fread(storedChecksum, CHECKSUM_SIZE, 1, file) == 1;
+    fclose(file);
+    PayloadChecksum checksum = {0};
+    if (complete) {
+        calculate_data_checksum(words, (uint32_t)width, checksum);
+    }
+    if (!complete || memcmp(checksum, storedChecksum, CHECKSUM_SIZE) != 0) {
+        FREE(words, "utxo_filter:words");
+        return -3;
+    }
+    lock_filter(true);
+    release_words();
+    filter.words = words;
+    filter.blockCount = header.blockCount;
+    filter.capacity = header.capacity;
+    filter.keys = header.keys;
+    filter.ready = true;
+    unlock_filter(true);
+    *tag = header.tag;
+    return 0;
+}
+
+void get_utxo_filter_stats(UtxoFilterStats *ptrStats) {
+    memset(ptrStats, 0, sizeof(*ptrStats));
+    ptrStats->ready = filter.ready;
+    ptrStats->capacity = filter.capacity;
+    ptrStats->keys = filter.keys;
+    ptrStats->memory = filter.blockCount * WORDS_PER_BLOCK * sizeof(uint64_t);
+    ptrStats->queries = atomic_load(&queryCount);
+    ptrStats->skipped = atomic_load(&skipCount);
+    ptrStats->falsePositives = atomic_load(&falsePositiveCount);
+}
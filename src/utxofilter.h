@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "messages/tx.h"
+
+// Blocked Bloom filter over the outpoints stored in the UTXO database, so that lookups of
+// outputs it never held (spends within one block, invalid spends) skip LevelDB. Each key sets
+// UTXO_FILTER_PROBES bits within one cache-line block. Only additions are recorded: spent
+// outputs linger as false positives until the filter is rebuilt from a database scan, which
+// also happens once more keys have gone in than it was sized for.
+// Queries may come from any thread; changes are made on the main thread.
+
+#define UTXO_FILTER_BITS_PER_KEY 10
+#define UTXO_FILTER_PROBES 7
+#define UTXO_FILTER_BLOCK_BITS 512
+#define UTXO_FILTER_MIN_KEYS (1 << 20)
+#define UTXO_FILTER_HEADROOM 2 // capacity over the keys present when built
+
+struct UtxoFilterStats {
+    bool ready;
+    uint64_t capacity; // keys
+    uint64_t keys; // added since built, spent or not
+    uint64_t memory; // bytes
+    uint64_t queries;
+    uint64_t skipped; // definite misses that never reached the database
+    uint64_t falsePositives;
+};
+
+typedef struct UtxoFilterStats UtxoFilterStats;
+
+void reset_utxo_filter(uint64_t expectedKeys);
+void release_utxo_filter(void);
+bool is_utxo_filter_ready(void);
+bool is_utxo_filter_saturated(void);
+void add_to_utxo_filter(Outpoint *outpoint);
+bool may_contain_utxo(Outpoint *outpoint);
+void record_utxo_filter_false_positive(void);
+int8_t save_utxo_filter(char *path, uint64_t tag);
+int8_t load_utxo_filter(char *path, uint64_t *tag);
+void get_utxo_filter_stats(UtxoFilterStats *ptrStats);
@@ -0,0 +1,194 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "openssl/bn.h"
+
+#include "utxostats.h"
+#include "compressor.h"
+
+#define MUHASH_ELEMENT_SEED_WIDTH (SHA256_LENGTH + sizeof(uint32_t) + MAX_COMPRESSED_TX_OUT_WIDTH)
+
+// Numerator and denominator stay in Montgomery form; see hash_to_element
+struct UtxoStats {
+    bool ready;
+    bool stale;
+    uint32_t staleUntil; // flush height past which a database scan gives the set at the tip
+    SHA256_HASH blockHash;
+    uint64_t outputs;
+    uint64_t amount;
+    BIGNUM *prime;
+    BIGNUM *numerator;
+    BIGNUM *denominator;
+    BIGNUM *element;
+    BN_CTX *ctx;
+    BN_MONT_CTX *mont;
+};
+
+static struct UtxoStats stats;
+
+static void set_empty_set() {
+    BN_to_montgomery(stats.numerator, BN_value_one(), stats.mont, stats.ctx);
+    BN_copy(stats.denominator, stats.numerator);
+    stats.outputs = 0;
+    stats.amount = 0;
+}
+
+static void ensure_utxo_stats() {
+    if (stats.ready) {
+        return;
+    }
+    stats.ctx = BN_CTX_new();
+    stats.prime = BN_new();
+    BN_set_bit(stats.prime, MUHASH_BITS);
+    BN_sub_word(stats.prime, MUHASH_PRIME_OFFSET);
+    stats.mont = BN_MONT_CTX_new();
+    BN_MONT_CTX_set(stats.mont, stats.prime, stats.ctx);
+    stats.numerator = BN_new();
+    stats.denominator = BN_new();
+    stats.element = BN_new();
+    set_empty_set();
+    stats.ready = true;
+}
+
+// The bytes are read as the element's Montgomery form, so a single Montgomery multiplication
+// both applies the element and keeps the accumulator in that form
+static void hash_to_element(Outpoint *outpoint, Byte *record, uint32_t width) {
+    Byte seed[MUHASH_ELEMENT_SEED_WIDTH];
+    memcpy(seed, outpoint->txHash, SHA256_LENGTH);
+    for (uint8_t i = 0; i < sizeof(uint32_t); i++) {
+        seed[SHA256_LENGTH + i] = (Byte)(outpoint->index >> (8 * i));
+    }
+    memcpy(seed + SHA256_LENGTH + sizeof(uint32_t), record, width);
+    Byte counterInput[SHA256_LENGTH + 1];
+    sha256(seed, SHA256_LENGTH + sizeof(uint32_t) + width, counterInput);
+    Byte bytes[MUHASH_BYTES];
+    for (uint8_t i = 0; i < MUHASH_BYTES / SHA256_LENGTH; i++) {
+        counterInput[SHA256_LENGTH] = i;
+        sha256(counterInput, sizeof(counterInput), bytes + i * SHA256_LENGTH);
+    }
+    BN_bin2bn(bytes, MUHASH_BYTES, stats.element);
+    if (BN_cmp(stats.element, stats.prime) >= 0) {
+        BN_sub(stats.element, stats.element, stats.prime);
+    }
+}
+
+static uint64_t get_record_amount(Byte *record, uint32_t width) {
+    uint64_t compressedAmount = 0;
+    if (!parse_msb_varint(record, width, &compressedAmount)) {
+        return 0;
+    }
+    return decompress_amount(compressedAmount);
+}
+
+// Starts over from the empty set, as of the given block
+void reset_utxo_stats(Byte *blockHash) {
+    ensure_utxo_stats();
+    set_empty_set();
+    memcpy(stats.blockHash, blockHash, SHA256_LENGTH);
+    stats.stale = false;
+    stats.staleUntil = 0;
+}
+
+void set_utxo_stats_block(Byte *blockHash) {
+    memcpy(stats.blockHash, blockHash, SHA256_LENGTH);
+}
+
+void add_to_utxo_stats(Outpoint *outpoint, Byte *record, uint32_t width) {
+    ensure_utxo_stats();
+    if (stats.stale || width > MAX_COMPRESSED_TX_OUT_WIDTH) {
+        return;
+    }
+    hash_to_element(outpoint, record, width);
+    BN_mod_mul_montgomery(stats.numerator, stats.numerator, stats.element, stats.mont, stats.ctx);
+    stats.outputs++;
+    stats.amount += get_record_amount(record, width);
+}
+
+void remove_from_utxo_stats(Outpoint *outpoint, Byte *record, uint32_t width) {
+    ensure_utxo_stats();
+    if (stats.stale || width > MAX_COMPRESSED_TX_OUT_WIDTH) {
+        return;
+    }
+    hash_to_element(outpoint, record, width);
+    BN_mod_mul_montgomery(stats.denominator, stats.denominator, stats.element, stats.mont, stats.ctx);
+    stats.outputs--;
+    stats.amount -= get_record_amount(record, width);
+}
+
+// For a change the values cannot follow; they stay stale until the first flush at or above
+// untilHeight, after which the database holds the set they should describe
+void mark_utxo_stats_stale(uint32_t untilHeight) {
+    if (!stats.stale || untilHeight > stats.staleUntil) {
+        stats.staleUntil = untilHeight;
+    }
+    stats.stale = true;
+}
+
+bool is_utxo_stats_stale() {
+    return stats.stale;
+}
+
+bool is_utxo_stats_rebuild_due(uint32_t flushHeight) {
+    return stats.stale && flushHeight >= stats.staleUntil;
+}
+
+uint64_t serialize_utxo_stats(Byte *ptrBuffer) {
+    ensure_utxo_stats();
+    Byte *p = ptrBuffer;
+    memcpy(p, stats.blockHash, SHA256_LENGTH);
+    p += SHA256_LENGTH;
+    memcpy(p, &stats.outputs, sizeof(stats.outputs));
+    p += sizeof(stats.outputs);
+    memcpy(p, &stats.amount, sizeof(stats.amount));
+    p += sizeof(stats.amount);
+    BN_bn2binpad(stats.numerator, p, MUHASH_BYTES);
+    p += MUHASH_BYTES;
+    BN_bn2binpad(stats.denominator, p, MUHASH_BYTES);
+    p += MUHASH_BYTES;
+    return p - ptrBuffer;
+}
+
+// Replaces the current values, which are no longer stale
+int8_t parse_utxo_stats(Byte *ptrBuffer, uint64_t width) {
+    if (width != UTXO_STATS_WIDTH) {
+        return -1;
+    }
+    ensure_utxo_stats();
+    Byte *p = ptrBuffer + SHA256_LENGTH + 2 * sizeof(uint64_t);
+    BN_bin2bn(p, MUHASH_BYTES, stats.numerator);
+    BN_bin2bn(p + MUHASH_BYTES, MUHASH_BYTES, stats.denominator);
+    if (BN_cmp(stats.numerator, stats.prime) >= 0 || BN_cmp(stats.denominator, stats.prime) >= 0) {
+        set_empty_set();
+        return -2;
+    }
+    p = ptrBuffer;
+    memcpy(stats.blockHash, p, SHA256_LENGTH);
+    p += SHA256_LENGTH;
+    memcpy(&stats.outputs, p, sizeof(stats.outputs));
+    p += sizeof(stats.outputs);
+    memcpy(&stats.amount, p, sizeof(stats.amount));
+    stats.stale = false;
+    stats.staleUntil = 0;
+    return 0;
+}
+
+// The commitment is SHA-256 of numerator over denominator, 384 bytes big-endian
+void get_utxo_set_stats(UtxoSetStats *ptrStats) {
+    ensure_utxo_stats();
+    memset(ptrStats, 0, sizeof(*ptrStats));
+    ptrStats->stale = stats.stale;
+    memcpy(ptrStats->blockHash, stats.blockHash, SHA256_LENGTH);
+    ptrStats->outputs = stats.outputs;
+    ptrStats->amount = stats.amount;
+    BIGNUM *numerator = BN_new();
+    BIGNUM *denominator = BN_new();
+    BN_from_montgomery(numerator, stats.numerator, stats.mont, stats.ctx);
+    BN_from_montgomery(denominator, stats.denominator, stats.mont, stats.ctx);
+    BN_mod_inverse(denominator, denominator, stats.prime, stats.ctx);
+    BN_mod_mul(numerator, numerator, denominator, stats.prime, stats.ctx);
+    Byte bytes[MUHASH_BYTES];
+    BN_bn2binpad(numerator, bytes, MUHASH_BYTES);
+    sha256(bytes, MUHASH_BYTES, ptrStats->commitment);
+    BN_free(numerator);
+    BN_free(denominator);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hash.h"
+#include "messages/tx.h"
+
+// Running totals of the UTXO set and a rolling multiset hash over it, so two nodes at the same
+// block can compare their sets without scanning the database. Each output counts as an
+// element of the multiplicative group modulo the MuHash3072 prime: adding it multiplies the
+// numerator, spending it multiplies the denominator, so the order of changes does not matter
+// and disconnecting a block undoes it exactly. The element is the Montgomery form of 384
+// bytes of SHA-256 in counter mode over the txid, the little-endian index and the compressed
+// record; that makes one multiplication per change, and commitments are only comparable
+// between tinybtc nodes, not with Bitcoin Core's muhash.
+// Saved alongside each UTXO flush. While the values cannot be trusted, as after an unclean
+// shutdown, they are stale: changes are ignored until a database scan recomputes them.
+
+#define MUHASH_BITS 3072
+#define MUHASH_BYTES (MUHASH_BITS / 8)
+#define MUHASH_PRIME_OFFSET 1103717 // the prime is 2^3072 minus this
+#define UTXO_STATS_WIDTH (SHA256_LENGTH + 2 * sizeof(uint64_t) + 2 * MUHASH_BYTES)
+
+struct UtxoSetStats {
+    bool stale;
+    SHA256_HASH blockHash; // last block applied
+    uint64_t outputs;
+    uint64_t amount; // satoshis
+    SHA256_HASH commitment;
+};
+
+typedef struct UtxoSetStats UtxoSetStats;
+
+void reset_utxo_stats(Byte *blockHash);
+void set_utxo_stats_block(Byte *blockHash);
+void add_to_utxo_stats(Outpoint *outpoint, Byte *record, uint32_t width);
+void remove_from_utxo_stats(Outpoint *outpoint, Byte *record, uint32_t width);
+void mark_utxo_stats_stale(uint32_t untilHeight);
+bool is_utxo_stats_stale(void);
+bool is_utxo_stats_rebuild_due(uint32_t flushHeight);
+uint64_t serialize_utxo_stats(Byte *ptrBuffer);
+int8_t parse_utxo_stats(Byte *ptrBuffer, uint64_t width);
+void get_utxo_set_stats(UtxoSetStats *ptrStats);
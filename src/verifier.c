@@ -0,0 +1,270 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "verifier.h"
+#include "config.h"
+#include "script.h"
+#include "utils/memory.h"
+
+struct ScriptCheck {
+    TxPayload *tx;
+    uint32_t inputIndex;
+    Byte *program; // signature script, OP_CODESEPARATOR, then the spent output's script
+    uint64_t programLength;
+};
+
+typedef struct ScriptCheck ScriptCheck;
+
+// Everything below running is shared with the workers under lock. Checks are taken in queue
+// order from next; done counts those finished, run or skipped, so a session is over once it
+// reaches count
+struct ScriptVerifier {
+    bool running;
+    bool stopping;
+    uv_mutex_t lock;
+    uv_cond_t checkReady;
+    uv_cond_t checkDone;
+    uv_thread_t threads[MAX_SCRIPT_THREADS];
+    uint32_t threadCount;
+    ScriptCheck *checks;
+    uint64_t capacity;
+    uint64_t count;
+    uint64_t next;
+    uint64_t done;
+    bool failed;
+    bool assumed; // for the session; main thread only
+    ScriptVerifierStats stats;
+};
+
+static struct ScriptVerifier verifier;
+
+static uint32_t get_script_thread_count() {
+    uint32_t threadCount = config.scriptThreads;
+    if (threadCount == 0) {
+        uv_cpu_info_t *cpuInfos = NULL;
+        int cpuCount = 0;
+        if (uv_cpu_info(&cpuInfos, &cpuCount) == 0) {
+            uv_free_cpu_info(cpuInfos, cpuCount);
+        }
+        threadCount = cpuCount > 0 ? (uint32_t)cpuCount : 1;
+    }
+    return threadCount > MAX_SCRIPT_THREADS ? MAX_SCRIPT_THREADS : threadCount;
+}
+
+static bool run_script_check(ScriptCheck *check) {
+    // The program already carries the spent output's script, which is all run_program needs
+    CheckSigMeta meta = {
+        .sourceOutput = NULL,
+        .txInputIndex = check->inputIndex,
+        .currentTx = check->tx,
+    };
+    return run_program(check->program, check->programLength, meta);
+}
+
+// Runs or skips the check at next and accounts for it; called and returns with the lock held
+static void process_next_check() {
+    ScriptCheck check = verifier.checks[verifier.next];
+    verifier.next++;
+    bool skip = verifier.failed;
+    uv_mutex_unlock(&verifier.lock);
+
+    bool passed = skip || run_script_check(&check);
+    FREE(check.program, "script_check:program");
+
+    uv_mutex_lock(&verifier.lock);
+    if (skip) {
+        verifier.stats.cancelled++;
+    }
+    else {
+        verifier.stats.checks++;
+        if (!passed) {
+            verifier.stats.failures++;
+            verifier.failed = true;
+        }
+    }
+    verifier.done++;
+    if (verifier.done == verifier.count) {
+        uv_cond_broadcast(&verifier.checkDone);
+    }
+}
+
+static void run_script_worker(void *arg) {
+    uv_mutex_lock(&verifier.lock);
+    while (true) {
+        while (!verifier.stopping && verifier.next == verifier.count) {
+            uv_cond_wait(&verifier.checkReady, &verifier.lock);
+        }
+        if (verifier.stopping) {
+            break;
+        }
+        process_next_check();
+    }
+    uv_mutex_unlock(&verifier.lock);
+}
+
+static int8_t start_script_verifier(uint32_t threadCount) {
+    memset(&verifier, 0, sizeof(verifier));
+    uv_mutex_init(&verifier.lock);
+    uv_cond_init(&verifier.checkReady);
+    uv_cond_init(&verifier.checkDone);
+    verifier.capacity = SCRIPT_CHECKS_INITIAL_CAPACITY;
+    verifier.checks = MALLOC(verifier.capacity * sizeof(ScriptCheck), "script_verifier:checks");
+    verifier.running = true;
+    // The validating thread is one of them
+    for (uint32_t i = 0; i + 1 < threadCount; i++) {
+        if (uv_thread_create(&verifier.threads[i], &run_script_worker, NULL)) {
+            fprintf(stderr, "start_script_verifier: cannot start worker %u\n", i);
+            stop_script_verifier();
+            return -1;
+        }
+        verifier.threadCount++;
+    }
+    verifier.stats.threads = verifier.threadCount + 1;
+    return 0;
+}
+
+// Starts the pool on first use when config.scriptThreads asks for more than the validating
+// thread; without it every check runs as soon as it is queued
+void begin_script_checks(bool assumeValid) {
+    if (!verifier.running) {
+        uint32_t threadCount = get_script_thread_count();
+        if (threadCount > 1) {
+            start_script_verifier(threadCount);
+        }
+        else {
+            verifier.stats.threads = 1;
+        }
+    }
+    verifier.assumed = assumeValid;
+    if (!verifier.running) {
+        verifier.failed = false;
+        verifier.stats.blocks++;
+        verifier.stats.assumed += assumeValid;
+        return;
+    }
+    uv_mutex_lock(&verifier.lock);
+    verifier.failed = false;
+    verifier.stats.blocks++;
+    verifier.stats.assumed += assumeValid;
+    uv_mutex_unlock(&verifier.lock);
+}
+
+// Whether the open session's block skips its script checks, so there is no program to build
+bool are_script_checks_assumed() {
+    return verifier.assumed;
+}
+
+// Takes ownership of program. Returns false once any check of the block is known to have
+// failed, after which queueing more is pointless
+bool queue_script_check(TxPayload *tx, uint32_t inputIndex, Byte *program, uint64_t programLength) {
+    ScriptCheck check = {
+        .tx = tx,
+        .inputIndex = inputIndex,
+        .program = program,
+        .programLength = programLength,
+    };
+    if (!verifier.running) {
+        if (verifier.failed) {
+            FREE(program, "script_check:program");
+            return false;
+        }
+        bool passed = run_script_check(&check);
+        FREE(program, "script_check:program");
+        verifier.stats.checks++;
+        if (!passed) {
+            verifier.stats.failures++;
+            verifier.failed = true;
+        }
+        return passed;
+    }
+    uv_mutex_lock(&verifier.lock);
+    if (verifier.failed) {
+        uv_mutex_unlock(&verifier.lock);
+        FREE(program, "script_check:program");
+        return false;
+    }
+    if (verifier.count == verifier.capacity) {
+        uint64_t capacity = verifier.capacity * 2;
+        ScriptCheck *checks = MALLOC(capacity * sizeof(ScriptCheck), "script_verifier:checks");
+        memcpy(checks, verifier.checks, verifier.count * sizeof(ScriptCheck));
+        FREE(verifier.checks, "script_verifier:checks");
+        verifier.checks = checks;
+        verifier.capacity = capacity;
+    }
+    verifier.checks[verifier.count] = check;
+    verifier.count++;
+    uv_cond_signal(&verifier.checkReady);
+    uv_mutex_unlock(&verifier.lock);
+    return true;
+}
+
+bool have_script_checks_failed() {
+    if (!verifier.running) {
+        return verifier.failed;
+    }
+    uv_mutex_lock(&verifier.lock);
+    bool failed = verifier.failed;
+    uv_mutex_unlock(&verifier.lock);
+    return failed;
+}
+
+// Helps the workers through the queue and waits for the last check in flight. With cancel the
+// block is already known invalid, so whatever has not started is skipped.
+// Returns whether every check of the block passed
+bool finish_script_checks(bool cancel) {
+    if (!verifier.running) {
+        bool passed = !verifier.failed;
+        verifier.failed = false;
+        return passed;
+    }
+    uv_mutex_lock(&verifier.lock);
+    if (cancel) {
+        verifier.failed = true;
+    }
+    while (verifier.next < verifier.count) {
+        process_next_check();
+    }
+    while (verifier.done < verifier.count) {
+        uv_cond_wait(&verifier.checkDone, &verifier.lock);
+    }
+    bool passed = !verifier.failed;
+    verifier.count = 0;
+    verifier.next = 0;
+    verifier.done = 0;
+    verifier.failed = false;
+    uv_mutex_unlock(&verifier.lock);
+    return passed;
+}
+
+// Joins the workers; must not be called with a session open. Stats stay readable
+void stop_script_verifier() {
+    if (!verifier.running) {
+        return;
+    }
+    uv_mutex_lock(&verifier.lock);
+    verifier.stopping = true;
+    uv_cond_broadcast(&verifier.checkReady);
+    uv_mutex_unlock(&verifier.lock);
+    for (uint32_t i = 0; i < verifier.threadCount; i++) {
+        uv_thread_join(&verifier.threads[i]);
+    }
+    uv_cond_destroy(&verifier.checkDone);
+    uv_cond_destroy(&verifier.checkReady);
+    uv_mutex_destroy(&verifier.lock);
+    FREE(verifier.checks, "script_verifier:checks");
+    verifier.checks = NULL;
+    verifier.capacity = 0;
+    verifier.running = false;
+    verifier.stopping = false;
+}
+
+void get_script_verifier_stats(ScriptVerifierStats *ptrStats) {
+    if (!verifier.running) {
+        *ptrStats = verifier.stats;
+        return;
+    }
+    uv_mutex_lock(&verifier.lock);
+    *ptrStats = verifier.stats;
+    uv_mutex_unlock(&verifier.lock);
+}
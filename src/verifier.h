@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "datatypes.h"
+#include "messages/tx.h"
+
+// Input scripts of a block are verified on a pool of worker threads while the validating
+// thread goes on resolving prevouts and summing amounts. A block opens a session with
+// begin_script_checks, queues one check per input and collects the verdict with
+// finish_script_checks; the first failing check cancels whatever of the block is still queued.
+// Checks refer to the block's transactions, which must stay put until the session finishes.
+// A session for a block under config.assumeValidBlock queues nothing; see is_block_valid.
+
+#define MAX_SCRIPT_THREADS 64
+#define SCRIPT_CHECKS_INITIAL_CAPACITY 1024
+
+struct ScriptVerifierStats {
+    uint32_t threads; // including the validating thread, which helps to drain each block
+    uint64_t blocks;
+    uint64_t assumed; // blocks whose scripts were taken as valid
+    uint64_t checks; // run to completion
+    uint64_t failures;
+    uint64_t cancelled; // skipped after a failure in the same block
+};
+
+typedef struct ScriptVerifierStats ScriptVerifierStats;
+
+void begin_script_checks(bool assumeValid);
+bool are_script_checks_assumed(void);
+bool queue_script_check(TxPayload *tx, uint32_t inputIndex, Byte *program, uint64_t programLength);
+bool have_script_checks_failed(void);
+bool finish_script_checks(bool cancel);
+void stop_script_verifier(void);
+void get_script_verifier_stats(ScriptVerifierStats *ptrStats);